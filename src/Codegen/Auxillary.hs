@@ -1,7 +1,8 @@
 module Codegen.Auxillary where
 
 import           Codegen.LlvmIr                (LLVMType (..), LLVMValue (..))
-import           Control.Monad                 (foldM_)
+import           Control.Monad                 (foldM, foldM_)
+import           Data.Bits                     (setBit, zeroBits, (.|.))
 import           Monomorphizer.MonomorphizerIr as MIR (Exp, T, Type (..))
 import qualified TypeChecker.TypeCheckerIr     as TIR
 
@@ -57,5 +58,39 @@ typeByteSize (Function _ _) = 8
 typeByteSize (Array n t)    = n * typeByteSize t
 typeByteSize (CustomType _) = 8
 
+-- | The size and alignment of a field of a structure type, as laid
+--   out by LLVM, or Nothing for the types whose layout is not known here
+fieldLayout :: LLVMType -> Maybe (Integer, Integer)
+fieldLayout I1             = Just (1, 1)
+fieldLayout I8             = Just (1, 1)
+fieldLayout I16            = Just (2, 2)
+fieldLayout I32            = Just (4, 4)
+fieldLayout I64            = Just (8, 8)
+fieldLayout Ptr            = Just (8, 8)
+fieldLayout (Ref _)        = Just (8, 8)
+fieldLayout (Function _ _) = Just (8, 8)
+fieldLayout _              = Nothing
+
+-- | The pointer map of a structure type, the descriptor passed to
+--   cheap_alloc_typed in src/GC/include/cheap.h. Bit i is set if word i
+--   of the structure holds a pointer. Nothing if the layout of a field
+--   is not known, as the object must then be scanned as all pointers.
+pointerMap :: [LLVMType] -> Maybe Integer
+pointerMap ts = snd <$> foldM field (0, zeroBits) ts
+  where
+    field (offset, bits) t = do
+        (size, align) <- fieldLayout t
+        let start = (offset + align - 1) `div` align * align
+        pure (start + size, if isPointer t then setBit bits (fromIntegral $ start `div` 8) else bits)
+    isPointer Ptr            = True
+    isPointer (Ref _)        = True
+    isPointer (Function _ _) = True
+    isPointer _              = False
+
+-- | The union of the pointer maps of the variants of a data type,
+--   which share the memory of the object
+unionPointerMap :: [[LLVMType]] -> Maybe Integer
+unionPointerMap = fmap (foldr (.|.) zeroBits) . mapM pointerMap
+
 enumerateOneM_ :: Monad m => (Integer -> a -> m b) -> [a] -> m ()
 enumerateOneM_ f = foldM_ (\i a -> f i a >> pure (i + 1)) 1
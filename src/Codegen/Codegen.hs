@@ -7,7 +7,8 @@ import           Codegen.CompilerState         (CodeGenerator (..),
                                                 StructType (inst),
                                                 initCodeGenerator)
 import           Codegen.Emits                 (compileScs)
-import           Codegen.LlvmIr                as LIR (LLVMIr (UnsafeRaw),
+import           Codegen.LlvmIr                as LIR (GcStrategy,
+                                                       LLVMIr (UnsafeRaw),
                                                        llvmIrToString)
 import           Control.Monad.State           (execStateT)
 import           Data.Functor                  ((<&>))
@@ -24,10 +25,10 @@ import           TypeChecker.TypeCheckerIr     (Ident (..))
   An easy way to actually "compile" this output is to
   Simply pipe it to LLI
 -}
-generateCode :: MIR.Program -> Bool -> Err String
-generateCode (MIR.Program scs) addGc = do
+generateCode :: MIR.Program -> Bool -> GcStrategy -> Err String
+generateCode (MIR.Program scs) addGc strategy = do
   let tree    = filter (not . detectPrelude) (sortBy lowData scs)
-      codegen = initCodeGenerator addGc tree
+      codegen = initCodeGenerator addGc strategy tree
 
   -- Append instructions
   execStateT (compileScs tree) codegen <&> \state ->
@@ -68,8 +69,64 @@ gcStart :: [LLVMIr]
 gcStart =
     [ UnsafeRaw "declare external void @cheap_init()\n"
     , UnsafeRaw "declare external ptr @cheap_alloc(i64)\n"
+    , UnsafeRaw "declare external ptr @cheap_alloc_refill(i64)\n"
+    , UnsafeRaw "declare external ptr @cheap_alloc_refill_site(i64, i64)\n"
+    , UnsafeRaw "declare external ptr @cheap_alloc_refill_typed(i64, i64, i64)\n"
+    , UnsafeRaw "declare external ptr @cheap_alloc_group_typed(ptr, ptr, i64, i64)\n"
+    , UnsafeRaw "declare external void @cheap_set_alloc_sites(ptr)\n"
     , UnsafeRaw "declare external void @cheap_dispose()\n"
     , UnsafeRaw "declare external ptr @cheap_the()\n"
     , UnsafeRaw "declare external void @cheap_set_profiler(ptr, i1)\n"
     , UnsafeRaw "declare external void @cheap_profiler_log_options(ptr, i64)\n"
+    , UnsafeRaw "declare external void @cheap_set_root_mode(i64)\n"
+    , UnsafeRaw "declare void @llvm.gcroot(ptr, ptr)\n"
+    ] ++ gcAllocFast
+
+-- | The fast path of cheap_alloc, the same as cheap_alloc_inline in
+--   src/GC/include/cheap.h. It bumps the object from the thread-local
+--   allocation buffer and writes its header, and only calls into the
+--   runtime when the buffer runs out. It is always inlined, so the
+--   rounding and size checks fold away for the constant sizes in GcMalloc.
+--   The empty deopt state of the refill call is extended with the one of
+--   the GcMalloc call when inlined, so the rooted buffers of the caller
+--   are in the stack map of the refill with the statepoint strategy.
+--   The site is passed on to the refill for allocation-site profiling.
+--   The descriptor is the pointer map of the object, written to the top
+--   bits of the header as by cheap_header_type, or -1 for all pointers.
+gcAllocFast :: [LLVMIr]
+gcAllocFast = map UnsafeRaw
+    [ "%cheap_tlab = type { ptr, ptr }\n"
+    , "@cheap_tlab = external thread_local global %cheap_tlab\n"
+    , "define internal ptr @cheap_alloc_fast(i64 %size, i64 %site, i64 %desc) alwaysinline {\n"
+    , "entry:\n"
+    , "    %cur_ptr = getelementptr inbounds %cheap_tlab, ptr @cheap_tlab, i32 0, i32 0\n"
+    , "    %end_ptr = getelementptr inbounds %cheap_tlab, ptr @cheap_tlab, i32 0, i32 1\n"
+    , "    %cur = load ptr, ptr %cur_ptr\n"
+    , "    %end = load ptr, ptr %end_ptr\n"
+    , "    %size_m1 = sub i64 %size, 1\n"
+    , "    %small = icmp ult i64 %size_m1, 256\n"
+    , "    %size_up = add i64 %size, 7\n"
+    , "    %rounded = and i64 %size_up, -8\n"
+    , "    %need = add i64 %rounded, 8\n"
+    , "    %cur_int = ptrtoint ptr %cur to i64\n"
+    , "    %end_int = ptrtoint ptr %end to i64\n"
+    , "    %room = sub i64 %end_int, %cur_int\n"
+    , "    %fits = icmp uge i64 %room, %need\n"
+    , "    %ok = and i1 %small, %fits\n"
+    , "    br i1 %ok, label %fast, label %slow\n"
+    , "fast:\n"
+    , "    %untyped = icmp ugt i64 %desc, 32767\n"
+    , "    %map = shl i64 %desc, 48\n"
+    , "    %typed = or i64 %map, -9223372036854775808\n"
+    , "    %type = select i1 %untyped, i64 0, i64 %typed\n"
+    , "    %header = or i64 %rounded, %type\n"
+    , "    store i64 %header, ptr %cur\n"
+    , "    %obj = getelementptr inbounds i8, ptr %cur, i64 8\n"
+    , "    %next = getelementptr inbounds i8, ptr %cur, i64 %need\n"
+    , "    store ptr %next, ptr %cur_ptr\n"
+    , "    ret ptr %obj\n"
+    , "slow:\n"
+    , "    %refilled = call ptr @cheap_alloc_refill_typed(i64 %size, i64 %desc, i64 %site) [ \"deopt\"() ]\n"
+    , "    ret ptr %refilled\n"
+    , "}\n"
     ]
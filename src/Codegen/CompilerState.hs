@@ -7,7 +7,8 @@ module Codegen.CompilerState where
 
 import           Auxiliary                     (snoc)
 import           Codegen.Auxillary             (type2LlvmType, typeByteSize)
-import           Codegen.LlvmIr                as LIR (LLVMIr (SetVariable, Type),
+import           Codegen.LlvmIr                as LIR (GcStrategy,
+                                                       LLVMIr (Define, DefineGc, SetVariable, Type),
                                                        LLVMType (CustomType, Function, I64, Ptr),
                                                        LLVMValue (VFunction, VIdent),
                                                        Visibility (Global),
@@ -30,11 +31,19 @@ data CodeGenerator = CodeGenerator
     , variableCount :: Integer
     , labelCount    :: Integer
     , gcEnabled     :: Bool
+    , gcStrategy    :: GcStrategy
+    , gcRoots       :: [(Ident, Integer)]
+    -- ^ Rooted buffers of the function, and their sizes, passed to
+    --   the calls of the function with the statepoint strategy
     , structTypes   :: Map Ident StructType
     -- ^ Custom stucture types
     , locals        :: [(Ident, LocalElem)]
     -- ^ Arguments and variables in local environment
     , globals       :: Map Ident (LLVMType, LLVMValue)
+    , allocSites    :: [String]
+    -- ^ Names of the allocation sites, in the order of their index
+    , typeDescriptors :: Map LLVMType Integer
+    -- ^ Pointer maps of the custom types, passed to cheap_alloc_typed
     }
 
 data StructType = StructType
@@ -97,6 +106,18 @@ emit l@(SetVariable x _) = modify $ \t ->
 
 emit l = modify $ \t -> t { instructions = Auxiliary.snoc l t.instructions }
 
+-- | Adds instructions to the entry block of the function being
+--   generated, right after its definition
+emitEntry :: [LLVMIr] -> CompilerState ()
+emitEntry ls = modify $ \t ->
+    let (body, entry) = break isDefine $ reverse t.instructions
+    in  t { instructions = reverse entry ++ ls ++ reverse body }
+  where
+    isDefine = \case
+        Define{}   -> True
+        DefineGc{} -> True
+        _          -> False
+
 -- | Increases the variable counter in the CodeGenerator state
 increaseVarCount :: CompilerState ()
 increaseVarCount = modify $ \t -> t{variableCount = variableCount t + 1}
@@ -109,6 +130,12 @@ getVarCount = gets variableCount
 getNewVar :: CompilerState TIR.Ident
 getNewVar = TIR.Ident . show <$> (increaseVarCount >> getVarCount)
 
+-- | Adds an allocation site and returns its index in the site table
+getNewAllocSite :: String -> CompilerState Integer
+getNewAllocSite name = do
+    modify (\t -> t{allocSites = snoc name t.allocSites})
+    gets (subtract 1 . fromIntegral . length . allocSites)
+
 -- | Increses the label count and returns a label from the CodeGenerator state
 getNewLabel :: CompilerState Integer
 getNewLabel = do
@@ -194,8 +221,8 @@ getGlobals scs = Map.fromList [ go b | MIR.DBind b <- scs ]
 
 
 
-initCodeGenerator :: Bool -> [MIR.Def] -> CodeGenerator
-initCodeGenerator addGc scs =
+initCodeGenerator :: Bool -> GcStrategy -> [MIR.Def] -> CodeGenerator
+initCodeGenerator addGc strategy scs =
     CodeGenerator
         { instructions = []
         , functions = getFunctions scs
@@ -205,7 +232,11 @@ initCodeGenerator addGc scs =
         , variableCount = 0
         , labelCount = 0
         , gcEnabled = addGc
+        , gcStrategy = strategy
+        , gcRoots = mempty
         , locals = mempty
         , globals = getGlobals scs
+        , allocSites = mempty
+        , typeDescriptors = mempty
         }
 
@@ -11,13 +11,14 @@ import           Codegen.Auxillary
 import           Codegen.CompilerState
 import           Codegen.LlvmIr                as LIR
 import           Control.Applicative           (Applicative (liftA2), (<|>))
-import           Control.Monad                 (forM_, when, zipWithM_)
+import           Control.Monad                 (forM_, guard, void, when,
+                                                zipWithM_)
 import           Control.Monad.Extra           (whenJust)
 import           Control.Monad.State           (gets, modify)
 import           Data.Char                     (ord)
 import           Data.Coerce                   (coerce)
 import           Data.Foldable.Extra           (notNull)
-import           Data.List                     (isPrefixOf)
+import           Data.List                     (intercalate, isPrefixOf)
 import qualified Data.Map                      as Map
 import           Data.Maybe                    (fromJust, fromMaybe, isNothing)
 import           Data.Tuple.Extra              (second)
@@ -32,6 +33,8 @@ compileScs :: [Def] -> CompilerState ()
 compileScs [] = do
     emit $ UnsafeRaw "\n"
     mapM_ createConstructor =<< gets (Map.toList . constructors)
+    useGc <- gets gcEnabled
+    when useGc (mapM_ emit . allocSiteTable =<< gets allocSites)
     -- as a last step create all the constructors
     -- //TODO maybe merge this with the data type match?
   where
@@ -39,12 +42,34 @@ compileScs [] = do
             let t  = returnTypeCI ci
                 t' = type2LlvmType t
                 x  = (mkCxtName, Ptr) :  map (second type2LlvmType) ci.argumentsCI
-            emit $ Define FastCC t' id x
+            useGc <- gets gcEnabled
+            cTypes <- gets customTypes
+            descriptors <- gets typeDescriptors
+
+            -- several heap allocated fields are allocated as one group,
+            -- whose sizes and descriptors are tables next to the constructor
+            let heapFields = [ (i, s, Map.findWithDefault (-1) arg_t' descriptors)
+                             | (i, (_, arg_t)) <- zip [1 ..] ci.argumentsCI
+                             , let arg_t' = type2LlvmType arg_t
+                             , Just s <- [Map.lookup arg_t' cTypes]
+                             ]
+                grouped = useGc && length heapFields > 1
+                offsets = Map.fromList . zip (map (\(i, _, _) -> i) heapFields)
+                        $ scanl (\o (_, s, _) -> o + groupStride s) 0 heapFields
+            when grouped $ mapM_ emit (allocGroupTables id heapFields)
+
+            emitDefine FastCC t' id x
             top <- getNewVar
             ptr <- getNewVar
             -- allocated the primary type
             emit $ SetVariable top (Alloca t')
 
+            -- the primary type is a root for the heap allocated
+            -- fields, while the next ones are allocated
+            whenJust (guard useGc >> Map.lookup t' cTypes) $ \size -> do
+                emit . UnsafeRaw $ "store " <> toIr t' <> " zeroinitializer, ptr %" <> coerce top <> "\n"
+                emitGcRoot top size
+
             -- set the first byte to the index of the constructor
             emit $
                 SetVariable ptr $
@@ -61,7 +86,12 @@ compileScs [] = do
             -- get a pointer of the correct type
             ptr' <- getNewVar
             emit $ SetVariable ptr' (Bitcast (Ref t') (VIdent top Ptr) (Ref $ CustomType id))
-            cTypes <- gets customTypes
+
+            mgroup <- if not grouped then pure Nothing else do
+                site <- getNewAllocSite (coerce id)
+                group <- getNewVar
+                emit . SetVariable group =<< withRoots (GcMallocGroup id (fromIntegral $ length heapFields) site)
+                pure $ Just group
 
             enumerateOneM_
                 ( \i (Ident arg_n, arg_t) -> do
@@ -84,8 +114,14 @@ compileScs [] = do
                         Just s -> do
                             emit $ Comment "Malloc and store"
                             heapPtr <- getNewVar
-                            useGc <- gets gcEnabled
-                            emit $ SetVariable heapPtr (if useGc then GcMalloc s else Malloc s)
+                            case mgroup of
+                                Just group -> emit . SetVariable heapPtr $
+                                    GetElementPtr (Array 0 I8) Ptr (VIdent group Ptr) I64 (VInteger 0)
+                                                  I64 (VInteger $ offsets Map.! i)
+                                Nothing -> do
+                                    site <- getNewAllocSite (coerce id <> "." <> show i)
+                                    let descriptor = Map.findWithDefault (-1) arg_t' descriptors
+                                    emit . SetVariable heapPtr =<< withRoots (if useGc then GcMalloc s site descriptor else Malloc s)
                             emit $ Store arg_t' (VIdent (Ident arg_n) arg_t') Ptr heapPtr
                             emit $ Store (Ref arg_t') (VIdent heapPtr arg_t') Ptr elemPtr
                         Nothing -> do
@@ -116,7 +152,7 @@ compileScs (DBind bind : xs) = do
     let args' | isMain    = []
               | otherwise = zip (mkCxtName : map fst args) t_args
 
-    emit $ Define FastCC (if isMain then I64 else t_return) name args'
+    emitDefine FastCC (if isMain then I64 else t_return) name args'
     modify $ \s -> s  { locals = foldr insertArg s.locals args' }
 
     -- Dereference ptr arguments
@@ -134,7 +170,8 @@ compileScs (DBind bind : xs) = do
     whenJust mcxt loadFreeVars
 
     gcEnabled <- gets gcEnabled
-    when isMain $ mapM_ emit (firstMainContent gcEnabled)
+    strategy <- gets gcStrategy
+    when isMain $ mapM_ emit (firstMainContent gcEnabled strategy)
 
     result <- exprToValue exp
 
@@ -189,24 +226,63 @@ compileScs (DData (Data typ ts) : xs) = do
     -- Add data type (e.g. %List) to top of the file
     addStructType_ (Ident outer_id) [I8, Array biggestVariant I8]
     typeSets <- gets customTypes
+    let fieldTypes fi = (\s -> if Map.member s typeSets then Ref s else s) <$> variantTypes fi
     mapM_
-        ( \(Inj inner_id fi) -> do
-            let types = (\s -> if Map.member s typeSets then Ref s else s) <$> variantTypes fi
+        ( \(Inj inner_id fi) ->
             -- Add constructor type (e.g. %Cons) to top of the file
-            addStructType_ inner_id (I8 : types)
+            addStructType_ inner_id (I8 : fieldTypes fi)
         )
         ts
+    -- The variants share the object, so a word holds a pointer if it
+    -- does in any of them, and unknown layouts are all pointers
+    let descriptor = fromMaybe (-1) $ unionPointerMap ((\(Inj _ fi) -> I8 : fieldTypes fi) <$> ts)
+    modify $ \s -> s { typeDescriptors = Map.insert (CustomType (Ident outer_id)) descriptor s.typeDescriptors }
     compileScs xs
 
+-- | The names of the allocation sites as a null-terminated array of
+--   strings, passed to cheap_set_alloc_sites by main
+allocSiteTable :: [String] -> [LLVMIr]
+allocSiteTable names =
+    zipWith name [0 :: Integer ..] names
+    ++ [ UnsafeRaw $ "@.cheap_alloc_sites = private unnamed_addr constant ["
+            <> show (length names + 1) <> " x ptr] ["
+            <> concatMap (\i -> "ptr @.cheap_site_" <> show i <> ", ") [0 .. length names - 1]
+            <> "ptr null]\n"
+       ]
+  where
+    name i s = UnsafeRaw $ "@.cheap_site_" <> show i <> " = private unnamed_addr constant ["
+        <> show (length s + 1) <> " x i8] c\"" <> s <> "\\00\"\n"
+
+-- | The distance from an object of a group of cheap_alloc_group to the
+--   next one, the size rounded up to CHEAP_GRANULE and the next header
+groupStride :: Integer -> Integer
+groupStride s = (s + 7) `div` 8 * 8 + 8
+
+-- | The sizes and descriptors of the heap allocated fields of a
+--   constructor, passed to cheap_alloc_group_typed
+allocGroupTables :: Ident -> [(Integer, Integer, Integer)] -> [LLVMIr]
+allocGroupTables (Ident c) fields =
+    [ table "sizes" (map (\(_, s, _) -> s) fields)
+    , table "types" (map (\(_, _, d) -> d) fields)
+    ]
+  where
+    table name xs = UnsafeRaw $ "@.cheap_group_" <> name <> "_" <> c <> " = private unnamed_addr constant ["
+        <> show (length xs) <> " x i64] [" <> intercalate ", " (map (("i64 " <>) . show) xs) <> "]\n"
+
 -- | The first content of the main function
-firstMainContent :: Bool -> [LLVMIr]
-firstMainContent True =
-    [ -- UnsafeRaw "%prof = call ptr @cheap_the()\n"
-      --     , UnsafeRaw "call void @cheap_set_profiler(ptr %prof, i1 true)\n"
-      -- , UnsafeRaw "call void @cheap_profiler_log_options(ptr %prof, i64 30)\n"
+firstMainContent :: Bool -> GcStrategy -> [LLVMIr]
+firstMainContent True strategy =
+    [ -- The profiler and the heap are configured by the CHEAP_*
+      -- environment variables that cheap_init reads, see cheap.md
       UnsafeRaw "call void @cheap_init()\n"
+    , UnsafeRaw $ "call void @cheap_set_root_mode(i64 " <> rootMode strategy <> ")\n"
+    , UnsafeRaw "call void @cheap_set_alloc_sites(ptr @.cheap_alloc_sites)\n"
     ]
-firstMainContent False = []
+  where
+    -- CHEAP_ROOTS_SHADOW_STACK and CHEAP_ROOTS_STACK_MAP in cheap.h
+    rootMode ShadowStack = "1"
+    rootMode Statepoint  = "2"
+firstMainContent False _ = []
 
 -- | The last content of the main function
 lastMainContent :: Bool -> [LLVMIr]
@@ -409,7 +485,8 @@ emitApp rt e1 e2 = do
     call <- preludeFuns call name (snd (head args)) (snd (args !! 1))
 
     emit $ Comment $ show (type2LlvmType rt)
-    emit $ SetVariable vs call
+    emit . SetVariable vs =<< withRoots call
+    void $ emitRootedValue (type2LlvmType rt) (VIdent vs (type2LlvmType rt))
 
   where
 
@@ -485,8 +562,8 @@ exprToValue et@(e, t) = case e of
 
         Just (Function t_return [_], _) -> do
             vc <- getNewVar
-            emit $ SetVariable vc (Call FastCC t_return Global name [(Ptr, VNull)])
-            pure $ VIdent vc t_return
+            emit . SetVariable vc =<< withRoots (Call FastCC t_return Global name [(Ptr, VNull)])
+            emitRootedValue t_return (VIdent vc t_return)
 
         Just _ -> error "Bad"
 
@@ -495,8 +572,8 @@ exprToValue et@(e, t) = case e of
             Just ConstructorInfo {numArgsCI}
                 | numArgsCI == 0 -> do
                     vc <- getNewVar
-                    emit $ SetVariable vc call
-                    pure $ VIdent vc (type2LlvmType t)
+                    emit . SetVariable vc =<< withRoots call
+                    emitRootedValue (type2LlvmType t) (VIdent vc (type2LlvmType t))
                 | otherwise -> pure $ VFunction name Global (type2LlvmType t)
                   where
                     call = Call FastCC (type2LlvmType t) Global name [(Ptr, VNull)]
@@ -537,6 +614,87 @@ exprToValue et@(e, t) = case e of
         pure $ VIdent (Ident $ show v) (getType et)
 
 
+-- | Emits a function definition, whose roots are found by the garbage
+--   collector if it is enabled.
+emitDefine :: CallingConvention -> LLVMType -> Ident -> Params -> CompilerState ()
+emitDefine c t name args = do
+    useGc <- gets gcEnabled
+    strategy <- gets gcStrategy
+    modify $ \s -> s { gcRoots = mempty }
+    emit $ (if useGc then DefineGc strategy else Define) c t name args
+
+-- | Registers an alloca'd buffer of the given size as a garbage
+--   collector root.
+--   With the shadow stack the buffer is pointed to by a ptr slot.
+--   The slot lives in the frame of the function from its entry on,
+--   so it is declared and nulled in the entry block, and only set to
+--   the buffer where the buffer is allocated.
+--   With statepoints the buffer, which must be allocated and zeroed
+--   in the entry block, is passed to the calls that follow.
+emitGcRoot :: Ident -> Integer -> CompilerState ()
+emitGcRoot buffer size = gets gcStrategy >>= \case
+    ShadowStack -> do
+        let slot = Ident ("root." <> coerce buffer)
+        emitEntry
+            [ SetVariable slot (Alloca Ptr)
+            , Store Ptr VNull Ptr slot
+            , GcRoot slot size
+            ]
+        emit $ Store Ptr (VIdent buffer Ptr) Ptr slot
+    Statepoint ->
+        modify $ \s -> s { gcRoots = snoc (buffer, size) s.gcRoots }
+
+-- | Allocates a buffer for a rooted value. With statepoints the stack
+--   maps hold the offsets of the buffers in the frame, so the buffers
+--   are allocated and zeroed in the entry block, and are named as the
+--   numbered variables can not be moved there.
+emitRootBuffer :: LLVMType -> CompilerState Ident
+emitRootBuffer t = gets gcStrategy >>= \case
+    ShadowStack -> do
+        buffer <- getNewVar
+        emit $ SetVariable buffer (Alloca t)
+        pure buffer
+    Statepoint -> do
+        n <- gets (length . gcRoots)
+        let buffer = Ident ("root." <> show n)
+        emitEntry
+            [ SetVariable buffer (Alloca t)
+            , UnsafeRaw $ "store " <> toIr t <> " zeroinitializer, ptr %" <> coerce buffer <> "\n"
+            ]
+        pure buffer
+
+-- | Roots a freshly returned value of a custom type, which may hold
+--   pointers to the heap, for the rest of the function. The value is
+--   spilled to a rooted buffer and reloaded from it, the reloaded
+--   value is the last variable and is returned.
+--   Values of custom types which are not returned from calls are
+--   arguments, fields or copies of such values, and are reachable
+--   from a root in this or a calling function already.
+emitRootedValue :: LLVMType -> LLVMValue -> CompilerState LLVMValue
+emitRootedValue t v = do
+    useGc <- gets gcEnabled
+    cTypes <- gets customTypes
+    case guard useGc >> Map.lookup t cTypes of
+        Nothing -> pure v
+        Just size -> do
+            buffer <- emitRootBuffer t
+            emit $ Store t v Ptr buffer
+            emitGcRoot buffer size
+            reloaded <- getNewVar
+            emit $ SetVariable reloaded (Load t Ptr buffer)
+            pure $ VIdent reloaded t
+
+-- | Passes the rooted buffers of the function to a call as its deopt
+--   state with statepoints, they are then in the stack map of the call.
+withRoots :: LLVMIr -> CompilerState LLVMIr
+withRoots call = do
+    useGc <- gets gcEnabled
+    strategy <- gets gcStrategy
+    roots <- gets gcRoots
+    pure $ if useGc && strategy == Statepoint && notNull roots
+        then Deopt roots call
+        else call
+
 mkClosureName :: Ident -> Ident
 mkClosureName (Ident s) = Ident $ "Closure_" ++ s
 
@@ -9,6 +9,7 @@ module Codegen.LlvmIr (
     LLVMComp (..),
     Visibility (..),
     CallingConvention (..),
+    GcStrategy (..),
     ToIr (..),
     typeOf
 ) where
@@ -24,6 +25,14 @@ instance ToIr CallingConvention where
     toIr CCC    = "ccc"
     toIr ColdCC = "coldcc"
 
+-- | How the functions of a program make their roots known to the
+--   garbage collector
+data GcStrategy = ShadowStack | Statepoint deriving (Show, Eq, Ord)
+instance ToIr GcStrategy where
+    toIr :: GcStrategy -> String
+    toIr ShadowStack = "gc \"shadow-stack\""
+    toIr Statepoint  = "\"frame-pointer\"=\"all\" gc \"statepoint-example\""
+
 -- | A datatype which represents some basic LLVM types
 data LLVMType
     = I1
@@ -122,6 +131,8 @@ type Args = [(LLVMType, LLVMValue)]
 data LLVMIr
     = Type Ident [LLVMType]
     | Define CallingConvention LLVMType Ident Params
+    | DefineGc GcStrategy CallingConvention LLVMType Ident Params
+    -- ^ A function whose roots are found by the garbage collector
     | DefineEnd
     | Declare LLVMType Ident Params
     | SetVariable Ident LLVMIr
@@ -146,7 +157,18 @@ data LLVMIr
     | Ret LLVMType LLVMValue
     | Comment String
     | Malloc Integer
-    | GcMalloc Integer
+    | GcMalloc Integer Integer Integer
+    -- ^ Allocates the given size on the heap, from the allocation
+    --   site of the given index in the site table
+    | GcMallocGroup Ident Integer Integer
+    -- ^ Allocates the heap allocated fields of the given constructor
+    --   as one group, from the tables of their sizes and descriptors
+    | GcRoot Ident Integer
+    -- ^ Registers an alloca'd ptr as a root, pointing to a buffer
+    --   of the given size
+    | Deopt [(Ident, Integer)] LLVMIr
+    -- ^ A call which passes the rooted buffers of the frame, and
+    --   their sizes, as its deopt state
     | UnsafeRaw String -- This should generally be avoided, and proper
     -- instructions should be used in its place
     deriving (Show, Eq, Ord)
@@ -175,9 +197,10 @@ llvmIrToString = go 0
     go _ [] = mempty
     go i (x : xs) = do
         let (i', n) = case x of
-                Define{}  -> (i + 1, 0)
-                DefineEnd -> (i - 1, 0)
-                _         -> (i, i)
+                Define{}   -> (i + 1, 0)
+                DefineGc{} -> (i + 1, 0)
+                DefineEnd  -> (i - 1, 0)
+                _          -> (i, i)
         insToString n x <> go i' xs
 
 -- \| Converts a LLVM inststruction to a String, allowing for printing etc.
@@ -217,6 +240,12 @@ llvmIrToString = go 0
                     , "(", intercalate ", " (map (\(Ident y, x) -> unwords [toIr x, "%" <> y]) params)
                     , ") {\n"
                     ]
+            (DefineGc gc c t (Ident i) params) ->
+                concat
+                    [ "define ", toIr c, " ", toIr t, " @", i
+                    , "(", intercalate ", " (map (\(Ident y, x) -> unwords [toIr x, "%" <> y]) params)
+                    , ") ", toIr gc, " {\n"
+                    ]
             DefineEnd -> "}\n"
             (Declare _t (Ident _i) _params) -> undefined
             (SetVariable (Ident i) ir) -> concat ["%", i, " = ", insToString 0 ir]
@@ -251,13 +280,31 @@ llvmIrToString = go 0
                     , intercalate ", " $ Prelude.map (\(x, y) -> toIr x <> " " <> toIr y) arg
                     , ")\n"
                     ]
+            (Deopt roots call) ->
+                concat
+                    [ init (insToString 0 call), " [ \"deopt\"("
+                    , intercalate ", " $ Prelude.map (\(Ident b, n) -> "ptr %" <> b <> ", i64 " <> show n) roots
+                    , ") ]\n"
+                    ]
             (Alloca t) -> unwords ["alloca", toIr t, "\n"]
             (Malloc t) ->
                 concat
                     [ "call ptr @malloc(i64 ", show t, ")\n"]
-            (GcMalloc t) ->
+            (GcMalloc t site descriptor) ->
+                concat
+                    [ "call ptr @cheap_alloc_fast(i64 ", show t, ", i64 ", show site
+                    , ", i64 ", show descriptor, ")\n"
+                    ]
+            (GcMallocGroup (Ident c) n site) ->
                 concat
-                    [ "call ptr @cheap_alloc(i64 ", show t, ")\n"]
+                    [ "call ptr @cheap_alloc_group_typed(ptr @.cheap_group_sizes_", c
+                    , ", ptr @.cheap_group_types_", c, ", i64 ", show n, ", i64 ", show site, ")\n"
+                    ]
+            (GcRoot (Ident slot) size) ->
+                concat
+                    [ "call void @llvm.gcroot(ptr %", slot
+                    , ", ptr inttoptr (i64 ", show size, " to ptr))\n"
+                    ]
             (Store t1 val t2 (Ident id2)) ->
                 concat
                     [ "store ", toIr t1, " ", toIr val
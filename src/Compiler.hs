@@ -4,8 +4,10 @@ import           System.Process.Extra (readCreateProcess, shell)
 
 -- spawnWait s = spawnCommand s >>= \s >>= waitForProcess
 
+-- | Statepoints are inserted after the optimizations, for the functions
+--   using gc "statepoint-example"; other functions are left as they are
 optimize :: String -> IO String
-optimize = readCreateProcess (shell "opt --O3 --tailcallopt -S")
+optimize = readCreateProcess (shell "opt -passes='default<O3>,rewrite-statepoints-for-gc' --tailcallopt -S")
 
 compileClang :: String -> Bool -> String -> IO String
 compileClang name False =
@@ -27,10 +29,20 @@ compileClang name True =
             , "src/GC/lib/cheap.cpp"
             , "src/GC/lib/event.cpp"
             , "src/GC/lib/heap.cpp"
+            , "src/GC/lib/marker.cpp"
             , "src/GC/lib/profiler.cpp"
+            , "src/GC/lib/stack_map.cpp"
             -- , "-Wall -Wextra -g -std=gnu++20 -stdlib=libstdc++"
             , "-w -g -std=gnu++20 -stdlib=libstdc++"
+            -- the release flavour of the runtime, see the release target
+            -- of src/GC/Makefile
+            , "-DCHEAP_RELEASE -DNDEBUG"
+            , "-pthread"
             , "-O3"
+            -- the stack map roots are found by walking the frame pointers
+            , "-fno-omit-frame-pointer"
+            -- names the frames of the allocation-site profiles
+            , "-rdynamic"
             --, "-tailcallopt"
             , "-Isrc/GC/include"
             , "-x"
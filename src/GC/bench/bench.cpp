@@ -0,0 +1,364 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <stdint.h>
+#include <vector>
+
+#include "cheap.h"
+
+/*
+ * The benchmarks of the heap, run through the C API the way
+ * the compiled code uses it. Every benchmark is run a number
+ * of warmup rounds that are not measured, then the measured
+ * repetitions, and is reported with the minimum, median, mean
+ * and maximum of the repetitions and the heap statistics of
+ * the measured ones, the pause percentiles are those of the
+ * process. The workloads are deterministic, the random ones
+ * use a fixed seed. The heap is shared by the benchmarks of a
+ * process, make bench runs each benchmark in a process of its
+ * own. See the Makefile for how to build it.
+ *
+ * Usage: bench [--list] [--json] [--warmup N] [--reps N]
+ *              [--nursery BYTES] [--compact THRESHOLD]
+ *              [--mark-threads N] [benchmark ...]
+ */
+
+// Bytes allocated per repetition of the allocation benchmarks
+#define ALLOC_BYTES         (64UL << 20)
+#define ALLOC_BATCH         16
+#define LIST_LEN            (1 << 20)
+#define LIST_ROUNDS         4
+// The tree depths of GCBench, scaled down from a stretch tree
+// of depth 20 to keep a repetition below a second
+#define TREE_STRETCH_DEPTH  18
+#define TREE_LONG_DEPTH     16
+#define TREE_ARRAY_SIZE     500000
+#define TREE_MIN_DEPTH      4
+#define TREE_MAX_DEPTH      16
+// Live objects and replacements of the fragmentation churn
+#define FRAG_LIVE           (1 << 16)
+#define FRAG_ROUNDS         (1 << 19)
+#define FRAG_SEED           0x9e3779b97f4a7c15UL
+
+using std::cout, std::cerr, std::endl;
+
+struct Benchmark
+{
+    const char *name;
+    // Runs a repetition, returns the operations it did
+    size_t (*run)(size_t param);
+    size_t param;
+};
+
+struct Result
+{
+    std::vector<double> ms;
+    size_t ops;
+    cheap_stats_t before;
+    cheap_stats_t after;
+};
+
+// Keeps the compiler from dropping the work of a benchmark
+static volatile uintptr_t sink;
+
+/*
+ * Allocation throughput of one size, none of the objects
+ * survive. Sizes up to CHEAP_TLAB_OBJ_MAX take the inlined
+ * fast path, larger ones go through the heap.
+ */
+static size_t __attribute__((noinline)) alloc_size(size_t size)
+{
+    size_t count = ALLOC_BYTES / (CHEAP_HEADER_SIZE + size);
+    for (size_t i = 0; i < count; i++)
+    {
+        auto obj = static_cast<uintptr_t *>(cheap_alloc(size));
+        obj[0] = i;
+    }
+    return count;
+}
+
+// The same with cheap_alloc_n(), in batches of ALLOC_BATCH
+static size_t __attribute__((noinline)) alloc_n(size_t size)
+{
+    size_t count = ALLOC_BYTES / (CHEAP_HEADER_SIZE + size);
+    void *objs[ALLOC_BATCH];
+    for (size_t i = 0; i < count; i += ALLOC_BATCH)
+    {
+        cheap_alloc_n(ALLOC_BATCH, size, objs);
+        for (size_t j = 0; j < ALLOC_BATCH; j++)
+            static_cast<uintptr_t *>(objs[j])[0] = i + j;
+    }
+    return count;
+}
+
+struct Node
+{
+    long value;
+    Node *next;
+};
+
+static long __attribute__((noinline)) list_sum(Node *list)
+{
+    long sum = 0;
+    for (Node *node = list; node != nullptr; node = node->next)
+        sum += node->value;
+    return sum;
+}
+
+// A deep linked list, built and walked, then dropped
+static size_t __attribute__((noinline)) linked_list(size_t len)
+{
+    for (int round = 0; round < LIST_ROUNDS; round++)
+    {
+        Node *head = nullptr;
+        for (size_t i = 0; i < len; i++)
+        {
+            auto node = static_cast<Node *>(cheap_alloc(sizeof(Node)));
+            node->value = i;
+            node->next = head;
+            head = node;
+        }
+        sink = list_sum(head);
+    }
+    return LIST_ROUNDS * len;
+}
+
+struct TreeNode
+{
+    TreeNode *left;
+    TreeNode *right;
+    long i;
+    long j;
+};
+
+static TreeNode *new_node(TreeNode *left, TreeNode *right)
+{
+    auto node = static_cast<TreeNode *>(cheap_alloc(sizeof(TreeNode)));
+    node->left = left;
+    node->right = right;
+    node->i = 0;
+    node->j = 0;
+    return node;
+}
+
+static size_t tree_size(int depth)
+{
+    return (1UL << (depth + 1)) - 1;
+}
+
+// Builds a tree top down, into an existing node
+static void __attribute__((noinline)) populate(int depth, TreeNode *node)
+{
+    if (depth <= 0)
+        return;
+    node->left = new_node(nullptr, nullptr);
+    node->right = new_node(nullptr, nullptr);
+    populate(depth - 1, node->left);
+    populate(depth - 1, node->right);
+}
+
+// Builds a tree bottom up
+static TreeNode *__attribute__((noinline)) make_tree(int depth)
+{
+    if (depth <= 0)
+        return new_node(nullptr, nullptr);
+    TreeNode *left = make_tree(depth - 1);
+    return new_node(left, make_tree(depth - 1));
+}
+
+/*
+ * Binary trees after GCBench by Boehm, Ellis and Kovac. A
+ * long-lived tree and array stay live while trees of growing
+ * depth are built top down and bottom up and dropped, as many
+ * of them per depth as add up to twice the stretch tree.
+ */
+static size_t __attribute__((noinline)) binary_trees(size_t)
+{
+    size_t ops = 0;
+    sink = reinterpret_cast<uintptr_t>(make_tree(TREE_STRETCH_DEPTH));
+    ops += tree_size(TREE_STRETCH_DEPTH);
+
+    TreeNode *long_lived = new_node(nullptr, nullptr);
+    populate(TREE_LONG_DEPTH, long_lived);
+    auto array = static_cast<double *>(cheap_alloc(TREE_ARRAY_SIZE * sizeof(double)));
+    for (int i = 0; i < TREE_ARRAY_SIZE / 2; i++)
+        array[i] = 1.0 / i;
+    ops += tree_size(TREE_LONG_DEPTH) + 1;
+
+    for (int depth = TREE_MIN_DEPTH; depth <= TREE_MAX_DEPTH; depth += 2)
+    {
+        size_t iterations = 2 * tree_size(TREE_STRETCH_DEPTH) / tree_size(depth);
+        for (size_t i = 0; i < iterations; i++)
+        {
+            TreeNode *tree = new_node(nullptr, nullptr);
+            populate(depth, tree);
+            sink = reinterpret_cast<uintptr_t>(make_tree(depth));
+        }
+        ops += 2 * iterations * tree_size(depth);
+    }
+
+    if (long_lived == nullptr || array[1000] != 1.0 / 1000)
+    {
+        cerr << "Error: binary_trees lost its long-lived data" << endl;
+        exit(1);
+    }
+    return ops;
+}
+
+static uint64_t next_random(uint64_t &state)
+{
+    state ^= state << 13;
+    state ^= state >> 7;
+    state ^= state << 17;
+    return state;
+}
+
+/*
+ * Fragmentation churn, a set of live objects of mixed sizes
+ * where a random one is replaced by an object of a random
+ * size, so that the heap is fragmented with live and dead
+ * chunks of all sizes.
+ */
+static size_t __attribute__((noinline)) fragmentation(size_t rounds)
+{
+    uint64_t state = FRAG_SEED;
+    auto live = static_cast<uintptr_t **>(cheap_alloc(FRAG_LIVE * sizeof(uintptr_t *)));
+    std::memset(live, 0, FRAG_LIVE * sizeof(uintptr_t *));
+    for (size_t i = 0; i < rounds; i++)
+    {
+        uint64_t random = next_random(state);
+        // Mostly small objects, one in 16 up to 4 KB
+        size_t size = random & 0xf0000 ? 16 + (random >> 20) % 240 : 256 + (random >> 20) % 3840;
+        auto obj = static_cast<uintptr_t *>(cheap_alloc(size));
+        obj[0] = i;
+        live[(random >> 32) % FRAG_LIVE] = obj;
+    }
+    sink = reinterpret_cast<uintptr_t>(live);
+    return rounds;
+}
+
+static const Benchmark benchmarks[] = {
+    {"alloc_16", alloc_size, 16},
+    {"alloc_64", alloc_size, 64},
+    {"alloc_256", alloc_size, 256},
+    {"alloc_1024", alloc_size, 1024},
+    {"alloc_4096", alloc_size, 4096},
+    {"alloc_n_16", alloc_n, 16},
+    {"alloc_n_64", alloc_n, 64},
+    {"linked_list", linked_list, LIST_LEN},
+    {"binary_trees", binary_trees, 0},
+    {"fragmentation", fragmentation, FRAG_ROUNDS},
+};
+
+static Result run(const Benchmark &bench, int warmup, int reps)
+{
+    Result result;
+    for (int i = 0; i < warmup; i++)
+        bench.run(bench.param);
+
+    cheap_get_stats(&result.before);
+    for (int i = 0; i < reps; i++)
+    {
+        auto start = std::chrono::steady_clock::now();
+        result.ops = bench.run(bench.param);
+        auto end = std::chrono::steady_clock::now();
+        result.ms.push_back(std::chrono::duration<double, std::milli>(end - start).count());
+    }
+    cheap_get_stats(&result.after);
+    return result;
+}
+
+static void print(const Benchmark &bench, int warmup, Result &result, bool json)
+{
+    std::vector<double> sorted(result.ms);
+    std::sort(sorted.begin(), sorted.end());
+    double median = sorted.size() % 2 ? sorted[sorted.size() / 2]
+        : (sorted[sorted.size() / 2 - 1] + sorted[sorted.size() / 2]) / 2;
+    double mean = 0;
+    for (double ms : sorted)
+        mean += ms / sorted.size();
+    double ns_per_op = median * 1e6 / result.ops;
+    unsigned long collections = result.after.collections - result.before.collections;
+    unsigned long minor = result.after.minor_collections - result.before.minor_collections;
+    unsigned long allocated = result.after.bytes_allocated - result.before.bytes_allocated;
+
+    if (json)
+    {
+        printf("{\"benchmark\": \"%s\", \"warmup\": %d, \"reps\": %zu, \"ops\": %zu, "
+            "\"min_ms\": %.3f, \"median_ms\": %.3f, \"mean_ms\": %.3f, \"max_ms\": %.3f, "
+            "\"ns_per_op\": %.3f, \"collections\": %lu, \"minor_collections\": %lu, "
+            "\"bytes_allocated\": %lu, \"mapped_bytes\": %lu, \"pause_p50_ns\": %lu, "
+            "\"pause_p99_ns\": %lu, \"pause_max_ns\": %lu}\n",
+            bench.name, warmup, sorted.size(), result.ops, sorted.front(), median, mean, sorted.back(),
+            ns_per_op, collections, minor, allocated, result.after.mapped_bytes,
+            result.after.pause.p50_ns, result.after.pause.p99_ns, result.after.pause.max_ns);
+        return;
+    }
+    printf("%-14s %10.3f %10.3f %10.3f %10.3f %9.2f %7lu %7lu %10lu %8.3f %8.3f\n",
+        bench.name, sorted.front(), median, mean, sorted.back(), ns_per_op, collections, minor,
+        result.after.mapped_bytes >> 20, result.after.pause.p99_ns / 1e6, result.after.pause.max_ns / 1e6);
+}
+
+int main(int argc, char **argv)
+{
+    cheap_init();
+    int warmup = 1, reps = 5;
+    bool json = false;
+    std::vector<const Benchmark *> selected;
+    for (int i = 1; i < argc; i++)
+    {
+        bool has_value = i + 1 < argc;
+        if (strcmp(argv[i], "--list") == 0)
+        {
+            for (const Benchmark &bench : benchmarks)
+                cout << bench.name << endl;
+            cheap_dispose();
+            return 0;
+        }
+        else if (strcmp(argv[i], "--json") == 0)
+            json = true;
+        else if (strcmp(argv[i], "--warmup") == 0 && has_value)
+            warmup = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--reps") == 0 && has_value)
+            reps = std::max(1, atoi(argv[++i]));
+        else if (strcmp(argv[i], "--nursery") == 0 && has_value)
+            cheap_set_nursery_size(strtoul(argv[++i], nullptr, 0));
+        else if (strcmp(argv[i], "--compact") == 0 && has_value)
+            cheap_set_compact_threshold(atof(argv[++i]));
+        else if (strcmp(argv[i], "--mark-threads") == 0 && has_value)
+            cheap_set_mark_threads(strtoul(argv[++i], nullptr, 0));
+        else
+        {
+            auto bench = std::find_if(std::begin(benchmarks), std::end(benchmarks),
+                [&](const Benchmark &bench) { return strcmp(bench.name, argv[i]) == 0; });
+            if (bench == std::end(benchmarks))
+            {
+                cerr << "Usage: " << argv[0] << " [--list] [--json] [--warmup N] [--reps N] [--nursery BYTES]"
+                    " [--compact THRESHOLD] [--mark-threads N] [benchmark ...]" << endl;
+                cheap_dispose();
+                return 2;
+            }
+            selected.push_back(bench);
+        }
+    }
+    if (selected.empty())
+        for (const Benchmark &bench : benchmarks)
+            selected.push_back(&bench);
+
+    if (!json)
+        printf("%-14s %10s %10s %10s %10s %9s %7s %7s %10s %8s %8s\n", "benchmark", "min ms", "median ms",
+            "mean ms", "max ms", "ns/op", "gcs", "minor", "mapped MB", "p99 ms", "max ms");
+    for (const Benchmark *bench : selected)
+    {
+        Result result = run(*bench, warmup, reps);
+        print(*bench, warmup, result, json);
+        fflush(stdout);
+    }
+
+    cheap_set_nursery_size(0);
+    cheap_dispose();
+    return 0;
+}
@@ -0,0 +1,414 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <fcntl.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+/*
+ * The end-to-end benchmarks of the runtime, the sample programs
+ * compiled with churf and linked with cheap the way any program
+ * is. Every program is scaled by replacing the literal input of
+ * its main with a generated one of a given size, or by adding a
+ * main to it, compiled once per scale and run a number of warmup
+ * rounds that are not measured, then the measured repetitions,
+ * each in a process of its own. A run is timed from the fork to
+ * the exit, and the heap reports its statistics through the file
+ * of CHEAP_STATS_FILE when it is disposed, see cheap.md. The
+ * repetitions are reported with the minimum, median and maximum
+ * time, the statistics of the last one, the programs being
+ * deterministic, and the largest peak resident set of them.
+ *
+ * The runs of --json can be saved and passed to --baseline by a
+ * later run, whose table then has the change of each column
+ * against the saved run, to compare two versions of the runtime,
+ * or two configurations of it with --env. The programs are run
+ * from the root of the repository, where the compiler writes
+ * output/, and need churf built, see the Justfile. See the
+ * Makefile for how to build it.
+ *
+ * Usage: programs [--list] [--json] [--root DIR] [--churf PATH]
+ *                 [--flags FLAGS] [--warmup N] [--reps N]
+ *                 [--env NAME=VALUE] [--baseline FILE]
+ *                 [program ...]
+ */
+
+#define SCALES  3
+
+using std::cout, std::cerr, std::endl, std::string;
+
+struct Program
+{
+    const char *name;
+    // Relative to the root of the repository
+    const char *source;
+    // The text of the source replaced by the scaled input, or a
+    // nullptr for a source without a main, and the replacement
+    const char *from;
+    const char *to;
+    // Definitions appended to the source, for the scaled input.
+    // In both, %lu is replaced by the scale
+    const char *append;
+    size_t scales[SCALES];
+};
+
+// A list of the scale down to 1, built like mkDescList of quicksort
+#define BENCH_LIST \
+    "benchList : Int -> List Int\n" \
+    "benchList n = case n == 0 of\n" \
+    "    True => Nil\n" \
+    "    False => Cons n (benchList (n - 1))\n"
+
+static const Program programs[] = {
+    // Quadratic, the list is sorted in descending order
+    {"quicksort", "demo/quicksort.crf", "mkDescList 1000 0", "mkDescList %lu 0", "", {500, 1000, 2000}},
+    // Call by name, so the sum of the nested lambdas of the scale
+    // evaluates its argument twice per level, 2^scale times in all
+    {"lambda_calculus", "demo/lambda_calculus.crf", "(EInt 200)", "(benchExp %lu)",
+        "benchExp : Int -> Exp\n"
+        "benchExp n = case n == 0 of\n"
+        "    True => EInt 1\n"
+        "    False => EApp (EAbs 'x' (EAdd (EVar 'x') (EVar 'x'))) (benchExp (n - 1))\n",
+        {10, 14, 18}},
+    // Inserts the scale down to 1 into a skew heap, then pops them
+    {"PriorityQueue", "sample-programs/PriorityQueue.crf", nullptr, nullptr,
+        "benchFill : Int -> Skewheap -> Skewheap\n"
+        "benchFill n h = case n == 0 of\n"
+        "    True => h\n"
+        "    False => benchFill (n - 1) (insert n h)\n"
+        "\n"
+        "benchDrain : Int -> Skewheap -> Int\n"
+        "benchDrain acc h = case pop h of\n"
+        "    Just p => case p of\n"
+        "        Pair x rest => benchDrain (acc + x) rest\n"
+        "    Nothing => acc\n"
+        "\n"
+        "main = benchDrain 0 (benchFill %lu empty)\n",
+        {1000, 5000, 20000}},
+    // Not tail recursive, the scales are bounded by the stack
+    {"foldr", "sample-programs/working/foldr.crf", "(Cons 1000 (Cons 100 Nil))", "(benchList %lu)", BENCH_LIST,
+        {1000, 5000, 20000}},
+    {"map", "sample-programs/working/map.crf", "(Cons 2 (Cons 4 Nil))", "(benchList %lu)", BENCH_LIST,
+        {1000, 5000, 20000}},
+};
+
+// The fields of a flat JSON object, as the text of their values
+typedef std::map<string, string> Record;
+
+struct Result
+{
+    std::vector<double> ms;
+    Record stats;
+    long max_rss_kb {0};
+};
+
+static void fail(const string &message)
+{
+    cerr << "Error: " << message << endl;
+    exit(1);
+}
+
+static string replace_scale(string text, size_t scale)
+{
+    for (size_t at = text.find("%lu"); at != string::npos; at = text.find("%lu", at))
+        text.replace(at, 3, std::to_string(scale));
+    return text;
+}
+
+static string read_file(const string &path)
+{
+    std::ifstream file(path);
+    if (!file)
+        fail("Cannot read " + path);
+    std::stringstream text;
+    text << file.rdbuf();
+    return text.str();
+}
+
+/*
+ * Parses a JSON object of numbers and strings on one line, as
+ * the heap and --json write them, nested values are not read.
+ */
+static Record parse_record(const string &line)
+{
+    Record record;
+    size_t at = line.find('"');
+    while (at != string::npos)
+    {
+        size_t end = line.find('"', at + 1);
+        size_t colon = line.find(':', end);
+        if (end == string::npos || colon == string::npos)
+            break;
+        string key = line.substr(at + 1, end - at - 1);
+        size_t start = line.find_first_not_of(" ", colon + 1);
+        if (start == string::npos)
+            break;
+        if (line[start] == '"')
+        {
+            end = line.find('"', start + 1);
+            record[key] = line.substr(start + 1, end - start - 1);
+            end++;
+        }
+        else
+        {
+            end = line.find_first_of(",}", start);
+            record[key] = line.substr(start, end - start);
+        }
+        at = end == string::npos ? end : line.find('"', end);
+    }
+    return record;
+}
+
+static double field(const Record &record, const string &key)
+{
+    auto value = record.find(key);
+    return value == record.end() ? 0.0 : strtod(value->second.c_str(), nullptr);
+}
+
+static string key_of(const string &program, size_t scale)
+{
+    return program + "/" + std::to_string(scale);
+}
+
+/*
+ * Writes the source of a program at a scale to the work
+ * directory and compiles it with churf, the binary is moved
+ * out of output/, which the next compilation removes.
+ *
+ * @returns The path of the binary.
+ */
+static string compile(const Program &program, size_t scale, const string &churf, const string &flags,
+    const string &work)
+{
+    string source = read_file(program.source);
+    if (program.from != nullptr)
+    {
+        size_t at = source.find(program.from);
+        if (at == string::npos)
+            fail(string(program.source) + " no longer contains " + program.from);
+        source.replace(at, strlen(program.from), replace_scale(program.to, scale));
+    }
+    source += "\n" + replace_scale(program.append, scale);
+
+    string name = string(program.name) + "_" + std::to_string(scale);
+    string path = work + "/" + name + ".crf";
+    std::ofstream(path) << source;
+
+    string log = work + "/" + name + ".log";
+    string command = churf + " --compile-only " + flags + " " + path + " > " + log + " 2>&1";
+    if (system(command.c_str()) != 0)
+        fail("Compiling " + path + " failed, see " + log);
+
+    string binary = work + "/" + name;
+    std::error_code error;
+    std::filesystem::copy_file("output/" + name, binary, std::filesystem::copy_options::overwrite_existing,
+        error);
+    if (error)
+        fail("churf did not write output/" + name + ", see " + log);
+    return binary;
+}
+
+/*
+ * Runs a binary with the statistics file of the heap and the
+ * environment variables of --env. The exit code of a program
+ * is the value of its main, so only a signal is a failure.
+ *
+ * @returns The time from the fork to the exit in milliseconds.
+ */
+static double run_once(const string &binary, const string &stats, const std::vector<string> &env, Record &record)
+{
+    std::remove(stats.c_str());
+    auto start = std::chrono::steady_clock::now();
+    pid_t pid = fork();
+    if (pid < 0)
+        fail("Cannot fork");
+    if (pid == 0)
+    {
+        for (const string &var : env)
+            putenv(const_cast<char *>(var.c_str()));
+        setenv("CHEAP_STATS_FILE", stats.c_str(), 1);
+        int null = open("/dev/null", O_WRONLY);
+        dup2(null, STDOUT_FILENO);
+        execl(binary.c_str(), binary.c_str(), nullptr);
+        _exit(127);
+    }
+    int status;
+    waitpid(pid, &status, 0);
+    auto end = std::chrono::steady_clock::now();
+    if (WIFSIGNALED(status))
+        fail(binary + " was killed by signal " + std::to_string(WTERMSIG(status)));
+    if (WEXITSTATUS(status) == 127)
+        fail("Cannot run " + binary);
+
+    std::ifstream file(stats);
+    string line;
+    if (!std::getline(file, line))
+        fail(binary + " did not write its statistics, is it linked with the runtime?");
+    record = parse_record(line);
+    return std::chrono::duration<double, std::milli>(end - start).count();
+}
+
+static Result run(const string &binary, const string &work, const std::vector<string> &env, int warmup, int reps)
+{
+    Result result;
+    string stats = work + "/stats.json";
+    for (int i = 0; i < warmup; i++)
+        run_once(binary, stats, env, result.stats);
+    for (int i = 0; i < reps; i++)
+    {
+        result.ms.push_back(run_once(binary, stats, env, result.stats));
+        result.max_rss_kb = std::max(result.max_rss_kb, static_cast<long>(field(result.stats, "max_rss_kb")));
+    }
+    std::sort(result.ms.begin(), result.ms.end());
+    return result;
+}
+
+static double median(const std::vector<double> &sorted)
+{
+    return sorted.size() % 2 ? sorted[sorted.size() / 2]
+        : (sorted[sorted.size() / 2 - 1] + sorted[sorted.size() / 2]) / 2;
+}
+
+// The change against the baseline, blank without one
+static string change(double now, const Record *baseline, const string &key, double scale = 1.0)
+{
+    if (baseline == nullptr || baseline->count(key) == 0)
+        return "";
+    double before = field(*baseline, key) * scale;
+    if (before == 0)
+        return now == 0 ? "+0%" : "new";
+    char text[16];
+    snprintf(text, sizeof(text), "%+.0f%%", (now / before - 1) * 100);
+    return text;
+}
+
+static void print(const Program &program, size_t scale, const Result &result, bool json,
+    const std::map<string, Record> &baselines)
+{
+    double mean = 0;
+    for (double ms : result.ms)
+        mean += ms / result.ms.size();
+    const Record &stats = result.stats;
+    if (json)
+    {
+        printf("{\"program\": \"%s\", \"scale\": %zu, \"reps\": %zu, \"min_ms\": %.3f, \"median_ms\": %.3f, "
+            "\"mean_ms\": %.3f, \"max_ms\": %.3f, \"collections\": %.0f, \"minor_collections\": %.0f, "
+            "\"bytes_allocated\": %.0f, \"mapped_bytes\": %.0f, \"pause_p50_ns\": %.0f, \"pause_p99_ns\": %.0f, "
+            "\"pause_max_ns\": %.0f, \"minor_pause_p99_ns\": %.0f, \"steps_max_ns\": %.0f, \"max_rss_kb\": %ld}\n",
+            program.name, scale, result.ms.size(), result.ms.front(), median(result.ms), mean, result.ms.back(),
+            field(stats, "collections"), field(stats, "minor_collections"), field(stats, "bytes_allocated"),
+            field(stats, "mapped_bytes"), field(stats, "pause_p50_ns"), field(stats, "pause_p99_ns"),
+            field(stats, "pause_max_ns"), field(stats, "minor_pause_p99_ns"), field(stats, "steps_max_ns"),
+            result.max_rss_kb);
+        return;
+    }
+
+    auto found = baselines.find(key_of(program.name, scale));
+    const Record *baseline = found == baselines.end() ? nullptr : &found->second;
+    double allocated = field(stats, "bytes_allocated");
+    double p99 = field(stats, "pause_p99_ns");
+    printf("%-16s %7zu %10.3f %10.3f %6s %7.0f %6s %7.0f %9.1f %6s %8.3f %8.3f %6s %8.3f %8.1f %6s\n",
+        program.name, scale, result.ms.front(), median(result.ms),
+        change(median(result.ms), baseline, "median_ms").c_str(),
+        field(stats, "collections"), change(field(stats, "collections"), baseline, "collections").c_str(),
+        field(stats, "minor_collections"), allocated / (1 << 20),
+        change(allocated, baseline, "bytes_allocated").c_str(), field(stats, "pause_p50_ns") / 1e6, p99 / 1e6,
+        change(p99, baseline, "pause_p99_ns").c_str(), field(stats, "pause_max_ns") / 1e6,
+        result.max_rss_kb / 1024.0, change(result.max_rss_kb, baseline, "max_rss_kb").c_str());
+}
+
+static void usage(const char *argv0)
+{
+    cerr << "Usage: " << argv0 << " [--list] [--json] [--root DIR] [--churf PATH] [--flags FLAGS]"
+        " [--warmup N] [--reps N] [--env NAME=VALUE] [--baseline FILE] [program ...]" << endl;
+    exit(2);
+}
+
+int main(int argc, char **argv)
+{
+    int warmup = 1, reps = 3;
+    bool json = false;
+    string root = ".", churf = "./churf", flags = "-t bi";
+    std::vector<string> env;
+    std::map<string, Record> baselines;
+    std::vector<const Program *> selected;
+    for (int i = 1; i < argc; i++)
+    {
+        bool has_value = i + 1 < argc;
+        if (strcmp(argv[i], "--list") == 0)
+        {
+            for (const Program &program : programs)
+                cout << program.name << endl;
+            return 0;
+        }
+        else if (strcmp(argv[i], "--json") == 0)
+            json = true;
+        else if (strcmp(argv[i], "--root") == 0 && has_value)
+            root = argv[++i];
+        else if (strcmp(argv[i], "--churf") == 0 && has_value)
+            churf = argv[++i];
+        else if (strcmp(argv[i], "--flags") == 0 && has_value)
+            flags = argv[++i];
+        else if (strcmp(argv[i], "--warmup") == 0 && has_value)
+            warmup = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--reps") == 0 && has_value)
+            reps = std::max(1, atoi(argv[++i]));
+        else if (strcmp(argv[i], "--env") == 0 && has_value && strchr(argv[i + 1], '=') != nullptr)
+            env.push_back(argv[++i]);
+        else if (strcmp(argv[i], "--baseline") == 0 && has_value)
+        {
+            // Read before changing to the root, relative to the caller
+            std::istringstream lines(read_file(argv[++i]));
+            for (string line; std::getline(lines, line);)
+            {
+                Record record = parse_record(line);
+                if (record.count("program") && record.count("scale"))
+                    baselines[key_of(record["program"], static_cast<size_t>(field(record, "scale")))] = record;
+            }
+        }
+        else
+        {
+            auto program = std::find_if(std::begin(programs), std::end(programs),
+                [&](const Program &program) { return strcmp(program.name, argv[i]) == 0; });
+            if (program == std::end(programs))
+                usage(argv[0]);
+            selected.push_back(program);
+        }
+    }
+    if (selected.empty())
+        for (const Program &program : programs)
+            selected.push_back(&program);
+    if (chdir(root.c_str()) != 0)
+        fail("Cannot change to " + root);
+
+    char work[] = "/tmp/cheap_programs_XXXXXX";
+    if (mkdtemp(work) == nullptr)
+        fail("Cannot create a work directory");
+
+    if (!json)
+        printf("%-16s %7s %10s %10s %6s %7s %6s %7s %9s %6s %8s %8s %6s %8s %8s %6s\n", "program", "scale",
+            "min ms", "median ms", "", "gcs", "", "minor", "alloc MB", "", "p50 ms", "p99 ms", "", "max ms",
+            "rss MB", "");
+    for (const Program *program : selected)
+    {
+        for (size_t scale : program->scales)
+        {
+            string binary = compile(*program, scale, churf, flags, work);
+            Result result = run(binary, work, env, warmup, reps);
+            print(*program, scale, result, json, baselines);
+            fflush(stdout);
+        }
+    }
+
+    std::filesystem::remove_all(work);
+    return 0;
+}
@@ -0,0 +1,172 @@
+#pragma once
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string>
+#include <sys/mman.h>
+#include <vector>
+
+// Size of the blocks of an arena, larger objects get a block
+// of their own
+#define ARENA_BLOCK     (64UL << 10)
+#define ARENA_GRANULE   8
+
+namespace GC
+{
+    /**
+     * The bump allocator behind cheap_region_push(),
+     * cheap_region_alloc() and cheap_region_pop(), one per
+     * thread. A push marks the top of the arena, a pop frees
+     * everything allocated since the matching push at once.
+     * The objects have no headers and are never traced nor
+     * swept, but their words are roots of the collections
+     * while they are allocated, see Heap::find_arena_roots().
+     *
+     * The memory is kept in blocks mapped from the OS, the
+     * blocks past the current one are kept for the next
+     * allocations, up to one spare block after a pop. Popped
+     * memory is zeroed, so objects start out zeroed like the
+     * chunks of the heap.
+    */
+    class Arena
+    {
+    private:
+        struct Block
+        {
+            char *m_start;
+            char *m_top;
+            char *m_end;
+        };
+
+        struct Mark
+        {
+            size_t m_block;
+            char *m_top;
+        };
+
+        std::vector<Block> m_blocks;
+        std::vector<Mark> m_marks;
+        // The block allocated from
+        size_t m_current {0};
+
+        static Block map_block(size_t size)
+        {
+            void *base = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if (base == MAP_FAILED)
+                throw std::runtime_error(std::string("Error: Region out of memory"));
+            auto start = static_cast<char *>(base);
+            return {start, start, start + size};
+        }
+
+        // Allocates from the next block that fits, the smaller
+        // blocks in between are skipped until the next pop
+        char *alloc_block(size_t size)
+        {
+            size_t next = m_current + 1;
+            while (next < m_blocks.size()
+                && static_cast<size_t>(m_blocks[next].m_end - m_blocks[next].m_top) < size)
+                next++;
+            if (next == m_blocks.size())
+                m_blocks.push_back(map_block(std::max(size, static_cast<size_t>(ARENA_BLOCK))));
+            m_current = next;
+            Block &block = m_blocks[m_current];
+            char *obj = block.m_top;
+            block.m_top += size;
+            return obj;
+        }
+
+    public:
+        Arena() = default;
+        Arena(const Arena &) = delete;
+        Arena &operator=(const Arena &) = delete;
+
+        ~Arena()
+        {
+            for (Block &block : m_blocks)
+                munmap(block.m_start, block.m_end - block.m_start);
+        }
+
+        size_t depth() const { return m_marks.size(); }
+
+        void push()
+        {
+            if (m_blocks.empty())
+                m_blocks.push_back(map_block(ARENA_BLOCK));
+            m_marks.push_back({m_current, m_blocks[m_current].m_top});
+        }
+
+        /**
+         * @param size  The size of the object in bytes.
+         *
+         * @returns The zeroed object, aligned to ARENA_GRANULE.
+         *
+         * Time complexity: O(1), unless a block is mapped.
+         */
+        void *alloc(size_t size)
+        {
+            if (m_marks.empty())
+                throw std::runtime_error(std::string("Error: No region to allocate in, push one first"));
+            size = (size + ARENA_GRANULE - 1) & ~static_cast<size_t>(ARENA_GRANULE - 1);
+            Block &block = m_blocks[m_current];
+            if (static_cast<size_t>(block.m_end - block.m_top) >= size)
+            {
+                char *obj = block.m_top;
+                block.m_top += size;
+                return obj;
+            }
+            return alloc_block(size);
+        }
+
+        /**
+         * Frees the objects allocated since the last push,
+         * and unmaps the blocks past the first spare one.
+         *
+         * Time complexity: O(B), where B is the number of
+         *                  bytes freed.
+         */
+        void pop()
+        {
+            if (m_marks.empty())
+                throw std::runtime_error(std::string("Error: No region to pop"));
+            Mark mark = m_marks.back();
+            m_marks.pop_back();
+
+            for (size_t i = mark.m_block; i <= m_current; i++)
+            {
+                Block &block = m_blocks[i];
+                char *start = i == mark.m_block ? mark.m_top : block.m_start;
+                std::memset(start, 0, block.m_top - start);
+                block.m_top = start;
+            }
+            m_current = mark.m_block;
+
+            while (m_blocks.size() > m_current + 2)
+            {
+                Block &block = m_blocks.back();
+                munmap(block.m_start, block.m_end - block.m_start);
+                m_blocks.pop_back();
+            }
+        }
+
+        /**
+         * Visits the words of the allocated objects.
+         *
+         * Time complexity: O(W), where W is the number of
+         *                  words allocated.
+         */
+        template <typename Visit>
+        void for_each_word(Visit visit) const
+        {
+            for (size_t i = 0; i < m_blocks.size() && !m_marks.empty(); i++)
+            {
+                auto word = reinterpret_cast<const uintptr_t *>(m_blocks[i].m_start);
+                auto top = reinterpret_cast<const uintptr_t *>(m_blocks[i].m_top);
+                for (; word < top; word++)
+                    visit(*word);
+            }
+        }
+    };
+}
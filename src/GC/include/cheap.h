@@ -7,8 +7,17 @@
 extern "C" {
 #endif
 
+/*
+ * The release build of the library, see the release target
+ * of the Makefile, defines CHEAP_RELEASE, which makes cheap_t
+ * opaque and compiles out the debug output. The layout of
+ * cheap_t is the same either way, so a program compiled
+ * without it links against the release library too.
+ */
+#ifndef CHEAP_RELEASE
 #define DEBUG
 #define WRAPPER_DEBUG
+#endif
 
 #ifdef WRAPPER_DEBUG
 typedef struct cheap
@@ -23,12 +32,320 @@ typedef struct cheap cheap_t;
 #define FuncCallsOnly   0x1E
 #define ChunkOpsOnly    0x3E0
 
+/*
+ * Root modes for cheap_set_root_mode(). By default the whole
+ * stack is scanned conservatively, programs compiled with
+ * gc "shadow-stack" register their roots with @llvm.gcroot,
+ * and programs compiled with gc "statepoint-example" list
+ * them in the stack maps of their statepoints.
+ */
+#define CHEAP_ROOTS_CONSERVATIVE    0x0
+#define CHEAP_ROOTS_SHADOW_STACK    0x1
+#define CHEAP_ROOTS_STACK_MAP       0x2
+
+/*
+ * Every object on the heap is preceded by a header word
+ * which holds the size of the object rounded up to a
+ * multiple of CHEAP_GRANULE.
+ */
+#define CHEAP_GRANULE       8UL
+#define CHEAP_HEADER_SIZE   8UL
+#define CHEAP_TLAB_SIZE     4096UL
+#define CHEAP_TLAB_OBJ_MAX  256UL
+
+/*
+ * The thread-local allocation buffer. Objects are bumped
+ * from cur towards end and the heap is only called when
+ * the buffer runs out. The buffer is empty (cur == end)
+ * while the profiler is enabled, so that every allocation
+ * is recorded by the slow path.
+ */
+typedef struct cheap_tlab
+{
+    char *cur;
+    char *end;
+} cheap_tlab_t;
+
+extern __thread cheap_tlab_t cheap_tlab;
+
 cheap_t *cheap_the();
 void cheap_init();
 void cheap_dispose();
 void *cheap_alloc(unsigned long size);
+void *cheap_alloc_refill(unsigned long size);
 void cheap_set_profiler(cheap_t *cheap, bool mode);
 void cheap_profiler_log_options(cheap_t *cheap, unsigned long flag);
+void cheap_profiler_trace_file(cheap_t *cheap, const char *path);
+void cheap_set_root_mode(unsigned long mode);
+void cheap_set_mark_threads(unsigned long threads);
+
+/*
+ * When the heap collects and when it grows, an argument of 0
+ * keeps the current value. The initial size is the mapped
+ * bytes at which the first collection is triggered.
+ * cheap_init() reads the same, and the settings of the
+ * other cheap_set_* functions, from the CHEAP_* environment
+ * variables, see docs/lib/cheap.md.
+ */
+void cheap_set_gc_policy(double growth_factor, unsigned long min_interval, unsigned long max_size);
+void cheap_set_initial_size(unsigned long bytes);
+
+/*
+ * Generational mode, enabled with the size of the nursery
+ * in bytes (0 disables it). A pointer stored into an object
+ * after it was initialised must be followed by a call to
+ * cheap_write_barrier() with the object.
+ */
+void cheap_set_nursery_size(unsigned long bytes);
+void cheap_write_barrier(void *obj);
+
+/*
+ * Incremental mode, enabled with the longest pause of the
+ * marking steps in microseconds (0 disables it). Collections
+ * then mark the heap in steps paced by the allocations, and
+ * a pointer stored into an object after it was initialised
+ * must be followed by a call to cheap_write_barrier() with
+ * the object, like in the generational mode.
+ */
+void cheap_set_pause_target(unsigned long micros);
+
+/*
+ * Compaction, collections slide the live objects to the
+ * start of their regions once the largest free chunk is
+ * less than this share of the free memory (0 disables it).
+ */
+void cheap_set_compact_threshold(double threshold);
+
+/*
+ * Large object space, objects of at least this many bytes
+ * get a mapping of their own, which is unmapped when they
+ * die, and are never moved (0 disables it).
+ */
+void cheap_set_large_object_size(unsigned long bytes);
+
+/*
+ * Page policy for the memory mapped from then on, pre-faulted
+ * to spare the page faults of the first touch, or in regions
+ * aligned for transparent huge pages. cheap_init() reads it
+ * from the environment variable CHEAP_PAGE_POLICY.
+ */
+#define CHEAP_PAGES_PREFAULT    0x1
+#define CHEAP_PAGES_HUGE        0x2
+
+void cheap_set_page_policy(unsigned long flags);
+
+/*
+ * Statistics of the heap, which can be polled at any time.
+ * The pause times are kept in histograms per collection
+ * phase, and are in nanoseconds. The pause of a minor
+ * collection includes the major collection it triggers.
+ */
+typedef struct cheap_pause_stats
+{
+    unsigned long count;
+    unsigned long total_ns;
+    unsigned long p50_ns;
+    unsigned long p99_ns;
+    unsigned long max_ns;
+} cheap_pause_stats_t;
+
+typedef struct cheap_stats
+{
+    unsigned long collections;
+    unsigned long minor_collections;
+    unsigned long bytes_allocated;
+    unsigned long bytes_reclaimed;
+    // Size of the objects marked by the last collection
+    unsigned long live_bytes;
+    unsigned long mapped_bytes;
+    // The part of it mapped for large objects
+    unsigned long large_object_bytes;
+    cheap_pause_stats_t pause;
+    cheap_pause_stats_t minor_pause;
+    cheap_pause_stats_t find_roots;
+    cheap_pause_stats_t mark;
+    cheap_pause_stats_t sweep;
+    cheap_pause_stats_t free;
+} cheap_stats_t;
+
+void cheap_get_stats(struct cheap_stats *stats);
+// The first pause and the marking steps of the incremental mode
+void cheap_get_step_stats(cheap_pause_stats_t *stats);
+
+/*
+ * Allocation-site profiling, samples one allocation per the
+ * given number of bytes each thread allocates (0 disables it,
+ * HEAP_SAMPLE_INTERVAL in heap.hpp is a sensible interval).
+ * The compiled code passes the site of an allocation to
+ * cheap_alloc_refill_site(), and names its sites with a
+ * null-terminated array. cheap_dispose() writes the bytes
+ * and objects allocated and surviving a collection per stack
+ * and site to the log folder.
+ */
+#define CHEAP_SITE_UNKNOWN  (~0UL)
+
+void cheap_set_alloc_sampling(unsigned long bytes);
+void cheap_set_alloc_sites(const char **names);
+void *cheap_alloc_refill_site(unsigned long size, unsigned long site);
+
+/*
+ * Typed allocation, the descriptor is a map of the words of
+ * the object that may hold a pointer, bit i for word i. The
+ * collector only scans these words, and never scans objects
+ * of CHEAP_NO_POINTERS. A map with bits past the first
+ * CHEAP_TYPED_WORDS words is taken as CHEAP_ALL_POINTERS,
+ * which scans every word like cheap_alloc() does. The map
+ * is kept in the header word, above the size.
+ */
+#define CHEAP_NO_POINTERS       0UL
+#define CHEAP_ALL_POINTERS      (~0UL)
+#define CHEAP_TYPED_WORDS       15
+#define CHEAP_HEADER_MAP_SHIFT  48
+#define CHEAP_HEADER_TYPED      (1UL << 63)
+
+void *cheap_alloc_typed(unsigned long size, unsigned long descriptor);
+void *cheap_alloc_refill_typed(unsigned long size, unsigned long descriptor, unsigned long site);
+
+/*
+ * Bulk allocation, for several objects whose sizes are known
+ * at once. cheap_alloc_n() allocates count objects of one
+ * size into out, bumping as many as fit in the allocation
+ * buffer with one check. cheap_alloc_group() allocates the
+ * objects of the sizes in one piece of memory and returns the
+ * first, each of the others follows the one before it, see
+ * cheap_group_next(). The descriptors of the typed group may
+ * be null for CHEAP_ALL_POINTERS.
+ */
+void cheap_alloc_n(unsigned long count, unsigned long size, void **out);
+void *cheap_alloc_group(const unsigned long *sizes, unsigned long n);
+void *cheap_alloc_group_typed(const unsigned long *sizes, const unsigned long *descriptors,
+    unsigned long n, unsigned long site);
+
+/*
+ * Regions, a stack of arenas per thread for objects that do
+ * not outlive a scope. cheap_region_alloc() bumps the object
+ * from the innermost region, cheap_region_pop() frees all of
+ * its objects at once. They are never traced nor swept, but
+ * the words of the objects of the pushed regions are roots
+ * of the collections, so they may point to heap objects.
+ * Heap objects must not point to them after the pop.
+ */
+void cheap_region_push();
+void *cheap_region_alloc(unsigned long size);
+void cheap_region_pop();
+
+/*
+ * Finalizers and weak references. The finalizer of an object
+ * is queued by the collection that finds the object dead, and
+ * runs later with the object, which is kept until then, on
+ * the thread that calls cheap_run_finalizers() or on the
+ * finalizer thread once it is enabled. A weak reference is a
+ * heap object holding a pointer that does not keep its target
+ * alive, cheap_weak_get() returns a null pointer once the
+ * target is dead.
+ */
+typedef void (*cheap_finalizer_t)(void *obj);
+
+void cheap_register_finalizer(void *obj, cheap_finalizer_t fn);
+unsigned long cheap_run_finalizers();
+void cheap_set_finalizer_thread(bool enabled);
+void *cheap_weak_ref(void *obj);
+void *cheap_weak_get(void *ref);
+
+/*
+ * Heap census, after every collection appends the number
+ * and bytes of the live objects per size to the file at
+ * path, or stops with a null path. A snapshot writes the
+ * live objects, the addresses they point to and the roots
+ * to the file at path at the end of the next mark, see
+ * docs/lib/snapshot.md for the format.
+ */
+void cheap_set_census(const char *path);
+void cheap_heap_snapshot(const char *path);
+
+/*
+ * Has cheap_dispose() write the statistics of cheap_get_stats()
+ * and cheap_get_step_stats(), with the peak resident set of the
+ * process, to the file at path as one line of JSON, or write
+ * none with a null path. cheap_init() reads the path from the
+ * environment variable CHEAP_STATS_FILE.
+ */
+void cheap_set_stats_file(const char *path);
+
+/*
+ * Threads, every thread other than the one that called
+ * cheap_init() registers before it allocates, and its stack
+ * is scanned up to the top the thread library reports.
+ * Collections stop the other threads at their next call into
+ * the heap, a thread that runs long without allocating calls
+ * cheap_safepoint() regularly, and one that blocks elsewhere
+ * unregisters first. The shadow stack root mode supports a
+ * single thread.
+ */
+void cheap_register_thread();
+void cheap_unregister_thread();
+void cheap_safepoint();
+
+/*
+ * Fast path of cheap_alloc(), bumps the object from the
+ * thread-local allocation buffer. Objects that are 0 bytes
+ * or larger than CHEAP_TLAB_OBJ_MAX, or that do not fit in
+ * what remains of the buffer, are passed on to the heap.
+ */
+static inline void *cheap_alloc_inline(unsigned long size)
+{
+    unsigned long rounded = (size + CHEAP_GRANULE - 1) & ~(CHEAP_GRANULE - 1);
+    char *header = cheap_tlab.cur;
+
+    if (size - 1 < CHEAP_TLAB_OBJ_MAX
+        && (unsigned long)(cheap_tlab.end - header) >= rounded + CHEAP_HEADER_SIZE)
+    {
+        *(unsigned long *)header = rounded;
+        cheap_tlab.cur = header + CHEAP_HEADER_SIZE + rounded;
+        return header + CHEAP_HEADER_SIZE;
+    }
+    return cheap_alloc_refill(size);
+}
+
+/*
+ * The bits of the header word that hold a descriptor of
+ * cheap_alloc_typed(), 0 for an untyped object.
+ */
+static inline unsigned long cheap_header_type(unsigned long descriptor)
+{
+    if (descriptor >> CHEAP_TYPED_WORDS)
+        return 0;
+    return CHEAP_HEADER_TYPED | descriptor << CHEAP_HEADER_MAP_SHIFT;
+}
+
+/*
+ * Fast path of cheap_alloc_typed(), the same as the one of
+ * cheap_alloc() but with the descriptor in the header.
+ */
+static inline void *cheap_alloc_typed_inline(unsigned long size, unsigned long descriptor)
+{
+    unsigned long rounded = (size + CHEAP_GRANULE - 1) & ~(CHEAP_GRANULE - 1);
+    char *header = cheap_tlab.cur;
+
+    if (size - 1 < CHEAP_TLAB_OBJ_MAX
+        && (unsigned long)(cheap_tlab.end - header) >= rounded + CHEAP_HEADER_SIZE)
+    {
+        *(unsigned long *)header = rounded | cheap_header_type(descriptor);
+        cheap_tlab.cur = header + CHEAP_HEADER_SIZE + rounded;
+        return header + CHEAP_HEADER_SIZE;
+    }
+    return cheap_alloc_refill_typed(size, descriptor, CHEAP_SITE_UNKNOWN);
+}
+
+/*
+ * The object after one of the given size in a group of
+ * cheap_alloc_group(), behind its header word.
+ */
+static inline void *cheap_group_next(void *obj, unsigned long size)
+{
+    unsigned long rounded = (size + CHEAP_GRANULE - 1) & ~(CHEAP_GRANULE - 1);
+    return (char *)obj + rounded + CHEAP_HEADER_SIZE;
+}
 
 #ifdef __cplusplus
 }
@@ -1,6 +1,8 @@
 #pragma once
 
-#include <ctime>
+#include <stdint.h>
+#include <stdlib.h>
+#include <time.h>
 
 #include "chunk.hpp"
 
@@ -22,34 +24,51 @@ namespace GC
         NewChunk        = 1 << 8,
         ReusedChunk     = 1 << 9,
         ProfilerDispose = 1 << 10,
-        FreeStart       = 1 << 11
+        FreeStart       = 1 << 11,
+        CompactStart    = 1 << 12
     };
 
     /**
-     * Stores metadeta about an event on the heap.
+     * @returns The time of the coarse monotonic clock in
+     *          nanoseconds, which is read without a system
+     *          call and is precise to a few milliseconds.
+    */
+    inline uint64_t event_clock()
+    {
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+        return static_cast<uint64_t>(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+    }
+
+    /**
+     * Stores metadeta about an event on the heap. Events are
+     * plain values, copied into the ring buffer of the thread
+     * that records them, and own no memory. A chunk event
+     * holds a copy of the chunk, as the chunk may be freed
+     * before the events are dumped.
     */
     class GCEvent
     {
     private:
-        const GCEventType m_type;
-        const std::time_t m_timestamp {std::time(NULL)};
-        const Chunk *m_chunk {nullptr};
-        const size_t m_size {0};
+        uint64_t m_timestamp {0};
+        GCEventType m_type {HeapInit};
+        bool m_marked {false};
+        uintptr_t *m_start {nullptr};
+        size_t m_size {0};
 
     public:
-        GCEvent(GCEventType type) : m_type(type) {}
-        GCEvent(GCEventType type, Chunk *chunk) : m_type(type), m_chunk(chunk) {}
-        GCEvent(GCEventType type, size_t size) : m_type(type), m_size(size) {}
-
-        ~GCEvent() {
-            if (m_chunk != nullptr)
-                delete m_chunk;
-        }
+        GCEvent() {}
+        GCEvent(GCEventType type) : m_timestamp(event_clock()), m_type(type) {}
+        GCEvent(GCEventType type, const Chunk *chunk)
+            : m_timestamp(event_clock()), m_type(type), m_marked(chunk->m_marked),
+              m_start(chunk->m_start), m_size(chunk->m_size) {}
+        GCEvent(GCEventType type, size_t size) : m_timestamp(event_clock()), m_type(type), m_size(size) {}
 
-        GCEventType get_type();
-        std::time_t get_time_stamp();
-        const Chunk *get_chunk();
-        size_t get_size();
-        const char *type_to_string();
+        GCEventType get_type() const;
+        uint64_t get_time_stamp() const;
+        bool has_chunk() const;
+        Chunk get_chunk() const;
+        size_t get_size() const;
+        const char *type_to_string() const;
     };
 }
\ No newline at end of file
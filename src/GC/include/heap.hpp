@@ -1,18 +1,113 @@
 #pragma once
 
-#include <list>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <map>
+#include <mutex>
+#include <stdint.h>
 #include <stdlib.h>
+#include <thread>
 #include <vector>
-#include <unordered_map>
-#include <queue>
 
+#include "cheap.h"
 #include "chunk.hpp"
+#include "histogram.hpp"
+#include "mutator.hpp"
 #include "profiler.hpp"
+#include "region.hpp"
 
-#define HEAP_SIZE 160000//65536
-#define FREE_THRESH (uint) 5
+// The heap grows by mapping regions of HEAP_REGION_SIZE bytes, or
+// larger ones for chunks that do not fit in a region. Collections are
+// preferred over growing once HEAP_INITIAL_SIZE bytes are mapped, after
+// each collection this limit is set to HEAP_GROWTH_FACTOR times the
+// size of the live chunks, and to at least HEAP_MIN_INTERVAL bytes
+// more than them. If the live chunks are HEAP_THRASH_SHARE or more of
+// the mapped bytes, the limit is at least HEAP_GROWTH_FACTOR times the
+// mapped bytes, so that the heap grows instead of collecting again
+// right away. The heap never maps more than HEAP_MAX_SIZE. The policy,
+// and the other settings of the heap, are read from the CHEAP_*
+// environment variables by init(), see load_policy().
+#define HEAP_REGION_SIZE	(1UL << 20)
+#define HEAP_INITIAL_SIZE	(4UL << 20)
+#define HEAP_GROWTH_FACTOR	2.0
+#define HEAP_MIN_INTERVAL	(1UL << 20)
+#define HEAP_THRASH_SHARE	0.75
+#define HEAP_MAX_SIZE		(4UL << 30)
+// The nursery of the generational mode is a set of regions of
+// HEAP_NURSERY_BLOCK bytes, a block that holds a pinned object
+// is promoted to the old generation as a whole
+#define HEAP_NURSERY_BLOCK	(64UL << 10)
+// A collection compacts the regions whose last sweep left free chunks
+// of at least HEAP_COMPACT_MIN_FREE of the region, the largest of them
+// less than the compaction threshold times their size, and sweeps the
+// others. The default threshold of 0 never compacts.
+#define HEAP_COMPACT_THRESHOLD	0.0
+#define HEAP_COMPACT_MIN_FREE	0.25
+// Objects of HEAP_LARGE_OBJECT bytes or more are mapped to pages of
+// their own, outside the regions of the small objects, and unmapped
+// when they die. They are never recycled, moved nor compacted. A
+// large group of cheap_alloc_group() is split in one mapping shared
+// by its objects, which is unmapped once none of them is marked.
+// cheap_set_large_object_size() with 0 keeps them in the regions
+#define HEAP_LARGE_OBJECT	(8UL << 10)
+// The finalizers of dead objects are queued by the collections and
+// run later by cheap_run_finalizers() or the finalizer thread, which
+// take up to HEAP_FINALIZER_BATCH of them off the queue at a time
+#define HEAP_FINALIZER_BATCH	64
+// The sweep zeroes the memory it frees, so that stale pointers in
+// recycled chunks are not taken for roots. Runs of HEAP_DONTNEED_MIN
+// bytes or more are given back to the OS with madvise() instead, the
+// OS maps them zeroed on the next touch. The page policy of
+// cheap_set_page_policy() pre-faults the mappings, or maps regions of
+// HEAP_HUGE_PAGE bytes aligned for transparent huge pages, and keeps
+// the memory it freed mapped
+#define HEAP_DONTNEED_MIN	(64UL << 10)
+#define HEAP_HUGE_PAGE		(2UL << 20)
+// With a pause target, a collection marks the heap incrementally. It
+// starts with a pause that finds the roots and grows the heap instead
+// of collecting, every HEAP_MARK_STEP bytes allocated after that the
+// allocating thread marks for up to the pause target, checking the time
+// every HEAP_MARK_CHECK chunks. Chunks allocated meanwhile are marked,
+// and once a step runs out of chunks the next one finds the roots again
+// and finishes the collection
+#define HEAP_MARK_STEP		(64UL << 10)
+#define HEAP_MARK_CHECK		64
+// Allocation-site profiling samples one allocation per interval of
+// bytes allocated by a thread, cheap_set_alloc_sampling() with 0
+// disables it, the default, and HEAP_SAMPLE_INTERVAL is the interval
+// suggested for production. Return addresses of up to HEAP_SAMPLE_DEPTH
+// frames of the stack are kept per sample
+#define HEAP_SAMPLE_INTERVAL	(512UL << 10)
+#define HEAP_SAMPLE_DEPTH	16
 // #define HEAP_DEBUG
 
+// Free chunks up to SMALL_CHUNK_MAX bytes are kept in segregated
+// free lists, one per multiple of SIZE_CLASS_GRANULE bytes
+#define SIZE_CLASS_GRANULE	REGION_GRANULE
+#define SIZE_CLASS_COUNT	8
+#define SMALL_CHUNK_MAX		(SIZE_CLASS_GRANULE * SIZE_CLASS_COUNT)
+
+// Every chunk is preceded by a header word holding its size and flags,
+// a free chunk is only split if the remainder can hold a header and a
+// granule. Sizes are multiples of the granule, which leaves the low
+// bits of the header for the flags.
+#define HEADER_SIZE			CHEAP_HEADER_SIZE
+#define MIN_SPLIT			(HEADER_SIZE + SIZE_CLASS_GRANULE)
+#define HEADER_FREE			0x2UL
+// Nursery chunks that have been copied to the old generation hold
+// the address of the copy in their header, old chunks in the
+// remembered set are flagged to be added only once
+#define HEADER_FORWARDED	0x1UL
+#define HEADER_REMEMBERED	0x4UL
+#define HEADER_FLAGS		(SIZE_CLASS_GRANULE - 1)
+// The bits above the size hold the pointer map of a typed chunk,
+// see cheap_alloc_typed()
+#define HEADER_TYPE			(~0UL << CHEAP_HEADER_MAP_SHIFT)
+#define HEADER_TYPED		CHEAP_HEADER_TYPED
+#define HEADER_SIZE_MASK	(~HEADER_TYPE & ~HEADER_FLAGS)
+
 namespace GC
 {
 	/**
@@ -27,79 +122,429 @@ namespace GC
 		COLLECT_ALL	= 0b1111 // all flags above
 	};
 
-	struct AddrRange
+	/**
+	 * Where a collection finds the roots: all the words
+	 * on the stack, the roots on the LLVM shadow stack,
+	 * or the roots the stack maps of statepoints list
+	 * for the frames on the stack.
+	*/
+	enum RootMode {
+		ConservativeRoots,
+		ShadowStackRoots,
+		StackMapRoots
+	};
+
+	/**
+	 * Rounds a request up to a whole number of granules,
+	 * all chunks on the heap have a size of this form.
+	*/
+	inline size_t size_class_round(size_t size)
 	{
-		const uintptr_t *start, *end;
+		return (size + SIZE_CLASS_GRANULE - 1) & ~(size_t)(SIZE_CLASS_GRANULE - 1);
+	}
 
-		AddrRange(uintptr_t *_start, uintptr_t *_end) : start(_start), end(_end) {}
-	};
+	/**
+	 * @returns The index of the free list for a small
+	 * 			chunk of a rounded size.
+	*/
+	inline size_t size_class(size_t size)
+	{
+		return size / SIZE_CLASS_GRANULE - 1;
+	}
+
+	/**
+	 * Writes the header word of a chunk. The object
+	 * itself starts HEADER_SIZE bytes after the header.
+	 *
+	 * @param chunk The address of the header.
+	 *
+	 * @param size  The size of the object, a multiple of
+	 * 				SIZE_CLASS_GRANULE.
+	 *
+	 * @param flags HEADER_FREE or 0.
+	*/
+	inline void set_header(char *chunk, size_t size, size_t flags = 0)
+	{
+		*reinterpret_cast<size_t *>(chunk) = size | flags;
+	}
+
+	/**
+	 * @returns The size of the object of a chunk.
+	*/
+	inline size_t chunk_size(const char *chunk)
+	{
+		return *reinterpret_cast<const size_t *>(chunk) & HEADER_SIZE_MASK;
+	}
+
+	/**
+	 * @returns The type bits in the header of a chunk, 0
+	 * 			for a chunk that is not typed.
+	*/
+	inline size_t chunk_type(const char *chunk)
+	{
+		return *reinterpret_cast<const size_t *>(chunk) & HEADER_TYPE;
+	}
+
+	/**
+	 * Calls a function with every word of the object of a
+	 * chunk that may hold a pointer, which are the words of
+	 * the pointer map of a typed chunk, none for a chunk
+	 * of CHEAP_NO_POINTERS, and all words of an untyped one.
+	 *
+	 * Time complexity: O(P) for a typed chunk and O(W) for an
+	 * 					untyped one, where P is the number of
+	 * 					pointer words and W the size in words.
+	 *
+	 * @param chunk	The header of the chunk.
+	 *
+	 * @param visit	Called with a reference to each word.
+	*/
+	template <typename Visit>
+	inline void for_each_pointer(char *chunk, Visit visit)
+	{
+		auto words = reinterpret_cast<uintptr_t *>(chunk + HEADER_SIZE);
+		size_t count = chunk_size(chunk) / sizeof(uintptr_t);
+		size_t type = chunk_type(chunk);
+		if (type == 0)
+		{
+			for (size_t i = 0; i < count; i++)
+				visit(words[i]);
+			return;
+		}
+		size_t map = (type & ~HEADER_TYPED) >> CHEAP_HEADER_MAP_SHIFT;
+		for (; map != 0; map &= map - 1)
+		{
+			size_t i = __builtin_ctzl(map);
+			if (i < count)
+				visit(words[i]);
+		}
+	}
+
+	/**
+	 * @returns The flags in the header of a chunk.
+	*/
+	inline size_t chunk_flags(const char *chunk)
+	{
+		return *reinterpret_cast<const size_t *>(chunk) & HEADER_FLAGS;
+	}
+
+	/**
+	 * @returns The header of the chunk directly after
+	 * 			a chunk on the heap.
+	*/
+	inline char *next_chunk(char *chunk)
+	{
+		return chunk + HEADER_SIZE + chunk_size(chunk);
+	}
+
+	/**
+	 * @returns The header of the copy of a forwarded
+	 * 			nursery chunk.
+	*/
+	inline char *forwardee(const char *chunk)
+	{
+		return reinterpret_cast<char *>(*reinterpret_cast<const size_t *>(chunk) & ~HEADER_FLAGS);
+	}
+
+	/**
+	 * The small free lists are linked through the first
+	 * word of the free chunks.
+	 *
+	 * @returns The next chunk in the free list of a chunk.
+	*/
+	inline char *next_free(char *chunk)
+	{
+		return *reinterpret_cast<char **>(chunk + HEADER_SIZE);
+	}
+
+	inline void set_next_free(char *chunk, char *next)
+	{
+		*reinterpret_cast<char **>(chunk + HEADER_SIZE) = next;
+	}
 
 	/**
 	 * The heap class to represent the heap for the
 	 * garbage collection. The heap is a singleton
 	 * instance and can be retrieved by Heap::the()
-	 * inside the heap class. The heap is represented
-	 * by a char array of size 65536 and can enable
-	 * a profiler to track the actions on the heap.
+	 * inside the heap class. The heap is a set of
+	 * regions mapped from the OS, where every chunk
+	 * is a header word followed by the object, and
+	 * can enable a profiler to track the actions on
+	 * the heap.
 	*/
 	class Heap
 	{
+		// Resolves chunks with find_chunk() while marking
+		friend class Marker;
+
 	private:
-		Heap() : m_heap(static_cast<char *>(malloc(HEAP_SIZE))) {}
+		Heap() {}
+
+		~Heap();
 
-		~Heap()
+		/**
+		 * Holds the heap lock for the scope of a call from
+		 * a thread, see lock().
+		*/
+		class Guard
 		{
-			std::free((char *)m_heap);
-		}
+		public:
+			Guard() { Heap::the().lock(); }
+			~Guard() { Heap::the().unlock(); }
+		};
 
-		char *const m_heap;
-		size_t m_size {0};
 		// static Heap *m_instance {nullptr};
-		uintptr_t *m_stack_top {nullptr};
 		bool m_profiler_enable {false};
+		RootMode m_root_mode {ConservativeRoots};
+
+		// The threads that use the heap, the lock of the thread
+		// in the heap, and the other threads parked while it
+		// stops the world for a collection
+		std::vector<Mutator *> m_mutators;
+		std::recursive_mutex m_lock;
+		std::mutex m_park_lock;
+		std::condition_variable m_parked;
+		std::condition_variable m_resume;
+		std::atomic<bool> m_stop {false};
+		size_t m_stops {0};
+
+		// The regions of the heap in address order, and the one
+		// new chunks are bumped from
+		std::vector<Region *> m_regions;
+		Region *m_bump_region {nullptr};
+		// Lowest and highest address of all the regions
+		uintptr_t m_low {UINTPTR_MAX};
+		uintptr_t m_high {0};
+		size_t m_mapped {0};
+		// Growth policy, see HEAP_GROWTH_FACTOR
+		size_t m_initial_size {HEAP_INITIAL_SIZE};
+		size_t m_collect_at {HEAP_INITIAL_SIZE};
+		size_t m_max_size {HEAP_MAX_SIZE};
+		double m_growth_factor {HEAP_GROWTH_FACTOR};
+		size_t m_min_interval {HEAP_MIN_INTERVAL};
+		// Size of the chunks marked by the last mark phase
+		size_t m_live_estimate {0};
+		double m_compact_threshold {HEAP_COMPACT_THRESHOLD};
+		// Large object space, see HEAP_LARGE_OBJECT. The regions of
+		// the large objects are among m_regions too, to be found
+		size_t m_large_object_size {HEAP_LARGE_OBJECT};
+		std::vector<Region *> m_large_objects;
+		size_t m_large_object_bytes {0};
+		// See HEAP_DONTNEED_MIN, the regions are HEAP_HUGE_PAGE
+		// bytes with huge pages
+		unsigned long m_page_policy {0};
+		size_t m_region_size {HEAP_REGION_SIZE};
+		// Incremental marking, see HEAP_MARK_STEP, off with a pause
+		// target of 0. The grey chunks are marked but not scanned yet,
+		// the write barrier adds marked chunks that are stored into.
+		// m_grey_drained is set by the step that scanned the last of
+		// them, and a compaction found due by the marking is pending
+		// until the next collection
+		size_t m_pause_target {0};
+		bool m_marking {false};
+		std::vector<char *> m_grey;
+		size_t m_step_at {0};
+		bool m_grey_drained {false};
+		bool m_compact_pending {false};
+
+		// Regions left to be swept lazily after a collection, and
+		// the size of the chunks marked by the last mark phase
+		std::vector<Region *> m_unswept;
+		size_t m_marked {0};
+
+		// Statistics of cheap_get_stats(), the times in nanoseconds.
+		// The pause of a minor collection includes the major one
+		// it may trigger
+		Histogram m_pause_times;
+		Histogram m_minor_pause_times;
+		Histogram m_roots_times;
+		Histogram m_mark_times;
+		Histogram m_sweep_times;
+		Histogram m_free_times;
+		// The pauses of the incremental mode before the last one,
+		// which is a collection pause
+		Histogram m_step_times;
+		size_t m_allocated {0};
+		size_t m_reclaimed {0};
+		// Size of the copies of the current nursery evacuation
+		size_t m_copied {0};
 
-		std::vector<Chunk *> m_allocated_chunks;
-		std::vector<Chunk *> m_freed_chunks;
-		std::list<Chunk *> m_free_list;
-		std::unordered_map<uintptr_t, Chunk*> m_chunk_table;
+		// The allocation samples that have not met a collection
+		// yet, and the profiler entries of their stacks and sites
+		struct AllocSample
+		{
+			char *m_chunk;
+			size_t m_entry;
+			size_t m_bytes;
+			size_t m_objects;
+		};
+		size_t m_sample_interval {0};
+		std::vector<AllocSample> m_samples;
+
+		// Both off by default, a census of the live objects by size
+		// is appended to m_census after every collection once
+		// cheap_set_census() names a file, and cheap_heap_snapshot()
+		// has the next collection write the graph of the live
+		// objects to m_snapshot, see docs/lib/snapshot.md
+		std::FILE *m_census {nullptr};
+		std::FILE *m_snapshot {nullptr};
+		// The file dispose() writes the statistics to, if any
+		std::FILE *m_stats_file {nullptr};
+
+		// Free lists for small chunks, indexed by size_class()
+		char *m_size_classes[SIZE_CLASS_COUNT] {};
+		// Free chunks above SMALL_CHUNK_MAX, ordered for best fit
+		std::multimap<size_t, char *> m_large_chunks;
+		// Size of the chunks in the free lists
+		size_t m_free_bytes {0};
+
+		// The blocks of the nursery, empty unless the generational
+		// mode is enabled, and the one new objects are bumped from
+		std::vector<Region *> m_nursery;
+		size_t m_nursery_next {0};
+		// Old chunks that may point into the nursery
+		std::vector<char *> m_remembered;
+
+		// The objects with a finalizer, and the dead ones whose
+		// finalizer is queued to run, which are roots until it has.
+		// Objects with a finalizer only die in major collections
+		struct Finalizer
+		{
+			char *m_chunk;
+			cheap_finalizer_t m_fn;
+		};
+		std::vector<Finalizer> m_finalizers;
+		std::vector<Finalizer> m_finalizable;
+		// The cells of cheap_weak_ref(), typed chunks of one word
+		// without pointers, so that the word is not traced
+		std::vector<char *> m_weak_refs;
+		// The finalizer thread of set_finalizer_thread(), woken up
+		// when a collection queues finalizers
+		std::thread m_finalizer_thread;
+		std::mutex m_finalize_lock;
+		std::condition_variable m_finalize_ready;
+		bool m_finalize_queued {false};
+		bool m_finalizer_stop {false};
 
 		static bool profiler_enabled();
-		// static Chunk *get_at(std::vector<Chunk *> &list, size_t n);
-		void collect(uintptr_t *stack_bottom);
+		static void record_chunk(GCEventType type, char *chunk);
+		static Mutator *mutator();
+		void lock();
+		void unlock();
+		void park(Mutator *mutator, void *frame);
+		void stop_world();
+		void resume_world();
+		void collect();
+		void collect_nursery();
+		bool collect_incrementally();
+		void start_marking();
+		void mark_step();
+		void finish_marking();
+		void end_marking(std::chrono::high_resolution_clock::time_point c_start);
+		void mark_allocated(char *chunk, Region *region);
+		bool drain_grey(std::chrono::high_resolution_clock::time_point deadline);
+		void finish_collection(std::vector<uintptr_t> &roots, bool compact, std::chrono::high_resolution_clock::time_point mark_start);
+		void evacuate_nursery();
+		void evacuate(uintptr_t *slot, std::vector<char *> &worklist);
+		char *promote(size_t size);
+		char *bump_nursery(size_t bytes, Region *&region);
+		void remember(char *chunk);
+		void pace();
+		void load_policy();
 		void sweep(Heap &heap);
-		Chunk *try_recycle_chunks(size_t size);
+		void sweep_region(Region *region);
+		void free_chunks(Region *region, char *end);
+		void empty_region(Region *region);
+		void zero_memory(char *start, size_t bytes);
+		bool compact_due();
+		void compact(std::vector<uintptr_t> &roots);
+		void slide_region(Region *region, std::vector<std::pair<char *, char *>> &moves, size_t &next);
+		char *recycle_or_sweep(size_t size);
+		char *try_recycle_chunks(size_t size);
+		void split_chunk(char *chunk, size_t size);
+		char *bump(size_t bytes);
+		bool grow(size_t bytes);
+		char *alloc_large_object(size_t size);
+		void sweep_large_objects();
+		Region *map_region(size_t mapped);
+		void retire_region();
+		void release_region(Region *region);
+		void sample(Mutator *mutator, void *obj, size_t site);
+		void settle_samples(bool young_only);
+		void census(std::map<size_t, std::pair<size_t, size_t>> &sizes, bool live_only);
+		void write_census();
+		void write_snapshot(const std::vector<uintptr_t> &roots);
+		void write_stats();
+		bool refill_tlab();
+		void retire_tlab(Mutator *mutator);
+		void retire_tlabs();
+		void add_free_chunk(char *chunk);
+		size_t largest_free_chunk();
 		void free(Heap &heap);
-		void free_overlap(Heap &heap);
-		void mark_hash(uintptr_t *start, const uintptr_t *end);
-		Chunk* find_pointer_hash(uintptr_t *start, const uintptr_t *end);
-		void create_table();
-		void print_line(Chunk *chunk);
-		void print_worklist(std::vector<Chunk *> &list);
-		void mark_step(uintptr_t start, uintptr_t end, std::vector<Chunk *> &worklist);
-		void mark_range(std::vector<AddrRange *> &ranges, std::vector<Chunk *> &worklist);
-
-		void find_roots(uintptr_t *stack_bottom, std::vector<uintptr_t *> &roots);
-		void mark(std::vector<uintptr_t *> &roots);
-		void find_chunks(uintptr_t *stack_addr, std::queue<std::pair<uintptr_t, uintptr_t>> &chunk_spaces);
-
-		// Temporary
-		Chunk *try_recycle_chunks_new(size_t size);
-		void free_overlap_new(Heap &heap);
+		void print_line(char *chunk);
+
+		Region *find_region(uintptr_t addr);
+		char *find_chunk(uintptr_t addr, Region *&region);
+		void find_all_roots(std::vector<uintptr_t> &roots);
+		void find_roots(std::vector<uintptr_t> &roots);
+		void find_shadow_roots(std::vector<uintptr_t> &roots);
+		void find_stack_map_roots(std::vector<uintptr_t> &roots);
+		void find_arena_roots(std::vector<uintptr_t> &roots);
+		void find_finalizer_roots(std::vector<uintptr_t> &roots);
+		void clear_weak_refs();
+		void evacuate_weak_refs();
+		void queue_finalizers(std::vector<uintptr_t> &roots);
+		static void finalizer_loop();
+		void mark(std::vector<uintptr_t> &roots);
+		void find_chunks(uintptr_t word, std::vector<char *> &worklist);
+
 	public:
 		/**
 		 * These are the only five functions which are exposed
 		 * as the API for LLVM. At the absolute start of the
 		 * program the developer has to call init() to ensure
-		 * that the address of the topmost stack frame is
-		 * saved as the limit for scanning the stack in collect.
+		 * that the top of the stack of the thread is saved as
+		 * the limit for scanning the stack in collect.
 		 */
 
 		static Heap &the();
-		static void init();
+		static void init(void *stack_top = nullptr);
 		static void dispose();
 		static void *alloc(size_t size);
+		static void *alloc_refill(size_t size, size_t site = CHEAP_SITE_UNKNOWN, size_t descriptor = CHEAP_ALL_POINTERS);
+		static void *alloc_group(const size_t *sizes, const size_t *descriptors, size_t n, size_t site);
 		void set_profiler(bool mode);
 		void set_profiler_log_options(RecordOption flags);
+		void set_profiler_trace_file(const char *path);
+		static void set_max_size(size_t bytes);
+		static void set_initial_size(size_t bytes);
+		static void set_growth_factor(double factor);
+		static void set_compact_threshold(double threshold);
+		static void set_large_object_size(size_t bytes);
+		static void set_page_policy(unsigned long flags);
+		static void set_gc_policy(double growth_factor, size_t min_interval, size_t max_size);
+		static void set_pause_target(size_t micros);
+		static void get_stats(cheap_stats_t *stats);
+		static void get_step_stats(cheap_pause_stats_t *stats);
+		static void set_alloc_sampling(size_t bytes);
+		static void set_alloc_sites(const char **names);
+		static void set_census(const char *path);
+		static void set_stats_file(const char *path);
+		static void heap_snapshot(const char *path);
+		static void set_root_mode(RootMode mode);
+		static void set_nursery_size(size_t bytes);
+		static void write_barrier(void *obj);
+		static void set_mark_threads(size_t threads);
+		static void register_thread(void *stack_top);
+		static void unregister_thread();
+		static void safepoint();
+		static void region_push();
+		static void *region_alloc(size_t size);
+		static void region_pop();
+		static void register_finalizer(void *obj, cheap_finalizer_t fn);
+		static size_t run_finalizers();
+		static void set_finalizer_thread(bool enabled);
+		static void *weak_ref(void *obj);
 
 		// Stop the compiler from generating copy-methods
 		Heap(Heap const&) = delete;
@@ -109,8 +554,19 @@ namespace GC
 		void collect(CollectOption flags); // conditional collection
 		void check_init();		  // print dummy things
 		void print_contents();	  // print dummy things
-		void print_allocated_chunks(Heap *heap); // print the contents in m_allocated_chunks
+		void print_allocated_chunks(Heap *heap); // print the allocated chunks
 		void print_summary();
+		size_t allocated_chunk_count(); // number of allocated chunks
+		size_t free_chunk_count(); // number of chunks in the free lists
+		size_t region_count(); // number of mapped regions
+		bool is_young(void *obj); // if the object is in the nursery
+		size_t unswept_region_count(); // number of regions left to sweep
+		size_t free_byte_count(); // size of the chunks in the free lists
+		size_t largest_free_chunk_size(); // size of the largest free chunk
+		size_t collect_limit(); // mapped bytes that trigger a collection
+		size_t region_depth(); // regions pushed by the calling thread
+		Region *region_of(void *obj); // the region holding an object
+		bool is_marking(); // if an incremental collection is marking
 #endif
 	};
 }
\ No newline at end of file
@@ -0,0 +1,88 @@
+#pragma once
+
+#include <algorithm>
+#include <stdint.h>
+#include <stdlib.h>
+
+// Buckets per power of two, the precision of a histogram
+// is one part in HISTOGRAM_SUB_BUCKETS
+#define HISTOGRAM_SUB_BITS      4
+#define HISTOGRAM_SUB_BUCKETS   (1 << HISTOGRAM_SUB_BITS)
+#define HISTOGRAM_BUCKETS       ((64 - HISTOGRAM_SUB_BITS + 1) * HISTOGRAM_SUB_BUCKETS)
+
+namespace GC
+{
+    /**
+     * A histogram of durations in the style of HdrHistogram,
+     * with log-linear buckets. Values below HISTOGRAM_SUB_BUCKETS
+     * have a bucket each, every power of two above is split into
+     * HISTOGRAM_SUB_BUCKETS buckets, so a percentile is off by
+     * at most 1 / HISTOGRAM_SUB_BUCKETS of its value. Recording
+     * takes constant time and never allocates.
+    */
+    class Histogram
+    {
+    private:
+        uint64_t m_buckets[HISTOGRAM_BUCKETS] {};
+        uint64_t m_count {0};
+        uint64_t m_total {0};
+        uint64_t m_max {0};
+
+        static size_t index(uint64_t value)
+        {
+            if (value < HISTOGRAM_SUB_BUCKETS)
+                return value;
+            size_t exponent = 63 - __builtin_clzll(value);
+            size_t sub = (value >> (exponent - HISTOGRAM_SUB_BITS)) & (HISTOGRAM_SUB_BUCKETS - 1);
+            return (exponent - HISTOGRAM_SUB_BITS + 1) * HISTOGRAM_SUB_BUCKETS + sub;
+        }
+
+        // The largest value of a bucket
+        static uint64_t highest(size_t index)
+        {
+            if (index < HISTOGRAM_SUB_BUCKETS)
+                return index;
+            size_t exponent = index / HISTOGRAM_SUB_BUCKETS + HISTOGRAM_SUB_BITS - 1;
+            uint64_t low = static_cast<uint64_t>(HISTOGRAM_SUB_BUCKETS + index % HISTOGRAM_SUB_BUCKETS)
+                << (exponent - HISTOGRAM_SUB_BITS);
+            return low + (1ULL << (exponent - HISTOGRAM_SUB_BITS)) - 1;
+        }
+
+    public:
+        void record(uint64_t value)
+        {
+            m_buckets[index(value)]++;
+            m_count++;
+            m_total += value;
+            m_max = std::max(m_max, value);
+        }
+
+        uint64_t count() const { return m_count; }
+        uint64_t total() const { return m_total; }
+        uint64_t max() const { return m_max; }
+
+        /**
+         * @param share The share of the values, from 0 to 1,
+         *              0.99 for the 99th percentile.
+         *
+         * @returns The value that the share of the recorded
+         *          values does not exceed, or 0 if none were
+         *          recorded.
+         */
+        uint64_t percentile(double share) const
+        {
+            if (m_count == 0)
+                return 0;
+            uint64_t rank = static_cast<uint64_t>(share * m_count + 0.5);
+            rank = std::clamp(rank, static_cast<uint64_t>(1), m_count);
+            uint64_t seen = 0;
+            for (size_t i = 0; i < HISTOGRAM_BUCKETS; i++)
+            {
+                seen += m_buckets[i];
+                if (seen >= rank)
+                    return std::min(highest(i), m_max);
+            }
+            return m_max;
+        }
+    };
+}
@@ -0,0 +1,147 @@
+#pragma once
+
+#include <atomic>
+#include <stdint.h>
+#include <stdlib.h>
+#include <vector>
+
+// Initial capacity of a mark deque, a power of two
+#define MARK_DEQUE_CAPACITY 1024
+
+namespace GC
+{
+    /**
+     * A Chase-Lev work-stealing deque of chunks waiting to
+     * be scanned by a marking thread, as described by Lê et
+     * al. in "Correct and Efficient Work-Stealing for Weak
+     * Memory Models". The owner pushes and pops at the
+     * bottom, other threads steal from the top. The buffer
+     * grows when it is full, the old buffers are kept until
+     * the deque is reset, as a thief may still read them.
+    */
+    class MarkDeque
+    {
+    private:
+        struct Buffer
+        {
+            size_t m_mask;
+            std::atomic<char *> *m_items;
+
+            Buffer(size_t capacity) : m_mask(capacity - 1), m_items(new std::atomic<char *>[capacity]) {}
+            ~Buffer() { delete[] m_items; }
+
+            char *get(int64_t i) const { return m_items[i & m_mask].load(std::memory_order_relaxed); }
+            void put(int64_t i, char *chunk) { m_items[i & m_mask].store(chunk, std::memory_order_relaxed); }
+        };
+
+        alignas(64) std::atomic<int64_t> m_top {0};
+        alignas(64) std::atomic<int64_t> m_bottom {0};
+        std::atomic<Buffer *> m_buffer {new Buffer(MARK_DEQUE_CAPACITY)};
+        std::vector<Buffer *> m_retired;
+
+        Buffer *grow(Buffer *buffer, int64_t top, int64_t bottom)
+        {
+            Buffer *bigger = new Buffer(2 * (buffer->m_mask + 1));
+            for (int64_t i = top; i < bottom; i++)
+                bigger->put(i, buffer->get(i));
+            m_retired.push_back(buffer);
+            m_buffer.store(bigger, std::memory_order_release);
+            return bigger;
+        }
+
+    public:
+        MarkDeque() {}
+
+        ~MarkDeque()
+        {
+            reset();
+            delete m_buffer.load(std::memory_order_relaxed);
+        }
+
+        MarkDeque(MarkDeque const&) = delete;
+        MarkDeque& operator=(MarkDeque const&) = delete;
+
+        /**
+         * Pushes a chunk at the bottom, only by the owner.
+        */
+        void push(char *chunk)
+        {
+            int64_t bottom = m_bottom.load(std::memory_order_relaxed);
+            int64_t top = m_top.load(std::memory_order_acquire);
+            Buffer *buffer = m_buffer.load(std::memory_order_relaxed);
+            if (bottom - top > static_cast<int64_t>(buffer->m_mask))
+                buffer = grow(buffer, top, bottom);
+            buffer->put(bottom, chunk);
+            std::atomic_thread_fence(std::memory_order_release);
+            m_bottom.store(bottom + 1, std::memory_order_relaxed);
+        }
+
+        /**
+         * Pops the chunk at the bottom, only by the owner.
+         *
+         * @returns The chunk, or a nullptr if it is empty.
+        */
+        char *pop()
+        {
+            int64_t bottom = m_bottom.load(std::memory_order_relaxed) - 1;
+            Buffer *buffer = m_buffer.load(std::memory_order_relaxed);
+            m_bottom.store(bottom, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            int64_t top = m_top.load(std::memory_order_relaxed);
+
+            char *chunk = nullptr;
+            if (top <= bottom)
+            {
+                chunk = buffer->get(bottom);
+                // The last chunk, which a thief may take as well
+                if (top == bottom)
+                {
+                    if (!m_top.compare_exchange_strong(top, top + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+                        chunk = nullptr;
+                    m_bottom.store(bottom + 1, std::memory_order_relaxed);
+                }
+            }
+            else
+            {
+                m_bottom.store(bottom + 1, std::memory_order_relaxed);
+            }
+            return chunk;
+        }
+
+        /**
+         * Steals the chunk at the top, by any thread.
+         *
+         * @returns The chunk, or a nullptr if it is empty or
+         *          another thread took the chunk first.
+        */
+        char *steal()
+        {
+            int64_t top = m_top.load(std::memory_order_acquire);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            int64_t bottom = m_bottom.load(std::memory_order_acquire);
+            if (top >= bottom)
+                return nullptr;
+
+            char *chunk = m_buffer.load(std::memory_order_acquire)->get(top);
+            if (!m_top.compare_exchange_strong(top, top + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+                return nullptr;
+            return chunk;
+        }
+
+        bool empty() const
+        {
+            return m_top.load(std::memory_order_acquire) >= m_bottom.load(std::memory_order_acquire);
+        }
+
+        /**
+         * Frees the old buffers, only while no thread uses
+         * the deque.
+        */
+        void reset()
+        {
+            for (Buffer *buffer : m_retired)
+                delete buffer;
+            m_retired.clear();
+        }
+    };
+}
@@ -0,0 +1,66 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <stdint.h>
+#include <stdlib.h>
+#include <thread>
+#include <vector>
+
+#include "mark_deque.hpp"
+
+// Upper limit of cheap_set_mark_threads()
+#define MARK_THREADS_MAX 64
+
+namespace GC
+{
+    /**
+     * The parallel marker, a pool of marking threads that
+     * share the mark phase of a collection. Every thread
+     * has a deque of chunks to scan and steals from the
+     * deques of the others when its own is empty, chunks
+     * are marked with an atomic test-and-set so that each
+     * is scanned once. The collecting thread takes part as
+     * the first thread, the others wait between collections.
+    */
+    class Marker
+    {
+    private:
+        Marker() {}
+        ~Marker();
+
+        static Marker &the();
+
+        std::vector<std::thread> m_workers;
+        std::vector<std::unique_ptr<MarkDeque>> m_deques;
+        size_t m_threads {1};
+
+        std::mutex m_lock;
+        std::condition_variable m_start;
+        std::condition_variable m_done;
+        uint64_t m_cycle {0};
+        size_t m_running {0};
+        bool m_exit {false};
+        // Size of the chunks marked by the extra threads
+        size_t m_marked {0};
+        // Threads that found no chunk to scan
+        std::atomic<size_t> m_idle {0};
+
+        void stop_workers();
+        void worker(size_t id, uint64_t cycle);
+        size_t drain(size_t id);
+        char *steal(size_t id);
+        bool all_empty();
+        size_t scan(char *chunk, MarkDeque &deque);
+
+    public:
+        static void set_threads(size_t threads);
+        static size_t threads();
+        static void mark(std::vector<uintptr_t> &roots);
+
+        Marker(Marker const&) = delete;
+        Marker& operator=(Marker const&) = delete;
+    };
+}
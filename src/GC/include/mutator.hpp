@@ -0,0 +1,49 @@
+#pragma once
+
+#include <atomic>
+#include <stdint.h>
+#include <stdlib.h>
+#include <vector>
+
+#include "arena.hpp"
+#include "cheap.h"
+#include "region.hpp"
+
+namespace GC
+{
+    /**
+     * The allocation context of a thread that uses the
+     * heap, registered by Heap::init() for the first thread
+     * and by Heap::register_thread() for the others. It
+     * holds the stack of the thread to be scanned for roots,
+     * the thread-local allocation buffer of the thread and
+     * the arena of its cheap_region_push() regions.
+     *
+     * A thread is parked while it waits for the heap lock or
+     * is stopped at a safepoint, and its stack is then only
+     * scanned from the frame where it was parked. A collection
+     * waits until every other thread is parked.
+    */
+    struct Mutator
+    {
+        // The stack is scanned from m_stack_bottom up to
+        // m_stack_top, and the frame pointers are walked
+        // from m_frame in the stack map root mode
+        uintptr_t *m_stack_top {nullptr};
+        uintptr_t *m_stack_bottom {nullptr};
+        uintptr_t *m_frame {nullptr};
+        // The cheap_tlab of the thread, and the start and
+        // region of the current buffer
+        cheap_tlab_t *m_tlab {nullptr};
+        char *m_tlab_start {nullptr};
+        Region *m_tlab_region {nullptr};
+        // Bytes left until the next allocation sample
+        long m_sample_left {0};
+        // Its objects are roots while they are allocated
+        Arena m_arena;
+        // The objects whose finalizers the thread is running,
+        // roots until the batch is done
+        std::vector<void *> m_finalizing;
+        std::atomic<bool> m_parked {false};
+    };
+}
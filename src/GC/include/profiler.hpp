@@ -1,31 +1,66 @@
 #pragma once
 
+#include <cstdio>
 #include <iostream>
+#include <map>
+#include <mutex>
 #include <vector>
 #include <chrono>
 
 #include "chunk.hpp"
 #include "event.hpp"
+#include "trace.hpp"
 
 // #define FunctionCallTypes   
 // #define ChunkOpsTypes        
 
+// Events kept per thread, older events are overwritten
+#define PROFILER_RING_EVENTS (1 << 16)
+// Bit positions of the GCEventType values
+#define PROFILER_EVENT_TYPES 32
+
 namespace GC {
 
     enum RecordOption
     {
         TimingInfo      = 0,
-        FunctionCalls   = (GC::AllocStart | GC::CollectStart | GC::MarkStart | GC::SweepStart | GC::FreeStart),
+        FunctionCalls   = (GC::AllocStart | GC::CollectStart | GC::MarkStart | GC::SweepStart | GC::FreeStart | GC::CompactStart),
         ChunkOps        = (GC::ChunkMarked | GC::ChunkSwept | GC::ChunkFreed | GC::NewChunk | GC::ReusedChunk),
         AllOps          = 0xFFFFFF
     };
 
-    struct ProfilerEvent
+    /**
+     * The events recorded by one thread, in a buffer that is
+     * allocated once, when the thread records its first event.
+     * Only the thread itself writes to it, so recording takes
+     * no lock. Once the buffer is full the oldest events are
+     * overwritten, the counts per type cover all events. While
+     * a trace file is open a full ring is written to it first.
+    */
+    struct EventRing
     {
-        uint m_n {1};
-        const GCEventType m_type;
+        GCEvent m_events[PROFILER_RING_EVENTS];
+        // Events recorded, the next goes to m_next % PROFILER_RING_EVENTS
+        size_t m_next {0};
+        // Events written to the trace file
+        size_t m_flushed {0};
+        size_t m_counts[PROFILER_EVENT_TYPES] {};
+        uint32_t m_thread {0};
+    };
 
-        ProfilerEvent(GCEventType type) : m_type(type) {}
+    /**
+     * The allocation samples of one stack and allocation site,
+     * in bytes and objects that the samples stand for.
+    */
+    struct SiteStats
+    {
+        size_t m_site {0};
+        // Return addresses, the innermost frame first
+        std::vector<uintptr_t> m_stack {};
+        size_t m_bytes {0};
+        size_t m_objects {0};
+        size_t m_survived_bytes {0};
+        size_t m_survived_objects {0};
     };
 
     class Profiler {
@@ -33,23 +68,49 @@ namespace GC {
         Profiler() {}
         ~Profiler()
         {
-            for (GCEvent *c : m_events)
-                delete c;
+            for (EventRing *ring : m_rings)
+                delete ring;
         }
 
         static Profiler &the();
         inline static Profiler *m_instance {nullptr};
-        std::vector<GCEvent *> m_events;
-        ProfilerEvent *m_last_prof_event {new ProfilerEvent(HeapInit)};
-        std::vector<ProfilerEvent *> m_prof_events;
+        // The rings of all threads that recorded events
+        std::vector<EventRing *> m_rings;
+        std::mutex m_rings_lock;
         RecordOption flags {AllOps};
+        // The allocation samples per stack and site, the key is
+        // the stack followed by the site
+        std::map<std::vector<uintptr_t>, size_t> m_site_entries;
+        std::vector<SiteStats> m_sites;
+        const char **m_site_names {nullptr};
+        size_t m_site_count {0};
+        // The binary trace the rings are streamed to, if open
+        std::FILE *m_trace {nullptr};
+        std::mutex m_trace_lock;
 
         std::chrono::microseconds alloc_time {0};
         // size_t alloc_counts {0};
         std::chrono::microseconds collect_time {0};
         // size_t collect_counts {0};
+        std::chrono::microseconds compact_time {0};
+        size_t compact_counts {0};
+        // Time and count of the mark phases per number of threads
+        std::map<size_t, std::pair<std::chrono::microseconds, size_t>> mark_times;
+        // Largest free chunk over the free bytes, before each collection
+        double frag_last {1.0};
+        double frag_lowest {1.0};
+        double frag_sum {0.0};
+        size_t frag_counts {0};
 
-        static void record_data(GCEvent *type);
+        static void record_data(const GCEvent &event);
+        static EventRing *add_ring();
+        static size_t event_count(GCEventType type);
+        static void open_trace(const std::string &path);
+        static void flush_ring(EventRing *ring);
+        static void close_trace();
+        static std::string site_name(size_t site);
+        static std::string frame_name(uintptr_t address);
+        static void dump_folded(const std::string &path, bool survived);
         std::ofstream create_file_stream();
         std::string get_log_folder();
         static void dump_trace();
@@ -57,16 +118,23 @@ namespace GC {
         static void dump_chunk_trace();
         // static void dump_trace_short();
         // static void dump_trace_full();
-        static void print_chunk_event(GCEvent *event, char buffer[22]);
         static const char *type_to_string(GCEventType type);
 
     public:
         static RecordOption log_options();
         static void set_log_options(RecordOption flags);
+        static void set_trace_file(const char *path);
         static void record(GCEventType type);
         static void record(GCEventType type, size_t size);
         static void record(GCEventType type, Chunk *chunk);
         static void record(GCEventType type, std::chrono::microseconds time);
+        static void record(GCEventType type, std::chrono::microseconds time, size_t threads);
+        static void record_fragmentation(size_t largest, size_t free);
+        static void set_alloc_sites(const char **names);
+        static size_t record_sample(const uintptr_t *stack, size_t depth, size_t site, size_t bytes, size_t objects);
+        static void record_survivor(size_t entry, size_t bytes, size_t objects);
+        static void dump_sites();
+        static const std::vector<SiteStats> &get_sites();
         static void dispose();
     };
 }
\ No newline at end of file
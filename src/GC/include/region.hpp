@@ -0,0 +1,131 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdlib.h>
+
+// The chunks of a region are parsed in granules of this many bytes,
+// the same as the size classes of the heap
+#define REGION_GRANULE 8
+
+namespace GC
+{
+    /**
+     * A block of memory mapped from the OS, holding
+     * chunks between m_start and m_top, and free space
+     * to bump new chunks from between m_top and m_end.
+     * The region struct itself and the side bitmaps of
+     * the region are kept at the start of the mapping,
+     * before the first chunk.
+     *
+     * The side bitmaps have one bit per granule, the bit
+     * of a chunk is the one of the granule holding its
+     * header.
+    */
+    struct Region
+    {
+        char *m_start;
+        char *m_top;
+        char *m_end;
+        // Size of the whole mapping, including this struct
+        size_t m_mapped;
+        // Bit set for the header of every chunk in the
+        // region, free or not
+        uint64_t *m_start_bits;
+        // Bit set for the header of every chunk marked
+        // in the current collection
+        uint64_t *m_mark_bits;
+        // Top of the region when the lazy sweep started,
+        // chunks above it were bumped after the mark phase
+        char *m_sweep_top {nullptr};
+        // Bytes of chunks found alive by the last sweep
+        size_t m_live {0};
+        // Bytes of the free chunks left by the last sweep,
+        // and the size of the largest of them
+        size_t m_free {0};
+        size_t m_largest_free {0};
+        // Compacted instead of swept by this collection
+        bool m_compact {false};
+        // Block of the nursery, its chunks are evacuated
+        // by minor collections instead of being swept
+        bool m_young {false};
+        // Holds a large object, which is never moved, and is
+        // unmapped as a whole when it dies
+        bool m_large_object {false};
+
+        size_t granule(const char *chunk) const
+        {
+            return (chunk - m_start) / REGION_GRANULE;
+        }
+
+        size_t bitmap_words() const
+        {
+            return ((m_end - m_start) / REGION_GRANULE + 63) / 64;
+        }
+
+        void set_start(const char *chunk)
+        {
+            size_t bit = granule(chunk);
+            m_start_bits[bit / 64] |= 1UL << (bit % 64);
+        }
+
+        void clear_start(const char *chunk)
+        {
+            size_t bit = granule(chunk);
+            m_start_bits[bit / 64] &= ~(1UL << (bit % 64));
+        }
+
+        void set_mark(const char *chunk)
+        {
+            size_t bit = granule(chunk);
+            m_mark_bits[bit / 64] |= 1UL << (bit % 64);
+        }
+
+        /**
+         * Marks a chunk atomically, for the marking threads.
+         *
+         * @returns True if this call marked the chunk, false
+         *          if it was marked already.
+        */
+        bool try_mark(const char *chunk)
+        {
+            size_t bit = granule(chunk);
+            uint64_t mask = 1UL << (bit % 64);
+            uint64_t *word = &m_mark_bits[bit / 64];
+            if (__atomic_load_n(word, __ATOMIC_RELAXED) & mask)
+                return false;
+            return !(__atomic_fetch_or(word, mask, __ATOMIC_RELAXED) & mask);
+        }
+
+        bool is_marked(const char *chunk) const
+        {
+            size_t bit = granule(chunk);
+            return m_mark_bits[bit / 64] & (1UL << (bit % 64));
+        }
+
+        /**
+         * @returns The header of the next chunk after a chunk
+         *          in the start bitmap, or m_top if there is
+         *          none below it.
+        */
+        char *next_start(const char *chunk) const
+        {
+            size_t bit = granule(chunk) + 1, last = granule(m_top);
+            while (bit < last)
+            {
+                uint64_t starts = m_start_bits[bit / 64] & (~0UL << (bit % 64));
+                if (starts != 0)
+                {
+                    bit = bit / 64 * 64 + __builtin_ctzl(starts);
+                    return bit < last ? m_start + bit * REGION_GRANULE : m_top;
+                }
+                bit = (bit / 64 + 1) * 64;
+            }
+            return m_top;
+        }
+
+        bool holds(uintptr_t addr) const
+        {
+            return reinterpret_cast<uintptr_t>(m_start) <= addr && addr < reinterpret_cast<uintptr_t>(m_top);
+        }
+    };
+}
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <stdint.h>
+
+/*
+ * The layout of the shadow stack emitted by LLVM for functions
+ * compiled with gc "shadow-stack", see the LLVM documentation on
+ * garbage collection.
+ */
+namespace GC
+{
+    /**
+     * The map for a single function's stack frame. One of these is
+     * compiled as constant data into the executable for each function.
+     *
+     * Storage of metadata values is elided if the %metadata parameter
+     * to @llvm.gcroot is null.
+    */
+    struct FrameMap
+    {
+        int32_t m_num_roots;    // Number of roots in stack frame
+        int32_t m_num_meta;     // Number of metadata entries, may be < m_num_roots
+        const void *m_meta[0];  // Metadata for each root
+    };
+
+    /**
+     * A link in the dynamic shadow stack. One of these is embedded in
+     * the stack frame of each function on the call stack.
+    */
+    struct StackEntry
+    {
+        StackEntry *m_next;     // Link to next stack entry (the caller's)
+        const FrameMap *m_map;  // Pointer to constant FrameMap
+        void *m_roots[0];       // Stack roots (in-place array)
+    };
+}
+
+/*
+ * The head of the singly-linked list of StackEntries. Functions push
+ * and pop onto this in their prologue and epilogue. It is defined in
+ * cheap.cpp, the definition LLVM emits in every module is a weak one.
+ */
+extern "C" GC::StackEntry *llvm_gc_root_chain;
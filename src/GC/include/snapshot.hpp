@@ -0,0 +1,48 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdlib.h>
+
+// First bytes of a heap snapshot file
+#define SNAPSHOT_MAGIC      "CHEAPSNP"
+#define SNAPSHOT_VERSION    1
+// Bytes the snapshot writer buffers before writing them out
+#define SNAPSHOT_BUFFER     (1 << 16)
+
+namespace GC
+{
+    /**
+     * The header at the start of a heap snapshot, written
+     * by the collection after cheap_heap_snapshot(). All
+     * fields are in the byte order of the machine that wrote
+     * the snapshot. The header is followed by m_roots root
+     * addresses and m_objects objects, see SnapshotObject.
+     * The schema is documented in docs/lib/snapshot.md.
+    */
+    struct SnapshotHeader
+    {
+        char m_magic[8];
+        uint32_t m_version;
+        // sizeof(SnapshotObject), objects may grow in later versions
+        uint32_t m_object_size;
+        uint64_t m_roots;
+        uint64_t m_objects;
+        uint64_t m_edges;
+    };
+
+    /**
+     * One live object of a snapshot, followed by the
+     * addresses of the m_edges objects it points to.
+    */
+    struct SnapshotObject
+    {
+        // The address the allocation returned
+        uint64_t m_address;
+        // The size of the object, without the header
+        uint64_t m_size;
+        uint64_t m_edges;
+    };
+
+    static_assert(sizeof(SnapshotHeader) == 40, "SnapshotHeader must be 40 bytes");
+    static_assert(sizeof(SnapshotObject) == 24, "SnapshotObject must be 24 bytes");
+}
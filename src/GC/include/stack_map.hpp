@@ -0,0 +1,72 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <unordered_map>
+#include <vector>
+
+// The version of the stack map format emitted by LLVM for statepoints,
+// see the LLVM documentation on stack maps
+#define STACK_MAP_VERSION 3
+
+// DWARF register numbers of the base registers of stack map locations
+#define STACK_MAP_REG_RBP 6
+#define STACK_MAP_REG_RSP 7
+
+namespace GC
+{
+    /**
+     * A root of a call site, a buffer of m_bytes in the
+     * frame of the caller at m_offset from the base
+     * register m_reg, as seen at the call. The words
+     * of the buffer are scanned for pointers into the
+     * heap, a spilled pointer is a buffer of one word.
+    */
+    struct StackMapRoot
+    {
+        uint16_t m_reg;
+        int32_t m_offset;
+        uint32_t m_bytes;
+    };
+
+    /**
+     * The roots of a call site, m_count roots starting
+     * at m_first in the root table of the stack map.
+    */
+    struct CallSite
+    {
+        uint32_t m_first;
+        uint32_t m_count;
+    };
+
+    /**
+     * The stack maps compiled into the executable by LLVM
+     * for functions using gc "statepoint-example", parsed
+     * once into a table from the return address of every
+     * statepoint call to the roots of the calling frame.
+     *
+     * The frames of the mutator are found by walking the
+     * frame pointers, the code generator keeps them with
+     * "frame-pointer"="all" on every gc function.
+    */
+    class StackMap
+    {
+    private:
+        StackMap() {}
+
+        static StackMap &the();
+
+        std::unordered_map<uintptr_t, CallSite> m_call_sites;
+        std::vector<StackMapRoot> m_roots;
+        bool m_loaded {false};
+
+        static const char *parse(const char *blob, const char *end);
+        static void load_section(const char *section, size_t size);
+
+    public:
+        static void load();
+        static const CallSite *find(uintptr_t ret);
+        static const StackMapRoot &root(uint32_t index);
+        static size_t call_site_count();
+    };
+}
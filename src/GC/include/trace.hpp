@@ -0,0 +1,54 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdlib.h>
+
+// First bytes of a trace file
+#define TRACE_MAGIC         "CHEAPTRC"
+#define TRACE_VERSION       1
+// Records the trace writer buffers before writing them out
+#define TRACE_BUFFER_RECORDS (1 << 12)
+
+namespace GC
+{
+    /**
+     * The header at the start of a binary trace file. All
+     * fields are in the byte order of the machine that wrote
+     * the trace, which the converter checks with m_version.
+     * The header is followed by records until the end of the
+     * file, see TraceRecord. The schema is documented in
+     * docs/lib/trace.md.
+    */
+    struct TraceHeader
+    {
+        char m_magic[8];
+        uint32_t m_version;
+        // sizeof(TraceRecord), records may grow in later versions
+        uint32_t m_record_size;
+        // The clock of the records when the trace was opened
+        uint64_t m_start_ns;
+    };
+
+    /**
+     * One event of a trace, 32 bytes. The records of a thread
+     * are in the order the thread recorded them, the records of
+     * different threads are interleaved in blocks.
+    */
+    struct TraceRecord
+    {
+        // Nanoseconds of CLOCK_MONOTONIC_COARSE
+        uint64_t m_timestamp;
+        // Start of the chunk, 0 for events without one
+        uint64_t m_start;
+        // Size of the chunk, or of the request of an AllocStart
+        uint64_t m_size;
+        // The recording thread, numbered from 0
+        uint32_t m_thread;
+        // The bit position of the GCEventType
+        uint16_t m_type;
+        uint8_t m_marked;
+        uint8_t m_pad;
+    };
+
+    static_assert(sizeof(TraceRecord) == 32, "TraceRecord must be 32 bytes");
+}
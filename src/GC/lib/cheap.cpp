@@ -1,8 +1,10 @@
+#include <algorithm>
 #include <stdlib.h>
 #include <iostream>
 
 #include "heap.hpp"
 #include "cheap.h"
+#include "shadow_stack.hpp"
 
 #ifndef WRAPPER_DEBUG
 struct cheap
@@ -11,6 +13,10 @@ struct cheap
 };
 #endif
 
+__thread cheap_tlab_t cheap_tlab;
+
+GC::StackEntry *llvm_gc_root_chain = nullptr;
+
 cheap_t *cheap_the()
 {
     cheap_t *c;
@@ -35,7 +41,137 @@ void cheap_dispose()
 
 void *cheap_alloc(unsigned long size)
 {
-    return GC::Heap::alloc(size);
+    return cheap_alloc_inline(size);
+}
+
+// Never inlined nor a tail call, as the samples skip its
+// frame, see Heap::sample()
+__attribute__((noinline)) void *cheap_alloc_refill(unsigned long size)
+{
+    void *obj = GC::Heap::alloc_refill(size);
+    asm volatile("" ::: "memory");
+    return obj;
+}
+
+// The same, with the site of the allocation from the compiled code
+__attribute__((noinline)) void *cheap_alloc_refill_site(unsigned long size, unsigned long site)
+{
+    void *obj = GC::Heap::alloc_refill(size, site);
+    asm volatile("" ::: "memory");
+    return obj;
+}
+
+void *cheap_alloc_typed(unsigned long size, unsigned long descriptor)
+{
+    return cheap_alloc_typed_inline(size, descriptor);
+}
+
+// The same, with the descriptor of a typed allocation
+__attribute__((noinline)) void *cheap_alloc_refill_typed(unsigned long size, unsigned long descriptor, unsigned long site)
+{
+    void *obj = GC::Heap::alloc_refill(size, site, descriptor);
+    asm volatile("" ::: "memory");
+    return obj;
+}
+
+void cheap_alloc_n(unsigned long count, unsigned long size, void **out)
+{
+    unsigned long rounded = (size + CHEAP_GRANULE - 1) & ~(CHEAP_GRANULE - 1);
+    unsigned long step = CHEAP_HEADER_SIZE + rounded;
+    unsigned long i = 0;
+    while (i < count)
+    {
+        // The objects that fit in the buffer are bumped at once,
+        // the next one refills it
+        unsigned long fit = size - 1 < CHEAP_TLAB_OBJ_MAX ? (cheap_tlab.end - cheap_tlab.cur) / step : 0;
+        char *header = cheap_tlab.cur;
+        for (unsigned long end = i + std::min(fit, count - i); i < end; i++, header += step)
+        {
+            *reinterpret_cast<unsigned long *>(header) = rounded;
+            out[i] = header + CHEAP_HEADER_SIZE;
+        }
+        cheap_tlab.cur = header;
+        if (i < count)
+            out[i++] = cheap_alloc_refill(size);
+    }
+}
+
+void *cheap_alloc_group(const unsigned long *sizes, unsigned long n)
+{
+    return cheap_alloc_group_typed(sizes, nullptr, n, CHEAP_SITE_UNKNOWN);
+}
+
+// Bumps a group that fits in the allocation buffer, never
+// inlined nor a tail call, as the samples skip its frame
+__attribute__((noinline)) void *cheap_alloc_group_typed(const unsigned long *sizes, const unsigned long *descriptors,
+    unsigned long n, unsigned long site)
+{
+    unsigned long total = 0;
+    bool small = true;
+    for (unsigned long i = 0; i < n; i++)
+    {
+        small &= sizes[i] - 1 < CHEAP_TLAB_OBJ_MAX;
+        total += CHEAP_HEADER_SIZE + ((sizes[i] + CHEAP_GRANULE - 1) & ~(CHEAP_GRANULE - 1));
+    }
+
+    char *header = cheap_tlab.cur;
+    if (n == 0 || !small || static_cast<unsigned long>(cheap_tlab.end - header) < total)
+    {
+        void *obj = GC::Heap::alloc_group(sizes, descriptors, n, site);
+        asm volatile("" ::: "memory");
+        return obj;
+    }
+
+    for (unsigned long i = 0; i < n; i++)
+    {
+        unsigned long rounded = (sizes[i] + CHEAP_GRANULE - 1) & ~(CHEAP_GRANULE - 1);
+        *reinterpret_cast<unsigned long *>(header) = rounded
+            | (descriptors != nullptr ? cheap_header_type(descriptors[i]) : 0);
+        header += CHEAP_HEADER_SIZE + rounded;
+    }
+    char *first = cheap_tlab.cur;
+    cheap_tlab.cur = header;
+    return first + CHEAP_HEADER_SIZE;
+}
+
+void cheap_region_push()
+{
+    GC::Heap::region_push();
+}
+
+void *cheap_region_alloc(unsigned long size)
+{
+    return GC::Heap::region_alloc(size);
+}
+
+void cheap_region_pop()
+{
+    GC::Heap::region_pop();
+}
+
+void cheap_register_finalizer(void *obj, cheap_finalizer_t fn)
+{
+    GC::Heap::register_finalizer(obj, fn);
+}
+
+unsigned long cheap_run_finalizers()
+{
+    return GC::Heap::run_finalizers();
+}
+
+void cheap_set_finalizer_thread(bool enabled)
+{
+    GC::Heap::set_finalizer_thread(enabled);
+}
+
+void *cheap_weak_ref(void *obj)
+{
+    return GC::Heap::weak_ref(obj);
+}
+
+void *cheap_weak_get(void *ref)
+{
+    return *static_cast<void *volatile *>(ref);
 }
 
 void cheap_set_profiler(cheap_t *cheap, bool mode)
@@ -58,4 +194,116 @@ void cheap_profiler_log_options(cheap_t *cheap, unsigned long flags)
         cast_flag = GC::AllOps;
 
     heap->set_profiler_log_options(cast_flag);
-}
\ No newline at end of file
+}
+
+void cheap_profiler_trace_file(cheap_t *cheap, const char *path)
+{
+    GC::Heap *heap = static_cast<GC::Heap *>(cheap->obj);
+
+    heap->set_profiler_trace_file(path);
+}
+
+void cheap_set_root_mode(unsigned long mode)
+{
+    if (mode == CHEAP_ROOTS_SHADOW_STACK)
+        GC::Heap::set_root_mode(GC::ShadowStackRoots);
+    else if (mode == CHEAP_ROOTS_STACK_MAP)
+        GC::Heap::set_root_mode(GC::StackMapRoots);
+    else
+        GC::Heap::set_root_mode(GC::ConservativeRoots);
+}
+
+void cheap_set_mark_threads(unsigned long threads)
+{
+    GC::Heap::set_mark_threads(threads);
+}
+
+void cheap_set_gc_policy(double growth_factor, unsigned long min_interval, unsigned long max_size)
+{
+    GC::Heap::set_gc_policy(growth_factor, min_interval, max_size);
+}
+
+void cheap_set_initial_size(unsigned long bytes)
+{
+    GC::Heap::set_initial_size(bytes);
+}
+
+void cheap_set_pause_target(unsigned long micros)
+{
+    GC::Heap::set_pause_target(micros);
+}
+
+void cheap_set_nursery_size(unsigned long bytes)
+{
+    GC::Heap::set_nursery_size(bytes);
+}
+
+void cheap_write_barrier(void *obj)
+{
+    GC::Heap::write_barrier(obj);
+}
+
+void cheap_set_compact_threshold(double threshold)
+{
+    GC::Heap::set_compact_threshold(threshold);
+}
+
+void cheap_set_large_object_size(unsigned long bytes)
+{
+    GC::Heap::set_large_object_size(bytes);
+}
+
+void cheap_set_page_policy(unsigned long flags)
+{
+    GC::Heap::set_page_policy(flags);
+}
+
+void cheap_get_stats(struct cheap_stats *stats)
+{
+    GC::Heap::get_stats(stats);
+}
+
+void cheap_get_step_stats(cheap_pause_stats_t *stats)
+{
+    GC::Heap::get_step_stats(stats);
+}
+
+void cheap_set_alloc_sampling(unsigned long bytes)
+{
+    GC::Heap::set_alloc_sampling(bytes);
+}
+
+void cheap_set_alloc_sites(const char **names)
+{
+    GC::Heap::set_alloc_sites(names);
+}
+
+void cheap_set_census(const char *path)
+{
+    GC::Heap::set_census(path);
+}
+
+void cheap_heap_snapshot(const char *path)
+{
+    GC::Heap::heap_snapshot(path);
+}
+
+void cheap_set_stats_file(const char *path)
+{
+    GC::Heap::set_stats_file(path);
+}
+
+void cheap_register_thread()
+{
+    GC::Heap::register_thread(nullptr);
+}
+
+void cheap_unregister_thread()
+{
+    GC::Heap::unregister_thread();
+}
+
+void cheap_safepoint()
+{
+    GC::Heap::safepoint();
+}
@@ -6,31 +6,42 @@ namespace GC
     /**
      * @returns The type of the event
     */
-    GCEventType GCEvent::get_type()
+    GCEventType GCEvent::get_type() const
     {
         return m_type;
     }
 
     /**
-     * @returns The time the event happened in
-     *          the form of time_t.
+     * @returns The time the event happened, in
+     *          nanoseconds of event_clock().
     */
-    std::time_t GCEvent::get_time_stamp()
+    uint64_t GCEvent::get_time_stamp() const
     {
         return m_timestamp;
     }
 
+    /**
+     * @returns True if the event is related to
+     *          a chunk.
+    */
+    bool GCEvent::has_chunk() const
+    {
+        return m_start != nullptr;
+    }
+
     /**
      * If the event is related to a chunk, this
-     * function returns the chunk that it is
-     * related to. If the event is independent
-     * of a chunk, it returns the nullptr.
+     * function returns a copy of the chunk as it
+     * was when the event was recorded. Only to be
+     * called if has_chunk() is true.
      * 
-     * @returns A chunk pointer or the nullptr.
+     * @returns The copy of the chunk.
     */
-    const Chunk *GCEvent::get_chunk()
+    Chunk GCEvent::get_chunk() const
     {
-        return m_chunk;
+        Chunk chunk(m_size, m_start);
+        chunk.m_marked = m_marked;
+        return chunk;
     }
     
     /**
@@ -43,15 +54,15 @@ namespace GC
      *          or 0 if the event is not an
      *          AllocStart event.
     */
-    size_t GCEvent::get_size()
+    size_t GCEvent::get_size() const
     {
-        return m_size;
+        return m_start == nullptr ? m_size : 0;
     }
 
     /**
      * @returns The string conversion of the event type.
     */
-    const char *GCEvent::type_to_string()
+    const char *GCEvent::type_to_string() const
     {
         switch (m_type)
         {
@@ -67,6 +78,7 @@ namespace GC
             case ReusedChunk:       return "ReusedChunk";
             case ProfilerDispose:   return "ProfilerDispose";
             case FreeStart:         return "FreeStart";
+            case CompactStart:      return "CompactStart";
             default:                return "[Unknown]";
         }
     }
@@ -2,20 +2,133 @@
 #include <stdexcept>
 #include <stdlib.h>
 #include <vector>
-#include <unordered_map>
+#include <algorithm>
 #include <chrono>
 #include <queue>
 #include <set>
-
+#include <map>
+#include <cstring>
+#include <new>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <unistd.h>
+
+#include "cheap.h"
 #include "heap.hpp"
+#include "marker.hpp"
+#include "shadow_stack.hpp"
+#include "snapshot.hpp"
+#include "stack_map.hpp"
 
 #define time_now	std::chrono::high_resolution_clock::now()
 #define to_us		std::chrono::duration_cast<std::chrono::microseconds>
+#define to_ns(d)	std::chrono::duration_cast<std::chrono::nanoseconds>(d).count()
 
-using std::cout, std::endl, std::vector, std::hex, std::dec, std::unordered_map;
+using std::cout, std::endl, std::vector, std::hex, std::dec;
 
 namespace GC
 {
+	// The allocation context of the calling thread, set while
+	// the thread is registered with the heap
+	static __thread Mutator *current_mutator = nullptr;
+
+	/**
+	 * @returns The offset of the first chunk in a mapping of
+	 * 			a region, after the struct and two bitmaps
+	 * 			covering the mapping, at a 16 byte boundary.
+	 */
+	static size_t region_layout(size_t mapped)
+	{
+		size_t bitmap = ((mapped / REGION_GRANULE + 63) / 64) * sizeof(uint64_t);
+		return (sizeof(Region) + 2 * bitmap + 15) & ~static_cast<size_t>(15);
+	}
+
+	/**
+	 * Reads a positive number from an environment variable.
+	 *
+	 * @param name	The name of the variable.
+	 *
+	 * @returns The number, or 0 if the variable is not set.
+	 */
+	static double env_number(const char *name)
+	{
+		const char *value = getenv(name);
+		if (value == nullptr || *value == '\0')
+			return 0.0;
+
+		char *end;
+		double number = strtod(value, &end);
+		if (*end != '\0' || !(number > 0.0))
+			throw std::runtime_error(std::string("Error: Invalid value of ") + name + ": " + value);
+		return number;
+	}
+
+	/**
+	 * Reads a number of bytes from an environment variable,
+	 * with an optional suffix K, M or G for KB, MB or GB.
+	 *
+	 * @param name	The name of the variable.
+	 *
+	 * @returns The number of bytes, or 0 if the variable is
+	 * 			not set.
+	 */
+	static size_t env_bytes(const char *name)
+	{
+		const char *value = getenv(name);
+		if (value == nullptr || *value == '\0')
+			return 0;
+
+		char *end;
+		double number = strtod(value, &end);
+		double unit = 1.0;
+		switch (*end)
+		{
+		case 'K': case 'k': unit = 1UL << 10; end++; break;
+		case 'M': case 'm': unit = 1UL << 20; end++; break;
+		case 'G': case 'g': unit = 1UL << 30; end++; break;
+		}
+		if (*end != '\0' || !(number >= 0.0))
+			throw std::runtime_error(std::string("Error: Invalid value of ") + name + ": " + value);
+		return static_cast<size_t>(number * unit);
+	}
+
+	/**
+	 * @param name	The name of an environment variable.
+	 *
+	 * @returns The value of the variable, or a nullptr if it
+	 * 			is not set or empty.
+	 */
+	static const char *env_string(const char *name)
+	{
+		const char *value = getenv(name);
+		return value == nullptr || *value == '\0' ? nullptr : value;
+	}
+
+	/**
+	 * The top of the stack of the calling thread, from the
+	 * bounds the thread library keeps for it, as the frames
+	 * of the callers cannot be relied on when they omit frame
+	 * pointers. The words above main() or the entry function
+	 * of the thread are scanned as well, they do not point
+	 * into the heap.
+	 *
+	 * @returns The end of the stack, the stack grows down.
+	 */
+	static uintptr_t *thread_stack_top()
+	{
+		pthread_attr_t attr;
+		void *stack;
+		size_t size;
+		if (pthread_getattr_np(pthread_self(), &attr) != 0)
+			throw std::runtime_error(std::string("Error: Cannot find the stack of the thread"));
+		int error = pthread_attr_getstack(&attr, &stack, &size);
+		pthread_attr_destroy(&attr);
+		if (error != 0)
+			throw std::runtime_error(std::string("Error: Cannot find the stack of the thread"));
+		return reinterpret_cast<uintptr_t *>(static_cast<char *>(stack) + size);
+	}
+
 	/**
 	 * This implementation of the() guarantees laziness
 	 * on the instance and a correct destruction with
@@ -30,19 +143,22 @@ namespace GC
 	}
 
 	/**
-	 * Initialises the heap singleton and saves the address
-	 * of the calling function's stack frame as the stack_top.
-	 * Presumeably this address points to the stack frame of
-	 * the compiled LLVM executable after linking.
+	 * Initialises the heap singleton and registers the calling
+	 * thread, whose stack is scanned up to its top, see
+	 * thread_stack_top().
+	 *
+	 * @param stack_top	The address to scan the stack up to, or
+	 * 					a nullptr for the top of the stack.
 	 */
-	void Heap::init()
+	void Heap::init(void *stack_top)
 	{
 		Heap &heap = Heap::the();
+		register_thread(stack_top);
+		StackMap::load();
+		heap.load_policy();
+		// After the policy, which may enable the profiler
 		if (heap.profiler_enabled())
 			Profiler::record(HeapInit);
-// clang complains because arg for __b_f_a is not 0 which is "unsafe"
-#pragma clang diagnostic ignored "-Wframe-address"
-		heap.m_stack_top = static_cast<uintptr_t *>(__builtin_frame_address(1));
 		// TODO: handle this below
 		//heap.m_heap_top = heap.m_heap;
 	}
@@ -52,6 +168,11 @@ namespace GC
 		Profiler::set_log_options(flags);
 	}
 
+	void Heap::set_profiler_trace_file(const char *path)
+	{
+		Profiler::set_trace_file(path);
+	}
+
 	/**
 	 * Disposes the heap and the profiler at program exit
 	 * which also triggers a heap log file dumped if the
@@ -60,531 +181,3469 @@ namespace GC
 	void Heap::dispose()
 	{
 		Heap &heap = Heap::the();
+		set_finalizer_thread(false);
 		if (heap.profiler_enabled())
 			Profiler::dispose();
+		if (heap.m_sample_interval > 0)
+			Profiler::dump_sites();
+		if (heap.m_stats_file != nullptr)
+			heap.write_stats();
+		if (heap.m_census != nullptr)
+			std::fclose(heap.m_census);
+		if (heap.m_snapshot != nullptr)
+			std::fclose(heap.m_snapshot);
+		heap.m_census = nullptr;
+		heap.m_snapshot = nullptr;
 	}
 
 	/**
-	 * Allocates a given amount of bytes on the heap.
-	 *
-	 * @param size The amount of bytes to be allocated.
-	 *
-	 * @return  A pointer to the address where the memory
-	 *          has been allocated. This pointer is supposed
-	 *          to be casted to and object pointer.
+	 * Returns all the regions to the OS at program exit.
 	 */
-	void *Heap::alloc(size_t size)
+	Heap::~Heap()
 	{
-		auto a_start = time_now;
-		// Singleton
-		Heap &heap = Heap::the();
-		bool profiler_enabled = heap.profiler_enabled();
-		
-		if (profiler_enabled)
-			Profiler::record(AllocStart, size);
-
-		if (size == 0)
-		{
-			cout << "Heap: Cannot alloc 0B. No bytes allocated." << endl;
-			return nullptr;
-		}
-
-		if (heap.m_size + size > HEAP_SIZE)
+		if (m_finalizer_thread.joinable())
 		{
-			// auto a_ms = to_us(c_start - a_start);
-			// Profiler::record(AllocStart, a_ms);
-			auto stack_bottom = reinterpret_cast<uintptr_t *>(__builtin_frame_address(0));
-			heap.collect(stack_bottom);
-			// If memory is not enough after collect, crash with OOM error
-			if (heap.m_size > HEAP_SIZE)
 			{
-				throw std::runtime_error(std::string("Error: Heap out of memory"));
+				std::lock_guard<std::mutex> lock(m_finalize_lock);
+				m_finalizer_stop = true;
 			}
-			//throw std::runtime_error(std::string("Error: Heap out of memory"));
+			m_finalize_ready.notify_all();
+			m_finalizer_thread.join();
 		}
-		if (heap.m_size + size > HEAP_SIZE)
+		for (Region *region : m_regions)
+			munmap(region, region->m_mapped);
+		for (Mutator *mutator : m_mutators)
+			delete mutator;
+	}
+
+	/**
+	 * Registers the calling thread with the heap, which
+	 * every thread other than the one that called init()
+	 * has to do before it allocates. A registered thread
+	 * has its own allocation buffer, and its stack is
+	 * scanned for roots up to its top. Calling this again
+	 * only moves the top of the scanned stack.
+	 *
+	 * A registered thread that blocks outside the heap for
+	 * a long time should be unregistered first, as every
+	 * collection waits for all registered threads to stop
+	 * at a safepoint, see safepoint().
+	 *
+	 * @param stack_top	The address to scan the stack up to, or
+	 * 					a nullptr for the top of the stack, see
+	 * 					thread_stack_top().
+	 */
+	void Heap::register_thread(void *stack_top)
+	{
+		Heap &heap = Heap::the();
+		if (stack_top == nullptr)
+			stack_top = thread_stack_top();
+		if (current_mutator != nullptr)
 		{
-			if (profiler_enabled)
-				Profiler::dispose();
-			throw std::runtime_error(std::string("Error: Heap out of memory"));
+			current_mutator->m_stack_top = static_cast<uintptr_t *>(stack_top);
+			return;
 		}
 
-		// If a chunk was recycled, return the old chunk address
-		Chunk *reused_chunk = heap.try_recycle_chunks(size);
-		if (reused_chunk != nullptr)
+		// Collections only wait for registered threads, so this
+		// one takes the lock without being parked
+		std::lock_guard<std::recursive_mutex> lock(heap.m_lock);
+		if (heap.m_root_mode == ShadowStackRoots && !heap.m_mutators.empty())
+			throw std::runtime_error(std::string("Error: The shadow stack root mode supports a single thread"));
+
+		auto mutator = new Mutator();
+		mutator->m_stack_top = static_cast<uintptr_t *>(stack_top);
+		mutator->m_tlab = &cheap_tlab;
+		mutator->m_sample_left = heap.m_sample_interval;
+		heap.m_mutators.push_back(mutator);
+		current_mutator = mutator;
+	}
+
+	/**
+	 * Unregisters the calling thread, its allocation buffer
+	 * is given back to the heap and its stack is no longer
+	 * scanned. The objects only the thread refers to can be
+	 * collected afterwards.
+	 */
+	void Heap::unregister_thread()
+	{
+		Heap &heap = Heap::the();
+		Guard guard;
+		Mutator *mutator = current_mutator;
+		heap.retire_tlab(mutator);
+		heap.m_mutators.erase(std::find(heap.m_mutators.begin(), heap.m_mutators.end(), mutator));
+		delete mutator;
+		current_mutator = nullptr;
+	}
+
+	/**
+	 * @returns The allocation context of the calling thread.
+	 */
+	Mutator *Heap::mutator()
+	{
+		if (current_mutator != nullptr)
+			return current_mutator;
+		if (Heap::the().m_mutators.empty())
+			throw std::runtime_error(std::string("Error: Heap is not initialized, read the docs!"));
+		throw std::runtime_error(std::string("Error: Thread is not registered with the heap"));
+	}
+
+	/**
+	 * Takes the heap lock for a call from a registered thread,
+	 * the lock is held for the whole call, collections included.
+	 * A thread that has to wait for the lock is parked, as the
+	 * thread holding it may stop the world for a collection. The
+	 * callee-saved registers are spilled to this frame first, so
+	 * that the pointers the thread keeps in them are scanned.
+	 */
+	__attribute__((noinline)) void Heap::lock()
+	{
+		Mutator *waiting = mutator();
+		if (m_lock.try_lock())
+			return;
+
+		__builtin_unwind_init();
+		park(waiting, __builtin_frame_address(0));
+		m_lock.lock();
+		waiting->m_parked = false;
+	}
+
+	void Heap::unlock()
+	{
+		m_lock.unlock();
+	}
+
+	/**
+	 * Parks a thread, its stack is scanned from the frame of
+	 * this function, which lies below the registers spilled
+	 * by the caller, and the stack maps are walked from the
+	 * frame of the caller. A parked thread must not touch the
+	 * heap until it is unparked.
+	 *
+	 * @param mutator	The allocation context of the thread.
+	 *
+	 * @param frame		The frame of the caller.
+	 */
+	__attribute__((noinline)) void Heap::park(Mutator *mutator, void *frame)
+	{
+		mutator->m_stack_bottom = static_cast<uintptr_t *>(__builtin_frame_address(0));
+		mutator->m_frame = static_cast<uintptr_t *>(frame);
 		{
-			if (profiler_enabled)
-				Profiler::record(ReusedChunk, reused_chunk);
-			auto a_end = time_now;
-			auto a_ms = to_us(a_end - a_start);
-			Profiler::record(AllocStart, a_ms);
-			return static_cast<void *>(reused_chunk->m_start);
+			std::lock_guard<std::mutex> lock(m_park_lock);
+			mutator->m_parked = true;
 		}
+		m_parked.notify_all();
+	}
 
-		// If no free chunks was found (reused_chunk is a nullptr),
-		// then create a new chunk
-		auto new_chunk = new Chunk(size, (uintptr_t *)(heap.m_heap + heap.m_size));
+	/**
+	 * A safepoint, to be called regularly by a registered
+	 * thread that runs for a long time without allocating.
+	 * If another thread is waiting to collect, the thread
+	 * stops here until the collection is done. Allocations
+	 * and the other calls into the heap are safepoints too.
+	 *
+	 * Time complexity: O(1) if no collection is waiting.
+	 */
+	__attribute__((noinline)) void Heap::safepoint()
+	{
+		Heap &heap = Heap::the();
+		if (!heap.m_stop.load(std::memory_order_acquire))
+			return;
+
+		Mutator *mutator = Heap::mutator();
+		__builtin_unwind_init();
+		heap.park(mutator, __builtin_frame_address(0));
+		std::unique_lock<std::mutex> lock(heap.m_park_lock);
+		heap.m_resume.wait(lock, [&heap] { return !heap.m_stop.load(); });
+		mutator->m_parked = false;
+	}
 
-		heap.m_size += size;
-		// TODO: handle this below
-		//heap.m_total_size += size;
-		heap.m_allocated_chunks.push_back(new_chunk);
+	/**
+	 * Pushes a region on the arena of the calling thread,
+	 * see Arena. Like the allocation buffer, the arena is
+	 * only touched by its thread, and collections scan it
+	 * while the thread is parked, so no lock is taken.
+	 */
+	void Heap::region_push()
+	{
+		Heap::mutator()->m_arena.push();
+	}
 
-		if (profiler_enabled)
-			Profiler::record(NewChunk, new_chunk);
+	/**
+	 * Allocates an object in the innermost region of the
+	 * calling thread. It is freed by the matching pop and
+	 * must not be referred to by heap objects afterwards.
+	 *
+	 * @param size	The size of the object in bytes.
+	 *
+	 * @returns The zeroed object.
+	 *
+	 * Time complexity: O(1), unless a block is mapped.
+	 */
+	void *Heap::region_alloc(size_t size)
+	{
+		return Heap::mutator()->m_arena.alloc(size);
+	}
 
-		auto a_end = time_now;
-		auto a_ms = to_us(a_end - a_start);
-		Profiler::record(AllocStart, a_ms);
-		return new_chunk->m_start;
+	/**
+	 * Frees the objects of the innermost region of the
+	 * calling thread at once.
+	 *
+	 * Time complexity: O(B), where B is the number of bytes
+	 * 					allocated in the region.
+	 */
+	void Heap::region_pop()
+	{
+		Heap::mutator()->m_arena.pop();
 	}
 
 	/**
-	 * Tries to recycle used and freed chunks that are
-	 * already allocated objects by the OS but freed
-	 * from our Heap. This reduces the amount of GC
-	 * objects slightly which saves time from malloc'ing
-	 * memory from the OS.
+	 * Registers a finalizer to be called with an object once
+	 * it is dead. The collection that finds the object dead
+	 * queues the finalizer and keeps the object, and what it
+	 * points to, until the finalizer has run, see
+	 * run_finalizers(). The object is not collected before
+	 * its finalizer has run, an object that the finalizer
+	 * makes reachable again lives on without it.
 	 *
-	 * @param size  Amount of bytes needed for the object
-	 *              which is about to be allocated.
+	 * @param obj	The start of a heap object.
+	 *
+	 * @param fn	The finalizer.
+	 */
+	void Heap::register_finalizer(void *obj, cheap_finalizer_t fn)
+	{
+		Heap &heap = Heap::the();
+		Guard guard;
+		// The object may still be in an allocation buffer and
+		// have no start bit, so only the region is checked
+		auto addr = reinterpret_cast<uintptr_t>(obj);
+		if (fn == nullptr || addr % REGION_GRANULE != 0 || heap.find_region(addr - HEADER_SIZE) == nullptr)
+			throw std::runtime_error(std::string("Error: A finalizer needs a function and a heap object"));
+		heap.m_finalizers.push_back({static_cast<char *>(obj) - HEADER_SIZE, fn});
+	}
+
+	/**
+	 * Runs the queued finalizers on the calling thread, in
+	 * batches of up to HEAP_FINALIZER_BATCH taken off the
+	 * queue under the lock, while the finalizers run without
+	 * it and may allocate. The objects of a batch are roots
+	 * until the batch is done. A finalizer that calls this
+	 * again returns right away.
 	 *
-	 * @returns If a chunk is found and recycled, a
-	 *          pointer to the allocated memory for
-	 *          the object is returned. If not, a
-	 *          nullptr is returned to signify no
-	 *          chunks were found.
+	 * @returns The number of finalizers run.
 	 */
-	Chunk *Heap::try_recycle_chunks(size_t size)
+	size_t Heap::run_finalizers()
 	{
 		Heap &heap = Heap::the();
-		// Check if there are any freed chunks large enough for current request
-		for (size_t i = 0; i < heap.m_freed_chunks.size(); i++)
+		Mutator *mutator = Heap::mutator();
+		if (!mutator->m_finalizing.empty())
+			return 0;
+
+		size_t run = 0;
+		cheap_finalizer_t batch[HEAP_FINALIZER_BATCH];
+		for (;;)
 		{
-			//auto chunk = Heap::get_at(heap.m_freed_chunks, i);
-			auto chunk = heap.m_freed_chunks[i];
-			auto iter = heap.m_freed_chunks.begin();
-			i++;
-			//advance(iter, i);
-			if (chunk->m_size > size)
+			size_t n;
 			{
-				// Split the chunk, use one part and add the remaining part to
-				// the list of freed chunks
-				size_t diff = chunk->m_size - size;
-				auto chunk_complement = new Chunk(diff, chunk->m_start + chunk->m_size);
+				Guard guard;
+				mutator->m_finalizing.clear();
+				n = std::min(heap.m_finalizable.size(), static_cast<size_t>(HEAP_FINALIZER_BATCH));
+				for (size_t i = 0; i < n; i++)
+				{
+					Finalizer finalizer = heap.m_finalizable.back();
+					heap.m_finalizable.pop_back();
+					mutator->m_finalizing.push_back(finalizer.m_chunk + HEADER_SIZE);
+					batch[i] = finalizer.m_fn;
+				}
+			}
+			if (n == 0)
+				return run;
+			for (size_t i = 0; i < n; i++)
+				batch[i](mutator->m_finalizing[i]);
+			run += n;
+		}
+	}
+
+	/**
+	 * Starts or stops the finalizer thread, which runs the
+	 * finalizers the collections queue. It is registered with
+	 * the heap while it runs a batch only, so the collections
+	 * do not wait for it while it sleeps. Not supported in the
+	 * shadow stack root mode, which supports a single thread.
+	 * Stopping the thread leaves the finalizers it has not run
+	 * queued.
+	 *
+	 * @param enabled	True to start the thread, false to stop it.
+	 */
+	void Heap::set_finalizer_thread(bool enabled)
+	{
+		Heap &heap = Heap::the();
+		if (enabled == heap.m_finalizer_thread.joinable())
+			return;
 
-				heap.m_freed_chunks.erase(iter);
-				heap.m_freed_chunks.push_back(chunk_complement);
-				heap.m_allocated_chunks.push_back(chunk);
+		if (enabled)
+		{
+			if (heap.m_root_mode == ShadowStackRoots)
+				throw std::runtime_error(std::string("Error: The shadow stack root mode supports a single thread"));
+			heap.m_finalizer_stop = false;
+			heap.m_finalize_queued = true;
+			heap.m_finalizer_thread = std::thread(finalizer_loop);
+			return;
+		}
 
-				return chunk;
-			}
-			else if (chunk->m_size == size)
+		{
+			std::lock_guard<std::mutex> lock(heap.m_finalize_lock);
+			heap.m_finalizer_stop = true;
+		}
+		heap.m_finalize_ready.notify_all();
+		heap.m_finalizer_thread.join();
+	}
+
+	__attribute__((noinline)) void Heap::finalizer_loop()
+	{
+		Heap &heap = Heap::the();
+		for (;;)
+		{
 			{
-				// Reuse the whole chunk
-				heap.m_freed_chunks.erase(iter);
-				heap.m_allocated_chunks.push_back(chunk);
-				return chunk;
+				std::unique_lock<std::mutex> lock(heap.m_finalize_lock);
+				heap.m_finalize_ready.wait(lock, [&heap] { return heap.m_finalize_queued || heap.m_finalizer_stop; });
+				if (heap.m_finalizer_stop)
+					return;
+				heap.m_finalize_queued = false;
 			}
+			register_thread(nullptr);
+			run_finalizers();
+			unregister_thread();
 		}
-		// If no chunk was found, return nullptr
-		return nullptr;
 	}
 
 	/**
-	 * Returns a bool whether the profiler is enabled
-	 * or not.
-	 * 
-	 * @returns True or false if the profiler is enabled
-	 * 			or disabled respectively.
-	*/
-	bool Heap::profiler_enabled() {
+	 * Allocates a weak reference to an object, a heap object
+	 * of one word holding the pointer, which is not traced.
+	 * The collection that finds the target dead clears the
+	 * word, and the word follows the target when it moves.
+	 * The reference is collected like any other object.
+	 *
+	 * @param obj	The target, a pointer into a heap object
+	 * 				or a null pointer.
+	 *
+	 * @returns The reference.
+	 */
+	void *Heap::weak_ref(void *obj)
+	{
 		Heap &heap = Heap::the();
-		return heap.m_profiler_enable;
+		Guard guard;
+		auto ref = static_cast<void **>(alloc(sizeof(void *)));
+		char *chunk = reinterpret_cast<char *>(ref) - HEADER_SIZE;
+		*reinterpret_cast<size_t *>(chunk) |= cheap_header_type(CHEAP_NO_POINTERS);
+		*ref = obj;
+		heap.m_weak_refs.push_back(chunk);
+		return ref;
 	}
 
 	/**
-	 * Collection phase of the garbage collector. When
-	 * an allocation is requested and there is no space
-	 * left on the heap, a collection is triggered. This
-	 * function is private so that the user cannot trigger
-	 * a collection unneccessarily.
+	 * Stops the world for a collection by the thread that
+	 * holds the heap lock. The other registered threads are
+	 * either waiting for the lock, and parked already, or
+	 * are parked at their next safepoint. Returns once they
+	 * are all parked. Calls nest, the world is resumed by
+	 * the outermost resume_world().
 	 */
-	void Heap::collect(uintptr_t *stack_bottom)
+	void Heap::stop_world()
 	{
-		auto c_start = time_now;
+		if (m_stops++ > 0 || m_mutators.size() < 2)
+			return;
+
+		std::unique_lock<std::mutex> lock(m_park_lock);
+		m_stop.store(true, std::memory_order_release);
+		m_parked.wait(lock, [this] {
+			return std::all_of(m_mutators.begin(), m_mutators.end(), [](Mutator *mutator) {
+				return mutator == current_mutator || mutator->m_parked.load();
+			});
+		});
+	}
+
+	void Heap::resume_world()
+	{
+		if (--m_stops > 0 || !m_stop.load())
+			return;
+
+		{
+			std::lock_guard<std::mutex> lock(m_park_lock);
+			m_stop.store(false, std::memory_order_release);
+		}
+		m_resume.notify_all();
+	}
+
+	/**
+	 * Gives the allocation buffers of all registered threads
+	 * back to the heap, before a collection walks the heap.
+	 */
+	void Heap::retire_tlabs()
+	{
+		for (Mutator *mutator : m_mutators)
+			retire_tlab(mutator);
+	}
+
+	/**
+	 * Sets the largest number of bytes the heap may map
+	 * from the OS, allocations that would need more after
+	 * a collection fail with an out of memory error.
+	 *
+	 * @param bytes The maximum size of the heap.
+	 */
+	void Heap::set_max_size(size_t bytes)
+	{
+		Heap &heap = Heap::the();
+		heap.m_max_size = bytes;
+	}
 
+	/**
+	 * Sets how much the heap is allowed to grow before
+	 * it collects again, as a factor of the size of the
+	 * chunks left alive by a collection.
+	 *
+	 * @param factor The growth factor, at least 1.
+	 */
+	void Heap::set_growth_factor(double factor)
+	{
 		Heap &heap = Heap::the();
+		heap.m_growth_factor = factor < 1.0 ? 1.0 : factor;
+	}
 
-		if (heap.profiler_enabled())
-			Profiler::record(CollectStart);
+	/**
+	 * Sets the policy that decides when the heap collects and
+	 * when it grows, see HEAP_GROWTH_FACTOR. The limit of the
+	 * next collection is unchanged until the next collection.
+	 *
+	 * @param growth_factor	The growth factor, at least 1, or 0
+	 * 						to keep the current one.
+	 *
+	 * @param min_interval	The least number of bytes the heap
+	 * 						may grow by after the live chunks of
+	 * 						a collection, or 0 to keep the current
+	 * 						one.
+	 *
+	 * @param max_size		The maximum size of the heap, or 0 to
+	 * 						keep the current one.
+	 */
+	void Heap::set_gc_policy(double growth_factor, size_t min_interval, size_t max_size)
+	{
+		Heap &heap = Heap::the();
+		if (growth_factor != 0.0)
+			set_growth_factor(growth_factor);
+		if (min_interval != 0)
+			heap.m_min_interval = min_interval;
+		if (max_size != 0)
+			set_max_size(max_size);
+	}
 
-		// get current stack frame
-		stack_bottom = reinterpret_cast<uintptr_t *>(__builtin_frame_address(0));
+	/**
+	 * Sets the number of mapped bytes at which the first
+	 * collection is triggered, and below which the limit of
+	 * the next collection is never set, see HEAP_INITIAL_SIZE.
+	 *
+	 * @param bytes	The initial size of the heap.
+	 */
+	void Heap::set_initial_size(size_t bytes)
+	{
+		Heap &heap = Heap::the();
+		Guard guard;
+		heap.m_initial_size = bytes;
+		if (heap.m_pause_times.count() == 0)
+			heap.m_collect_at = bytes;
+		else
+			heap.m_collect_at = std::max(heap.m_collect_at, bytes);
+	}
 
-		if (heap.m_stack_top == nullptr)
-			throw std::runtime_error(std::string("Error: Heap is not initialized, read the docs!"));
+	/**
+	 * Enables the incremental mode with a pause target, or
+	 * disables it with 0, see HEAP_MARK_STEP. The collection
+	 * that is marking when it is disabled is finished first.
+	 * The incremental marking is done by the allocating thread
+	 * alone, whatever the number of marking threads.
+	 *
+	 * @param micros	The longest pause of the steps of the
+	 * 					marking, in microseconds.
+	 */
+	void Heap::set_pause_target(size_t micros)
+	{
+		Heap &heap = Heap::the();
+		Guard guard;
+		if (micros == 0 && heap.m_marking)
+			heap.finish_marking();
+		heap.m_pause_target = micros * 1000;
+	}
+
+	/**
+	 * Reads the configuration of the heap from the CHEAP_*
+	 * environment variables, so that a program is tuned
+	 * without recompiling it or the library. Variables that
+	 * are not set keep the current value, sizes in bytes take
+	 * a suffix K, M or G, and invalid values are an error.
+	 *
+	 * CHEAP_GROWTH_FACTOR, CHEAP_MIN_INTERVAL and CHEAP_MAX_SIZE
+	 * are the policy of set_gc_policy(), CHEAP_INITIAL_SIZE the
+	 * size of set_initial_size(). CHEAP_PAGE_POLICY, before the
+	 * nursery is mapped, CHEAP_NURSERY_SIZE, CHEAP_MARK_THREADS,
+	 * CHEAP_LARGE_OBJECT, CHEAP_COMPACT_THRESHOLD, CHEAP_ALLOC_SAMPLING
+	 * and CHEAP_FINALIZER_THREAD, which 1 starts, are the arguments
+	 * of their setters, CHEAP_CENSUS is the file of set_census(),
+	 * CHEAP_STATS_FILE the file of set_stats_file() and
+	 * CHEAP_PAUSE_TARGET the target of set_pause_target().
+	 * CHEAP_PROFILER enables the profiler and records all events
+	 * with "all", function calls only with "calls" and chunk
+	 * operations only with "chunks", CHEAP_TRACE_FILE streams them
+	 * to a trace file.
+	 */
+	void Heap::load_policy()
+	{
+		set_gc_policy(env_number("CHEAP_GROWTH_FACTOR"), env_bytes("CHEAP_MIN_INTERVAL"), env_bytes("CHEAP_MAX_SIZE"));
+		if (size_t initial = env_bytes("CHEAP_INITIAL_SIZE"))
+			set_initial_size(initial);
+		set_page_policy(env_number("CHEAP_PAGE_POLICY"));
+		if (size_t nursery = env_bytes("CHEAP_NURSERY_SIZE"))
+			set_nursery_size(nursery);
+		if (double threads = env_number("CHEAP_MARK_THREADS"))
+			set_mark_threads(threads);
+		// 0 keeps the large objects in the regions
+		if (env_string("CHEAP_LARGE_OBJECT") != nullptr)
+			set_large_object_size(env_bytes("CHEAP_LARGE_OBJECT"));
+		if (double threshold = env_number("CHEAP_COMPACT_THRESHOLD"))
+			set_compact_threshold(threshold);
+		if (size_t interval = env_bytes("CHEAP_ALLOC_SAMPLING"))
+			set_alloc_sampling(interval);
+		if (const char *census = env_string("CHEAP_CENSUS"))
+			set_census(census);
+		if (const char *stats = env_string("CHEAP_STATS_FILE"))
+			set_stats_file(stats);
+		if (env_number("CHEAP_FINALIZER_THREAD") != 0.0)
+			set_finalizer_thread(true);
+		if (double target = env_number("CHEAP_PAUSE_TARGET"))
+			set_pause_target(target);
+
+		if (const char *mode = env_string("CHEAP_PROFILER"))
+		{
+			if (std::strcmp(mode, "all") == 0)
+				set_profiler_log_options(AllOps);
+			else if (std::strcmp(mode, "calls") == 0)
+				set_profiler_log_options(FunctionCalls);
+			else if (std::strcmp(mode, "chunks") == 0)
+				set_profiler_log_options(ChunkOps);
+			else
+				throw std::runtime_error(std::string("Error: Invalid value of CHEAP_PROFILER: ") + mode);
+			set_profiler(true);
+		}
+		if (const char *trace = env_string("CHEAP_TRACE_FILE"))
+			set_profiler_trace_file(trace);
+	}
 
-		// uintptr_t *stack_top = heap.m_stack_top;
+	static void pause_stats(const Histogram &times, cheap_pause_stats_t &stats)
+	{
+		stats.count = times.count();
+		stats.total_ns = times.total();
+		stats.p50_ns = times.percentile(0.5);
+		stats.p99_ns = times.percentile(0.99);
+		stats.max_ns = times.max();
+	}
 
-		//auto work_list = heap.m_allocated_chunks;
-		//mark(stack_bottom, stack_top, work_list);
+	/**
+	 * Fills in the statistics of the heap since init(), see
+	 * cheap_stats_t. The bytes allocated count the headers and
+	 * the rounding of the sizes, and include the objects still
+	 * in allocation buffers only once the buffers are retired.
+	 * Can be called from any registered thread at any time.
+	 *
+	 * @param stats	The statistics to fill in.
+	 */
+	void Heap::get_stats(cheap_stats_t *stats)
+	{
+		Heap &heap = Heap::the();
+		Guard guard;
+		stats->collections = heap.m_pause_times.count();
+		stats->minor_collections = heap.m_minor_pause_times.count();
+		stats->bytes_allocated = heap.m_allocated;
+		stats->bytes_reclaimed = heap.m_reclaimed;
+		stats->live_bytes = heap.m_live_estimate;
+		stats->mapped_bytes = heap.m_mapped;
+		stats->large_object_bytes = heap.m_large_object_bytes;
+		pause_stats(heap.m_pause_times, stats->pause);
+		pause_stats(heap.m_minor_pause_times, stats->minor_pause);
+		pause_stats(heap.m_roots_times, stats->find_roots);
+		pause_stats(heap.m_mark_times, stats->mark);
+		pause_stats(heap.m_sweep_times, stats->sweep);
+		pause_stats(heap.m_free_times, stats->free);
+	}
 
-		// Testing mark_hash, previous woking implementation above
-		// create_table();
-		// mark_hash(stack_bottom, stack_top);
+	/**
+	 * Fills in the pauses of the incremental mode, the first
+	 * pause and the steps of the marking of each collection,
+	 * its last pause is a collection pause of get_stats().
+	 * Kept out of cheap_stats_t, whose layout is part of the
+	 * interface of the release library.
+	 *
+	 * @param stats	The statistics to fill in.
+	 */
+	void Heap::get_step_stats(cheap_pause_stats_t *stats)
+	{
+		Heap &heap = Heap::the();
+		Guard guard;
+		pause_stats(heap.m_step_times, *stats);
+	}
 
-		create_table();
-		vector<uintptr_t *> roots;
-		// cout << "\nb4 find_roots\n";
-		find_roots(stack_bottom, roots);
+	/**
+	 * Sets which regions a collection compacts instead of
+	 * sweeping them, see HEAP_COMPACT_THRESHOLD.
+	 *
+	 * @param threshold	The share of the free bytes of a region
+	 * 					below which its largest free chunk makes
+	 * 					the next collection compact it, from 0,
+	 * 					which never compacts, to 1.
+	 */
+	void Heap::set_compact_threshold(double threshold)
+	{
+		Heap &heap = Heap::the();
+		heap.m_compact_threshold = std::clamp(threshold, 0.0, 1.0);
+	}
 
-		// cout << "b4 mark\n";''
-		mark(roots);
+	/**
+	 * Sets the size from which objects are allocated in the
+	 * large object space, see HEAP_LARGE_OBJECT. The objects
+	 * allocated before stay where they are.
+	 *
+	 * @param bytes	The least size of a large object, or 0 to
+	 * 				allocate all objects in the regions.
+	 */
+	void Heap::set_large_object_size(size_t bytes)
+	{
+		Heap &heap = Heap::the();
+		Guard guard;
+		heap.m_large_object_size = bytes;
+	}
+
+	/**
+	 * Sets how the memory mapped from now on is backed, see
+	 * HEAP_DONTNEED_MIN. Pre-faulting maps the pages right
+	 * away, huge pages make the regions HEAP_HUGE_PAGE bytes,
+	 * aligned to it, and ask the OS for transparent huge
+	 * pages, which it may not grant.
+	 *
+	 * @param flags	CHEAP_PAGES_PREFAULT and CHEAP_PAGES_HUGE,
+	 * 				or 0 for the default policy.
+	 */
+	void Heap::set_page_policy(unsigned long flags)
+	{
+		Heap &heap = Heap::the();
+		Guard guard;
+		heap.m_page_policy = flags & (CHEAP_PAGES_PREFAULT | CHEAP_PAGES_HUGE);
+		heap.m_region_size = flags & CHEAP_PAGES_HUGE ? HEAP_HUGE_PAGE : HEAP_REGION_SIZE;
+	}
+
+	/**
+	 * Selects how collections find the roots, by scanning
+	 * the whole stack conservatively or by visiting the
+	 * roots on the shadow stack of a program compiled
+	 * with gc "shadow-stack".
+	 *
+	 * @param mode	The root mode.
+	 */
+	void Heap::set_root_mode(RootMode mode)
+	{
+		Heap &heap = Heap::the();
+		if (mode == ShadowStackRoots && (heap.m_mutators.size() > 1 || heap.m_finalizer_thread.joinable()))
+			throw std::runtime_error(std::string("Error: The shadow stack root mode supports a single thread"));
+		heap.m_root_mode = mode;
+	}
+
+	/**
+	 * Sets the number of threads that mark the heap in a
+	 * collection, the collecting thread included. With more
+	 * than one, the extra threads are started here and wait
+	 * for the collections.
+	 *
+	 * @param threads	The number of threads, 1 by default.
+	 */
+	void Heap::set_mark_threads(size_t threads)
+	{
+		Guard guard;
+		Marker::set_threads(threads);
+	}
+
+	/**
+	 * Enables the generational mode with a nursery of a given
+	 * size, or disables it with a size of 0. Objects up to
+	 * CHEAP_TLAB_OBJ_MAX bytes are then bumped from the blocks
+	 * of the nursery, and the survivors are copied to the old
+	 * generation, the regions collected by mark-sweep, when the
+	 * nursery is full. The objects in the nursery are moved to
+	 * the old generation before the nursery is changed.
+	 *
+	 * Words of heap objects that point into a nursery object
+	 * are taken as references to it and are updated when it is
+	 * copied, words on the stack pin the object in place.
+	 *
+	 * @param bytes	The size of the nursery, rounded up to
+	 * 				whole blocks of HEAP_NURSERY_BLOCK bytes.
+	 */
+	void Heap::set_nursery_size(size_t bytes)
+	{
+		Heap &heap = Heap::the();
+		Guard guard;
+		if (!heap.m_nursery.empty())
+		{
+			__builtin_unwind_init();
+			heap.stop_world();
+			heap.retire_tlabs();
+			heap.evacuate_nursery();
+			for (Region *block : heap.m_nursery)
+				heap.release_region(block);
+			heap.m_nursery.clear();
+			heap.resume_world();
+		}
+
+		for (size_t mapped = 0; mapped < bytes; mapped += HEAP_NURSERY_BLOCK)
+		{
+			Region *block = heap.map_region(HEAP_NURSERY_BLOCK);
+			if (block == nullptr)
+				throw std::runtime_error(std::string("Error: Heap out of memory"));
+			block->m_young = true;
+			heap.m_nursery.push_back(block);
+		}
+		heap.m_nursery_next = 0;
+	}
+
+	/**
+	 * The write barrier of the generational and the incremental
+	 * mode, to be called after a pointer is stored into an object
+	 * that may be in the old generation. The object is added to
+	 * the remembered set, and its words are roots of the next
+	 * minor collection. Stores into objects of the nursery, and
+	 * the stores that initialise an object allocated in the old
+	 * generation, do not need the barrier.
+	 *
+	 * While an incremental collection marks, a marked object is
+	 * made grey again, as it may have been scanned before the
+	 * store, Steele's barrier, so that the pointer stored into it
+	 * is found. Objects allocated while marking are marked and
+	 * grey, and are scanned by a later step, so their initialising
+	 * stores need no barrier either.
+	 *
+	 * Time complexity: O(log R), where R is the number of
+	 * 					regions.
+	 *
+	 * @param obj	The object that was stored into.
+	 */
+	void Heap::write_barrier(void *obj)
+	{
+		Heap &heap = Heap::the();
+		if (heap.m_nursery.empty() && !heap.m_marking)
+			return;
+
+		Guard guard;
+		Region *region;
+		char *chunk = heap.find_chunk(reinterpret_cast<uintptr_t>(obj), region);
+		if (chunk == nullptr || region->m_young)
+			return;
+		if (!heap.m_nursery.empty())
+			heap.remember(chunk);
+		// A marked chunk may be black, scanned before the store
+		if (heap.m_marking && region->is_marked(chunk) && (heap.m_grey.empty() || heap.m_grey.back() != chunk))
+			heap.m_grey.push_back(chunk);
+	}
+
+	/**
+	 * Adds an old chunk to the remembered set, once.
+	 *
+	 * @param chunk	The header of the chunk.
+	 */
+	void Heap::remember(char *chunk)
+	{
+		if (chunk_flags(chunk) & HEADER_REMEMBERED)
+			return;
+		*reinterpret_cast<size_t *>(chunk) |= HEADER_REMEMBERED;
+		m_remembered.push_back(chunk);
+	}
+
+	/**
+	 * Allocates a given amount of bytes on the heap.
+	 * The request is rounded up to a whole number of
+	 * size-class granules and served from the free
+	 * lists first. Only if no free chunk fits, the
+	 * chunk is bumped from a region. If no region has
+	 * room for it, a collection is triggered once the
+	 * heap has grown to its collection limit, and only
+	 * if that does not free a fitting chunk either, a
+	 * new region is mapped.
+	 *
+	 * @param size The amount of bytes to be allocated.
+	 *
+	 * @return  A pointer to the address where the memory
+	 *          has been allocated. This pointer is supposed
+	 *          to be casted to and object pointer.
+	 */
+	void *Heap::alloc(size_t size)
+	{
+		// Singleton
+		Heap &heap = Heap::the();
+		Guard guard;
+		bool profiler_enabled = heap.profiler_enabled();
+		std::chrono::high_resolution_clock::time_point a_start;
+
+		if (profiler_enabled)
+		{
+			a_start = time_now;
+			Profiler::record(AllocStart, size);
+		}
+
+		if (size == 0)
+		{
+#ifndef CHEAP_RELEASE
+			cout << "Heap: Cannot alloc 0B. No bytes allocated." << endl;
+#endif
+			return nullptr;
+		}
+
+		size = size_class_round(size);
+		heap.m_allocated += HEADER_SIZE + size;
+		heap.mark_step();
+
+		// In the generational mode small objects are bumped from
+		// the nursery, which is evacuated when it is full
+		if (!heap.m_nursery.empty() && size <= CHEAP_TLAB_OBJ_MAX)
+		{
+			Region *block;
+			char *young_chunk = heap.bump_nursery(HEADER_SIZE + size, block);
+			if (young_chunk == nullptr)
+			{
+				heap.collect_nursery();
+				young_chunk = heap.bump_nursery(HEADER_SIZE + size, block);
+			}
+			set_header(young_chunk, size);
+			block->set_start(young_chunk);
+			if (profiler_enabled)
+			{
+				record_chunk(NewChunk, young_chunk);
+				Profiler::record(AllocStart, to_us(time_now - a_start));
+			}
+			return young_chunk + HEADER_SIZE;
+		}
+
+		// Large objects get a mapping of their own
+		if (heap.m_large_object_size > 0 && size >= heap.m_large_object_size)
+		{
+			char *large_chunk = heap.alloc_large_object(size);
+			if (!heap.m_nursery.empty())
+				heap.remember(large_chunk);
+			if (heap.m_marking)
+				heap.mark_allocated(large_chunk, heap.find_region(reinterpret_cast<uintptr_t>(large_chunk)));
+			if (profiler_enabled)
+			{
+				record_chunk(NewChunk, large_chunk);
+				Profiler::record(AllocStart, to_us(time_now - a_start));
+			}
+			return large_chunk + HEADER_SIZE;
+		}
+
+		// If a chunk was recycled, return the old chunk address
+		char *reused_chunk = heap.recycle_or_sweep(size);
+		if (reused_chunk != nullptr)
+		{
+			// Its initialising stores have no write barrier
+			if (!heap.m_nursery.empty())
+				heap.remember(reused_chunk);
+			if (heap.m_marking)
+				heap.mark_allocated(reused_chunk, heap.find_region(reinterpret_cast<uintptr_t>(reused_chunk)));
+			if (profiler_enabled)
+			{
+				record_chunk(ReusedChunk, reused_chunk);
+				Profiler::record(AllocStart, to_us(time_now - a_start));
+			}
+			return reused_chunk + HEADER_SIZE;
+		}
+
+		// If no free chunks was found (reused_chunk is a nullptr),
+		// then create a new chunk at the top of a region. The
+		// incremental mode grows the heap while it marks, and
+		// finishes the collection once it cannot grow
+		char *new_chunk = heap.bump(HEADER_SIZE + size);
+		bool collected = false;
+		if (new_chunk == nullptr && heap.m_mapped >= heap.m_collect_at && !heap.collect_incrementally())
+		{
+			heap.collect();
+			collected = true;
+		}
+		else if (new_chunk == nullptr && heap.grow(HEADER_SIZE + size))
+			new_chunk = heap.bump(HEADER_SIZE + size);
+		if (new_chunk == nullptr && heap.m_marking)
+		{
+			heap.finish_marking();
+			collected = true;
+		}
+		if (collected)
+		{
+			reused_chunk = heap.recycle_or_sweep(size);
+			if (reused_chunk != nullptr)
+			{
+				if (!heap.m_nursery.empty())
+					heap.remember(reused_chunk);
+				if (heap.m_marking)
+					heap.mark_allocated(reused_chunk, heap.find_region(reinterpret_cast<uintptr_t>(reused_chunk)));
+				if (profiler_enabled)
+				{
+					record_chunk(ReusedChunk, reused_chunk);
+					Profiler::record(AllocStart, to_us(time_now - a_start));
+				}
+				return reused_chunk + HEADER_SIZE;
+			}
+			new_chunk = heap.bump(HEADER_SIZE + size);
+			if (new_chunk == nullptr && heap.grow(HEADER_SIZE + size))
+				new_chunk = heap.bump(HEADER_SIZE + size);
+		}
+
+		// If memory is not enough after collect, crash with OOM error
+		if (new_chunk == nullptr)
+		{
+			if (profiler_enabled)
+				Profiler::dispose();
+			throw std::runtime_error(std::string("Error: Heap out of memory"));
+		}
+
+		set_header(new_chunk, size);
+		heap.m_bump_region->set_start(new_chunk);
+		if (!heap.m_nursery.empty())
+			heap.remember(new_chunk);
+		if (heap.m_marking)
+			heap.mark_allocated(new_chunk, heap.m_bump_region);
+
+		if (profiler_enabled)
+		{
+			record_chunk(NewChunk, new_chunk);
+			Profiler::record(AllocStart, to_us(time_now - a_start));
+		}
+		return new_chunk + HEADER_SIZE;
+	}
+
+	/**
+	 * The slow path of cheap_alloc_inline(), called when
+	 * the thread-local allocation buffer cannot fit the
+	 * request. The used part of the buffer is retired and
+	 * a new buffer is reserved, unless the profiler is
+	 * enabled or the request is too large for a buffer.
+	 * In that case, and if there is no room for a new
+	 * buffer, the request goes through alloc(). In the
+	 * generational mode a full nursery is evacuated to
+	 * make room for the buffer.
+	 *
+	 * The allocation samples of allocation-site profiling
+	 * are taken here, as the bytes allocated since the last
+	 * refill are known without touching the fast path.
+	 *
+	 * @param size The amount of bytes to be allocated.
+	 *
+	 * @param site The allocation site in the compiled code,
+	 * 			   or CHEAP_SITE_UNKNOWN.
+	 *
+	 * @param descriptor The pointer map of a typed object, or
+	 * 					 CHEAP_ALL_POINTERS.
+	 *
+	 * @return  A pointer to the allocated memory.
+	 */
+	__attribute__((noinline)) void *Heap::alloc_refill(size_t size, size_t site, size_t descriptor)
+	{
+		Heap &heap = Heap::the();
+		Guard guard;
+		Mutator *mutator = Heap::mutator();
+		heap.retire_tlab(mutator);
+		heap.mark_step();
+
+		void *obj = nullptr;
+		if (!heap.m_profiler_enable && size != 0 && size <= CHEAP_TLAB_OBJ_MAX)
+		{
+			if (heap.refill_tlab())
+				obj = cheap_alloc_inline(size);
+			// The nursery is full
+			else if (!heap.m_nursery.empty())
+			{
+				heap.collect_nursery();
+				if (heap.refill_tlab())
+					obj = cheap_alloc_inline(size);
+			}
+		}
+		if (obj == nullptr)
+		{
+			obj = alloc(size);
+			// The buffers are counted as they are retired
+			if (heap.m_sample_interval > 0 && obj != nullptr)
+				mutator->m_sample_left -= static_cast<long>(HEADER_SIZE + chunk_size(static_cast<char *>(obj) - HEADER_SIZE));
+		}
+
+		if (obj != nullptr)
+			*reinterpret_cast<size_t *>(static_cast<char *>(obj) - HEADER_SIZE) |= cheap_header_type(descriptor);
+		if (heap.m_sample_interval > 0 && obj != nullptr)
+			heap.sample(mutator, obj, site);
+		return obj;
+	}
+
+	/**
+	 * The slow path of cheap_alloc_group(), called when the
+	 * group does not fit in the thread-local allocation
+	 * buffer. A group that fits in a buffer is bumped from a
+	 * new one, like in alloc_refill(). Larger groups, and all
+	 * groups while the profiler is enabled, are allocated as
+	 * one chunk through alloc(), which is split into the
+	 * chunks of the objects, the last one keeping any slack of
+	 * the chunk. In the generational mode, the split chunks
+	 * are remembered if the chunk was, as their initialising
+	 * stores have no write barrier either, and they are marked
+	 * like the chunk while marking incrementally.
+	 *
+	 * One allocation sample at most is taken for the group,
+	 * of its first object.
+	 *
+	 * @param sizes			The sizes of the objects.
+	 *
+	 * @param descriptors	The pointer maps of typed objects,
+	 * 						or nullptr for untyped ones.
+	 *
+	 * @param n				The number of objects.
+	 *
+	 * @param site			The allocation site in the compiled
+	 * 						code, or CHEAP_SITE_UNKNOWN.
+	 *
+	 * @returns The first object of the group, or nullptr if
+	 * 			the group is empty or holds an object of 0
+	 * 			bytes.
+	 */
+	__attribute__((noinline)) void *Heap::alloc_group(const size_t *sizes, const size_t *descriptors, size_t n, size_t site)
+	{
+		Heap &heap = Heap::the();
+		Guard guard;
+		Mutator *mutator = Heap::mutator();
+
+		size_t total = 0;
+		bool small = true;
+		for (size_t i = 0; i < n; i++)
+		{
+			if (sizes[i] == 0)
+			{
+#ifndef CHEAP_RELEASE
+				cout << "Heap: Cannot alloc 0B. No bytes allocated." << endl;
+#endif
+				return nullptr;
+			}
+			small &= sizes[i] <= CHEAP_TLAB_OBJ_MAX;
+			total += HEADER_SIZE + size_class_round(sizes[i]);
+		}
+		if (n == 0)
+			return nullptr;
+
+		heap.retire_tlab(mutator);
+		heap.mark_step();
+		char *first = nullptr;
+		if (!heap.m_profiler_enable && small && total <= CHEAP_TLAB_SIZE)
+		{
+			bool refilled = heap.refill_tlab();
+			// The nursery is full
+			if (!refilled && !heap.m_nursery.empty())
+			{
+				heap.collect_nursery();
+				refilled = heap.refill_tlab();
+			}
+			if (refilled)
+			{
+				first = mutator->m_tlab->cur;
+				char *chunk = first;
+				for (size_t i = 0; i < n; chunk = next_chunk(chunk), i++)
+					set_header(chunk, size_class_round(sizes[i]));
+				mutator->m_tlab->cur = chunk;
+			}
+		}
+		if (first == nullptr)
+		{
+			first = static_cast<char *>(alloc(total - HEADER_SIZE)) - HEADER_SIZE;
+			if (heap.m_sample_interval > 0)
+				mutator->m_sample_left -= static_cast<long>(HEADER_SIZE + chunk_size(first));
+
+			Region *region = heap.find_region(reinterpret_cast<uintptr_t>(first));
+			bool remembered = chunk_flags(first) & HEADER_REMEMBERED;
+			char *end = next_chunk(first);
+			char *chunk = first;
+			for (size_t i = 0; i < n; chunk = next_chunk(chunk), i++)
+			{
+				size_t size = i + 1 < n ? size_class_round(sizes[i]) : end - chunk - HEADER_SIZE;
+				set_header(chunk, size, i == 0 && remembered ? HEADER_REMEMBERED : 0);
+				region->set_start(chunk);
+				if (i > 0 && remembered)
+					heap.remember(chunk);
+				if (i > 0 && heap.m_marking)
+					heap.mark_allocated(chunk, region);
+			}
+		}
+
+		if (descriptors != nullptr)
+		{
+			char *chunk = first;
+			for (size_t i = 0; i < n; chunk = next_chunk(chunk), i++)
+				*reinterpret_cast<size_t *>(chunk) |= cheap_header_type(descriptors[i]);
+		}
+		if (heap.m_sample_interval > 0)
+			heap.sample(mutator, first + HEADER_SIZE, site);
+		return first + HEADER_SIZE;
+	}
+
+	/**
+	 * Takes an allocation sample once the bytes a thread
+	 * allocated add up to the sampling interval, as counted
+	 * by retire_tlab() and alloc_refill(). The sample stands
+	 * for the intervals that passed, and keeps the return
+	 * addresses of the stack above the runtime, the frames
+	 * of this function, alloc_refill() and the
+	 * cheap_alloc_refill() that called it are skipped.
+	 * Whether the sampled object survives is settled by
+	 * the next collection.
+	 *
+	 * @param mutator	The allocating thread.
+	 *
+	 * @param obj		The allocated object.
+	 *
+	 * @param site		The allocation site of the object.
+	 */
+	__attribute__((noinline)) void Heap::sample(Mutator *mutator, void *obj, size_t site)
+	{
+		if (mutator->m_sample_left >= 0)
+			return;
+
+		auto interval = static_cast<long>(m_sample_interval);
+		long intervals = (interval - 1 - mutator->m_sample_left) / interval;
+		mutator->m_sample_left += intervals * interval;
+
+		uintptr_t stack[HEAP_SAMPLE_DEPTH];
+		size_t depth = 0;
+		auto frame = static_cast<uintptr_t *>(__builtin_frame_address(0));
+		for (size_t skip = 0; frame != nullptr && frame + 2 <= mutator->m_stack_top && depth < HEAP_SAMPLE_DEPTH; skip++)
+		{
+			if (skip >= 2)
+				stack[depth++] = frame[1];
+			auto caller_frame = reinterpret_cast<uintptr_t *>(frame[0]);
+			if (caller_frame <= frame)
+				break;
+			frame = caller_frame;
+		}
+
+		char *chunk = static_cast<char *>(obj) - HEADER_SIZE;
+		size_t weight = intervals * interval;
+		size_t objects = std::max(static_cast<size_t>(1), weight / (HEADER_SIZE + chunk_size(chunk)));
+		size_t entry = Profiler::record_sample(stack, depth, site, weight, objects);
+		m_samples.push_back({chunk, entry, weight, objects});
+	}
+
+	/**
+	 * Settles whether the pending allocation samples survived,
+	 * after the nursery was evacuated or the heap was marked.
+	 * A young sample survived if it was copied or pinned, an
+	 * old one if it is marked. A sample is settled once, so
+	 * the moves of later collections need not be followed.
+	 *
+	 * @param young_only	Only settle the samples in the
+	 * 						nursery, for a minor collection.
+	 */
+	void Heap::settle_samples(bool young_only)
+	{
+		size_t kept = 0;
+		for (AllocSample &sample : m_samples)
+		{
+			Region *region = find_region(reinterpret_cast<uintptr_t>(sample.m_chunk));
+			if (young_only && !region->m_young)
+			{
+				m_samples[kept++] = sample;
+				continue;
+			}
+			if (chunk_flags(sample.m_chunk) & HEADER_FORWARDED || region->is_marked(sample.m_chunk))
+				Profiler::record_survivor(sample.m_entry, sample.m_bytes, sample.m_objects);
+		}
+		m_samples.resize(kept);
+	}
+
+	/**
+	 * Enables allocation-site profiling, see HEAP_SAMPLE_INTERVAL.
+	 *
+	 * @param bytes	The sampling interval in bytes, or 0 to
+	 * 				disable the sampling.
+	 */
+	void Heap::set_alloc_sampling(size_t bytes)
+	{
+		Heap &heap = Heap::the();
+		Guard guard;
+		heap.m_sample_interval = bytes;
+		for (Mutator *mutator : heap.m_mutators)
+			mutator->m_sample_left = bytes;
+	}
+
+	/**
+	 * Names the allocation sites of the compiled code, a
+	 * site is the index of its name.
+	 *
+	 * @param names	A null-terminated array of names, that
+	 * 				lives until the heap is disposed.
+	 */
+	void Heap::set_alloc_sites(const char **names)
+	{
+		Profiler::set_alloc_sites(names);
+	}
+
+	/**
+	 * Appends a census of the live objects to a file after
+	 * every collection, see write_census().
+	 *
+	 * @param path	The file, which is truncated, or a nullptr
+	 * 				to stop the census.
+	 */
+	void Heap::set_census(const char *path)
+	{
+		Heap &heap = Heap::the();
+		Guard guard;
+		if (heap.m_census != nullptr)
+			std::fclose(heap.m_census);
+		heap.m_census = nullptr;
+		if (path == nullptr)
+			return;
+
+		heap.m_census = std::fopen(path, "w");
+		if (heap.m_census == nullptr)
+			throw std::runtime_error(std::string("Error: Cannot open the census file ") + path);
+	}
+
+	/**
+	 * Has dispose() write the statistics of the heap to a file,
+	 * see write_stats(). The file is opened here, so that a
+	 * program that cannot write it fails at the start.
+	 *
+	 * @param path	The file, which is truncated, or a nullptr
+	 * 				to write none.
+	 */
+	void Heap::set_stats_file(const char *path)
+	{
+		Heap &heap = Heap::the();
+		Guard guard;
+		if (heap.m_stats_file != nullptr)
+			std::fclose(heap.m_stats_file);
+		heap.m_stats_file = nullptr;
+		if (path == nullptr)
+			return;
+
+		heap.m_stats_file = std::fopen(path, "w");
+		if (heap.m_stats_file == nullptr)
+			throw std::runtime_error(std::string("Error: Cannot open the statistics file ") + path);
+	}
+
+	/**
+	 * Has the next collection write a snapshot of the live
+	 * objects, see write_snapshot(). The file is opened here,
+	 * so that the collection does not fail on it.
+	 *
+	 * @param path	The file the snapshot is written to, which
+	 * 				is truncated.
+	 */
+	void Heap::heap_snapshot(const char *path)
+	{
+		Heap &heap = Heap::the();
+		Guard guard;
+		if (heap.m_snapshot != nullptr)
+			std::fclose(heap.m_snapshot);
+		heap.m_snapshot = std::fopen(path, "wb");
+		if (heap.m_snapshot == nullptr)
+			throw std::runtime_error(std::string("Error: Cannot open the snapshot file ") + path);
+		std::setvbuf(heap.m_snapshot, nullptr, _IOFBF, SNAPSHOT_BUFFER);
+	}
+
+	/**
+	 * Counts the chunks of the old generation per size.
+	 *
+	 * Time complexity: O(N log S), where N is the number of
+	 * 					chunks and S the number of sizes.
+	 *
+	 * @param sizes		The number of chunks and their bytes,
+	 * 					headers included, per chunk size.
+	 *
+	 * @param live_only	Only count the chunks marked by the
+	 * 					collection, or else all allocated
+	 * 					chunks, of the nursery as well.
+	 */
+	void Heap::census(std::map<size_t, std::pair<size_t, size_t>> &sizes, bool live_only)
+	{
+		for (Region *region : m_regions)
+		{
+			if (live_only && region->m_young)
+				continue;
+			for (char *chunk = region->m_start; chunk < region->m_top; chunk = next_chunk(chunk))
+			{
+				if (chunk_flags(chunk) & HEADER_FREE || (live_only && !region->is_marked(chunk)))
+					continue;
+				auto &[count, bytes] = sizes[chunk_size(chunk)];
+				count++;
+				bytes += HEADER_SIZE + chunk_size(chunk);
+			}
+		}
+	}
+
+	/**
+	 * Appends the census of the objects marked by the current
+	 * collection to the census file, a line with the number of
+	 * the collection, the live objects and their bytes, then a
+	 * line per object size with the objects of the size and
+	 * their bytes, headers included, and an empty line. The
+	 * file is flushed, so a census survives a crash.
+	 */
+	void Heap::write_census()
+	{
+		std::map<size_t, std::pair<size_t, size_t>> sizes;
+		census(sizes, true);
+		size_t objects = 0, bytes = 0;
+		for (auto &[size, totals] : sizes)
+		{
+			objects += totals.first;
+			bytes += totals.second;
+		}
+
+		std::fprintf(m_census, "collection %lu: %lu objects, %lu bytes\n", m_pause_times.count() + 1, objects, bytes);
+		for (auto &[size, totals] : sizes)
+			std::fprintf(m_census, "%lu\t%lu\t%lu\n", size, totals.first, totals.second);
+		std::fprintf(m_census, "\n");
+		std::fflush(m_census);
+	}
+
+	/**
+	 * Writes the snapshot requested by heap_snapshot(), at
+	 * the end of the mark phase. The objects a root points
+	 * into come first, then every marked object with the
+	 * objects that its words point into, as the marking
+	 * found them. The header is written last, once the
+	 * counts are known.
+	 *
+	 * Time complexity: O(W log R), where W is the number of
+	 * 					words of the live objects and R the
+	 * 					number of regions.
+	 *
+	 * @param roots	The roots of the collection.
+	 */
+	void Heap::write_snapshot(const vector<uintptr_t> &roots)
+	{
+		std::FILE *file = m_snapshot;
+		m_snapshot = nullptr;
+
+		SnapshotHeader header {};
+		std::memcpy(header.m_magic, SNAPSHOT_MAGIC, sizeof(header.m_magic));
+		header.m_version = SNAPSHOT_VERSION;
+		header.m_object_size = sizeof(SnapshotObject);
+		std::fwrite(&header, sizeof(header), 1, file);
+
+		// The address of the live object a word points into
+		auto target = [this](uintptr_t word) -> uint64_t {
+			Region *region;
+			char *chunk = find_chunk(word, region);
+			if (chunk == nullptr || region->m_young || !region->is_marked(chunk))
+				return 0;
+			return reinterpret_cast<uint64_t>(chunk + HEADER_SIZE);
+		};
+
+		vector<uint64_t> addresses;
+		for (uintptr_t root : roots)
+			if (uint64_t address = target(root))
+				addresses.push_back(address);
+		std::sort(addresses.begin(), addresses.end());
+		addresses.erase(std::unique(addresses.begin(), addresses.end()), addresses.end());
+		std::fwrite(addresses.data(), sizeof(uint64_t), addresses.size(), file);
+		header.m_roots = addresses.size();
+
+		for (Region *region : m_regions)
+		{
+			if (region->m_young)
+				continue;
+			for (char *chunk = region->m_start; chunk < region->m_top; chunk = next_chunk(chunk))
+			{
+				if (chunk_flags(chunk) & HEADER_FREE || !region->is_marked(chunk))
+					continue;
+				addresses.clear();
+				for_each_pointer(chunk, [&](uintptr_t word) {
+					if (uint64_t address = target(word))
+						addresses.push_back(address);
+				});
+
+				SnapshotObject object {reinterpret_cast<uint64_t>(chunk + HEADER_SIZE), chunk_size(chunk), addresses.size()};
+				std::fwrite(&object, sizeof(object), 1, file);
+				std::fwrite(addresses.data(), sizeof(uint64_t), addresses.size(), file);
+				header.m_objects++;
+				header.m_edges += addresses.size();
+			}
+		}
+
+		std::fseek(file, 0, SEEK_SET);
+		std::fwrite(&header, sizeof(header), 1, file);
+		std::fclose(file);
+	}
+
+	/**
+	 * Writes the statistics of get_stats() and get_step_stats()
+	 * to the statistics file as one JSON object on a line, with
+	 * the peak resident set of the process in kilobytes, so that
+	 * a program is measured without changing it. The pauses are
+	 * flattened to the count, total, percentiles and maximum of
+	 * each histogram, like "pause_p99_ns".
+	 */
+	void Heap::write_stats()
+	{
+		cheap_stats_t stats;
+		get_stats(&stats);
+		cheap_pause_stats_t steps;
+		get_step_stats(&steps);
+		struct rusage usage;
+		getrusage(RUSAGE_SELF, &usage);
+
+		std::FILE *file = m_stats_file;
+		m_stats_file = nullptr;
+		std::fprintf(file, "{\"collections\": %lu, \"minor_collections\": %lu, \"bytes_allocated\": %lu, "
+			"\"bytes_reclaimed\": %lu, \"live_bytes\": %lu, \"mapped_bytes\": %lu, \"large_object_bytes\": %lu, "
+			"\"max_rss_kb\": %ld",
+			stats.collections, stats.minor_collections, stats.bytes_allocated, stats.bytes_reclaimed,
+			stats.live_bytes, stats.mapped_bytes, stats.large_object_bytes, usage.ru_maxrss);
+		const std::pair<const char *, const cheap_pause_stats_t *> pauses[] = {
+			{"pause", &stats.pause}, {"minor_pause", &stats.minor_pause}, {"find_roots", &stats.find_roots},
+			{"mark", &stats.mark}, {"sweep", &stats.sweep}, {"free", &stats.free}, {"steps", &steps},
+		};
+		for (auto &[name, pause] : pauses)
+			std::fprintf(file, ", \"%s_count\": %lu, \"%s_total_ns\": %lu, \"%s_p50_ns\": %lu, "
+				"\"%s_p99_ns\": %lu, \"%s_max_ns\": %lu",
+				name, pause->count, name, pause->total_ns, name, pause->p50_ns, name, pause->p99_ns,
+				name, pause->max_ns);
+		std::fprintf(file, "}\n");
+		std::fclose(file);
+	}
+
+	/**
+	 * Bumps a block of memory from the region new chunks
+	 * are bumped from. If it does not fit, the remaining
+	 * space of the region is retired and an empty region
+	 * is bumped from instead, if there is one. This never
+	 * triggers a collection and never maps a region.
+	 *
+	 * @param bytes The size of the block, including the
+	 * 				header if it is to hold a chunk.
+	 *
+	 * @returns The start of the block, or a nullptr if no
+	 * 			region has room for it.
+	 */
+	char *Heap::bump(size_t bytes)
+	{
+		Region *region = m_bump_region;
+		if (region == nullptr || static_cast<size_t>(region->m_end - region->m_top) < bytes)
+		{
+			auto fits = [bytes](Region *r) {
+				return !r->m_young && r->m_top == r->m_start && static_cast<size_t>(r->m_end - r->m_start) >= bytes;
+			};
+			auto iter = std::find_if(m_regions.begin(), m_regions.end(), fits);
+			if (iter == m_regions.end())
+				return nullptr;
+			retire_region();
+			region = m_bump_region = *iter;
+		}
+
+		char *block = region->m_top;
+		region->m_top += bytes;
+		return block;
+	}
+
+	/**
+	 * Bumps a block of memory from the nursery, from the
+	 * next block of the nursery if it does not fit in the
+	 * current one. This never triggers a collection.
+	 *
+	 * @param bytes 	The size of the block of memory, at
+	 * 					most HEAP_NURSERY_BLOCK bytes less
+	 * 					the layout of a region.
+	 *
+	 * @param region	Set to the nursery block.
+	 *
+	 * @returns The start of the memory, or a nullptr if the
+	 * 			nursery is full.
+	 */
+	char *Heap::bump_nursery(size_t bytes, Region *&region)
+	{
+		for (; m_nursery_next < m_nursery.size(); m_nursery_next++)
+		{
+			region = m_nursery[m_nursery_next];
+			if (static_cast<size_t>(region->m_end - region->m_top) >= bytes)
+			{
+				char *block = region->m_top;
+				region->m_top += bytes;
+				return block;
+			}
+		}
+		return nullptr;
+	}
+
+	/**
+	 * Turns the remaining space of the region new chunks
+	 * are bumped from into a free chunk, to be able to
+	 * bump from another region.
+	 */
+	void Heap::retire_region()
+	{
+		Region *region = m_bump_region;
+		if (region == nullptr)
+			return;
+
+		size_t tail = region->m_end - region->m_top;
+		if (tail >= MIN_SPLIT)
+		{
+			set_header(region->m_top, tail - HEADER_SIZE, HEADER_FREE);
+			region->set_start(region->m_top);
+			add_free_chunk(region->m_top);
+			region->m_top = region->m_end;
+		}
+		else if (tail == HEADER_SIZE)
+		{
+			set_header(region->m_top, 0, HEADER_FREE);
+			region->set_start(region->m_top);
+			region->m_top = region->m_end;
+		}
+		m_bump_region = nullptr;
+	}
+
+	/**
+	 * Maps a new region from the OS and makes it the one
+	 * new chunks are bumped from. The region has a size
+	 * of HEAP_REGION_SIZE bytes, or HEAP_HUGE_PAGE with huge
+	 * pages, or more if it is to hold a larger block.
+	 *
+	 * @param bytes The size of the block the region must
+	 * 				be able to hold.
+	 *
+	 * @returns True if the region was mapped, false if it
+	 * 			would make the heap exceed its maximum size
+	 * 			or the OS is out of memory.
+	 */
+	bool Heap::grow(size_t bytes)
+	{
+		// Regions stay a multiple of the huge page to be aligned
+		const size_t page = m_page_policy & CHEAP_PAGES_HUGE ? HEAP_HUGE_PAGE : sysconf(_SC_PAGESIZE);
+
+		size_t mapped = m_region_size;
+		while (region_layout(mapped) + bytes > mapped)
+			mapped = (region_layout(mapped) + bytes + page - 1) / page * page;
+
+		Region *region = map_region(mapped);
+		if (region == nullptr)
+			return false;
+
+		retire_region();
+		m_bump_region = region;
+		return true;
+	}
+
+	/**
+	 * Allocates a large object in a region of its own, mapped
+	 * to fit the object to the page, see HEAP_LARGE_OBJECT.
+	 * The region counts towards the size of the heap like the
+	 * others, so the heap is collected first if the mapping
+	 * reaches the collection limit, or its incremental marking
+	 * is started.
+	 *
+	 * @param size	The size of the object, rounded to a size
+	 * 				class.
+	 *
+	 * @returns The header of the object.
+	 */
+	char *Heap::alloc_large_object(size_t size)
+	{
+		const size_t page = sysconf(_SC_PAGESIZE);
+
+		size_t bytes = HEADER_SIZE + size;
+		size_t mapped = (bytes + page - 1) / page * page;
+		while (region_layout(mapped) + bytes > mapped)
+			mapped = (region_layout(mapped) + bytes + page - 1) / page * page;
+
+		if (m_mapped + mapped >= m_collect_at && !collect_incrementally())
+			collect();
+		Region *region = map_region(mapped);
+		if (region == nullptr && m_marking)
+		{
+			finish_marking();
+			region = map_region(mapped);
+		}
+		if (region == nullptr)
+		{
+			if (profiler_enabled())
+				Profiler::dispose();
+			throw std::runtime_error(std::string("Error: Heap out of memory"));
+		}
+
+		region->m_large_object = true;
+		char *chunk = region->m_start;
+		set_header(chunk, size);
+		region->set_start(chunk);
+		region->m_top = chunk + bytes;
+		m_large_objects.push_back(region);
+		m_large_object_bytes += mapped;
+		return chunk;
+	}
+
+	/**
+	 * Sweeps the large object space, unmaps the regions of the
+	 * large objects that were not marked and clears the marks
+	 * of the others. A region holds more than one chunk if it
+	 * was split by alloc_group(), it is unmapped once none of
+	 * them is marked.
+	 *
+	 * Time complexity: O(L), where L is the number of chunks
+	 * 					in the large object space, plus O(R) per
+	 * 					unmapped region, where R is the number
+	 * 					of regions.
+	 */
+	void Heap::sweep_large_objects()
+	{
+		size_t kept = 0;
+		for (Region *region : m_large_objects)
+		{
+			region->m_live = 0;
+			for (char *chunk = region->m_start; chunk < region->m_top; chunk = next_chunk(chunk))
+				if (region->is_marked(chunk))
+					region->m_live += HEADER_SIZE + chunk_size(chunk);
+
+			if (region->m_live > 0)
+			{
+				std::memset(region->m_mark_bits, 0, region->bitmap_words() * sizeof(uint64_t));
+				m_large_objects[kept++] = region;
+				continue;
+			}
+			if (m_profiler_enable)
+				for (char *chunk = region->m_start; chunk < region->m_top; chunk = next_chunk(chunk))
+					record_chunk(ChunkSwept, chunk);
+			m_reclaimed += region->m_top - region->m_start;
+			m_large_object_bytes -= region->m_mapped;
+			release_region(region);
+		}
+		m_large_objects.resize(kept);
+	}
+
+	/**
+	 * Maps a region from the OS and adds it to the regions
+	 * of the heap.
+	 *
+	 * @param mapped	The size of the mapping, a multiple of
+	 * 					the page size.
+	 *
+	 * @returns The region, or a nullptr if it would make the
+	 * 			heap exceed its maximum size or the OS is out
+	 * 			of memory.
+	 */
+	Region *Heap::map_region(size_t mapped)
+	{
+		if (m_mapped + mapped > m_max_size)
+			return nullptr;
+
+		bool prefault = m_page_policy & CHEAP_PAGES_PREFAULT;
+		bool huge = m_page_policy & CHEAP_PAGES_HUGE && mapped % HEAP_HUGE_PAGE == 0;
+		size_t slack = huge ? HEAP_HUGE_PAGE : 0;
+		int flags = MAP_PRIVATE | MAP_ANONYMOUS | (prefault && !huge ? MAP_POPULATE : 0);
+		void *base = mmap(nullptr, mapped + slack, PROT_READ | PROT_WRITE, flags, -1, 0);
+		if (base == MAP_FAILED)
+			return nullptr;
+		if (huge)
+		{
+			// Trims the mapping to the aligned range, whose pages are
+			// only faulted after the advice so that they can be huge
+			auto start = reinterpret_cast<uintptr_t>(base);
+			auto aligned = (start + HEAP_HUGE_PAGE - 1) & ~(HEAP_HUGE_PAGE - 1);
+			if (aligned > start)
+				munmap(base, aligned - start);
+			if (start + slack > aligned)
+				munmap(reinterpret_cast<void *>(aligned + mapped), start + slack - aligned);
+			base = reinterpret_cast<void *>(aligned);
+			madvise(base, mapped, MADV_HUGEPAGE);
+			if (prefault)
+				for (size_t offset = 0; offset < mapped; offset += sysconf(_SC_PAGESIZE))
+					static_cast<volatile char *>(base)[offset] = 0;
+		}
+
+		// The mapping is zeroed, which clears the bitmaps as well
+		char *mem = static_cast<char *>(base);
+		size_t bitmap_words = (mapped / REGION_GRANULE + 63) / 64;
+		Region *region = new (base) Region();
+		region->m_mapped = mapped;
+		region->m_start_bits = reinterpret_cast<uint64_t *>(mem + sizeof(Region));
+		region->m_mark_bits = region->m_start_bits + bitmap_words;
+		region->m_start = mem + region_layout(mapped);
+		region->m_top = region->m_start;
+		region->m_end = mem + mapped;
+
+		m_regions.insert(std::upper_bound(m_regions.begin(), m_regions.end(), region), region);
+		m_mapped += mapped;
+		m_low = std::min(m_low, reinterpret_cast<uintptr_t>(region->m_start));
+		m_high = std::max(m_high, reinterpret_cast<uintptr_t>(region->m_end));
+		return region;
+	}
+
+	/**
+	 * Unmaps an empty region and returns it to the OS.
+	 *
+	 * @param region The region, with no allocated chunks
+	 * 				 and none of its chunks in the free lists.
+	 */
+	void Heap::release_region(Region *region)
+	{
+		if (m_bump_region == region)
+			m_bump_region = nullptr;
+
+		m_regions.erase(std::lower_bound(m_regions.begin(), m_regions.end(), region));
+		m_mapped -= region->m_mapped;
+		munmap(region, region->m_mapped);
+
+		m_low = UINTPTR_MAX;
+		m_high = 0;
+		for (Region *r : m_regions)
+		{
+			m_low = std::min(m_low, reinterpret_cast<uintptr_t>(r->m_start));
+			m_high = std::max(m_high, reinterpret_cast<uintptr_t>(r->m_end));
+		}
+	}
+
+	/**
+	 * Reserves a new thread-local allocation buffer of
+	 * CHEAP_TLAB_SIZE bytes from the top of a region, or
+	 * from a large free chunk if no region has room. In
+	 * the generational mode the buffer is bumped from the
+	 * nursery instead. This never triggers a collection.
+	 * The buffer belongs to the calling thread.
+	 *
+	 * @returns True if a buffer was reserved.
+	 */
+	bool Heap::refill_tlab()
+	{
+		Mutator *mutator = current_mutator;
+		char *start, *end;
+		if (!m_nursery.empty())
+		{
+			if ((start = bump_nursery(CHEAP_TLAB_SIZE, mutator->m_tlab_region)) == nullptr)
+				return false;
+			end = start + CHEAP_TLAB_SIZE;
+		}
+		else if ((start = bump(CHEAP_TLAB_SIZE)) != nullptr)
+		{
+			end = start + CHEAP_TLAB_SIZE;
+			mutator->m_tlab_region = m_bump_region;
+		}
+		else
+		{
+			auto iter = m_large_chunks.lower_bound(CHEAP_TLAB_SIZE - HEADER_SIZE);
+			if (iter == m_large_chunks.end())
+				return false;
+			start = iter->second;
+			m_large_chunks.erase(iter);
+			m_free_bytes -= chunk_size(start);
+			if (chunk_size(start) >= CHEAP_TLAB_SIZE - HEADER_SIZE + MIN_SPLIT)
+				split_chunk(start, CHEAP_TLAB_SIZE - HEADER_SIZE);
+			end = start + HEADER_SIZE + chunk_size(start);
+			mutator->m_tlab_region = find_region(reinterpret_cast<uintptr_t>(start));
+		}
+		mutator->m_tlab_start = start;
+		mutator->m_tlab->cur = start;
+		mutator->m_tlab->end = end;
+		return true;
+	}
+
+	/**
+	 * Gives the unused tail of the thread-local allocation
+	 * buffer back to the heap, the objects bumped in the
+	 * buffer already have their headers, which are added
+	 * to the start bitmap here, and are marked while an
+	 * incremental collection marks. Afterwards the heap
+	 * can be walked chunk by chunk again and the buffer is
+	 * empty, so the next cheap_alloc() ends up in the slow
+	 * path. This has to be done before every collection.
+	 *
+	 * Time complexity: O(N), where N is the number of
+	 * 					objects bumped in the buffer.
+	 *
+	 * @param mutator	The thread the buffer belongs to.
+	 */
+	void Heap::retire_tlab(Mutator *mutator)
+	{
+		if (mutator->m_tlab_start == nullptr)
+			return;
+
+		cheap_tlab_t *tlab = mutator->m_tlab;
+		Region *region = mutator->m_tlab_region;
+		for (char *chunk = mutator->m_tlab_start; chunk < tlab->cur; chunk = next_chunk(chunk))
+		{
+			region->set_start(chunk);
+			if (m_marking)
+				mark_allocated(chunk, region);
+		}
+		m_allocated += tlab->cur - mutator->m_tlab_start;
+		if (m_sample_interval > 0)
+			mutator->m_sample_left -= tlab->cur - mutator->m_tlab_start;
+
+		size_t tail = tlab->end - tlab->cur;
+		// A buffer carved from a free chunk can also end at the
+		// top of a retired region, which is bumped from no more
+		if (tlab->end == region->m_top && (region == m_bump_region || region->m_young))
+		{
+			region->m_top -= tail;
+		}
+		else if (tail >= MIN_SPLIT && !region->m_young)
+		{
+			set_header(tlab->cur, tail - HEADER_SIZE, HEADER_FREE);
+			region->set_start(tlab->cur);
+			add_free_chunk(tlab->cur);
+		}
+		else if (tail >= HEADER_SIZE)
+		{
+			// Not recycled, but keeps the heap walkable
+			set_header(tlab->cur, tail - HEADER_SIZE, HEADER_FREE);
+			region->set_start(tlab->cur);
+		}
+
+		mutator->m_tlab_start = nullptr;
+		mutator->m_tlab_region = nullptr;
+		tlab->cur = nullptr;
+		tlab->end = nullptr;
+	}
+
+	/**
+	 * Tries to recycle used and freed chunks that are
+	 * already allocated objects by the OS but freed
+	 * from our Heap. Small requests pop a chunk from
+	 * their own size class, or from the first larger
+	 * non-empty class, and large requests take the
+	 * best fitting large chunk. A chunk that is large
+	 * enough to hold another chunk after the request
+	 * is split and the remainder is put back in the
+	 * free lists.
+	 *
+	 * Time complexity: O(1) for small requests, which
+	 * 					only checks SIZE_CLASS_COUNT lists, and
+	 * 					O(log N) for large requests, where N is
+	 * 					the number of large free chunks.
+	 *
+	 * @param size  Amount of bytes needed for the object
+	 *              which is about to be allocated, rounded
+	 *              to a whole number of granules.
+	 *
+	 * @returns If a chunk is found and recycled, the
+	 *          address of its header is returned. If
+	 *          not, a nullptr is returned to signify
+	 *          no chunks were found.
+	 */
+	char *Heap::try_recycle_chunks(size_t size)
+	{
+		Heap &heap = Heap::the();
+		char *chunk = nullptr;
+
+		if (size <= SMALL_CHUNK_MAX)
+		{
+			for (size_t i = size_class(size); i < SIZE_CLASS_COUNT; i++)
+			{
+				char *&free_list = heap.m_size_classes[i];
+				if (free_list != nullptr)
+				{
+					chunk = free_list;
+					free_list = next_free(chunk);
+					set_next_free(chunk, nullptr);
+					break;
+				}
+			}
+		}
+
+		if (chunk == nullptr)
+		{
+			auto iter = heap.m_large_chunks.lower_bound(size);
+			if (iter == heap.m_large_chunks.end())
+				return nullptr;
+			chunk = iter->second;
+			heap.m_large_chunks.erase(iter);
+		}
+		heap.m_free_bytes -= chunk_size(chunk);
+
+		if (chunk_size(chunk) >= size + MIN_SPLIT)
+			heap.split_chunk(chunk, size);
+		else
+			set_header(chunk, chunk_size(chunk));
+
+		return chunk;
+	}
+
+	/**
+	 * Splits a free chunk in two, the lower part is
+	 * kept to be used and the remaining part, with a
+	 * header of its own, is put back in the free lists.
+	 *
+	 * @param chunk The header of the free chunk to split,
+	 *              which becomes the header of the lower
+	 *              part.
+	 *
+	 * @param size  The size of the lower part, must leave
+	 *              at least MIN_SPLIT bytes of chunk.
+	 */
+	void Heap::split_chunk(char *chunk, size_t size)
+	{
+		char *rest = chunk + HEADER_SIZE + size;
+
+		set_header(rest, chunk_size(chunk) - size - HEADER_SIZE, HEADER_FREE);
+		set_header(chunk, size);
+		find_region(reinterpret_cast<uintptr_t>(rest))->set_start(rest);
+		add_free_chunk(rest);
+	}
+
+	/**
+	 * Puts a free chunk in the free list of its size
+	 * class, or among the large chunks if it is larger
+	 * than the largest size class. The small free lists
+	 * are linked through the first word of the chunks.
+	 *
+	 * @param chunk The header of the free chunk.
+	 */
+	void Heap::add_free_chunk(char *chunk)
+	{
+		size_t size = chunk_size(chunk);
+		m_free_bytes += size;
+		if (size <= SMALL_CHUNK_MAX)
+		{
+			char *&free_list = m_size_classes[size_class(size)];
+			set_next_free(chunk, free_list);
+			free_list = chunk;
+		}
+		else
+		{
+			m_large_chunks.insert(std::make_pair(size, chunk));
+		}
+	}
+
+	/**
+	 * @returns The size of the largest chunk in the free
+	 * 			lists, the largest large chunk if there is
+	 * 			one, or else the largest small size class
+	 * 			that is not empty.
+	 */
+	size_t Heap::largest_free_chunk()
+	{
+		if (!m_large_chunks.empty())
+			return m_large_chunks.rbegin()->first;
+		for (size_t i = SIZE_CLASS_COUNT; i-- > 0;)
+			if (m_size_classes[i] != nullptr)
+				return (i + 1) * SIZE_CLASS_GRANULE;
+		return 0;
+	}
+
+	/**
+	 * Records an event related to a chunk, the profiler
+	 * keeps its own copy of the size and mark bit.
+	 *
+	 * @param type  The type of event to record.
+	 *
+	 * @param chunk The header of the chunk.
+	 */
+	void Heap::record_chunk(GCEventType type, char *chunk)
+	{
+		Chunk view(chunk_size(chunk), reinterpret_cast<uintptr_t *>(chunk + HEADER_SIZE));
+		view.m_marked = Heap::the().find_region(reinterpret_cast<uintptr_t>(chunk))->is_marked(chunk);
+		Profiler::record(type, &view);
+	}
+
+	/**
+	 * Returns a bool whether the profiler is enabled
+	 * or not.
+	 * 
+	 * @returns True or false if the profiler is enabled
+	 * 			or disabled respectively.
+	*/
+	bool Heap::profiler_enabled() {
+		Heap &heap = Heap::the();
+		return heap.m_profiler_enable;
+	}
+
+	/**
+	 * Collection phase of the garbage collector. When
+	 * an allocation is requested and there is no space
+	 * left on the heap, a collection is triggered. This
+	 * function is private so that the user cannot trigger
+	 * a collection unneccessarily. The pause only marks
+	 * the heap, the sweep is left to the allocations after
+	 * the collection, see sweep().
+	 */
+	void Heap::collect()
+	{
+		auto c_start = time_now;
+
+		Heap &heap = Heap::the();
+
+		if (heap.profiler_enabled())
+			Profiler::record(CollectStart);
+
+		// Spill the callee-saved registers to this stack frame, pointers
+		// that the mutator keeps in registers are then scanned as well
+		__builtin_unwind_init();
+
+		mutator();
+		heap.stop_world();
+		heap.retire_tlabs();
+
+		// What is left of the lazy sweep of the last collection
+		auto phase_start = time_now;
+		free(heap);
+		heap.m_free_times.record(to_ns(time_now - phase_start));
+		if (heap.profiler_enabled() && heap.m_free_bytes > 0)
+			Profiler::record_fragmentation(heap.largest_free_chunk(), heap.m_free_bytes);
+		bool compact = heap.compact_due();
+
+		// The old generation is collected with the nursery empty
+		if (!heap.m_nursery.empty())
+			heap.evacuate_nursery();
+
+		phase_start = time_now;
+		vector<uintptr_t> roots;
+		heap.find_all_roots(roots);
+		heap.m_roots_times.record(to_ns(time_now - phase_start));
+
+		phase_start = time_now;
+		mark(roots);
+		heap.finish_collection(roots, compact, phase_start);
+		
+		auto c_end = time_now;
+		heap.m_pause_times.record(to_ns(c_end - c_start));
+		heap.resume_world();
+		
+		Profiler::record(CollectStart, to_us(c_end - c_start));
+	}
+
+	/**
+	 * The end of a collection, once the heap is marked. The
+	 * weak references to dead objects are cleared, the
+	 * finalizers of dead objects queued, and the heap is left
+	 * to the lazy sweep, or compacted.
+	 *
+	 * @param roots			The roots of the mark phase.
+	 *
+	 * @param compacting	If compact_due() chose regions to
+	 * 						compact.
+	 *
+	 * @param mark_start	The start of the mark phase.
+	 */
+	void Heap::finish_collection(vector<uintptr_t> &roots, bool compacting, std::chrono::high_resolution_clock::time_point mark_start)
+	{
+		clear_weak_refs();
+		queue_finalizers(roots);
+		m_mark_times.record(to_ns(time_now - mark_start));
+		if (!m_samples.empty())
+			settle_samples(false);
+		if (m_census != nullptr)
+			write_census();
+		if (m_snapshot != nullptr)
+			write_snapshot(roots);
+
+		auto phase_start = time_now;
+		sweep(*this);
+		m_sweep_times.record(to_ns(time_now - phase_start));
+		if (compacting)
+			compact(roots);
+	}
+
+	/**
+	 * Starts the incremental marking of a collection if the
+	 * incremental mode is enabled, see HEAP_MARK_STEP, unless
+	 * the last incremental collection found a compaction due.
+	 *
+	 * @returns True if the heap is marked incrementally, the
+	 * 			heap then grows instead of collecting.
+	 */
+	bool Heap::collect_incrementally()
+	{
+		if (m_pause_target == 0)
+			return false;
+		if (!m_marking)
+		{
+			// A compaction is a pause of its own, the last collection
+			// found one due and left it to this one to stop the world
+			if (m_compact_pending)
+			{
+				m_compact_pending = false;
+				return false;
+			}
+			start_marking();
+		}
+		return true;
+	}
+
+	/**
+	 * The first pause of an incremental collection, which
+	 * prepares the heap like collect() and marks the chunks
+	 * the roots point into grey, to be scanned by the steps
+	 * of mark_step().
+	 */
+	void Heap::start_marking()
+	{
+		auto c_start = time_now;
+		if (m_profiler_enable)
+			Profiler::record(MarkStart);
+
+		// Spill the callee-saved registers for find_roots()
+		__builtin_unwind_init();
+
+		mutator();
+		stop_world();
+		retire_tlabs();
+
+		auto phase_start = time_now;
+		free(*this);
+		m_free_times.record(to_ns(time_now - phase_start));
+		if (m_profiler_enable && m_free_bytes > 0)
+			Profiler::record_fragmentation(largest_free_chunk(), m_free_bytes);
+		m_compact_pending = compact_due();
+		if (!m_nursery.empty())
+			evacuate_nursery();
+
+		vector<uintptr_t> roots;
+		find_all_roots(roots);
+		for (uintptr_t root : roots)
+			find_chunks(root, m_grey);
+		m_marking = true;
+		m_grey_drained = false;
+		m_step_at = m_allocated + HEAP_MARK_STEP;
+
+		auto c_end = time_now;
+		m_step_times.record(to_ns(c_end - c_start));
+		resume_world();
+
+		Profiler::record(MarkStart, to_us(c_end - c_start), 1);
+	}
+
+	/**
+	 * A step of the incremental marking, once HEAP_MARK_STEP
+	 * bytes were allocated since the last one. Grey chunks are
+	 * scanned until the pause target has passed. The step that
+	 * scans the last one also evacuates the nursery, so that
+	 * the last pause only evacuates what was allocated since,
+	 * and the next step is the last pause, see end_marking().
+	 *
+	 * Time complexity: O(S), where S is the number of pointer
+	 * 					words the pause target allows to scan, at
+	 * 					the granularity of a chunk.
+	 */
+	void Heap::mark_step()
+	{
+		if (!m_marking || m_allocated < m_step_at)
+			return;
+
+		auto c_start = time_now;
+		if (m_profiler_enable)
+			Profiler::record(MarkStart);
+
+		// Spill the callee-saved registers for find_roots()
+		__builtin_unwind_init();
+
+		mutator();
+		stop_world();
+		// The objects of the buffers are found by their start bits,
+		// and are marked and grey
+		retire_tlabs();
+		if (m_grey_drained)
+		{
+			end_marking(c_start);
+			Profiler::record(MarkStart, to_us(time_now - c_start), 1);
+			resume_world();
+			return;
+		}
+
+		auto deadline = c_start + std::chrono::nanoseconds(m_pause_target);
+		bool drained = drain_grey(deadline);
+		// Greys the objects it promotes
+		if (drained && !m_nursery.empty())
+		{
+			evacuate_nursery();
+			drained = drain_grey(deadline);
+		}
+		m_grey_drained = drained;
+		m_step_at = m_allocated + HEAP_MARK_STEP;
+
+		auto c_end = time_now;
+		m_step_times.record(to_ns(c_end - c_start));
+		Profiler::record(MarkStart, to_us(c_end - c_start), 1);
+		resume_world();
+	}
+
+	/**
+	 * Finishes the incremental collection that is marking at
+	 * once, when the mode is disabled, the heap is disposed or
+	 * cannot grow any further, see end_marking().
+	 */
+	void Heap::finish_marking()
+	{
+		auto c_start = time_now;
+		if (m_profiler_enable)
+			Profiler::record(CollectStart);
+
+		// Spill the callee-saved registers for find_roots()
+		__builtin_unwind_init();
+
+		mutator();
+		stop_world();
+		retire_tlabs();
+		end_marking(c_start);
+		resume_world();
+
+		Profiler::record(CollectStart, to_us(time_now - c_start));
+	}
+
+	/**
+	 * The last pause of an incremental collection, with the
+	 * world stopped and the allocation buffers retired. The
+	 * nursery is evacuated, the roots are found again and the
+	 * chunks they point into that are not marked yet are
+	 * scanned along with the grey ones left, the chunks the
+	 * write barrier made grey and the ones allocated since the
+	 * last step. Chunks allocated while marking are marked, so
+	 * little else is left to scan. The collection is then
+	 * finished like by collect(), a compaction found due when
+	 * the marking started is left to the next collection.
+	 *
+	 * Time complexity: O(R + N), where R is the number of roots
+	 * 					and N the number of pointer words left to
+	 * 					scan, mostly in the chunks allocated
+	 * 					since the last step.
+	 *
+	 * @param c_start	The start of the pause.
+	 */
+	void Heap::end_marking(std::chrono::high_resolution_clock::time_point c_start)
+	{
+		// Greys the objects it promotes, as m_marking is still set
+		if (!m_nursery.empty())
+			evacuate_nursery();
+
+		auto phase_start = time_now;
+		vector<uintptr_t> roots;
+		find_all_roots(roots);
+		m_roots_times.record(to_ns(time_now - phase_start));
+
+		phase_start = time_now;
+		for (uintptr_t root : roots)
+			find_chunks(root, m_grey);
+		drain_grey(std::chrono::high_resolution_clock::time_point::max());
+		m_marking = false;
+		m_grey_drained = false;
+		finish_collection(roots, false, phase_start);
+		m_pause_times.record(to_ns(time_now - c_start));
+	}
+
+	/**
+	 * Marks a chunk allocated while an incremental collection
+	 * marks, which keeps it alive through the collection. The
+	 * chunk is grey as well, as its initialising stores have
+	 * no write barrier, and is scanned by a later step. It is
+	 * not counted in the marked bytes, which set the next
+	 * collection limit from what the roots reached, see pace().
+	 *
+	 * @param chunk		The header of the chunk.
+	 *
+	 * @param region	The region of the chunk.
+	 */
+	void Heap::mark_allocated(char *chunk, Region *region)
+	{
+		if (region->m_young || region->is_marked(chunk))
+			return;
+		region->set_mark(chunk);
+		m_grey.push_back(chunk);
+	}
+
+	/**
+	 * Scans grey chunks, the chunks they point into that are
+	 * not marked yet are marked and become grey in turn.
+	 *
+	 * @param deadline	The time after which no more chunks are
+	 * 					scanned, checked every HEAP_MARK_CHECK
+	 * 					chunks.
+	 *
+	 * @returns True if no grey chunk is left.
+	 */
+	bool Heap::drain_grey(std::chrono::high_resolution_clock::time_point deadline)
+	{
+		for (size_t scanned = 1; !m_grey.empty(); scanned++)
+		{
+			if (scanned % HEAP_MARK_CHECK == 0 && time_now >= deadline)
+				return false;
+			char *chunk = m_grey.back();
+			m_grey.pop_back();
+			for_each_pointer(chunk, [this](uintptr_t word) { find_chunks(word, m_grey); });
+		}
+		return true;
+	}
+
+	/**
+	 * Minor collection of the generational mode, triggered
+	 * when the nursery is full. The nursery is evacuated to
+	 * the old generation, which is collected as well once
+	 * the heap has grown to its collection limit.
+	 */
+	void Heap::collect_nursery()
+	{
+		auto c_start = time_now;
+
+		if (m_profiler_enable)
+			Profiler::record(CollectStart);
+
+		// Spill the callee-saved registers for find_roots()
+		__builtin_unwind_init();
+
+		mutator();
+		stop_world();
+		retire_tlabs();
+		evacuate_nursery();
+
+		if (m_mapped >= m_collect_at && !collect_incrementally())
+			collect();
+		m_minor_pause_times.record(to_ns(time_now - c_start));
+		resume_world();
+
+		Profiler::record(CollectStart, to_us(time_now - c_start));
+	}
+
+	/**
+	 * Copies the objects of the nursery that are alive to the
+	 * old generation, after which the nursery is empty. This
+	 * is Cheney's algorithm, except that the copies are not
+	 * contiguous in the old generation, where they are placed
+	 * like any other chunk, so the scan queue holds the headers
+	 * of the copies. The roots are the words of the chunks in
+	 * the remembered set and the words of the stack.
+	 *
+	 * The stack is scanned conservatively in every root mode,
+	 * as the compiled code keeps copies of its rooted values in
+	 * registers and stack slots, and a nursery object that a
+	 * word on the stack points into is pinned. It keeps its
+	 * address, and its block is promoted to the old generation
+	 * as a whole, the rest of the block becoming free chunks.
+	 * Other objects are copied, and the words of heap objects
+	 * pointing into them are updated.
+	 *
+	 * Time complexity: O(S + L + W + B), where S is the depth
+	 * 					of the stack in words, L is the size of
+	 * 					the surviving objects, W the size of the
+	 * 					remembered chunks and B the number of
+	 * 					nursery blocks. The dead objects are not
+	 * 					visited, besides clearing the used part
+	 * 					of the nursery.
+	 */
+	void Heap::evacuate_nursery()
+	{
+		vector<char *> worklist;
+		m_copied = 0;
+
+		vector<uintptr_t> stack;
+		find_roots(stack);
+		find_arena_roots(stack);
+		find_finalizer_roots(stack);
+		for (uintptr_t word : stack)
+		{
+			Region *region;
+			char *chunk = find_chunk(word, region);
+			if (chunk != nullptr && region->m_young && !region->is_marked(chunk))
+			{
+				region->set_mark(chunk);
+				region->m_live += HEADER_SIZE + chunk_size(chunk);
+				worklist.push_back(chunk);
+			}
+		}
+
+		auto evacuate_word = [this, &worklist](uintptr_t &word) { evacuate(&word, worklist); };
+		for (Finalizer &finalizer : m_finalizers)
+		{
+			auto word = reinterpret_cast<uintptr_t>(finalizer.m_chunk + HEADER_SIZE);
+			evacuate_word(word);
+			finalizer.m_chunk = reinterpret_cast<char *>(word) - HEADER_SIZE;
+		}
+		for (char *chunk : m_remembered)
+		{
+			*reinterpret_cast<size_t *>(chunk) &= ~HEADER_REMEMBERED;
+			for_each_pointer(chunk, evacuate_word);
+		}
+		m_remembered.clear();
+
+		// Scans the pinned objects and the copies in the order
+		// they were found, which evacuates breadth first
+		for (size_t i = 0; i < worklist.size(); i++)
+			for_each_pointer(worklist[i], evacuate_word);
+		evacuate_weak_refs();
+
+		if (!m_samples.empty())
+			settle_samples(true);
+
+		size_t used = 0, pinned = 0;
+		for (Region *block : m_nursery)
+		{
+			used += block->m_top - block->m_start;
+			pinned += block->m_live;
+		}
+		m_reclaimed += used - pinned - m_copied;
+
+		for (Region *&block : m_nursery)
+		{
+			if (block->m_live == 0)
+			{
+				std::memset(block->m_start, 0, block->m_top - block->m_start);
+				std::memset(block->m_start_bits, 0, block->bitmap_words() * sizeof(uint64_t));
+				block->m_top = block->m_start;
+				continue;
+			}
+
+			// The pinned objects stay, the rest is free. The copy of
+			// a forwarded chunk may be larger than the chunk, as it can
+			// be a recycled chunk too small to split, so the next chunk
+			// is found by the start bitmap
+			char *next;
+			for (char *chunk = block->m_start; chunk < block->m_top; chunk = next)
+			{
+				next = chunk_flags(chunk) & HEADER_FORWARDED ? block->next_start(chunk) : next_chunk(chunk);
+				size_t size = next - chunk - HEADER_SIZE;
+				if (!(chunk_flags(chunk) & HEADER_FREE) && block->is_marked(chunk))
+					continue;
+				std::memset(chunk + HEADER_SIZE, 0, size);
+				set_header(chunk, size, HEADER_FREE);
+			}
+			free_chunks(block, block->m_top);
+			std::memset(block->m_mark_bits, 0, block->bitmap_words() * sizeof(uint64_t));
+			block->m_young = false;
+
+			block = map_region(HEAP_NURSERY_BLOCK);
+			if (block == nullptr)
+				throw std::runtime_error(std::string("Error: Heap out of memory"));
+			block->m_young = true;
+		}
+
+		m_nursery_next = 0;
+
+		// While marking incrementally, the promoted objects may be
+		// referenced from black ones only, so they are grey
+		if (m_marking)
+		{
+			for (char *chunk : worklist)
+			{
+				Region *region = find_region(reinterpret_cast<uintptr_t>(chunk));
+				if (!region->is_marked(chunk))
+				{
+					region->set_mark(chunk);
+					m_marked += HEADER_SIZE + chunk_size(chunk);
+					m_grey.push_back(chunk);
+				}
+			}
+		}
+	}
+
+	/**
+	 * Evacuates the nursery object a word points into, if it
+	 * does, and updates the word to point into the copy. The
+	 * object is copied the first time, its header is then set
+	 * to the address of the copy, and the copy is added to the
+	 * scan queue. Pinned objects are not copied.
+	 *
+	 * @param slot		The word.
+	 *
+	 * @param worklist	The scan queue of evacuate_nursery().
+	 */
+	void Heap::evacuate(uintptr_t *slot, vector<char *> &worklist)
+	{
+		Region *region;
+		char *chunk = find_chunk(*slot, region);
+		if (chunk == nullptr || !region->m_young || region->is_marked(chunk))
+			return;
+
+		char *copy;
+		if (chunk_flags(chunk) & HEADER_FORWARDED)
+		{
+			copy = forwardee(chunk);
+		}
+		else
+		{
+			size_t size = chunk_size(chunk);
+			copy = promote(size);
+			m_copied += HEADER_SIZE + size;
+			std::memcpy(copy + HEADER_SIZE, chunk + HEADER_SIZE, size);
+			*reinterpret_cast<size_t *>(copy) |= chunk_type(chunk);
+			set_header(chunk, reinterpret_cast<size_t>(copy), HEADER_FORWARDED);
+			worklist.push_back(copy);
+		}
+		*slot = *slot - reinterpret_cast<uintptr_t>(chunk) + reinterpret_cast<uintptr_t>(copy);
+	}
+
+	/**
+	 * Allocates the copy of a nursery object in the old
+	 * generation, like alloc() but without triggering a
+	 * collection, as it is called by one.
+	 *
+	 * @param size	The size of the object.
+	 *
+	 * @returns The header of the copy.
+	 */
+	char *Heap::promote(size_t size)
+	{
+		char *chunk = recycle_or_sweep(size);
+		if (chunk != nullptr)
+			return chunk;
+
+		chunk = bump(HEADER_SIZE + size);
+		if (chunk == nullptr && grow(HEADER_SIZE + size))
+			chunk = bump(HEADER_SIZE + size);
+		if (chunk == nullptr)
+			throw std::runtime_error(std::string("Error: Heap out of memory"));
+
+		set_header(chunk, size);
+		m_bump_region->set_start(chunk);
+		return chunk;
+	}
+
+	/**
+	 * Finds the roots of a collection in the root mode of the
+	 * heap, and the roots in the arenas and of the finalizers.
+	 *
+	 * @param roots	Vector to which the found roots are added
+	 */
+	void Heap::find_all_roots(vector<uintptr_t> &roots)
+	{
+		if (m_root_mode == ShadowStackRoots)
+			find_shadow_roots(roots);
+		else if (m_root_mode == StackMapRoots)
+			find_stack_map_roots(roots);
+		else
+			find_roots(roots);
+		find_arena_roots(roots);
+		find_finalizer_roots(roots);
+	}
+
+	/**
+	 * Scans the stacks of the registered threads for words
+	 * pointing into the heap. The scan of the calling thread
+	 * starts at the frame of this function, which is never
+	 * inlined and therefore lies below the registers spilled
+	 * by the calling collect(), the other threads are parked
+	 * and are scanned from where they were parked.
+	 *
+	 * Time complexity: O(D), where D is the depth of the stacks
+	 * 					in words.
+	 *
+	 * @param roots	Vector to which the found roots are added
+	 */
+	__attribute__((noinline)) void Heap::find_roots(vector<uintptr_t> &roots)
+	{
+		auto frame = reinterpret_cast<uintptr_t *>(__builtin_frame_address(0));
+
+		for (Mutator *mutator : m_mutators)
+		{
+			uintptr_t *stack_bottom = mutator == current_mutator ? frame : mutator->m_stack_bottom;
+			while (stack_bottom < mutator->m_stack_top)
+			{
+				if (m_low < *stack_bottom && *stack_bottom < m_high)
+				{
+					roots.push_back(*stack_bottom);
+				}
+				stack_bottom++;
+			}
+		}
+	}
+
+	/**
+	 * Adds the words of the objects in the arenas of the
+	 * registered threads that point into the heap, in every
+	 * root mode, as the arenas are neither traced nor swept.
+	 * Like the words on the stack, they pin the objects they
+	 * point into when the nursery is evacuated or the heap
+	 * compacted.
+	 *
+	 * Time complexity: O(A), where A is the number of words
+	 * 					allocated in the arenas.
+	 *
+	 * @param roots	Vector to which the found roots are added
+	 */
+	void Heap::find_arena_roots(vector<uintptr_t> &roots)
+	{
+		for (Mutator *mutator : m_mutators)
+		{
+			mutator->m_arena.for_each_word([this, &roots](uintptr_t word) {
+				if (m_low < word && word < m_high)
+					roots.push_back(word);
+			});
+		}
+	}
+
+	/**
+	 * Adds the objects whose finalizers are queued or running
+	 * as roots, in every root mode. They pin their objects
+	 * like the words of the arenas.
+	 *
+	 * @param roots	Vector to which the found roots are added
+	 */
+	void Heap::find_finalizer_roots(vector<uintptr_t> &roots)
+	{
+		for (Finalizer &finalizer : m_finalizable)
+			roots.push_back(reinterpret_cast<uintptr_t>(finalizer.m_chunk + HEADER_SIZE));
+		for (Mutator *mutator : m_mutators)
+			for (void *obj : mutator->m_finalizing)
+				roots.push_back(reinterpret_cast<uintptr_t>(obj));
+	}
+
+	/**
+	 * Clears the weak references whose targets the mark phase
+	 * did not mark, and drops the references that are dead
+	 * themselves. This is done before the finalizers are
+	 * queued, so a reference to an object that is only kept
+	 * for its finalizer is cleared as well.
+	 *
+	 * Time complexity: O(W log R), where W is the number of
+	 * 					weak references and R the number of
+	 * 					regions.
+	 */
+	void Heap::clear_weak_refs()
+	{
+		size_t kept = 0;
+		for (char *ref : m_weak_refs)
+		{
+			if (!find_region(reinterpret_cast<uintptr_t>(ref))->is_marked(ref))
+				continue;
+			auto &word = *reinterpret_cast<uintptr_t *>(ref + HEADER_SIZE);
+			Region *region;
+			char *target = find_chunk(word, region);
+			if (target != nullptr && !region->is_marked(target))
+				word = 0;
+			m_weak_refs[kept++] = ref;
+		}
+		m_weak_refs.resize(kept);
+	}
+
+	/**
+	 * The same for a nursery evacuation, the references and
+	 * targets that were copied are followed to their copies,
+	 * the ones that were neither copied nor pinned are dead.
+	 *
+	 * Time complexity: O(W log R).
+	 */
+	void Heap::evacuate_weak_refs()
+	{
+		size_t kept = 0;
+		for (char *ref : m_weak_refs)
+		{
+			Region *region = find_region(reinterpret_cast<uintptr_t>(ref));
+			if (region->m_young && chunk_flags(ref) & HEADER_FORWARDED)
+				ref = forwardee(ref);
+			else if (region->m_young && !region->is_marked(ref))
+				continue;
+
+			auto &word = *reinterpret_cast<uintptr_t *>(ref + HEADER_SIZE);
+			char *target = find_chunk(word, region);
+			if (target != nullptr && region->m_young && !region->is_marked(target))
+			{
+				if (chunk_flags(target) & HEADER_FORWARDED)
+					word = word - reinterpret_cast<uintptr_t>(target) + reinterpret_cast<uintptr_t>(forwardee(target));
+				else
+					word = 0;
+			}
+			m_weak_refs[kept++] = ref;
+		}
+		m_weak_refs.resize(kept);
+	}
+
+	/**
+	 * Queues the finalizers of the objects the mark phase did
+	 * not mark, and marks what they reach, as the objects are
+	 * kept until their finalizers have run. The objects are
+	 * added to the roots, to be pinned by the compaction, and
+	 * the finalizer thread is woken up.
+	 *
+	 * Time complexity: O(F log R) plus the marking, where F is
+	 * 					the number of objects with a finalizer.
+	 *
+	 * @param roots	The roots of the collection.
+	 */
+	void Heap::queue_finalizers(vector<uintptr_t> &roots)
+	{
+		vector<uintptr_t> dead;
+		size_t kept = 0;
+		for (Finalizer &finalizer : m_finalizers)
+		{
+			if (find_region(reinterpret_cast<uintptr_t>(finalizer.m_chunk))->is_marked(finalizer.m_chunk))
+			{
+				m_finalizers[kept++] = finalizer;
+				continue;
+			}
+			m_finalizable.push_back(finalizer);
+			dead.push_back(reinterpret_cast<uintptr_t>(finalizer.m_chunk + HEADER_SIZE));
+		}
+		m_finalizers.resize(kept);
+		if (dead.empty())
+			return;
+
+		roots.insert(roots.end(), dead.begin(), dead.end());
+		mark(dead);
+		{
+			std::lock_guard<std::mutex> lock(m_finalize_lock);
+			m_finalize_queued = true;
+		}
+		m_finalize_ready.notify_one();
+	}
+
+	/**
+	 * Visits the roots registered with @llvm.gcroot by the
+	 * compiled program, by walking the shadow stack from
+	 * llvm_gc_root_chain. A root without metadata holds a
+	 * pointer itself. A root with metadata points to a
+	 * spill buffer on the stack, holding a value of as many
+	 * bytes as the metadata, and the words of the buffer
+	 * are the roots. The buffers hold the structs that the
+	 * code generator passes by value, which are not always
+	 * aligned.
+	 *
+	 * Time complexity: O(R), where R is the number of words
+	 * 					in the roots of the frames on the stack.
+	 *
+	 * @param roots	Vector to which the found roots are added
+	 */
+	void Heap::find_shadow_roots(vector<uintptr_t> &roots)
+	{
+		for (StackEntry *entry = llvm_gc_root_chain; entry != nullptr; entry = entry->m_next)
+		{
+			const FrameMap *map = entry->m_map;
+			for (int32_t i = 0; i < map->m_num_roots; i++)
+			{
+				void *root = entry->m_roots[i];
+				auto bytes = i < map->m_num_meta ? reinterpret_cast<uintptr_t>(map->m_meta[i]) : 0;
+				if (root == nullptr)
+					continue;
+				if (bytes == 0)
+				{
+					roots.push_back(reinterpret_cast<uintptr_t>(root));
+					continue;
+				}
+
+				auto buffer = static_cast<const char *>(root);
+				for (size_t offset = 0; offset + sizeof(uintptr_t) <= bytes; offset += sizeof(uintptr_t))
+				{
+					uintptr_t word;
+					std::memcpy(&word, buffer + offset, sizeof(word));
+					if (m_low < word && word < m_high)
+						roots.push_back(word);
+				}
+			}
+		}
+	}
+	
+	/**
+	 * Visits the roots the stack maps list for the frames on
+	 * the stack, by walking the chain of frame pointers from
+	 * the frame of this function, and from the frames where
+	 * the other registered threads were parked, up to the top
+	 * of each thread's stack, as init() and register_thread()
+	 * took it from the stack of the thread. A frame that a
+	 * statepoint call returns to has its roots in the call
+	 * site table, at offsets from the stack pointer at the
+	 * call, which is right above the callee's saved frame
+	 * pointer and return address, or from the frame pointer
+	 * of the frame. Frames of other calls have no roots.
+	 *
+	 * All frames between the mutator and this function must keep
+	 * their frame pointers, the runtime is compiled with
+	 * -fno-omit-frame-pointer for this.
+	 *
+	 * Time complexity: O(F + R), where F is the number of frames
+	 * 					on the stack and R the number of words
+	 * 					in their roots.
+	 *
+	 * @param roots	Vector to which the found roots are added
+	 */
+	__attribute__((noinline)) void Heap::find_stack_map_roots(vector<uintptr_t> &roots)
+	{
+		auto own_frame = static_cast<uintptr_t *>(__builtin_frame_address(0));
+
+		for (Mutator *mutator : m_mutators)
+		{
+			uintptr_t *frame = mutator == current_mutator ? own_frame : mutator->m_frame;
+			while (frame != nullptr && frame + 2 <= mutator->m_stack_top)
+			{
+				auto caller_frame = reinterpret_cast<uintptr_t *>(frame[0]);
+				const CallSite *site = StackMap::find(frame[1]);
+				if (site != nullptr)
+				{
+					auto stack_pointer = reinterpret_cast<const char *>(frame + 2);
+					for (uint32_t i = 0; i < site->m_count; i++)
+					{
+						const StackMapRoot &root = StackMap::root(site->m_first + i);
+						const char *base;
+						if (root.m_reg == STACK_MAP_REG_RSP)
+							base = stack_pointer;
+						else if (root.m_reg == STACK_MAP_REG_RBP)
+							base = reinterpret_cast<const char *>(caller_frame);
+						else
+							continue;
+
+						auto buffer = base + root.m_offset;
+						for (size_t offset = 0; offset + sizeof(uintptr_t) <= root.m_bytes; offset += sizeof(uintptr_t))
+						{
+							uintptr_t word;
+							std::memcpy(&word, buffer + offset, sizeof(word));
+							if (m_low < word && word < m_high)
+								roots.push_back(word);
+						}
+					}
+				}
+
+				// The stack grows down, a frame pointer that does not
+				// lead up the stack ends the chain
+				if (caller_frame <= frame)
+					break;
+				frame = caller_frame;
+			}
+		}
+	}
+
+	/**
+	 * Marks the chunks reachable from the roots, with the
+	 * marking threads if there are more than one. The marking
+	 * threads do not record chunk events, so the heap is marked
+	 * by this thread alone while the profiler records them. The
+	 * time of the mark phase is recorded per number of threads.
+	 *
+	 * Time complexity: O(N), where N is the number of words in
+	 * 					the reachable chunks that may hold a
+	 * 					pointer, see for_each_pointer().
+	 *
+	 * @param roots	The possible pointers into the heap.
+	 */
+	void Heap::mark(vector<uintptr_t> &roots)
+	{
+		bool prof_enabled = m_profiler_enable;
+		if (prof_enabled)
+			Profiler::record(MarkStart);
+		auto m_start = time_now;
+
+		size_t threads = Marker::threads();
+		if (threads > 1 && !(prof_enabled && (Profiler::log_options() & static_cast<int>(ChunkMarked))))
+		{
+			Marker::mark(roots);
+			Profiler::record(MarkStart, to_us(time_now - m_start), threads);
+			return;
+		}
+
+		auto iter = roots.begin(), end = roots.end();
+		std::vector<char *> worklist;
+
+		while (iter != end)
+		{
+			find_chunks(*iter++, worklist);
+		}
+
+		while (!worklist.empty())
+		{
+			char *chunk = worklist.back();
+			worklist.pop_back();
+			for_each_pointer(chunk, [this, &worklist](uintptr_t word) { find_chunks(word, worklist); });
+		}
+
+		Profiler::record(MarkStart, to_us(time_now - m_start), 1);
+	}
+
+	/**
+	 * Checks if a word is a pointer into an allocated chunk
+	 * and if so, marks the chunk and pushes it to the
+	 * worklist to have its contents scanned.
+	 *
+	 * @param word      The word to check.
+	 *
+	 * @param worklist  The headers of marked chunks whose
+	 * 					contents have not been scanned yet.
+	 */
+	void Heap::find_chunks(uintptr_t word, vector<char *> &worklist)
+	{
+		Heap &heap = Heap::the();
+
+		Region *region;
+		char *chunk = heap.find_chunk(word, region);
+		// The nursery is only in use while marking incrementally,
+		// its mark bits pin its objects
+		if (chunk != nullptr && !region->m_young && !region->is_marked(chunk))
+		{
+			region->set_mark(chunk);
+			heap.m_marked += HEADER_SIZE + chunk_size(chunk);
+			if (heap.m_profiler_enable)
+				record_chunk(ChunkMarked, chunk);
+			worklist.push_back(chunk);
+		}
+	}
+
+	/**
+	 * Finds the region holding an address among the chunks
+	 * of the regions.
+	 *
+	 * Time complexity: O(log R), where R is the number of
+	 * 					regions.
+	 *
+	 * @param addr  The address.
+	 *
+	 * @returns The region, or a nullptr if the address is
+	 * 			not in the chunks of any region.
+	 */
+	Region *Heap::find_region(uintptr_t addr)
+	{
+		auto iter = std::upper_bound(m_regions.begin(), m_regions.end(), addr,
+			[](uintptr_t a, Region *r) { return a < reinterpret_cast<uintptr_t>(r->m_start); });
+		if (iter == m_regions.begin())
+			return nullptr;
+		Region *region = *--iter;
+		return region->holds(addr) ? region : nullptr;
+	}
+
+	/**
+	 * Resolves a possible pointer to the allocated chunk it
+	 * points into, interior pointers included. Since every
+	 * chunk in a region has a bit in its start bitmap, the
+	 * closest start at or below the address is the header
+	 * of the chunk containing it.
+	 *
+	 * Time complexity: O(log R + S / 512), where R is the
+	 * 					number of regions and S the size of the
+	 * 					chunk in bytes, as one bitmap word covers
+	 * 					512 bytes of a region.
+	 *
+	 * @param addr  	The possible pointer.
+	 *
+	 * @param region	Set to the region of the chunk.
+	 *
+	 * @returns The header of the chunk, or a nullptr if the
+	 * 			address does not point into the object of an
+	 * 			allocated chunk.
+	 */
+	char *Heap::find_chunk(uintptr_t addr, Region *&region)
+	{
+		region = find_region(addr);
+		if (region == nullptr)
+			return nullptr;
+
+		size_t bit = region->granule(reinterpret_cast<char *>(addr));
+		size_t word = bit / 64;
+		// Only the starts at or below the address
+		uint64_t starts = region->m_start_bits[word] & (~0UL >> (63 - bit % 64));
+		while (starts == 0)
+		{
+			if (word == 0)
+				return nullptr;
+			starts = region->m_start_bits[--word];
+		}
+
+		char *chunk = region->m_start + (word * 64 + 63 - __builtin_clzl(starts)) * REGION_GRANULE;
+		if (chunk_flags(chunk) & HEADER_FREE || addr < reinterpret_cast<uintptr_t>(chunk + HEADER_SIZE))
+			return nullptr;
+		return chunk;
+	}
+
+	/**
+	 * Starts the lazy sweep of the heap after the mark phase. The
+	 * chunks are not swept here, the regions are queued to be swept
+	 * one at a time by the allocations that find no free chunk,
+	 * which keeps the sweep out of the pause of the collection. The
+	 * free lists are emptied, the sweep of a region adds its free
+	 * chunks to them again. The size of the marked chunks sets the
+	 * collection limit of the heap for the growth policy.
+	 *
+	 * Time complexity: O(R), where R is the number of regions.
+	 *
+	 * @param heap Pointer to the heap singleton instance.
+	 */
+	void Heap::sweep(Heap &heap)
+	{
+		bool profiler_enabled = heap.m_profiler_enable;
+		if (profiler_enabled)
+			Profiler::record(SweepStart);
+
+		for (char *&free_list : heap.m_size_classes)
+			free_list = nullptr;
+		heap.m_large_chunks.clear();
+		heap.m_free_bytes = 0;
+
+		heap.m_unswept.clear();
+		for (Region *region : heap.m_regions)
+		{
+			if (region->m_young || region->m_large_object)
+				continue;
+			region->m_sweep_top = region->m_top;
+			heap.m_unswept.push_back(region);
+		}
+		heap.sweep_large_objects();
+
+		heap.pace();
+	}
 
-		// cout << "b4 sweep\n";
-		sweep(heap);
+	/**
+	 * Sets the limit of the mapped bytes at which the next
+	 * collection is triggered, from the size of the chunks
+	 * marked by this collection, see HEAP_GROWTH_FACTOR. The
+	 * limit leaves room for at least the minimum interval of
+	 * allocations, and is raised further when the collection
+	 * found most of the heap alive, as collecting again soon
+	 * would free as little.
+	 */
+	void Heap::pace()
+	{
+		m_live_estimate = m_marked;
+		m_marked = 0;
 
-		// cout << "b4 free\n";
-		free(heap);
-		
-		auto c_end = time_now;
-		
-		Profiler::record(CollectStart, to_us(c_end - c_start));
+		size_t limit = std::max(static_cast<size_t>(m_live_estimate * m_growth_factor), m_live_estimate + m_min_interval);
+		if (m_live_estimate >= m_mapped * HEAP_THRASH_SHARE)
+			limit = std::max(limit, static_cast<size_t>(m_mapped * m_growth_factor));
+		m_collect_at = std::max(m_initial_size, limit);
 	}
 
-	void Heap::find_roots(uintptr_t *stack_bottom, vector<uintptr_t *> &roots)
+	/**
+	 * Sweeps a region, flags its unmarked chunks as free and
+	 * clears its mark bitmap. The contents of the unmarked chunks
+	 * are cleared. The free chunks of the region are added to the
+	 * free lists, unless the region has no live chunks at all. It
+	 * is then emptied to be bumped from again, or returned to the
+	 * OS if the heap is larger than its collection limit, or if it
+	 * is larger than HEAP_REGION_SIZE. Only the chunks below the
+	 * top of the region at the start of the sweep are swept, the
+	 * ones bumped after the mark phase are alive.
+	 *
+	 * Time complexity: O(N), where N is the number of chunks in
+	 * 					the region, plus O(log M) per large chunk,
+	 * 					where M is the number of large free chunks.
+	 *
+	 * @param region	The region, queued by sweep().
+	 */
+	void Heap::sweep_region(Region *region)
 	{
-		auto heap_bottom = reinterpret_cast<const uintptr_t>(m_heap);
-		auto heap_top = reinterpret_cast<const uintptr_t>(m_heap + HEAP_SIZE);
-
-		while (stack_bottom < m_stack_top)
+		bool profiler_enabled = m_profiler_enable;
+
+		// A run of dead chunks is freed as one chunk and zeroed at
+		// once. Stale pointers in a recycled chunk would otherwise keep
+		// garbage alive, as the contents are scanned conservatively
+		auto free_run = [this](char *run, char *end) {
+			zero_memory(run + HEADER_SIZE, end - run - HEADER_SIZE);
+			set_header(run, end - run - HEADER_SIZE, HEADER_FREE);
+		};
+
+		region->m_live = 0;
+		char *run = nullptr, *next;
+		for (char *chunk = region->m_start; chunk < region->m_sweep_top; chunk = next)
 		{
-			if (heap_bottom < *stack_bottom && *stack_bottom < heap_top)
+			next = next_chunk(chunk);
+			bool is_free = chunk_flags(chunk) & HEADER_FREE;
+			if (!is_free && !region->is_marked(chunk))
 			{
-				roots.push_back(stack_bottom);
+				if (profiler_enabled)
+					record_chunk(ChunkSwept, chunk);
+				m_reclaimed += HEADER_SIZE + chunk_size(chunk);
+				if (run == nullptr)
+					run = chunk;
+				else
+					region->clear_start(chunk);
+				continue;
 			}
-			stack_bottom++;
+
+			if (run != nullptr)
+				free_run(run, chunk);
+			run = nullptr;
+			if (!is_free)
+				region->m_live += HEADER_SIZE + chunk_size(chunk);
 		}
-	}
-	
-	void Heap::mark(vector<uintptr_t *> &roots)
-	{
-		bool prof_enabled = m_profiler_enable;
-		if (prof_enabled)
-			Profiler::record(MarkStart);
+		if (run != nullptr)
+			free_run(run, region->m_sweep_top);
+		std::memset(region->m_mark_bits, 0, region->bitmap_words() * sizeof(uint64_t));
 
-		auto iter = roots.begin(), end = roots.end();
-		std::queue<std::pair<uintptr_t, uintptr_t>> chunk_spaces;
+		if (region->m_live == 0 && region->m_top == region->m_sweep_top)
+		{
+			empty_region(region);
+			return;
+		}
 
-		while (iter != end)
+		free_chunks(region, region->m_sweep_top);
+	}
+
+	/**
+	 * Empties a region without live chunks to be bumped from
+	 * again, or returns it to the OS if the heap is larger than
+	 * its collection limit, or if it is larger than
+	 * HEAP_REGION_SIZE.
+	 *
+	 * @param region	The region, with a clear mark bitmap and
+	 * 					none of its chunks in the free lists.
+	 */
+	void Heap::empty_region(Region *region)
+	{
+		region->m_free = 0;
+		region->m_largest_free = 0;
+		if (m_mapped > m_collect_at || region->m_mapped > m_region_size)
 		{
-			find_chunks(*iter++, chunk_spaces);
+			release_region(region);
 		}
+		else
+		{
+			// Clears the headers and free list links as well
+			zero_memory(region->m_start, region->m_top - region->m_start);
+			std::memset(region->m_start_bits, 0, region->bitmap_words() * sizeof(uint64_t));
+			region->m_top = region->m_start;
+		}
+	}
 
-		while (!chunk_spaces.empty())
+	/**
+	 * Zeroes memory the heap has freed. A run of at least
+	 * HEAP_DONTNEED_MIN bytes is given back to the OS with
+	 * madvise(), but for the parts of pages at its ends,
+	 * which keeps it out of the resident set until it is
+	 * reused. Not with a page policy, which keeps it mapped.
+	 *
+	 * @param start	The start of the memory.
+	 *
+	 * @param bytes	The size of the memory.
+	 */
+	void Heap::zero_memory(char *start, size_t bytes)
+	{
+		if (bytes < HEAP_DONTNEED_MIN || m_page_policy != 0)
 		{
-			auto range = chunk_spaces.front();
-			chunk_spaces.pop();
+			std::memset(start, 0, bytes);
+			return;
+		}
 
-			auto addr_bottom = reinterpret_cast<uintptr_t *>(range.first);
-			auto addr_top = reinterpret_cast<uintptr_t *>(range.second);
+		const uintptr_t page = sysconf(_SC_PAGESIZE);
+		char *low = reinterpret_cast<char *>((reinterpret_cast<uintptr_t>(start) + page - 1) & ~(page - 1));
+		char *high = reinterpret_cast<char *>((reinterpret_cast<uintptr_t>(start) + bytes) & ~(page - 1));
+		std::memset(start, 0, low - start);
+		if (madvise(low, high - low, MADV_DONTNEED) != 0)
+			std::memset(low, 0, high - low);
+		std::memset(high, 0, start + bytes - high);
+	}
 
-			while (addr_bottom < addr_top)
-			{
-				find_chunks(addr_bottom, chunk_spaces);
-				addr_bottom++;
-			}
+	/**
+	 * Chooses the regions the next collection compacts, the
+	 * ones whose last sweep left at least HEAP_COMPACT_MIN_FREE
+	 * of the region in free chunks, the largest of them less
+	 * than the compaction threshold times their size. This is
+	 * done when all the regions are swept.
+	 *
+	 * @returns True if a region is to be compacted.
+	 */
+	bool Heap::compact_due()
+	{
+		bool due = false;
+		for (Region *region : m_regions)
+		{
+			region->m_compact = m_compact_threshold > 0.0 && !region->m_young
+				&& region->m_free >= (region->m_end - region->m_start) * HEAP_COMPACT_MIN_FREE
+				&& region->m_largest_free < m_compact_threshold * region->m_free;
+			due = due || region->m_compact;
 		}
+		return due;
 	}
 
-	void Heap::find_chunks(uintptr_t *stack_addr, std::queue<std::pair<uintptr_t, uintptr_t>> &chunk_spaces)
+	/**
+	 * Compacts the regions chosen by compact_due() after the
+	 * mark phase, which are then no longer left to the lazy
+	 * sweep. This is the sliding compaction of Lisp-2, the live
+	 * chunks of a region are given new addresses from the start
+	 * of the region in address order, the words of all the live
+	 * chunks of the heap that point into a moved chunk are
+	 * updated, and then the chunks are slid down to their new
+	 * addresses. The space above the last live chunk of a region
+	 * is left free in one piece, as the bump space of the region
+	 * new chunks are bumped from and as a single free chunk in
+	 * the others.
+	 *
+	 * The chunks that the roots or the words on the stack point
+	 * into are pinned and keep their addresses, as the compiled
+	 * code keeps copies of its rooted values in registers and
+	 * stack slots. The chunks below a pinned chunk are slid up to
+	 * it, and the gap before it becomes a free chunk. The new
+	 * addresses are kept in a table ordered by the old ones, as
+	 * a chunk of 0 bytes has no room for one.
+	 *
+	 * Time complexity: O(N + W log M), where N is the number of
+	 * 					chunks in the heap, W the number of words in
+	 * 					the live chunks and M the number of chunks
+	 * 					that are moved.
+	 *
+	 * @param roots	The roots of the mark phase.
+	 */
+	void Heap::compact(vector<uintptr_t> &roots)
 	{
-		Heap &heap = Heap::the();
-
-		auto it = heap.m_chunk_table.find(*stack_addr);
-		if (it != heap.m_chunk_table.end())
+		if (m_profiler_enable)
+			Profiler::record(CompactStart);
+		auto p_start = time_now;
+
+		vector<uintptr_t> stack;
+		if (m_root_mode != ConservativeRoots)
+			find_roots(stack);
+		vector<char *> pinned;
+		for (vector<uintptr_t> *words : {&roots, &stack})
 		{
-			auto chunk = it->second;
-
-			if (!chunk->m_marked) 
+			for (uintptr_t word : *words)
 			{
-				auto c_start = reinterpret_cast<uintptr_t>(chunk->m_start);
-				auto c_size  = reinterpret_cast<uintptr_t>(chunk->m_size);
-				auto c_end   = reinterpret_cast<uintptr_t>(c_start + c_size);
-
-				chunk->m_marked = true;
-				chunk_spaces.push(std::make_pair(c_start, c_end));
+				Region *region;
+				char *chunk = find_chunk(word, region);
+				if (chunk != nullptr)
+					pinned.push_back(chunk);
 			}
-			
 		}
-
-/* 		auto iter = m_allocated_chunks.begin();
-		auto end = m_allocated_chunks.end();
-
-		while (iter != end)
+		std::sort(pinned.begin(), pinned.end());
+
+		vector<Region *> regions;
+		for (Region *region : m_regions)
+			if (region->m_compact)
+				regions.push_back(region);
+		auto compacted = [](Region *region) { return region->m_compact; };
+		m_unswept.erase(std::remove_if(m_unswept.begin(), m_unswept.end(), compacted), m_unswept.end());
+
+		// The old and new header of every chunk that moves
+		vector<std::pair<char *, char *>> moves;
+		auto pin = pinned.begin();
+		for (Region *region : regions)
 		{
-			auto chunk = *iter++;
-			
-			if (chunk->m_marked)
-				continue;
-
-			auto c_start = reinterpret_cast<uintptr_t>(chunk->m_start);
-			auto c_size  = reinterpret_cast<uintptr_t>(chunk->m_size);
-			auto c_end   = reinterpret_cast<uintptr_t>(c_start + c_size);
-
-			if (c_start < *stack_addr && *stack_addr < c_end)
+			char *to = region->m_start;
+			for (char *chunk = region->m_start; chunk < region->m_top; chunk = next_chunk(chunk))
 			{
-				chunk->m_marked = true;
-				chunk_spaces.push(std::make_pair(c_start, c_end));
+				if (chunk_flags(chunk) & HEADER_FREE || !region->is_marked(chunk))
+					continue;
+				while (pin != pinned.end() && *pin < chunk)
+					pin++;
+				if (pin != pinned.end() && *pin == chunk)
+					to = chunk;
+				else if (to != chunk)
+					moves.emplace_back(chunk, to);
+				to += HEADER_SIZE + chunk_size(chunk);
 			}
-		} */
-
-	}
-
-	void Heap::create_table() 
-	{
-		Heap &heap = Heap::the();
-		unordered_map<uintptr_t, Chunk*> chunk_table;
-		for (auto chunk : heap.m_allocated_chunks) {
-			auto pair = std::make_pair(reinterpret_cast<uintptr_t>(chunk->m_start), chunk);
-			heap.m_chunk_table.insert(pair);		
 		}
-	}
-
-	void Heap::mark_hash(uintptr_t *start, const uintptr_t* const end) 
-	{
-		Heap &heap = Heap::the();
-
-		bool profiler_enabled = heap.m_profiler_enable;
-		if (profiler_enabled)
-			Profiler::record(MarkStart);
 
-		for (; start <= end; start++) 
+		auto update = [this, &moves](uintptr_t &word) {
+			Region *region;
+			char *chunk = find_chunk(word, region);
+			if (chunk == nullptr)
+				return;
+			auto iter = std::lower_bound(moves.begin(), moves.end(), chunk,
+				[](const std::pair<char *, char *> &move, char *c) { return move.first < c; });
+			if (iter != moves.end() && iter->first == chunk)
+				word = word - reinterpret_cast<uintptr_t>(chunk) + reinterpret_cast<uintptr_t>(iter->second);
+		};
+		if (!moves.empty())
 		{
-			auto search = heap.m_chunk_table.find(*start);
-			if (search != heap.m_chunk_table.end())
+			for (Region *region : m_regions)
 			{
-				Chunk *chunk = search->second;
-				auto c_start = reinterpret_cast<uintptr_t>(chunk->m_start);
-				auto c_size = reinterpret_cast<uintptr_t>(chunk->m_size);
-				auto c_end = reinterpret_cast<uintptr_t*>(c_start + c_size);
-				if (!chunk->m_marked) 
+				if (region->m_young)
+					continue;
+				// The large objects are swept already, the ones left are alive
+				for (char *chunk = region->m_start; chunk < region->m_top; chunk = next_chunk(chunk))
 				{
-					chunk->m_marked = true;
-
-					if (profiler_enabled)
-						Profiler::record(ChunkMarked, chunk);
-
-					//mark_hash(chunk->m_start, c_end);
-					Chunk *next = find_pointer_hash((uintptr_t *) c_start, (uintptr_t *) c_end);
-					while (next != NULL) 
-					{
-						if (!next->m_marked) 
-						{
-							next->m_marked = true;
-
-							if (profiler_enabled)
-								Profiler::record(ChunkMarked, chunk);
-
-							auto c_start = reinterpret_cast<uintptr_t>(next->m_start);
-							auto c_size  = reinterpret_cast<uintptr_t>(next->m_size);
-							auto c_end   = reinterpret_cast<uintptr_t>(c_start + c_size);
-							next = find_pointer_hash((uintptr_t *) c_start, (uintptr_t *) c_end);
-						}
-					}
+					if (chunk_flags(chunk) & HEADER_FREE || !(region->m_large_object || region->is_marked(chunk)))
+						continue;
+					for_each_pointer(chunk, update);
 				}
 			}
+			auto update_chunk = [&update](char *&chunk) {
+				auto word = reinterpret_cast<uintptr_t>(chunk + HEADER_SIZE);
+				update(word);
+				chunk = reinterpret_cast<char *>(word) - HEADER_SIZE;
+			};
+			for (char *&chunk : m_remembered)
+				update_chunk(chunk);
+			for (Finalizer &finalizer : m_finalizers)
+				update_chunk(finalizer.m_chunk);
+			// The target is updated before the reference moves
+			for (char *&ref : m_weak_refs)
+			{
+				update(*reinterpret_cast<uintptr_t *>(ref + HEADER_SIZE));
+				update_chunk(ref);
+			}
 		}
+
+		size_t next = 0;
+		for (Region *region : regions)
+		{
+			region->m_compact = false;
+			slide_region(region, moves, next);
+		}
+
+		Profiler::record(CompactStart, to_us(time_now - p_start));
 	}
 
 	/**
-	 * Sweeps the heap, unmarks the marked chunks for the next cycle,
-	 * adds the unmarked nodes to the list of freed chunks; to be freed.
+	 * Slides the live chunks of a region to the new addresses
+	 * given by compact(), in address order, so that a chunk is
+	 * only copied over chunks that are done with. The start and
+	 * mark bitmaps are rebuilt, and the free space between and
+	 * above the live chunks is cleared and added to the free
+	 * lists, unless the region has no live chunks at all.
 	 *
-	 * Time complexity: O(N^2), where N is the number of allocated chunks. 
-	 * 					It is quadratic, in the worst case, 
-	 * 					since each call to erase() is linear.  
+	 * Time complexity: O(N + L), where N is the number of chunks
+	 * 					in the region and L the size of the live
+	 * 					chunks.
 	 *
-	 * @param heap Pointer to the heap singleton instance.
+	 * @param region	The region, marked.
+	 *
+	 * @param moves		The old and new headers of the chunks that
+	 * 					move, in address order.
+	 *
+	 * @param next		The index of the first move of the region,
+	 * 					set to the one of the next region.
 	 */
-	void Heap::sweep(Heap &heap)
+	void Heap::slide_region(Region *region, vector<std::pair<char *, char *>> &moves, size_t &next)
 	{
-		bool profiler_enabled = heap.m_profiler_enable;
-		if (profiler_enabled)
-			Profiler::record(SweepStart);
-		auto iter = heap.m_allocated_chunks.begin();
-		// std::cout << "Chunks alloced: " << heap.m_allocated_chunks.size() << std::endl;
-		// This cannot "iter != stop", results in seg fault, since the end gets updated, I think.
-		while (iter != heap.m_allocated_chunks.end())
+		region->m_live = 0;
+		std::memset(region->m_start_bits, 0, region->bitmap_words() * sizeof(uint64_t));
+
+		char *top = region->m_start, *following;
+		for (char *chunk = region->m_start; chunk < region->m_top; chunk = following)
 		{
-			Chunk *chunk = *iter;
+			following = next_chunk(chunk);
+			if (chunk_flags(chunk) & HEADER_FREE || !region->is_marked(chunk))
+				continue;
 
-			// Unmark the marked chunks for the next iteration.
-			if (chunk->m_marked)
+			size_t bytes = HEADER_SIZE + chunk_size(chunk);
+			char *to = chunk;
+			if (next < moves.size() && moves[next].first == chunk)
 			{
-				chunk->m_marked = false;
-				++iter;
+				to = moves[next++].second;
+				std::memmove(to, chunk, bytes);
 			}
-			else
+			else if (top < chunk)
 			{
-				// Add the unmarked chunks to freed chunks and remove from
-				// the list of allocated chunks
-				if (profiler_enabled)
-					Profiler::record(ChunkSwept, chunk);
-				heap.m_freed_chunks.push_back(chunk);
-				iter = heap.m_allocated_chunks.erase(iter);
-				heap.m_size -= chunk->m_size;
-				// cout << "Decremented total heap size with: " << chunk->m_size << endl;
-				// cout << "Total size is: " << heap.m_size << endl;
+				// The gap below a chunk that stays
+				std::memset(top, 0, chunk - top);
+				set_header(top, chunk - top - HEADER_SIZE, HEADER_FREE);
+				region->set_start(top);
 			}
+			region->set_start(to);
+			region->m_live += bytes;
+			top = to + bytes;
+		}
+		std::memset(region->m_mark_bits, 0, region->bitmap_words() * sizeof(uint64_t));
+
+		if (region->m_live == 0)
+		{
+			empty_region(region);
+			return;
+		}
+
+		zero_memory(top, region->m_top - top);
+		region->m_top = top;
+		if (region != m_bump_region && top < region->m_end)
+		{
+			set_header(top, region->m_end - top - HEADER_SIZE, HEADER_FREE);
+			region->set_start(top);
+			region->m_top = region->m_end;
 		}
-		// std::cout << "Chunks left: " << heap.m_allocated_chunks.size() << std::endl;
+		free_chunks(region, region->m_top);
 	}
 
 	/**
-	 * Frees chunks that was moved to the list m_freed_chunks
-	 * by the sweep phase. If there are more than a certain
-	 * amount of free chunks, delete the free chunks to
-	 * avoid cluttering.
-	 * 
-	 * Time complexity: O(N^2), where N is the freed chunks.
-	 * 					If free_overlap() is called, it runs in O(N^2),
-	 * 					otherwise O(N).
+	 * Merges every run of adjacent free chunks of a region into
+	 * a single free chunk, and adds the free chunks to the free
+	 * lists. The headers of the merged chunks are cleared, and
+	 * so are the free list links, the contents of free chunks
+	 * are zero otherwise. None of the free chunks may be in the
+	 * free lists already.
 	 *
-	 * @param heap  Heap singleton instance, only for avoiding
-	 *              redundant calls to the singleton get
+	 * Time complexity: O(N), where N is the number of chunks
+	 * 					below the address, plus O(log M) per
+	 * 					large chunk, where M is the number of
+	 * 					large free chunks.
+	 *
+	 * @param region	The region.
+	 *
+	 * @param end		The address up to which the chunks of
+	 * 					the region are freed.
 	 */
-	void Heap::free(Heap &heap)
+	void Heap::free_chunks(Region *region, char *end)
 	{
-		bool profiler_enabled = heap.m_profiler_enable;
-		if (profiler_enabled)
-			Profiler::record(FreeStart);
-		if (heap.m_freed_chunks.size() > FREE_THRESH)
+		region->m_free = 0;
+		region->m_largest_free = 0;
+		char *run = nullptr, *next;
+		for (char *chunk = region->m_start; chunk <= end; chunk = next)
 		{
-			bool profiler_enabled = heap.profiler_enabled();
-			while (heap.m_freed_chunks.size())
+			bool is_free = chunk < end && chunk_flags(chunk) & HEADER_FREE;
+			if (!is_free)
 			{
-				auto chunk = heap.m_freed_chunks.back();
-				heap.m_freed_chunks.pop_back();
-				if (profiler_enabled)
-					Profiler::record(ChunkFreed, chunk);
-				// heap.m_size -= chunk->m_size;
-				// cout << "Decremented total heap size with: " << chunk->m_size << endl;
-				// cout << "Total size is: " << heap.m_size << endl;
-				delete chunk;
+				if (run != nullptr && chunk_size(run) > 0)
+				{
+					if (m_profiler_enable)
+						record_chunk(ChunkFreed, run);
+					add_free_chunk(run);
+					region->m_free += chunk_size(run);
+					region->m_largest_free = std::max(region->m_largest_free, chunk_size(run));
+				}
+				run = nullptr;
+				if (chunk == end)
+					break;
+				next = next_chunk(chunk);
+				continue;
+			}
+
+			next = next_chunk(chunk);
+			if (chunk_size(chunk) > 0)
+				set_next_free(chunk, nullptr);
+			if (run == nullptr)
+			{
+				run = chunk;
+				continue;
 			}
+			set_header(run, chunk_size(run) + HEADER_SIZE + chunk_size(chunk), HEADER_FREE);
+			*reinterpret_cast<size_t *>(chunk) = 0;
+			region->clear_start(chunk);
 		}
-		// if there are chunks but not more than FREE_THRESH
-		else if (heap.m_freed_chunks.size())
+	}
+
+	/**
+	 * Recycles a free chunk like try_recycle_chunks(), and
+	 * sweeps the regions that have not been swept yet one by
+	 * one until a chunk fits.
+	 *
+	 * @param size  The rounded size of the object.
+	 *
+	 * @returns The header of the chunk, or a nullptr if no
+	 * 			free chunk fits after sweeping the heap.
+	 */
+	char *Heap::recycle_or_sweep(size_t size)
+	{
+		char *chunk = try_recycle_chunks(size);
+		while (chunk == nullptr && !m_unswept.empty())
 		{
-			// essentially, always check for overlap between
-			// chunks before finishing the allocation
-			free_overlap(heap);
+			Region *region = m_unswept.back();
+			m_unswept.pop_back();
+			sweep_region(region);
+			chunk = try_recycle_chunks(size);
 		}
+		return chunk;
 	}
 
 	/**
-	 * Checks for overlaps between freed chunks of memory
-	 * and removes overlapping chunks while prioritizing
-	 * the chunks at lower addresses.
-	 * 
-	 * Time complexity: O(N^2), where N is the number of freed chunks.
-	 * 					At each iteration get_at() is called, which is linear.
+	 * Sweeps the regions that have not been swept yet, before
+	 * the next mark phase and for the debugging collections.
 	 *
 	 * @param heap  Heap singleton instance, only for avoiding
 	 *              redundant calls to the singleton get
-	 *
-	 * @note Maybe this should be changed to prioritizing
-	 *       larger chunks. Should remove get_at() to indexing,
-	 * 		 since that's constant.
 	 */
-	void Heap::free_overlap(Heap &heap) // borde göra en record(ChunkFreed) på onödiga chunks
+	void Heap::free(Heap &heap)
 	{
-		std::vector<Chunk *> filtered;
-		size_t i = 0;
-		//auto prev = Heap::get_at(heap.m_freed_chunks, i++);
-		auto prev = heap.m_freed_chunks[i++];
-		prev->m_marked = true;
-		filtered.push_back(prev);
-		// cout << filtered.back()->m_start << endl;
-		for (; i < heap.m_freed_chunks.size(); i++)
-		{
-			prev = filtered.back();
-			//auto next = Heap::get_at(heap.m_freed_chunks, i);
-			auto next = heap.m_freed_chunks[i];
-			auto p_start = (uintptr_t)(prev->m_start);
-			auto p_size = (uintptr_t)(prev->m_size);
-			auto n_start = (uintptr_t)(next->m_start);
-			if (n_start >= (p_start + p_size))
-			{
-				next->m_marked = true;
-				filtered.push_back(next);
-			}
-		}
-		heap.m_freed_chunks.swap(filtered);
-		
 		bool profiler_enabled = heap.m_profiler_enable;
-		// After swap m_freed_chunks contains still available chunks
-		// and filtered contains all the chunks, so delete unused chunks
-		for (Chunk *chunk : filtered)
+		if (profiler_enabled)
+			Profiler::record(FreeStart);
+
+		while (!heap.m_unswept.empty())
 		{
-			// if chunk was filtered away, delete it
-			if (!chunk->m_marked)
-			{
-				if (profiler_enabled)
-					Profiler::record(ChunkFreed, chunk);
-				heap.m_size -= chunk->m_size;
-				cout << "Decremented total heap size with: " << chunk->m_size << endl;
-				cout << "Total size is: " << heap.m_size << endl;
-				delete chunk;
-			}
-			else
-			{
-				chunk->m_marked = false;
-			}
+			Region *region = heap.m_unswept.back();
+			heap.m_unswept.pop_back();
+			heap.sweep_region(region);
 		}
 	}
 
 	void Heap::set_profiler(bool mode)
 	{
 		Heap &heap = Heap::the();
+		Guard guard;
+		// Empty the allocation buffers so every allocation is recorded
+		if (mode)
+			heap.retire_tlabs();
 		heap.m_profiler_enable = mode;
 	}
 
-	Chunk* find_pointer(uintptr_t *start, const uintptr_t* const end, vector<Chunk *> &worklist) {
-		for (; start <= end; start++) {
-			auto it = worklist.begin();
-			auto stop = worklist.end();
-			while (it != stop)
-			{
-				Chunk *chunk = *it;
-				auto c_start = reinterpret_cast<uintptr_t>(chunk->m_start);
-				auto c_size  = reinterpret_cast<uintptr_t>(chunk->m_size);
-				auto c_end   = reinterpret_cast<uintptr_t>(c_start + c_size);
-
-				// Check if the stack pointer points to something within the chunk
-				if (c_start <= *start && *start < c_end)
-				{
-					return chunk;	
-				}
-				return NULL;
-			}
-		}
-	}
-
-	// Checks if a given chunk points to another chunk and returns it
-	Chunk* Heap::find_pointer_hash(uintptr_t *start, const uintptr_t* const end) {
-		Heap &heap = Heap::the();
-		for (; start <= end; start++) {
-			auto search = heap.m_chunk_table.find(*start);
-			if (search != heap.m_chunk_table.end()) {
-				return search->second;
-			}
-			return NULL;
-		}
-	}
-
 #ifdef HEAP_DEBUG
 	/**
 	 * Prints the result of Heap::init() and a dummy value
@@ -594,13 +3653,15 @@ namespace GC
 	{
 		Heap &heap = Heap::the();
 		cout << "Heap addr:\t" << &heap << "\n";
-		cout << "GC m_stack_top:\t" << heap.m_stack_top << "\n";
+		cout << "GC m_stack_top:\t" << mutator()->m_stack_top << "\n";
 		auto stack_bottom = reinterpret_cast<uintptr_t *>(__builtin_frame_address(0));
 		cout << "GC stack_bottom:\t" << stack_bottom << endl;
 	}
 
 	/**
-	 * Conditional collection, only to be used in debugging
+	 * Conditional collection, only to be used in debugging.
+	 * Enables the profiler, so that the collection and the
+	 * allocations after it are recorded.
 	 *
 	 * @param flags Bitmap of flags
 	 */
@@ -609,6 +3670,7 @@ namespace GC
 		set_profiler(true);
 
 		Heap &heap = Heap::the();
+		Guard guard;
 
 		if (heap.m_profiler_enable)
 			Profiler::record(CollectStart);
@@ -625,19 +3687,42 @@ namespace GC
 		// get the frame adress, whwere local variables and saved registers are located
 		auto stack_bottom = reinterpret_cast<uintptr_t *>(__builtin_frame_address(0));
 		cout << "Stack bottom in collect:\t" << stack_bottom << "\n";
-		uintptr_t *stack_top = heap.m_stack_top;
+		uintptr_t *stack_top = mutator()->m_stack_top;
 
 		cout << "Stack end in collect:\t " << stack_top << endl;
-		auto work_list = heap.m_allocated_chunks;
 
+		if (heap.m_marking)
+			heap.finish_marking();
+		heap.stop_world();
+		heap.retire_tlabs();
+		free(heap);
+
+		bool compact = heap.compact_due();
+		if (!heap.m_nursery.empty())
+			heap.evacuate_nursery();
+
+		vector<uintptr_t> roots;
 		if (flags & MARK)
-			mark(stack_bottom, stack_top, work_list);
+		{
+			heap.find_all_roots(roots);
+			mark(roots);
+			heap.clear_weak_refs();
+			heap.queue_finalizers(roots);
+			heap.settle_samples(false);
+			if (heap.m_census != nullptr)
+				heap.write_census();
+			if (heap.m_snapshot != nullptr)
+				heap.write_snapshot(roots);
+		}
 
 		if (flags & SWEEP)
 			sweep(heap);
+		if (flags & SWEEP && flags & MARK && compact)
+			heap.compact(roots);
 
 		if (flags & FREE)
 			free(heap);
+		heap.resume_world();
 	}
 
 	// Mark child references from the root references
@@ -677,37 +3762,128 @@ namespace GC
 	}
 
 	// For testing purposes
-	void Heap::print_line(Chunk *chunk)
+	void Heap::print_line(char *chunk)
+	{
+		cout << "Marked: " << find_region(reinterpret_cast<uintptr_t>(chunk))->is_marked(chunk) << "\nStart adr: " << (void *)(chunk + HEADER_SIZE)
+			 << "\nSize: " << chunk_size(chunk) << " B\n" << endl;
+	}
+
+	/**
+	 * @returns The number of allocated chunks on the heap.
+	 */
+	size_t Heap::allocated_chunk_count()
+	{
+		Heap &heap = Heap::the();
+		size_t count = 0;
+		for (Region *region : heap.m_regions)
+			for (char *chunk = region->m_start; chunk < region->m_top; chunk = next_chunk(chunk))
+				if (!(chunk_flags(chunk) & HEADER_FREE))
+					count++;
+		return count;
+	}
+
+	/**
+	 * @returns The number of regions mapped by the heap.
+	 */
+	size_t Heap::region_count()
+	{
+		Heap &heap = Heap::the();
+		return heap.m_regions.size();
+	}
+
+	/**
+	 * @returns The size of the chunks in the free lists.
+	 */
+	size_t Heap::free_byte_count()
+	{
+		Heap &heap = Heap::the();
+		return heap.m_free_bytes;
+	}
+
+	/**
+	 * @returns The size of the largest chunk in the free lists.
+	 */
+	size_t Heap::largest_free_chunk_size()
+	{
+		Heap &heap = Heap::the();
+		return heap.largest_free_chunk();
+	}
+
+	/**
+	 * @returns The number of mapped bytes at which the next
+	 * 			collection is triggered.
+	 */
+	size_t Heap::collect_limit()
+	{
+		Heap &heap = Heap::the();
+		return heap.m_collect_at;
+	}
+
+	/**
+	 * @returns The number of regions left to be swept lazily.
+	 */
+	size_t Heap::unswept_region_count()
+	{
+		Heap &heap = Heap::the();
+		return heap.m_unswept.size();
+	}
+
+	/**
+	 * @returns True if the object is in the nursery.
+	 */
+	bool Heap::is_young(void *obj)
+	{
+		Heap &heap = Heap::the();
+		Region *region = heap.find_region(reinterpret_cast<uintptr_t>(obj));
+		return region != nullptr && region->m_young;
+	}
+
+	/**
+	 * @returns True while an incremental collection marks.
+	 */
+	bool Heap::is_marking()
+	{
+		Heap &heap = Heap::the();
+		return heap.m_marking;
+	}
+
+	/**
+	 * @returns The region holding an object, or a nullptr.
+	 */
+	Region *Heap::region_of(void *obj)
 	{
-		cout << "Marked: " << chunk->m_marked << "\nStart adr: " << chunk->m_start << "\nSize: " << chunk->m_size << " B\n"
-			 << endl;
+		return find_region(reinterpret_cast<uintptr_t>(obj));
 	}
 
-	void Heap::print_worklist(std::vector<Chunk *> &list)
+	/**
+	 * @returns The number of regions the calling thread
+	 * 			has pushed and not popped.
+	 */
+	size_t Heap::region_depth()
 	{
-		for (auto cp : list)
-			cout << "Chunk at:\t" << cp->m_start << "\nSize:\t\t" << cp->m_size << "\n";
-		cout << endl;
+		return Heap::mutator()->m_arena.depth();
 	}
 
 	void Heap::print_contents()
 	{
 		Heap &heap = Heap::the();
-		if (heap.m_allocated_chunks.size())
+		if (heap.allocated_chunk_count())
 		{
-			cout << "\nALLOCATED CHUNKS #" << dec << heap.m_allocated_chunks.size() << endl;
-			for (auto chunk : heap.m_allocated_chunks)
-				print_line(chunk);
+			cout << "\nALLOCATED CHUNKS #" << dec << heap.allocated_chunk_count() << endl;
+			print_allocated_chunks(&heap);
 		}
 		else
 		{
 			cout << "NO ALLOCATIONS\n" << endl;
 		}
-		if (heap.m_freed_chunks.size())
+		if (heap.free_chunk_count())
 		{
-			cout << "\nFREED CHUNKS #" << dec << heap.m_freed_chunks.size() << endl;
-			for (auto fchunk : heap.m_freed_chunks)
-				print_line(fchunk);
+			cout << "\nFREED CHUNKS #" << dec << heap.free_chunk_count() << endl;
+			for (char *free_list : heap.m_size_classes)
+				for (char *fchunk = free_list; fchunk != nullptr; fchunk = next_free(fchunk))
+					print_line(fchunk);
+			for (auto &entry : heap.m_large_chunks)
+				print_line(entry.second);
 		}
 		else
 		{
@@ -718,17 +3894,21 @@ namespace GC
 	void Heap::print_summary()
 	{
 		Heap &heap = Heap::the();
-		if (heap.m_allocated_chunks.size())
+		if (heap.allocated_chunk_count())
 		{
-			cout << "\nALLOCATED CHUNKS #" << dec << heap.m_allocated_chunks.size() << endl;
+			cout << "\nALLOCATED CHUNKS #" << dec << heap.allocated_chunk_count() << endl;
+			std::map<size_t, std::pair<size_t, size_t>> sizes;
+			heap.census(sizes, false);
+			for (auto &[size, totals] : sizes)
+				cout << "Size " << size << " B: " << totals.first << " chunks, " << totals.second << " B" << endl;
 		}
 		else
 		{
 			cout << "NO ALLOCATIONS\n" << endl;
 		}
-		if (heap.m_freed_chunks.size())
+		if (heap.free_chunk_count())
 		{
-			cout << "\nFREED CHUNKS #" << dec << heap.m_freed_chunks.size() << endl;
+			cout << "\nFREED CHUNKS #" << dec << heap.free_chunk_count() << endl;
 		}
 		else
 		{
@@ -736,88 +3916,25 @@ namespace GC
 		}
 	}
 
-	void Heap::print_allocated_chunks(Heap *heap) {
-		cout << "--- Allocated Chunks ---\n" << endl;
-		for (auto chunk : heap->m_allocated_chunks) {
-			print_line(chunk);
-		}
-	}
-
-	Chunk *Heap::try_recycle_chunks_new(size_t size)
+	/**
+	 * @returns The number of chunks in all the free lists.
+	 */
+	size_t Heap::free_chunk_count()
 	{
 		Heap &heap = Heap::the();
-		// Check if there are any freed chunks large enough for current request
-		for (size_t i = 0; i < heap.m_freed_chunks.size(); i++)
-		{
-			auto chunk = heap.m_freed_chunks[i]; //Heap::get_at(heap.m_freed_chunks, i);
-			auto iter = heap.m_freed_chunks.begin();
-			//advance(iter, i);
-			i++;
-			if (chunk->m_size > size)
-			{
-				// Split the chunk, use one part and add the remaining part to
-				// the list of freed chunks
-				size_t diff = chunk->m_size - size;
-				auto chunk_complement = new Chunk(diff, chunk->m_start + chunk->m_size);
-
-				heap.m_freed_chunks.erase(iter);
-				heap.m_freed_chunks.push_back(chunk_complement);
-				heap.m_allocated_chunks.push_back(chunk);
-
-				return chunk;
-			}
-			else if (chunk->m_size == size)
-			{
-				// Reuse the whole chunk
-				heap.m_freed_chunks.erase(iter);
-				heap.m_allocated_chunks.push_back(chunk);
-				return chunk;
-			}
-		}
-		// If no chunk was found, return nullptr
-		return nullptr;
+		size_t count = heap.m_large_chunks.size();
+		for (char *free_list : heap.m_size_classes)
+			for (char *chunk = free_list; chunk != nullptr; chunk = next_free(chunk))
+				count++;
+		return count;
 	}
 
-	void Heap::free_overlap_new(Heap &heap) // borde göra en record(ChunkFreed) på onödiga chunks
-	{
-		std::vector<Chunk *> filtered;
-		size_t i = 0;
-		auto prev = heap.m_freed_chunks[i++]; //Heap::get_at(heap.m_freed_chunks, i++);
-		prev->m_marked = true;
-		filtered.push_back(prev);
-		cout << filtered.back()->m_start << endl;
-		for (; i < heap.m_freed_chunks.size(); i++)
-		{
-			prev = filtered.back();
-			auto next = heap.m_freed_chunks[i]; //Heap::get_at(heap.m_freed_chunks, i);
-			auto p_start = (uintptr_t)(prev->m_start);
-			auto p_size = (uintptr_t)(prev->m_size);
-			auto n_start = (uintptr_t)(next->m_start);
-			if (n_start >= (p_start + p_size))
-			{
-				next->m_marked = true;
-				filtered.push_back(next);
-			}
-		}
-		heap.m_freed_chunks.swap(filtered);
-		
-		bool profiler_enabled = heap.m_profiler_enable;
-		// After swap m_freed_chunks contains still available chunks
-		// and filtered contains all the chunks, so delete unused chunks
-		for (Chunk *chunk : filtered)
-		{
-			// if chunk was filtered away, delete it
-			if (!chunk->m_marked)
-			{
-				if (profiler_enabled)
-					Profiler::record(ChunkFreed, chunk);
-				delete chunk;
-			}
-			else
-			{
-				chunk->m_marked = false;
-			}
-		}
+	void Heap::print_allocated_chunks(Heap *heap) {
+		cout << "--- Allocated Chunks ---\n" << endl;
+		for (Region *region : heap->m_regions)
+			for (char *chunk = region->m_start; chunk < region->m_top; chunk = next_chunk(chunk))
+				if (!(chunk_flags(chunk) & HEADER_FREE))
+					print_line(chunk);
 	}
 
 #endif
@@ -0,0 +1,230 @@
+#include <algorithm>
+
+#include "heap.hpp"
+#include "marker.hpp"
+
+namespace GC
+{
+    Marker &Marker::the()
+    {
+        static Marker instance;
+        return instance;
+    }
+
+    Marker::~Marker()
+    {
+        stop_workers();
+    }
+
+    /**
+     * Sets the number of threads that mark the heap, the
+     * collecting thread included, and starts the extra
+     * threads. With one thread the heap is marked by the
+     * collecting thread alone, without the marker.
+     *
+     * @param threads   The number of threads, from 1 up
+     *                  to MARK_THREADS_MAX.
+     */
+    void Marker::set_threads(size_t threads)
+    {
+        Marker &marker = Marker::the();
+        threads = std::clamp(threads, static_cast<size_t>(1), static_cast<size_t>(MARK_THREADS_MAX));
+
+        marker.stop_workers();
+        marker.m_threads = threads;
+        marker.m_deques.clear();
+        for (size_t id = 0; id < threads; id++)
+            marker.m_deques.push_back(std::make_unique<MarkDeque>());
+        for (size_t id = 1; id < threads; id++)
+            marker.m_workers.emplace_back(&Marker::worker, &marker, id, marker.m_cycle);
+    }
+
+    size_t Marker::threads()
+    {
+        return Marker::the().m_threads;
+    }
+
+    void Marker::stop_workers()
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_lock);
+            m_exit = true;
+        }
+        m_start.notify_all();
+        for (std::thread &worker : m_workers)
+            worker.join();
+        m_workers.clear();
+        m_exit = false;
+    }
+
+    /**
+     * Marks the chunks reachable from the roots with all the
+     * marking threads. The chunks the roots point into are
+     * dealt out to the deques of the threads, then each thread
+     * scans chunks until there are none left on any deque.
+     *
+     * Time complexity: O(N / T), where N is the number of pointer
+     *                  words in the reachable chunks and T the number
+     *                  of threads, if the graph allows it. A
+     *                  long linked list is still scanned by one
+     *                  thread at a time.
+     *
+     * @param roots The possible pointers into the heap.
+     */
+    void Marker::mark(std::vector<uintptr_t> &roots)
+    {
+        Marker &marker = Marker::the();
+        Heap &heap = Heap::the();
+
+        size_t next = 0;
+        for (uintptr_t root : roots)
+        {
+            Region *region;
+            char *chunk = heap.find_chunk(root, region);
+            if (chunk != nullptr && region->try_mark(chunk))
+            {
+                heap.m_marked += HEADER_SIZE + chunk_size(chunk);
+                marker.m_deques[next++ % marker.m_threads]->push(chunk);
+            }
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(marker.m_lock);
+            marker.m_idle = 0;
+            marker.m_marked = 0;
+            marker.m_running = marker.m_threads - 1;
+            marker.m_cycle++;
+        }
+        marker.m_start.notify_all();
+
+        size_t marked = marker.drain(0);
+
+        std::unique_lock<std::mutex> lock(marker.m_lock);
+        marker.m_done.wait(lock, [&marker] { return marker.m_running == 0; });
+        heap.m_marked += marked + marker.m_marked;
+        for (auto &deque : marker.m_deques)
+            deque->reset();
+    }
+
+    /**
+     * The loop of a marking thread, which drains the deques
+     * once for every collection.
+     *
+     * @param id    The index of the deque of the thread.
+     *
+     * @param cycle The collection before the thread was
+     *              started.
+     */
+    void Marker::worker(size_t id, uint64_t cycle)
+    {
+        while (true)
+        {
+            {
+                std::unique_lock<std::mutex> lock(m_lock);
+                m_start.wait(lock, [this, cycle] { return m_exit || m_cycle != cycle; });
+                if (m_exit)
+                    return;
+                cycle = m_cycle;
+            }
+
+            size_t marked = drain(id);
+
+            std::lock_guard<std::mutex> lock(m_lock);
+            m_marked += marked;
+            if (--m_running == 0)
+                m_done.notify_one();
+        }
+    }
+
+    /**
+     * Scans chunks from the deque of a thread, and steals
+     * from the others when it is empty. A thread that finds
+     * no chunk anywhere is idle until a deque has chunks
+     * again, marking is done once all threads are idle, as
+     * only a thread that is scanning can push new chunks.
+     *
+     * @param id    The index of the deque of the thread.
+     *
+     * @returns The size of the chunks the thread marked.
+     */
+    size_t Marker::drain(size_t id)
+    {
+        MarkDeque &deque = *m_deques[id];
+        size_t marked = 0;
+        while (true)
+        {
+            char *chunk = deque.pop();
+            if (chunk == nullptr)
+                chunk = steal(id);
+            if (chunk != nullptr)
+            {
+                marked += scan(chunk, deque);
+                continue;
+            }
+
+            m_idle.fetch_add(1);
+            while (true)
+            {
+                if (m_idle.load() == m_threads)
+                    return marked;
+                if (!all_empty())
+                {
+                    m_idle.fetch_sub(1);
+                    break;
+                }
+                std::this_thread::yield();
+            }
+        }
+    }
+
+    /**
+     * Tries to steal a chunk from the deque of every other
+     * thread once, starting after the thread itself.
+     *
+     * @param id    The index of the deque of the thread.
+     *
+     * @returns The chunk, or a nullptr if none was stolen.
+     */
+    char *Marker::steal(size_t id)
+    {
+        for (size_t i = 1; i < m_threads; i++)
+        {
+            char *chunk = m_deques[(id + i) % m_threads]->steal();
+            if (chunk != nullptr)
+                return chunk;
+        }
+        return nullptr;
+    }
+
+    bool Marker::all_empty()
+    {
+        return std::all_of(m_deques.begin(), m_deques.end(), [](auto &deque) { return deque->empty(); });
+    }
+
+    /**
+     * Marks the chunks the words of a chunk point into, the
+     * ones this thread marks first are pushed to its deque.
+     * Only the pointer words of a typed chunk are scanned.
+     *
+     * @param chunk The header of the chunk.
+     *
+     * @param deque The deque of the thread.
+     *
+     * @returns The size of the chunks marked.
+     */
+    size_t Marker::scan(char *chunk, MarkDeque &deque)
+    {
+        Heap &heap = Heap::the();
+        size_t marked = 0;
+        for_each_pointer(chunk, [&](uintptr_t word) {
+            Region *region;
+            char *child = heap.find_chunk(word, region);
+            if (child != nullptr && region->try_mark(child))
+            {
+                marked += HEADER_SIZE + chunk_size(child);
+                deque.push(child);
+            }
+        });
+        return marked;
+    }
+}
@@ -1,5 +1,8 @@
+#include <algorithm>
 #include <ctime>
 #include <cstring>
+#include <cxxabi.h>
+#include <dlfcn.h>
 #include <iostream>
 #include <fstream>
 #include <time.h>
@@ -7,6 +10,7 @@
 #include <unistd.h>
 #include <stdexcept>
 
+#include "cheap.h"
 #include "chunk.hpp"
 #include "event.hpp"
 #include "profiler.hpp"
@@ -15,6 +19,9 @@
 
 namespace GC
 {
+    // The ring of the calling thread, once it recorded an event
+    static __thread EventRing *thread_ring = nullptr;
+
     Profiler& Profiler::the()
     {
         static Profiler instance;
@@ -33,18 +40,52 @@ namespace GC
         prof.flags = flags;
     }
 
-    void Profiler::record_data(GCEvent *event)
+    /**
+     * Copies an event into the ring of the calling thread.
+     *
+     * Time complexity: O(1), without allocating after the
+     *                  first event of the thread.
+     *
+     * @param event The event to record.
+    */
+    void Profiler::record_data(const GCEvent &event)
+    {
+        EventRing *ring = thread_ring;
+        if (ring == nullptr)
+            ring = add_ring();
+        if (ring->m_next - ring->m_flushed == PROFILER_RING_EVENTS && Profiler::the().m_trace != nullptr)
+            flush_ring(ring);
+
+        ring->m_events[ring->m_next++ % PROFILER_RING_EVENTS] = event;
+        ring->m_counts[__builtin_ctz(event.get_type())]++;
+    }
+
+    /**
+     * Allocates the ring of the calling thread.
+     *
+     * @returns The ring.
+    */
+    EventRing *Profiler::add_ring()
     {
         Profiler &prof = Profiler::the();
-        prof.m_events.push_back(event);
+        thread_ring = new EventRing();
+        std::lock_guard<std::mutex> lock(prof.m_rings_lock);
+        thread_ring->m_thread = prof.m_rings.size();
+        prof.m_rings.push_back(thread_ring);
+        return thread_ring;
+    }
 
-        if (prof.m_last_prof_event->m_type == event->get_type())
-            prof.m_last_prof_event->m_n++;
-        else
-        {
-            prof.m_prof_events.push_back(prof.m_last_prof_event);
-            prof.m_last_prof_event = new ProfilerEvent(event->get_type());
-        }
+    /**
+     * @returns The number of events of a type that the
+     *          threads recorded.
+    */
+    size_t Profiler::event_count(GCEventType type)
+    {
+        Profiler &prof = Profiler::the();
+        size_t count = 0;
+        for (EventRing *ring : prof.m_rings)
+            count += ring->m_counts[__builtin_ctz(type)];
+        return count;
     }
 
     /**
@@ -56,7 +97,7 @@ namespace GC
     {
         Profiler &prof = Profiler::the();
         if (prof.flags & type)
-            Profiler::record_data(new GCEvent(type));
+            Profiler::record_data(GCEvent(type));
         // auto event = new GCEvent(type);
         // auto profiler = Profiler::the();
         // profiler.m_events.push_back(event);
@@ -74,7 +115,7 @@ namespace GC
     {
         Profiler &prof = Profiler::the();
         if (prof.flags & type)
-            Profiler::record_data(new GCEvent(type, size));
+            Profiler::record_data(GCEvent(type, size));
         // auto event = new GCEvent(type, size);
         // auto profiler = Profiler::the();
         // profiler.m_events.push_back(event);
@@ -89,6 +130,100 @@ namespace GC
             dump_prof_trace(false);
         else
             dump_chunk_trace();
+        close_trace();
+    }
+
+    /**
+     * Streams the recorded events to a binary trace file
+     * from now on, instead of overwriting the oldest events
+     * when the ring of a thread is full. The file is written
+     * through a buffer, one block of events at a time, and is
+     * closed by dispose(). See docs/lib/trace.md for the
+     * format and tools/cheap_trace.cpp for a converter.
+     *
+     * @param path  The trace file, or a nullptr to close the
+     *              open trace.
+     *
+     * @throws  A runtime error if the file cannot be opened.
+    */
+    void Profiler::set_trace_file(const char *path)
+    {
+        close_trace();
+        if (path != nullptr)
+            open_trace(path);
+    }
+
+    void Profiler::open_trace(const std::string &path)
+    {
+        Profiler &prof = Profiler::the();
+        std::FILE *trace = std::fopen(path.c_str(), "wb");
+        if (trace == nullptr)
+            throw std::runtime_error(std::string("Error: Cannot open the trace file ") + path);
+        std::setvbuf(trace, nullptr, _IOFBF, TRACE_BUFFER_RECORDS * sizeof(TraceRecord));
+
+        TraceHeader header {};
+        std::memcpy(header.m_magic, TRACE_MAGIC, sizeof(header.m_magic));
+        header.m_version = TRACE_VERSION;
+        header.m_record_size = sizeof(TraceRecord);
+        header.m_start_ns = event_clock();
+        std::fwrite(&header, sizeof(header), 1, trace);
+
+        // Only the events from now on are streamed
+        for (EventRing *ring : prof.m_rings)
+            ring->m_flushed = ring->m_next;
+        prof.m_trace = trace;
+    }
+
+    /**
+     * Writes the events of a ring that are not in the trace
+     * file yet to the file.
+     *
+     * Time complexity: O(N), where N is the number of events
+     *                  written.
+     *
+     * @param ring  The ring of a thread.
+    */
+    void Profiler::flush_ring(EventRing *ring)
+    {
+        Profiler &prof = Profiler::the();
+        std::lock_guard<std::mutex> lock(prof.m_trace_lock);
+        size_t first = std::max(ring->m_flushed,
+            ring->m_next > PROFILER_RING_EVENTS ? ring->m_next - PROFILER_RING_EVENTS : 0);
+
+        for (size_t i = first; i < ring->m_next; i++)
+        {
+            const GCEvent &event = ring->m_events[i % PROFILER_RING_EVENTS];
+            TraceRecord record {};
+            record.m_timestamp = event.get_time_stamp();
+            record.m_thread = ring->m_thread;
+            record.m_type = __builtin_ctz(event.get_type());
+            if (event.has_chunk())
+            {
+                Chunk chunk = event.get_chunk();
+                record.m_start = reinterpret_cast<uint64_t>(chunk.m_start);
+                record.m_size = chunk.m_size;
+                record.m_marked = chunk.m_marked;
+            }
+            else
+                record.m_size = event.get_size();
+            std::fwrite(&record, sizeof(record), 1, prof.m_trace);
+        }
+        ring->m_flushed = ring->m_next;
+    }
+
+    /**
+     * Writes what the rings hold to the open trace file and
+     * closes it.
+    */
+    void Profiler::close_trace()
+    {
+        Profiler &prof = Profiler::the();
+        if (prof.m_trace == nullptr)
+            return;
+        for (EventRing *ring : prof.m_rings)
+            flush_ring(ring);
+        std::fclose(prof.m_trace);
+        prof.m_trace = nullptr;
     }
 
     /**
@@ -101,17 +236,11 @@ namespace GC
     */
     void Profiler::record(GCEventType type, Chunk *chunk)
     {
-        // Create a copy of chunk to store in the profiler
-        // because in free() chunks are deleted and cannot
-        // be referenced by the profiler. These copied
-        // chunks are deleted by the profiler on dispose().
+        // The event holds a copy of the chunk, because chunks
+        // are freed and cannot be referenced by the profiler
         Profiler &prof = Profiler::the();
         if (prof.flags & type)
-        {
-            auto chunk_copy = new Chunk(chunk);
-            auto event = new GCEvent(type, chunk_copy);
-            Profiler::record_data(event);
-        }
+            Profiler::record_data(GCEvent(type, chunk));
         // auto profiler = Profiler::the();
         // profiler.m_events.push_back(event);
     }
@@ -127,95 +256,311 @@ namespace GC
         {
             prof.collect_time += time;
         }
+        else if (type == CompactStart)
+        {
+            prof.compact_time += time;
+            prof.compact_counts++;
+        }
     }
 
-    void Profiler::dump_prof_trace(bool timing_only)
+    /**
+     * Records the time of a mark phase, which is kept
+     * per number of marking threads.
+     *
+     * @param type      MarkStart.
+     *
+     * @param time      The time of the mark phase.
+     *
+     * @param threads   The number of threads that marked.
+    */
+    void Profiler::record(GCEventType type, std::chrono::microseconds time, size_t threads)
     {
         Profiler &prof = Profiler::the();
-        prof.m_prof_events.push_back(prof.m_last_prof_event);
-        auto start = prof.m_prof_events.begin();
-        auto end = prof.m_prof_events.end();
-        int allocs = 0, collects = 0;
+        if (type == MarkStart)
+        {
+            auto &mark_time = prof.mark_times[threads];
+            mark_time.first += time;
+            mark_time.second++;
+        }
+    }
 
-        char buffer[22];
-        std::ofstream fstr = prof.create_file_stream();
+    /**
+     * Records the fragmentation of the free chunks, as the
+     * share of the free bytes in the largest free chunk. A
+     * share of 1 means that all free memory can be used by a
+     * single allocation.
+     *
+     * @param largest   The size of the largest free chunk.
+     *
+     * @param free      The size of all free chunks.
+    */
+    void Profiler::record_fragmentation(size_t largest, size_t free)
+    {
+        Profiler &prof = Profiler::the();
+        double share = static_cast<double>(largest) / free;
+        prof.frag_last = share;
+        prof.frag_lowest = std::min(prof.frag_lowest, share);
+        prof.frag_sum += share;
+        prof.frag_counts++;
+    }
+
+    /**
+     * Prints the runs of events of the same type that the
+     * rings hold, one thread after the other, and the totals.
+    */
+    void Profiler::set_alloc_sites(const char **names)
+    {
+        Profiler &prof = Profiler::the();
+        prof.m_site_names = names;
+        prof.m_site_count = 0;
+        while (names != nullptr && names[prof.m_site_count] != nullptr)
+            prof.m_site_count++;
+    }
 
-        while (start != end)
+    /**
+     * Records an allocation sample of allocation-site profiling,
+     * which is added to the samples of the same stack and site.
+     *
+     * Time complexity: O(D log S), where D is the depth of the
+     *                  stack and S the number of stacks and
+     *                  sites sampled.
+     *
+     * @param stack     The return addresses of the stack, the
+     *                  innermost frame first.
+     *
+     * @param depth     The number of return addresses.
+     *
+     * @param site      The allocation site.
+     *
+     * @param bytes     The bytes the sample stands for.
+     *
+     * @param objects   The objects the sample stands for.
+     *
+     * @returns The entry of the stack and site, for
+     *          record_survivor().
+    */
+    size_t Profiler::record_sample(const uintptr_t *stack, size_t depth, size_t site, size_t bytes, size_t objects)
+    {
+        Profiler &prof = Profiler::the();
+        std::vector<uintptr_t> key(stack, stack + depth);
+        key.push_back(site);
+
+        auto [iter, added] = prof.m_site_entries.try_emplace(key, prof.m_sites.size());
+        if (added)
         {
-            auto event = *start++;
+            key.pop_back();
+            prof.m_sites.push_back(SiteStats {site, key});
+        }
+        SiteStats &stats = prof.m_sites[iter->second];
+        stats.m_bytes += bytes;
+        stats.m_objects += objects;
+        return iter->second;
+    }
 
-            if (event->m_type == AllocStart)
-                allocs += event->m_n;
-            else if (event->m_type == CollectStart)
-                collects += event->m_n;
+    /**
+     * Records that a sampled object survived the first
+     * collection after it was allocated.
+    */
+    void Profiler::record_survivor(size_t entry, size_t bytes, size_t objects)
+    {
+        SiteStats &stats = Profiler::the().m_sites[entry];
+        stats.m_survived_bytes += bytes;
+        stats.m_survived_objects += objects;
+    }
 
-            if (!timing_only)
+    const std::vector<SiteStats> &Profiler::get_sites()
+    {
+        return Profiler::the().m_sites;
+    }
+
+    std::string Profiler::site_name(size_t site)
+    {
+        Profiler &prof = Profiler::the();
+        if (site < prof.m_site_count)
+            return prof.m_site_names[site];
+        return site == CHEAP_SITE_UNKNOWN ? "[unknown site]" : "site " + std::to_string(site);
+    }
+
+    /**
+     * @returns The name of the function a return address
+     *          is in, if the executable exports its symbols,
+     *          e.g. when linked with -rdynamic, or else the
+     *          address for addr2line.
+    */
+    std::string Profiler::frame_name(uintptr_t address)
+    {
+        Dl_info info;
+        if (dladdr(reinterpret_cast<void *>(address), &info) != 0 && info.dli_sname != nullptr)
+        {
+            int status;
+            char *demangled = abi::__cxa_demangle(info.dli_sname, nullptr, nullptr, &status);
+            std::string name = status == 0 ? demangled : info.dli_sname;
+            std::free(demangled);
+            return name;
+        }
+        char buffer[24];
+        snprintf(buffer, sizeof(buffer), "0x%lx", static_cast<unsigned long>(address));
+        return buffer;
+    }
+
+    /**
+     * Writes the samples in the folded stack format of
+     * flamegraph.pl and speedscope, one line per stack and
+     * site, the outermost frame first and the site last,
+     * followed by the bytes. Stacks with the same names,
+     * from different calls in a function, are merged.
+     *
+     * @param path      The file to write.
+     *
+     * @param survived  Write the bytes that survived a
+     *                  collection instead of all bytes.
+    */
+    void Profiler::dump_folded(const std::string &path, bool survived)
+    {
+        Profiler &prof = Profiler::the();
+        std::map<uintptr_t, std::string> names;
+        std::map<std::string, size_t> stacks;
+        for (SiteStats &stats : prof.m_sites)
+        {
+            size_t bytes = survived ? stats.m_survived_bytes : stats.m_bytes;
+            if (bytes == 0)
+                continue;
+            std::string stack;
+            for (auto frame = stats.m_stack.rbegin(); frame != stats.m_stack.rend(); frame++)
             {
-                fstr << "\n--------------------------------\n"
-                << Profiler::type_to_string(event->m_type) << " "
-                << event->m_n << " times:"; 
+                auto [name, added] = names.try_emplace(*frame);
+                if (added)
+                {
+                    // Semicolons separate the frames
+                    name->second = frame_name(*frame);
+                    std::replace(name->second.begin(), name->second.end(), ';', ':');
+                }
+                stack += name->second + ";";
             }
+            stacks[stack + site_name(stats.m_site)] += bytes;
         }
-        fstr << "\n--------------------------------";
 
-        fstr << "\n\nTime spent on allocations:\t" << prof.alloc_time.count() << " microseconds"
-            << "\nAllocation cycles:\t" << allocs
-            << "\nTime spent on collections:\t" << prof.collect_time.count() << " microseconds"
-            << "\nCollection cycles:\t" << collects
-            << "\n--------------------------------";
+        std::ofstream fstr(path);
+        for (auto &[stack, bytes] : stacks)
+            fstr << stack << " " << bytes << "\n";
     }
 
     /**
-     * Prints the history of the recorded events
-     * to a log file in the /tests/logs folder.
+     * Writes the results of allocation-site profiling to the
+     * log folder, a summary per site sorted by the bytes, and
+     * the folded stacks of the bytes allocated and of the bytes
+     * that survived, see dump_folded().
     */
-    void Profiler::dump_chunk_trace()
+    void Profiler::dump_sites()
     {
         Profiler &prof = Profiler::the();
-        auto start = prof.m_events.begin();
-        auto end = prof.m_events.end();
-
-        // Buffer for timestamp
-        char buffer[22];
+        std::time_t tt = std::time(NULL);
+        std::tm *ptm = std::localtime(&tt);
+        char buffer[32];
+        std::strftime(buffer, 32, "/sites_%a_%H_%M_%S", ptm);
+        const std::string path = prof.get_log_folder() + buffer;
 
-        while (start != end)
+        std::map<size_t, SiteStats> per_site;
+        for (SiteStats &stats : prof.m_sites)
         {
-            auto event = *start++;
-            auto e_type = event->get_type();
-
-            prof.print_chunk_event(event, buffer);
+            SiteStats &total = per_site.try_emplace(stats.m_site, SiteStats {stats.m_site}).first->second;
+            total.m_bytes += stats.m_bytes;
+            total.m_objects += stats.m_objects;
+            total.m_survived_bytes += stats.m_survived_bytes;
+            total.m_survived_objects += stats.m_survived_objects;
         }
+        std::vector<SiteStats> sites;
+        for (auto &[site, total] : per_site)
+            sites.push_back(total);
+        std::sort(sites.begin(), sites.end(), [](const SiteStats &a, const SiteStats &b) { return a.m_bytes > b.m_bytes; });
+
+        std::ofstream fstr(path + ".txt");
+        fstr << "bytes\tobjects\tsurvived bytes\tsurvived objects\tsite\n";
+        for (SiteStats &total : sites)
+            fstr << total.m_bytes << "\t" << total.m_objects << "\t" << total.m_survived_bytes
+                << "\t" << total.m_survived_objects << "\t" << site_name(total.m_site) << "\n";
+
+        dump_folded(path + ".folded", false);
+        dump_folded(path + "_survived.folded", true);
     }
 
-    void Profiler::print_chunk_event(GCEvent *event, char buffer[22])
+    void Profiler::dump_prof_trace(bool timing_only)
     {
         Profiler &prof = Profiler::the();
-        // File output stream
-        std::ofstream fstr = prof.create_file_stream(); 
-        std::time_t tt = event->get_time_stamp(); 
-        std::tm *btm = std::localtime(&tt);
-        std::strftime(buffer, 22, "%a %T", btm);
-
-        fstr << "--------------------------------\n"
-             << buffer
-             << "\nEvent:\t" << Profiler::type_to_string(event->get_type());
-             // event->type_to_string(); 
-        
+        size_t allocs = event_count(AllocStart), collects = event_count(CollectStart);
+        size_t lost = 0;
 
+        std::ofstream fstr = prof.create_file_stream();
 
-        const Chunk *chunk = event->get_chunk(); 
+        for (EventRing *ring : prof.m_rings)
+        {
+            size_t first = ring->m_next > PROFILER_RING_EVENTS ? ring->m_next - PROFILER_RING_EVENTS : 0;
+            // The events before the ring are lost unless they were streamed
+            if (first > ring->m_flushed)
+                lost += first - ring->m_flushed;
+            if (timing_only)
+                continue;
+
+            for (size_t i = first; i < ring->m_next;)
+            {
+                GCEventType type = ring->m_events[i % PROFILER_RING_EVENTS].get_type();
+                size_t n = 0;
+                for (; i < ring->m_next && ring->m_events[i % PROFILER_RING_EVENTS].get_type() == type; i++)
+                    n++;
+                fstr << "\n--------------------------------\n"
+                << Profiler::type_to_string(type) << " "
+                << n << " times:"; 
+            }
+        }
+        if (lost > 0)
+            fstr << "\nEvents overwritten:\t" << lost;
+        if (prof.frag_counts > 0)
+        {
+            fstr << "\nLargest free chunk / free bytes, last:\t" << prof.frag_last
+                << "\nLargest free chunk / free bytes, lowest:\t" << prof.frag_lowest
+                << "\nLargest free chunk / free bytes, mean:\t" << prof.frag_sum / prof.frag_counts;
+        }
+        fstr << "\n--------------------------------";
 
-        if (event->get_type() == AllocStart)
+        fstr << "\n\nTime spent on allocations:\t" << prof.alloc_time.count() << " microseconds"
+            << "\nAllocation cycles:\t" << allocs
+            << "\nTime spent on collections:\t" << prof.collect_time.count() << " microseconds"
+            << "\nCollection cycles:\t" << collects;
+        if (prof.compact_counts > 0)
         {
-            fstr << "\nSize: " << event->get_size();
+            fstr << "\nTime spent on compaction:\t" << prof.compact_time.count() << " microseconds"
+                << "\nCompactions:\t" << prof.compact_counts;
         }
-        else if (chunk)
+        for (auto &[threads, mark_time] : prof.mark_times)
         {
-            fstr << "\nChunk:  " << chunk->m_start
-                 << "\n  Size: " << chunk->m_size
-                 << "\n  Mark: " << chunk->m_marked;
+            fstr << "\nTime spent on marking with " << threads << " threads:\t" << mark_time.first.count() << " microseconds"
+                << "\nMark phases with " << threads << " threads:\t" << mark_time.second;
         }
-        fstr << "\n";
+        fstr << "\n--------------------------------";
+    }
+
+    /**
+     * Writes the history of the recorded events to a
+     * binary trace file in the /tests/logs folder, unless
+     * they are streamed to a trace file already. The
+     * events are written by close_trace().
+    */
+    void Profiler::dump_chunk_trace()
+    {
+        Profiler &prof = Profiler::the();
+        if (prof.m_trace != nullptr)
+            return;
+
+        // get current time
+        std::time_t tt = std::time(NULL);
+        std::tm *ptm = std::localtime(&tt);
+        char buffer[32];
+        std::strftime(buffer, 32, "/trace_%a_%H_%M_%S.bin", ptm);
+
+        open_trace(prof.get_log_folder() + buffer);
+        // The events the rings still hold are written as well
+        for (EventRing *ring : prof.m_rings)
+            ring->m_flushed = 0;
     }
 
     /**
@@ -310,6 +655,7 @@ namespace GC
             case ProfilerDispose:   return "ProfilerDispose";
             case SweepStart:        return "SweepStart";
             case FreeStart:         return "FreeStart";
+            case CompactStart:      return "CompactStart";
             default:                return "[Unknown]";
         }
     }
@@ -0,0 +1,260 @@
+#include <cstring>
+#include <fcntl.h>
+#include <stdexcept>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+#ifdef __APPLE__
+#include <mach-o/getsect.h>
+#include <mach-o/ldsyms.h>
+#else
+#include <elf.h>
+#include <link.h>
+#endif
+
+#include "stack_map.hpp"
+
+// Location kinds of the stack map format
+#define LOCATION_REGISTER       1
+#define LOCATION_DIRECT         2
+#define LOCATION_INDIRECT       3
+#define LOCATION_CONSTANT       4
+#define LOCATION_CONSTANT_INDEX 5
+
+#define HEADER_BYTES    16
+#define FUNCTION_BYTES  24
+#define CONSTANT_BYTES  8
+#define RECORD_BYTES    16
+#define LOCATION_BYTES  12
+#define LIVE_OUT_BYTES  4
+
+namespace GC
+{
+    template <typename T>
+    static T read(const char *p)
+    {
+        T value;
+        std::memcpy(&value, p, sizeof(T));
+        return value;
+    }
+
+    static const char *align_8(const char *p)
+    {
+        return reinterpret_cast<const char *>((reinterpret_cast<uintptr_t>(p) + 7) & ~7UL);
+    }
+
+    StackMap &StackMap::the()
+    {
+        static StackMap instance;
+        return instance;
+    }
+
+    /**
+     * Parses one stack map, as emitted for a single module,
+     * into the call site table. The section of the executable
+     * holds the stack maps of all its modules back to back.
+     *
+     * Statepoint records start with three constants, followed
+     * by the deopt operands and the gc pointers of the call.
+     * The code generator passes every rooted buffer as a deopt
+     * pair of the buffer and its size, which is a Direct location
+     * followed by a Constant. Gc pointers spilled by LLVM are
+     * Indirect locations, and are taken as buffers of a word.
+     * Other locations hold no roots of ours and are skipped.
+     *
+     * @param blob  The start of the stack map
+     *
+     * @param end   The end of the section
+     *
+     * @returns     The start of the next stack map in the section
+     *
+     * Time complexity: O(n), n being the number of locations
+    */
+    const char *StackMap::parse(const char *blob, const char *end)
+    {
+        StackMap &map = StackMap::the();
+
+        if (read<uint8_t>(blob) != STACK_MAP_VERSION)
+            throw std::runtime_error(std::string("Error: unsupported stack map version ") + std::to_string(read<uint8_t>(blob)));
+
+        uint32_t num_functions = read<uint32_t>(blob + 4);
+        uint32_t num_constants = read<uint32_t>(blob + 8);
+        const char *functions = blob + HEADER_BYTES;
+        const char *constants = functions + num_functions * FUNCTION_BYTES;
+        const char *p = constants + num_constants * CONSTANT_BYTES;
+
+        for (uint32_t f = 0; f < num_functions; f++)
+        {
+            const char *function = functions + f * FUNCTION_BYTES;
+            uintptr_t address = read<uint64_t>(function);
+            uint64_t num_records = read<uint64_t>(function + 16);
+
+            for (uint64_t r = 0; r < num_records; r++)
+            {
+                if (p + RECORD_BYTES > end)
+                    throw std::runtime_error(std::string("Error: truncated stack map"));
+
+                uint32_t offset = read<uint32_t>(p + 8);
+                uint16_t num_locations = read<uint16_t>(p + 14);
+                const char *locations = p + RECORD_BYTES;
+
+                CallSite site {static_cast<uint32_t>(map.m_roots.size()), 0};
+                for (uint16_t l = 0; l < num_locations; l++)
+                {
+                    const char *location = locations + l * LOCATION_BYTES;
+                    uint8_t kind = read<uint8_t>(location);
+                    uint16_t size = read<uint16_t>(location + 2);
+                    uint16_t reg = read<uint16_t>(location + 4);
+                    int32_t value = read<int32_t>(location + 8);
+
+                    if (kind == LOCATION_INDIRECT)
+                    {
+                        map.m_roots.push_back({reg, value, size});
+                        site.m_count++;
+                    }
+                    else if (kind == LOCATION_DIRECT && l + 1 < num_locations)
+                    {
+                        const char *next = location + LOCATION_BYTES;
+                        uint8_t next_kind = read<uint8_t>(next);
+                        int32_t next_value = read<int32_t>(next + 8);
+                        uint64_t bytes;
+                        if (next_kind == LOCATION_CONSTANT)
+                            bytes = static_cast<uint32_t>(next_value);
+                        else if (next_kind == LOCATION_CONSTANT_INDEX)
+                            bytes = read<uint64_t>(constants + next_value * CONSTANT_BYTES);
+                        else
+                            continue;
+                        map.m_roots.push_back({reg, value, static_cast<uint32_t>(bytes)});
+                        site.m_count++;
+                        l++;
+                    }
+                }
+
+                // Padding to 8 bytes, then the live-out registers
+                p = align_8(locations + num_locations * LOCATION_BYTES);
+                uint16_t num_live_outs = read<uint16_t>(p + 2);
+                p = align_8(p + 4 + num_live_outs * LIVE_OUT_BYTES);
+
+                if (site.m_count > 0)
+                    map.m_call_sites[address + offset] = site;
+            }
+        }
+
+        return p;
+    }
+
+    void StackMap::load_section(const char *section, size_t size)
+    {
+        const char *p = section, *end = section + size;
+        while (p + HEADER_BYTES <= end)
+        {
+            // The linker may pad between the stack maps of modules
+            if (read<uint8_t>(p) == 0)
+            {
+                p += 8;
+                continue;
+            }
+            p = parse(p, end);
+        }
+    }
+
+#ifndef __APPLE__
+    /**
+     * Finds the stack map section of the executable from its
+     * section headers, which are not mapped into memory. The
+     * stack maps themselves are read from the mapping, where
+     * the addresses of the functions have been relocated.
+    */
+    static int find_section(struct dl_phdr_info *info, size_t, void *data)
+    {
+        auto *section = static_cast<std::pair<const char *, size_t> *>(data);
+
+        // Without the section headers the table is left empty,
+        // this is called from C and must not throw
+        int fd = open("/proc/self/exe", O_RDONLY);
+        if (fd == -1)
+            return 1;
+
+        Elf64_Ehdr header;
+        if (pread(fd, &header, sizeof(header), 0) == sizeof(header) && std::memcmp(header.e_ident, ELFMAG, SELFMAG) == 0)
+        {
+            std::vector<Elf64_Shdr> sections(header.e_shnum);
+            size_t bytes = header.e_shnum * sizeof(Elf64_Shdr);
+            if (pread(fd, sections.data(), bytes, header.e_shoff) == static_cast<ssize_t>(bytes) && header.e_shstrndx < header.e_shnum)
+            {
+                const Elf64_Shdr &strtab = sections[header.e_shstrndx];
+                std::vector<char> names(strtab.sh_size + 1, '\0');
+                if (pread(fd, names.data(), strtab.sh_size, strtab.sh_offset) == static_cast<ssize_t>(strtab.sh_size))
+                {
+                    for (const Elf64_Shdr &s : sections)
+                    {
+                        if (s.sh_name < strtab.sh_size && std::strcmp(names.data() + s.sh_name, ".llvm_stackmaps") == 0)
+                        {
+                            section->first = reinterpret_cast<const char *>(info->dlpi_addr + s.sh_addr);
+                            section->second = s.sh_size;
+                        }
+                    }
+                }
+            }
+        }
+        close(fd);
+
+        // The executable is always the first object
+        return 1;
+    }
+#endif
+
+    /**
+     * Parses the stack maps of the executable into the table of
+     * call sites, once. An executable without statepoints has no
+     * stack map section, and the table is left empty.
+     *
+     * Time complexity: O(n), n being the size of the stack maps
+    */
+    void StackMap::load()
+    {
+        StackMap &map = StackMap::the();
+        if (map.m_loaded)
+            return;
+        map.m_loaded = true;
+
+        std::pair<const char *, size_t> section {nullptr, 0};
+#ifdef __APPLE__
+        unsigned long size = 0;
+        section.first = reinterpret_cast<const char *>(getsectiondata(&_mh_execute_header, "__LLVM_STACKMAPS", "__llvm_stackmaps", &size));
+        section.second = size;
+#else
+        dl_iterate_phdr(find_section, &section);
+#endif
+        if (section.first != nullptr)
+            load_section(section.first, section.second);
+    }
+
+    /**
+     * Looks up the roots of the frame a call returns to.
+     *
+     * @param ret   The return address of the call
+     *
+     * @returns     The call site, or nullptr if the call is
+     *              not a statepoint with roots
+     *
+     * Time complexity: O(1) on average
+    */
+    const CallSite *StackMap::find(uintptr_t ret)
+    {
+        StackMap &map = StackMap::the();
+        auto it = map.m_call_sites.find(ret);
+        return it == map.m_call_sites.end() ? nullptr : &it->second;
+    }
+
+    const StackMapRoot &StackMap::root(uint32_t index)
+    {
+        return StackMap::the().m_roots[index];
+    }
+
+    size_t StackMap::call_site_count()
+    {
+        return StackMap::the().m_call_sites.size();
+    }
+}
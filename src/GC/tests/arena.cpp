@@ -0,0 +1,138 @@
+#include <iostream>
+#include <stdexcept>
+#include <stdint.h>
+
+#include "cheap.h"
+#include "heap.hpp"
+#include "test_util.hpp"
+
+/*
+ * Checks the regions of cheap_region_push(). A list only
+ * referenced from a region object survives collections until
+ * the region is popped, with and without the nursery, and is
+ * collected afterwards. Nested regions free their objects in
+ * order, reused memory is zeroed, objects larger than a block
+ * work, and using regions that were not pushed is an error.
+ * Must be compiled with HEAP_DEBUG defined, see the Makefile.
+ */
+
+#define LIST_LEN    (1 << 15)
+#define SLOTS       16
+
+using std::cout, std::endl;
+
+Node *__attribute__((noinline)) make_list(long len)
+{
+    Node *head = nullptr;
+    for (long i = 0; i < len; i++)
+    {
+        auto node = static_cast<Node *>(cheap_alloc(sizeof(Node)));
+        node->value = i;
+        node->next = head;
+        head = node;
+    }
+    return head;
+}
+
+long list_sum(Node *list)
+{
+    long sum = 0;
+    for (Node *node = list; node != nullptr; node = node->next)
+        sum += node->value;
+    return sum;
+}
+
+unsigned long live_bytes()
+{
+    cheap_stats_t stats;
+    cheap_get_stats(&stats);
+    return stats.live_bytes;
+}
+
+// The list is only referenced from the region, the slots
+// are kept so that the caller does not hold the list itself
+Node **__attribute__((noinline)) make_slots()
+{
+    auto slots = static_cast<Node **>(cheap_region_alloc(SLOTS * sizeof(Node *)));
+    slots[SLOTS - 1] = make_list(LIST_LEN);
+    return slots;
+}
+
+bool check_roots(size_t nursery)
+{
+    cheap_set_nursery_size(nursery);
+    unsigned long list_bytes = LIST_LEN * (CHEAP_HEADER_SIZE + sizeof(Node));
+
+    cheap_region_push();
+    Node **slots = make_slots();
+    churn_until_collection(nursery != 0);
+    churn_until_collection(false);
+    unsigned long live = live_bytes();
+    long sum = list_sum(slots[SLOTS - 1]);
+    cheap_region_pop();
+
+    // Garbage that dies young never triggers a major collection
+    cheap_set_nursery_size(0);
+    churn_until_collection(false);
+    unsigned long dead = live_bytes();
+    cout << "nursery " << nursery << ": live in region " << live << ", after pop " << dead << endl;
+    return live >= list_bytes && dead < list_bytes / 2 && sum == static_cast<long>(LIST_LEN) * (LIST_LEN - 1) / 2;
+}
+
+bool check_nesting()
+{
+    cheap_region_push();
+    auto outer = static_cast<long *>(cheap_region_alloc(sizeof(long)));
+    *outer = 1;
+
+    cheap_region_push();
+    auto inner = static_cast<long *>(cheap_region_alloc(3 * sizeof(long)));
+    inner[0] = inner[1] = inner[2] = 2;
+    // Larger than a block, gets a block of its own
+    auto large = static_cast<char *>(cheap_region_alloc(2 * ARENA_BLOCK));
+    large[2 * ARENA_BLOCK - 1] = 3;
+    cheap_region_pop();
+
+    cheap_region_push();
+    auto reused = static_cast<long *>(cheap_region_alloc(3 * sizeof(long)));
+    bool zeroed = reused == inner && reused[0] == 0 && reused[1] == 0 && reused[2] == 0;
+    cheap_region_pop();
+
+    bool kept = *outer == 1 && GC::Heap::the().region_depth() == 1;
+    cheap_region_pop();
+    cout << "nesting: reused zeroed " << zeroed << ", outer kept " << kept << endl;
+    return zeroed && kept && GC::Heap::the().region_depth() == 0;
+}
+
+bool check_errors()
+{
+    bool pop = false, alloc = false;
+    try
+    {
+        cheap_region_pop();
+    }
+    catch (const std::runtime_error &)
+    {
+        pop = true;
+    }
+    try
+    {
+        cheap_region_alloc(8);
+    }
+    catch (const std::runtime_error &)
+    {
+        alloc = true;
+    }
+    return pop && alloc;
+}
+
+int main()
+{
+    cheap_init();
+
+    bool ok = check_roots(0) && check_roots(1 << 20) && check_nesting() && check_errors();
+    cout << (ok ? "OK" : "FAIL") << endl;
+
+    cheap_dispose();
+    return ok ? 0 : 1;
+}
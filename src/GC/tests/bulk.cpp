@@ -0,0 +1,170 @@
+#include <iostream>
+#include <stdint.h>
+
+#include "cheap.h"
+#include "heap.hpp"
+#include "test_util.hpp"
+
+/*
+ * Checks the bulk allocation of cheap_alloc_n() and
+ * cheap_alloc_group(). A list built in batches of
+ * cheap_alloc_n() survives collections, a group is laid out
+ * as cheap_group_next() finds it, with the sizes and types
+ * in the headers, in the allocation buffer and as one chunk
+ * split through the heap. The objects of a split group are
+ * collected one by one, and in the generational mode the
+ * young objects its later objects point to survive a minor
+ * collection without a write barrier.
+ * Must be compiled with HEAP_DEBUG defined, see the Makefile.
+ */
+
+#define LIST_LEN    (1 << 15)
+#define BATCH       64
+#define LARGE_GROUP 30
+#define LARGE_SIZE  200
+
+using std::cout, std::endl;
+
+size_t header(void *obj)
+{
+    return reinterpret_cast<size_t *>(obj)[-1];
+}
+
+Node *__attribute__((noinline)) make_list()
+{
+    Node *head = nullptr;
+    void *nodes[BATCH];
+    for (long i = 0; i < LIST_LEN; i += BATCH)
+    {
+        cheap_alloc_n(BATCH, sizeof(Node), nodes);
+        for (long j = 0; j < BATCH; j++)
+        {
+            auto node = static_cast<Node *>(nodes[j]);
+            node->value = i + j;
+            node->next = head;
+            head = node;
+        }
+    }
+    return head;
+}
+
+bool check_n()
+{
+    Node *list = make_list();
+    churn_until_collection(false);
+
+    long sum = 0, len = 0;
+    bool headers = true;
+    for (Node *node = list; node != nullptr; node = node->next, len++)
+    {
+        sum += node->value;
+        headers &= (header(node) & ~HEADER_FLAGS) == sizeof(Node);
+    }
+    cout << "alloc_n: " << len << " nodes, headers " << headers << endl;
+    return headers && len == LIST_LEN && sum == static_cast<long>(LIST_LEN) * (LIST_LEN - 1) / 2;
+}
+
+// The objects of a group are where cheap_group_next() finds them
+bool check_layout(void *first, const unsigned long *sizes, const unsigned long *descriptors, size_t n)
+{
+    void *obj = first;
+    for (size_t i = 0; i < n; i++)
+    {
+        size_t rounded = (sizes[i] + CHEAP_GRANULE - 1) & ~(CHEAP_GRANULE - 1);
+        size_t size = header(obj) & HEADER_SIZE_MASK;
+        // The last object of a split chunk keeps its slack
+        if (i + 1 < n ? size != rounded : size < rounded)
+            return false;
+        if (descriptors != nullptr && (header(obj) & HEADER_TYPE) != cheap_header_type(descriptors[i]))
+            return false;
+        if (i + 1 < n)
+            obj = cheap_group_next(obj, sizes[i]);
+    }
+    return true;
+}
+
+bool check_group()
+{
+    const unsigned long sizes[] = {16, 20, 8, 200};
+    const unsigned long descriptors[] = {0x2UL, CHEAP_NO_POINTERS, 0x1UL, CHEAP_ALL_POINTERS};
+    bool small = check_layout(cheap_alloc_group(sizes, 4), sizes, nullptr, 4)
+        && check_layout(cheap_alloc_group_typed(sizes, descriptors, 4, CHEAP_SITE_UNKNOWN), sizes, descriptors, 4);
+
+    unsigned long large_sizes[LARGE_GROUP];
+    for (size_t i = 0; i < LARGE_GROUP; i++)
+        large_sizes[i] = LARGE_SIZE;
+    bool large = check_layout(cheap_alloc_group(large_sizes, LARGE_GROUP), large_sizes, nullptr, LARGE_GROUP);
+
+    cout << "group: small " << small << ", large " << large << endl;
+    return small && large && cheap_alloc_group(sizes, 0) == nullptr;
+}
+
+// Only the first object of a large group stays alive
+unsigned long __attribute__((noinline)) live_after_split()
+{
+    unsigned long sizes[LARGE_GROUP];
+    for (size_t i = 0; i < LARGE_GROUP; i++)
+        sizes[i] = LARGE_SIZE;
+    auto *volatile first = static_cast<long *>(cheap_alloc_group(sizes, LARGE_GROUP));
+    first[0] = 42;
+    churn_until_collection(false);
+    cheap_stats_t stats;
+    cheap_get_stats(&stats);
+    return first[0] == 42 ? stats.live_bytes : ~0UL;
+}
+
+bool check_split()
+{
+    unsigned long live = live_after_split();
+    cout << "split: live bytes " << live << endl;
+    return live < LARGE_GROUP * (CHEAP_HEADER_SIZE + LARGE_SIZE) / 2;
+}
+
+// The group is in the old generation, the node in the nursery
+Node **__attribute__((noinline)) make_old_group()
+{
+    unsigned long sizes[LARGE_GROUP];
+    for (size_t i = 0; i < LARGE_GROUP; i++)
+        sizes[i] = LARGE_SIZE;
+    auto first = static_cast<Node **>(cheap_alloc_group(sizes, LARGE_GROUP));
+    void *obj = first;
+    for (size_t i = 0; i + 1 < LARGE_GROUP; i++)
+        obj = cheap_group_next(obj, LARGE_SIZE);
+
+    auto node = static_cast<Node *>(cheap_alloc(sizeof(Node)));
+    node->value = 42;
+    node->next = nullptr;
+    static_cast<Node **>(obj)[0] = node;
+    // The first object links to the last, so the group is alive
+    first[0] = static_cast<Node *>(obj);
+    return first;
+}
+
+bool check_nursery()
+{
+    cheap_set_nursery_size(1 << 20);
+    // The allocation buffer of the thread may still be an old one
+    while (!GC::Heap::the().is_young(cheap_alloc(sizeof(Node))))
+        ;
+    Node **volatile group = make_old_group();
+    bool old = !GC::Heap::the().is_young(group);
+    churn_until_collection(true);
+
+    auto last = reinterpret_cast<Node **>(group[0]);
+    Node *node = last[0];
+    bool moved = !GC::Heap::the().is_young(node);
+    cout << "nursery: group old " << old << ", node promoted " << moved << ", value " << node->value << endl;
+    cheap_set_nursery_size(0);
+    return old && moved && node->value == 42;
+}
+
+int main()
+{
+    cheap_init();
+
+    bool ok = check_n() && check_group() && check_split() && check_nursery();
+    cout << (ok ? "OK" : "FAIL") << endl;
+
+    cheap_dispose();
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,138 @@
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <map>
+#include <stdint.h>
+#include <vector>
+
+#include "cheap.h"
+#include "heap.hpp"
+#include "snapshot.hpp"
+#include "test_util.hpp"
+
+/*
+ * Keeps a list alive through a collection with the census and
+ * a snapshot enabled, then reads both files back. The census
+ * must count the list, and every object of the snapshot must
+ * be reachable from its roots along its edges, as the marking
+ * found them.
+ * Must be compiled with HEAP_DEBUG defined, see the Makefile.
+ */
+
+#define LIST_LEN    (1 << 14)
+#define CENSUS      "census.txt"
+#define SNAPSHOT    "snapshot.bin"
+
+using std::cout, std::endl;
+
+Node *__attribute__((noinline)) make_list(long len)
+{
+    Node *head = nullptr;
+    for (long i = 0; i < len; i++)
+    {
+        auto node = static_cast<Node *>(cheap_alloc(sizeof(Node)));
+        node->value = i;
+        node->next = head;
+        head = node;
+    }
+    return head;
+}
+
+// The objects of the size in the first census of the file
+bool check_census(unsigned long &objects)
+{
+    std::FILE *file = std::fopen(CENSUS, "r");
+    if (file == nullptr)
+        return false;
+    unsigned long collection, total, bytes, size, count, size_bytes;
+    bool ok = std::fscanf(file, "collection %lu: %lu objects, %lu bytes\n", &collection, &total, &bytes) == 3;
+    objects = 0;
+    while (ok && std::fscanf(file, "%lu\t%lu\t%lu\n", &size, &count, &size_bytes) == 3)
+        if (size == sizeof(Node))
+            objects = count;
+    std::fclose(file);
+    cout << "census: collection " << collection << ", " << total << " objects, " << bytes
+        << " bytes, " << objects << " of " << sizeof(Node) << " B" << endl;
+    return ok && objects >= LIST_LEN && total >= objects && bytes >= total * (CHEAP_HEADER_SIZE + sizeof(Node));
+}
+
+bool check_snapshot()
+{
+    std::FILE *file = std::fopen(SNAPSHOT, "rb");
+    if (file == nullptr)
+        return false;
+    GC::SnapshotHeader header;
+    bool ok = std::fread(&header, sizeof(header), 1, file) == 1
+        && std::memcmp(header.m_magic, SNAPSHOT_MAGIC, sizeof(header.m_magic)) == 0
+        && header.m_version == SNAPSHOT_VERSION && header.m_object_size == sizeof(GC::SnapshotObject);
+
+    std::vector<uint64_t> roots(ok ? header.m_roots : 0);
+    ok = ok && std::fread(roots.data(), sizeof(uint64_t), roots.size(), file) == roots.size();
+
+    std::map<uint64_t, std::vector<uint64_t>> graph;
+    size_t edges = 0, nodes = 0;
+    for (uint64_t i = 0; ok && i < header.m_objects; i++)
+    {
+        GC::SnapshotObject object;
+        ok = std::fread(&object, sizeof(object), 1, file) == 1;
+        std::vector<uint64_t> &targets = graph[object.m_address];
+        targets.resize(ok ? object.m_edges : 0);
+        ok = ok && std::fread(targets.data(), sizeof(uint64_t), targets.size(), file) == targets.size();
+        edges += targets.size();
+        nodes += object.m_size == sizeof(Node);
+    }
+    std::fclose(file);
+
+    // Everything in the snapshot is reachable from its roots
+    std::vector<uint64_t> worklist(roots);
+    std::map<uint64_t, bool> reached;
+    while (!worklist.empty())
+    {
+        uint64_t address = worklist.back();
+        worklist.pop_back();
+        if (reached[address] || graph.count(address) == 0)
+            continue;
+        reached[address] = true;
+        for (uint64_t target : graph[address])
+            worklist.push_back(target);
+    }
+    size_t reachable = 0;
+    for (auto &[address, flag] : reached)
+        reachable += flag;
+
+    cout << "snapshot: " << header.m_roots << " roots, " << header.m_objects << " objects, "
+        << header.m_edges << " edges, " << reachable << " reachable" << endl;
+    return ok && header.m_objects == graph.size() && header.m_edges == edges && nodes >= LIST_LEN
+        && edges >= LIST_LEN - 1 && !roots.empty() && reachable == graph.size();
+}
+
+bool __attribute__((noinline)) run()
+{
+    cheap_set_census(CENSUS);
+    cheap_heap_snapshot(SNAPSHOT);
+    Node *list = make_list(LIST_LEN);
+    GC::Heap::the().print_summary();
+    churn_until_collection(false);
+    cheap_set_census(nullptr);
+
+    long sum = 0;
+    for (Node *node = list; node != nullptr; node = node->next)
+        sum += node->value;
+
+    unsigned long objects;
+    bool ok = check_census(objects) && check_snapshot();
+    std::remove(CENSUS);
+    std::remove(SNAPSHOT);
+    return ok && sum == static_cast<long>(LIST_LEN) * (LIST_LEN - 1) / 2;
+}
+
+int main()
+{
+    cheap_init();
+
+    bool ok = run();
+    cout << (ok ? "OK" : "FAIL") << endl;
+
+    cheap_dispose();
+    return ok ? 0 : 1;
+}
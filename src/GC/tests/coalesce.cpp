@@ -0,0 +1,60 @@
+#include <iostream>
+#include <stdint.h>
+
+#include "heap.hpp"
+#include "test_util.hpp"
+
+/*
+ * Leaves runs of dead chunks between the nodes of a live list,
+ * then checks that a collection merges every run into a single
+ * free chunk, and that allocations of the merged size recycle
+ * the runs instead of growing the heap.
+ * Must be compiled with HEAP_DEBUG defined, see the Makefile.
+ */
+
+#define LIST_LEN    4096
+#define RUN_LEN     6
+
+using std::cout, std::endl;
+
+Node *__attribute__((noinline)) make_list(long len)
+{
+    Node *head = nullptr;
+    for (long i = 0; i < len; i++)
+    {
+        auto node = static_cast<Node *>(GC::Heap::alloc(sizeof(Node)));
+        node->value = i;
+        node->next = head;
+        head = node;
+        for (int j = 0; j < RUN_LEN; j++)
+            GC::Heap::alloc(sizeof(Node));
+    }
+    return head;
+}
+
+int main()
+{
+    GC::Heap::init();
+    GC::Heap &heap = GC::Heap::the();
+
+    Node *head = make_list(LIST_LEN);
+    heap.collect(GC::COLLECT_ALL);
+
+    size_t merged = RUN_LEN * (HEADER_SIZE + sizeof(Node)) - HEADER_SIZE;
+    size_t chunks = heap.free_chunk_count();
+    size_t largest = heap.largest_free_chunk_size();
+    cout << "free chunks: " << chunks << ", largest: " << largest
+        << ", free bytes: " << heap.free_byte_count() << endl;
+
+    size_t regions = heap.region_count();
+    for (long i = 0; i < LIST_LEN - 1; i++)
+        GC::Heap::alloc(merged);
+    cout << "regions: " << regions << ", " << heap.region_count() << endl;
+
+    bool ok = chunks <= LIST_LEN + 1 && largest >= merged
+        && heap.region_count() == regions && check_list(head, LIST_LEN);
+    cout << (ok ? "OK" : "FAIL") << endl;
+
+    GC::Heap::dispose();
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,91 @@
+#include <iostream>
+#include <stdint.h>
+#include <vector>
+
+#include "heap.hpp"
+#include "test_util.hpp"
+
+/*
+ * Fragments the heap with garbage between the nodes of a live
+ * list, then compacts it and checks that the free memory is in
+ * a few large chunks, that the nodes were moved except for the
+ * one the stack points into, and that the list is intact.
+ * Must be compiled with HEAP_DEBUG defined, see the Makefile.
+ */
+
+#define LIST_LEN    (1 << 15)
+#define RUN_LEN     3
+#define PINNED      1000
+
+using std::cout, std::endl;
+
+Node *__attribute__((noinline)) make_list(long len)
+{
+    Node *head = nullptr;
+    for (long i = 0; i < len; i++)
+    {
+        auto node = static_cast<Node *>(GC::Heap::alloc(sizeof(Node)));
+        node->value = i;
+        node->next = head;
+        head = node;
+        for (int j = 0; j < RUN_LEN; j++)
+            GC::Heap::alloc(sizeof(Node));
+    }
+    return head;
+}
+
+// The addresses are kept off the heap and the stack, where they
+// would pin the nodes
+void __attribute__((noinline)) addresses(Node *head, std::vector<uintptr_t> &out)
+{
+    out.clear();
+    for (; head != nullptr; head = head->next)
+        out.push_back(reinterpret_cast<uintptr_t>(head));
+}
+
+Node *__attribute__((noinline)) nth(Node *head, long n)
+{
+    for (; n > 0; n--)
+        head = head->next;
+    return head;
+}
+
+int main()
+{
+    GC::Heap::init();
+    GC::Heap &heap = GC::Heap::the();
+
+    Node *head = make_list(LIST_LEN);
+    Node *volatile pinned = nth(head, PINNED);
+    std::vector<uintptr_t> before, after;
+
+    heap.collect(GC::COLLECT_ALL);
+    addresses(head, before);
+    size_t swept_chunks = heap.free_chunk_count();
+    size_t swept_largest = heap.largest_free_chunk_size();
+
+    GC::Heap::set_compact_threshold(1.0);
+    heap.collect(GC::COLLECT_ALL);
+    GC::Heap::set_compact_threshold(0.0);
+    size_t chunks = heap.free_chunk_count();
+    size_t largest = heap.largest_free_chunk_size();
+    cout << "free chunks: " << swept_chunks << ", " << chunks
+        << ", largest: " << swept_largest << ", " << largest << endl;
+
+    addresses(head, after);
+    long moved = 0;
+    for (size_t i = 0; i < before.size() && i < after.size(); i++)
+        moved += before[i] != after[i];
+    bool stayed = nth(head, PINNED) == pinned;
+    cout << "nodes moved: " << moved << ", pinned node stayed: " << stayed << endl;
+
+    // The freed space is reused and the list survives it
+    for (long i = 0; i < 2 * LIST_LEN; i++)
+        GC::Heap::alloc(sizeof(Node));
+    bool ok = chunks < swept_chunks / 16 && largest > LIST_LEN * sizeof(Node) && stayed && moved > LIST_LEN / 2
+        && check_list(head, LIST_LEN);
+    cout << (ok ? "OK" : "FAIL") << endl;
+
+    GC::Heap::dispose();
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,87 @@
+#include <iostream>
+#include <stdexcept>
+#include <stdlib.h>
+
+#include "cheap.h"
+#include "heap.hpp"
+#include "marker.hpp"
+
+/*
+ * Checks that cheap_init() configures the heap from the CHEAP_*
+ * environment variables, the sizes with their suffixes, that 0
+ * is a valid large object size, and that an invalid value is an
+ * error.
+ * Must be compiled with HEAP_DEBUG defined, see the Makefile.
+ */
+
+#define LARGE_SIZE  (16UL << 10)
+
+using std::cout, std::endl;
+
+unsigned long large_bytes()
+{
+    cheap_stats_t stats;
+    cheap_get_stats(&stats);
+    return stats.large_object_bytes;
+}
+
+bool check_config()
+{
+    GC::Heap &heap = GC::Heap::the();
+    bool initial = heap.collect_limit() == (24UL << 20);
+    bool threads = GC::Marker::threads() == 2;
+
+    // The allocation buffer of the thread may not be a nursery one yet
+    bool young = false;
+    for (int i = 0; i < 1000 && !young; i++)
+        young = heap.is_young(cheap_alloc(16));
+
+    void *volatile large = cheap_alloc(LARGE_SIZE);
+    bool regions = large != nullptr && large_bytes() == 0;
+    cout << "config: initial size " << initial << ", mark threads " << threads
+         << ", nursery " << young << ", large objects in regions " << regions << endl;
+    return initial && threads && young && regions;
+}
+
+bool check_errors()
+{
+    setenv("CHEAP_INITIAL_SIZE", "24Q", 1);
+    bool size = false, profiler = false;
+    try
+    {
+        cheap_init();
+    }
+    catch (const std::runtime_error &)
+    {
+        size = true;
+    }
+    unsetenv("CHEAP_INITIAL_SIZE");
+    unsetenv("CHEAP_NURSERY_SIZE");
+    setenv("CHEAP_PROFILER", "everything", 1);
+    try
+    {
+        cheap_init();
+    }
+    catch (const std::runtime_error &)
+    {
+        profiler = true;
+    }
+    unsetenv("CHEAP_PROFILER");
+    cout << "errors: size " << size << ", profiler " << profiler << endl;
+    return size && profiler;
+}
+
+int main()
+{
+    setenv("CHEAP_INITIAL_SIZE", "24M", 1);
+    setenv("CHEAP_NURSERY_SIZE", "512k", 1);
+    setenv("CHEAP_MARK_THREADS", "2", 1);
+    setenv("CHEAP_LARGE_OBJECT", "0", 1);
+    cheap_init();
+
+    bool ok = check_config() && check_errors();
+    cout << (ok ? "OK" : "FAIL") << endl;
+
+    cheap_dispose();
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,208 @@
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <stdint.h>
+#include <thread>
+#include <vector>
+
+#include "cheap.h"
+#include "heap.hpp"
+#include "test_util.hpp"
+
+/*
+ * Checks the finalizers and weak references. The finalizers of
+ * dead objects run once, with the objects and what they point
+ * to intact, and only when cheap_run_finalizers() or the
+ * finalizer thread runs them. Weak references keep following
+ * live targets, also when the nursery evacuation or the
+ * compaction moves them, and are cleared when the targets die.
+ * Must be compiled with HEAP_DEBUG defined, see the Makefile.
+ */
+
+#define OBJECTS     100
+#define SLOTS       1024
+
+using std::cout, std::endl;
+
+std::atomic<long> finalized {0};
+std::atomic<long> finalized_sum {0};
+
+void finalize(void *obj)
+{
+    auto node = static_cast<Node *>(obj);
+    finalized++;
+    finalized_sum += node->value + node->next->value;
+}
+
+// The node points to another one, that only it keeps alive
+Node *__attribute__((noinline)) make_finalized(long value)
+{
+    auto node = static_cast<Node *>(cheap_alloc(sizeof(Node)));
+    node->value = value;
+    node->next = static_cast<Node *>(cheap_alloc(sizeof(Node)));
+    node->next->value = 1;
+    node->next->next = nullptr;
+    cheap_register_finalizer(node, finalize);
+    return node;
+}
+
+void __attribute__((noinline)) make_garbage()
+{
+    for (long i = 0; i < OBJECTS; i++)
+        make_finalized(i);
+}
+
+bool check_finalizers()
+{
+    finalized = finalized_sum = 0;
+    Node *volatile live = make_finalized(-1);
+    make_garbage();
+    churn_until_collection(false);
+    bool queued = finalized == 0;
+    unsigned long run = cheap_run_finalizers();
+    churn_until_collection(false);
+    bool once = cheap_run_finalizers() == 0 && finalized == OBJECTS;
+    long expected = static_cast<long>(OBJECTS) * (OBJECTS - 1) / 2 + OBJECTS;
+    cout << "finalizers: queued " << queued << ", run " << run << ", once " << once
+         << ", sum " << finalized_sum << ", live " << live->value << endl;
+    return queued && run == OBJECTS && once && finalized_sum == expected && live->value == -1;
+}
+
+bool check_errors()
+{
+    long local = 0;
+    try
+    {
+        cheap_register_finalizer(&local, finalize);
+    }
+    catch (const std::runtime_error &)
+    {
+        return true;
+    }
+    return false;
+}
+
+void *__attribute__((noinline)) make_dead_ref()
+{
+    auto node = static_cast<Node *>(cheap_alloc(sizeof(Node)));
+    node->value = 7;
+    return cheap_weak_ref(node);
+}
+
+// The target is only kept by the holder, so that it can move
+void *__attribute__((noinline)) make_live_ref(Node **holder)
+{
+    auto node = static_cast<Node *>(cheap_alloc(sizeof(Node)));
+    node->value = 42;
+    holder[0] = node;
+    return cheap_weak_ref(node);
+}
+
+bool check_weak(bool nursery)
+{
+    if (nursery)
+    {
+        cheap_set_nursery_size(1 << 20);
+        // The allocation buffer of the thread may still be an old one
+        while (!GC::Heap::the().is_young(cheap_alloc(sizeof(Node))))
+            ;
+    }
+    void *volatile dead = make_dead_ref();
+    Node **volatile holder = static_cast<Node **>(cheap_alloc(sizeof(Node *)));
+    void *volatile live = make_live_ref(holder);
+    volatile uintptr_t inverted = ~reinterpret_cast<uintptr_t>(holder[0]);
+    bool young = !nursery || GC::Heap::the().is_young(cheap_weak_get(live));
+    churn_until_collection(nursery);
+
+    auto target = static_cast<Node *>(cheap_weak_get(live));
+    bool moved = reinterpret_cast<uintptr_t>(target) != ~inverted;
+    cout << "weak, nursery " << nursery << ": dead cleared " << (cheap_weak_get(dead) == nullptr)
+         << ", live " << (target != nullptr) << ", moved " << moved << endl;
+    cheap_set_nursery_size(0);
+    return young && cheap_weak_get(dead) == nullptr && target == holder[0]
+        && target->value == 42 && moved == nursery;
+}
+
+// The finalizers keep their objects when the nursery is evacuated,
+// only a major collection finds them dead
+bool check_nursery()
+{
+    // The live object of check_finalizers() is dead by now
+    churn_until_collection(false);
+    cheap_run_finalizers();
+    finalized = finalized_sum = 0;
+    cheap_set_nursery_size(1 << 20);
+    while (!GC::Heap::the().is_young(cheap_alloc(sizeof(Node))))
+        ;
+    make_garbage();
+    churn_until_collection(true);
+    churn_until_collection(true);
+    cheap_set_nursery_size(0);
+    churn_until_collection(false);
+    unsigned long run = cheap_run_finalizers();
+    cout << "nursery: run " << run << ", sum " << finalized_sum << endl;
+    return run == OBJECTS && finalized_sum == static_cast<long>(OBJECTS) * (OBJECTS - 1) / 2 + OBJECTS;
+}
+
+// The nodes are strong from the holder, and weak from the refs
+void __attribute__((noinline)) make_fragmented(Node **holder, void **refs)
+{
+    for (size_t i = 0; i < SLOTS; i++)
+    {
+        for (int j = 0; j < 3; j++)
+            cheap_alloc(sizeof(Node));
+        auto node = static_cast<Node *>(cheap_alloc(sizeof(Node)));
+        node->value = i;
+        holder[i] = node;
+        refs[i] = cheap_weak_ref(node);
+    }
+}
+
+bool check_compact()
+{
+    cheap_set_compact_threshold(1.0);
+    Node **volatile holder = static_cast<Node **>(cheap_alloc(SLOTS * sizeof(Node *)));
+    void **volatile refs = static_cast<void **>(cheap_alloc(SLOTS * sizeof(void *)));
+    std::vector<uintptr_t> before;
+    make_fragmented(holder, refs);
+    for (size_t i = 0; i < SLOTS; i++)
+        before.push_back(~reinterpret_cast<uintptr_t>(holder[i]));
+    for (int i = 0; i < 3; i++)
+        churn_until_collection(false);
+    cheap_set_compact_threshold(0.0);
+
+    size_t moved = 0;
+    bool same = true;
+    for (size_t i = 0; i < SLOTS; i++)
+    {
+        moved += reinterpret_cast<uintptr_t>(holder[i]) != ~before[i];
+        same &= cheap_weak_get(refs[i]) == holder[i] && holder[i]->value == static_cast<long>(i);
+    }
+    cout << "compact: " << moved << " moved, weak refs follow " << same << endl;
+    return moved > 0 && same;
+}
+
+bool check_thread()
+{
+    finalized = finalized_sum = 0;
+    cheap_set_finalizer_thread(true);
+    make_garbage();
+    churn_until_collection(false);
+    for (int i = 0; i < 1000 && finalized < OBJECTS; i++)
+        std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    cheap_set_finalizer_thread(false);
+    cout << "thread: run " << finalized << endl;
+    return finalized == OBJECTS && cheap_run_finalizers() == 0;
+}
+
+int main()
+{
+    cheap_init();
+
+    bool ok = check_finalizers() && check_errors() && check_weak(false) && check_weak(true)
+        && check_nursery() && check_compact() && check_thread();
+    cout << (ok ? "OK" : "FAIL") << endl;
+
+    cheap_dispose();
+    return ok ? 0 : 1;
+}
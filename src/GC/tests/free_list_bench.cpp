@@ -0,0 +1,56 @@
+#include <chrono>
+#include <iostream>
+#include <stdint.h>
+
+#include "heap.hpp"
+
+/*
+ * Measures the latency of alloc() when it is served from the
+ * free lists, for a growing number of chunks in the free lists.
+ * Must be compiled with HEAP_DEBUG defined, see the Makefile.
+ */
+
+#define ROUNDS      	10
+#define GARBAGE_STEP	1500
+#define TIMED_ALLOCS	1000
+
+using std::cout, std::endl;
+
+// Allocates chunks that are unreachable once this returns
+void __attribute__((noinline)) make_garbage(size_t n)
+{
+    for (size_t i = 0; i < n; i++)
+        GC::Heap::alloc(8 * (1 + i % 2));
+}
+
+long __attribute__((noinline)) timed_allocs(size_t n)
+{
+    auto start = std::chrono::high_resolution_clock::now();
+    for (size_t i = 0; i < n; i++)
+        GC::Heap::alloc(8);
+    auto end = std::chrono::high_resolution_clock::now();
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+}
+
+int main()
+{
+    GC::Heap::init();
+    GC::Heap &heap = GC::Heap::the();
+    // Keeps the region alive, empty regions are not put in the free lists
+    void *volatile pinned = GC::Heap::alloc(8);
+
+    cout << "free chunks\tns/alloc" << endl;
+    for (int i = 0; i < ROUNDS; i++)
+    {
+        make_garbage(GARBAGE_STEP * (i + 1));
+        heap.collect(GC::COLLECT_ALL);
+
+        size_t population = heap.free_chunk_count();
+        long ns = timed_allocs(TIMED_ALLOCS);
+        cout << population << "\t\t" << (double)ns / TIMED_ALLOCS << endl;
+    }
+
+    (void)pinned;
+    GC::Heap::dispose();
+    return 0;
+}
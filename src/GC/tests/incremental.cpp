@@ -0,0 +1,122 @@
+#include <iostream>
+#include <stdint.h>
+
+#include "cheap.h"
+#include "heap.hpp"
+#include "test_util.hpp"
+
+/*
+ * Checks the incremental mode. Collections mark the heap in
+ * steps between allocations, a live list survives them, and
+ * objects stored into an object that was already scanned are
+ * kept alive by the write barrier, also when they are young
+ * and promoted while the heap is marked. The last pause of a
+ * collection stays under the target, and disabling the mode
+ * finishes the collection that is marking.
+ * Must be compiled with HEAP_DEBUG defined, see the Makefile.
+ */
+
+#define LIST_LEN    (1 << 18)
+#define GARBAGE     1000
+#define SLOTS       256
+#define PAUSE_US    200
+
+using std::cout, std::endl;
+
+Node *__attribute__((noinline)) make_list(long len)
+{
+    Node *head = nullptr;
+    for (long i = 0; i < len; i++)
+    {
+        auto node = static_cast<Node *>(cheap_alloc(sizeof(Node)));
+        node->value = i;
+        node->next = head;
+        head = node;
+    }
+    return head;
+}
+
+void __attribute__((noinline)) garbage()
+{
+    for (int i = 0; i < GARBAGE; i++)
+        cheap_alloc(sizeof(Node));
+}
+
+void __attribute__((noinline)) start_marking()
+{
+    while (!GC::Heap::the().is_marking())
+        garbage();
+}
+
+// Only the holder points to the node, which is stored after the
+// holder may have been scanned
+void __attribute__((noinline)) store_node(Node **holder, long i)
+{
+    auto node = static_cast<Node *>(cheap_alloc(sizeof(Node)));
+    node->value = i;
+    node->next = nullptr;
+    holder[i] = node;
+    cheap_write_barrier(holder);
+}
+
+bool check_barrier(Node *list, bool nursery)
+{
+    cheap_set_nursery_size(nursery ? 1 << 20 : 0);
+    Node **volatile holder = static_cast<Node **>(cheap_alloc(SLOTS * sizeof(Node *)));
+    start_marking();
+    long stored = 0;
+    for (; stored < SLOTS && GC::Heap::the().is_marking(); stored++)
+    {
+        store_node(holder, stored);
+        garbage();
+    }
+    while (GC::Heap::the().is_marking())
+        garbage();
+    cheap_set_nursery_size(0);
+    // Sweeps what is left of the lazy sweep, which zeroes the dead nodes
+    GC::Heap::the().collect(GC::FREE);
+
+    long kept = 0;
+    for (long i = 0; i < stored; i++)
+        kept += holder[i]->value == i;
+    bool intact = check_list(list, LIST_LEN);
+    cout << "barrier, nursery " << nursery << ": stored while marking " << stored << ", kept " << kept
+         << ", list intact " << intact << endl;
+    return stored > 1 && kept == stored && intact;
+}
+
+// The last pauses are only counted by the stats of the collections
+bool check_steps()
+{
+    cheap_pause_stats_t steps;
+    cheap_get_step_stats(&steps);
+    cheap_stats_t stats;
+    cheap_get_stats(&stats);
+    cout << "steps: " << steps.count << " pauses, max " << steps.max_ns / 1000 << " us, "
+         << stats.collections << " collections, last pause max " << stats.pause.max_ns / 1000 << " us" << endl;
+    return steps.count > stats.collections && stats.collections > 0 && stats.pause.max_ns < PAUSE_US * 1000;
+}
+
+bool check_disable(Node *list)
+{
+    start_marking();
+    cheap_set_pause_target(0);
+    bool finished = !GC::Heap::the().is_marking();
+    garbage();
+    cout << "disable: finished " << finished << endl;
+    return finished && check_list(list, LIST_LEN);
+}
+
+int main()
+{
+    cheap_init();
+    cheap_set_pause_target(PAUSE_US);
+
+    Node *volatile list = make_list(LIST_LEN);
+    bool ok = check_barrier(list, false) && check_barrier(list, true) && check_steps()
+        && check_disable(list);
+    cout << (ok ? "OK" : "FAIL") << endl;
+
+    cheap_dispose();
+    return ok ? 0 : 1;
+}
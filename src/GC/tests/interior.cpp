@@ -0,0 +1,53 @@
+#include <iostream>
+#include <stdint.h>
+
+#include "heap.hpp"
+
+/*
+ * Checks that an object only referenced by a pointer into
+ * the middle of it survives a collection, while garbage
+ * around it is freed. Must be compiled with HEAP_DEBUG
+ * defined, see the Makefile.
+ */
+
+#define ARRAY_LEN   32
+
+using std::cout, std::endl;
+
+// Allocates an array and returns a pointer to its middle element
+long *__attribute__((noinline)) make_array()
+{
+    long *array = static_cast<long *>(GC::Heap::alloc(ARRAY_LEN * sizeof(long)));
+    for (long i = 0; i < ARRAY_LEN; i++)
+        array[i] = i;
+    return array + ARRAY_LEN / 2;
+}
+
+void __attribute__((noinline)) make_garbage(size_t n)
+{
+    for (size_t i = 0; i < n; i++)
+        GC::Heap::alloc(16);
+}
+
+int main()
+{
+    GC::Heap::init();
+    GC::Heap &heap = GC::Heap::the();
+
+    make_garbage(100);
+    long *volatile middle = make_array();
+    make_garbage(100);
+
+    heap.collect(GC::COLLECT_ALL);
+
+    size_t live = heap.allocated_chunk_count();
+    bool intact = true;
+    for (long i = -ARRAY_LEN / 2; i < ARRAY_LEN / 2; i++)
+        intact &= middle[i] == ARRAY_LEN / 2 + i;
+
+    cout << "live chunks: " << live << endl;
+    cout << (live == 1 && intact ? "OK" : "FAIL") << endl;
+
+    GC::Heap::dispose();
+    return live == 1 && intact ? 0 : 1;
+}
@@ -0,0 +1,166 @@
+#include <iostream>
+#include <stdint.h>
+#include <vector>
+
+#include "cheap.h"
+#include "heap.hpp"
+#include "test_util.hpp"
+
+/*
+ * Checks the large object space. An object of the large
+ * object size gets a mapping of its own, survives collections
+ * while it is referenced and is unmapped by the collection
+ * that finds it dead, also when it is a group of
+ * cheap_alloc_group(). The size is configurable, 0 keeps large
+ * objects in the regions, and in the generational mode the
+ * young objects a large object points to survive a minor
+ * collection without a write barrier. The objects a large object
+ * points to can be compacted, the large object stays in place.
+ * Must be compiled with HEAP_DEBUG defined, see the Makefile.
+ */
+
+#define LARGE_SIZE  (16UL << 10)
+#define GROUP       60
+#define GROUP_SIZE  200
+#define SLOTS       (LARGE_SIZE / sizeof(Node *))
+
+using std::cout, std::endl;
+
+unsigned long large_bytes()
+{
+    cheap_stats_t stats;
+    cheap_get_stats(&stats);
+    return stats.large_object_bytes;
+}
+
+// Returns the large object bytes while the object is alive,
+// or 0 if its contents were lost
+unsigned long __attribute__((noinline)) live_large(size_t size)
+{
+    auto *volatile obj = static_cast<long *>(cheap_alloc(size));
+    obj[0] = 1;
+    obj[size / sizeof(long) - 1] = 2;
+    churn_until_collection(false);
+    churn_until_collection(false);
+    return obj[0] == 1 && obj[size / sizeof(long) - 1] == 2 ? large_bytes() : 0;
+}
+
+bool check_space()
+{
+    unsigned long before = large_bytes();
+    unsigned long live = live_large(LARGE_SIZE);
+    churn_until_collection(false);
+    unsigned long dead = large_bytes();
+    cout << "space: before " << before << ", live " << live << ", dead " << dead << endl;
+    return live >= LARGE_SIZE + CHEAP_HEADER_SIZE && dead == before;
+}
+
+bool check_size()
+{
+    cheap_set_large_object_size(0);
+    bool regions = live_large(LARGE_SIZE) == 0;
+    cheap_set_large_object_size(1024);
+    bool smaller = live_large(2048) > 0;
+    cheap_set_large_object_size(HEAP_LARGE_OBJECT);
+    bool below = live_large(HEAP_LARGE_OBJECT / 2) == 0;
+    churn_until_collection(false);
+    cout << "size: disabled " << regions << ", lowered " << smaller << ", below " << below << endl;
+    return regions && smaller && below && large_bytes() == 0;
+}
+
+// Only the first object of the group is referenced
+unsigned long __attribute__((noinline)) live_group()
+{
+    unsigned long sizes[GROUP];
+    for (size_t i = 0; i < GROUP; i++)
+        sizes[i] = GROUP_SIZE;
+    auto *volatile first = static_cast<long *>(cheap_alloc_group(sizes, GROUP));
+    first[0] = 42;
+    churn_until_collection(false);
+    return first[0] == 42 ? large_bytes() : 0;
+}
+
+bool check_group()
+{
+    unsigned long live = live_group();
+    churn_until_collection(false);
+    cout << "group: live " << live << ", dead " << large_bytes() << endl;
+    return live >= GROUP * (CHEAP_HEADER_SIZE + GROUP_SIZE) && large_bytes() == 0;
+}
+
+Node **__attribute__((noinline)) make_old_holder()
+{
+    auto holder = static_cast<Node **>(cheap_alloc(LARGE_SIZE));
+    auto node = static_cast<Node *>(cheap_alloc(sizeof(Node)));
+    node->value = 42;
+    node->next = nullptr;
+    holder[LARGE_SIZE / sizeof(Node *) - 1] = node;
+    return holder;
+}
+
+bool check_nursery()
+{
+    cheap_set_nursery_size(1 << 20);
+    // The allocation buffer of the thread may still be an old one
+    while (!GC::Heap::the().is_young(cheap_alloc(sizeof(Node))))
+        ;
+    Node **volatile holder = make_old_holder();
+    bool old = !GC::Heap::the().is_young(holder) && large_bytes() > 0;
+    churn_until_collection(true);
+
+    Node *node = holder[LARGE_SIZE / sizeof(Node *) - 1];
+    bool moved = !GC::Heap::the().is_young(node);
+    cout << "nursery: holder old " << old << ", node promoted " << moved << ", value " << node->value << endl;
+    cheap_set_nursery_size(0);
+    return old && moved && node->value == 42;
+}
+
+// The nodes are kept inverted, so that the vector does not pin them
+Node **__attribute__((noinline)) make_fragmented(std::vector<uintptr_t> &nodes)
+{
+    auto holder = static_cast<Node **>(cheap_alloc(LARGE_SIZE));
+    for (size_t i = 0; i < SLOTS; i++)
+    {
+        for (int j = 0; j < 3; j++)
+            cheap_alloc(sizeof(Node));
+        auto node = static_cast<Node *>(cheap_alloc(sizeof(Node)));
+        node->value = i;
+        holder[i] = node;
+        nodes.push_back(~reinterpret_cast<uintptr_t>(node));
+    }
+    return holder;
+}
+
+bool check_compact()
+{
+    cheap_set_compact_threshold(1.0);
+    std::vector<uintptr_t> nodes;
+    Node **volatile holder = make_fragmented(nodes);
+    uintptr_t start = reinterpret_cast<uintptr_t>(holder);
+    for (int i = 0; i < 3; i++)
+        churn_until_collection(false);
+    cheap_set_compact_threshold(0.0);
+
+    size_t moved = 0;
+    bool values = true;
+    for (size_t i = 0; i < SLOTS; i++)
+    {
+        moved += reinterpret_cast<uintptr_t>(holder[i]) != ~nodes[i];
+        values &= holder[i]->value == static_cast<long>(i);
+    }
+    bool kept = reinterpret_cast<uintptr_t>(holder) == start;
+    cout << "compact: " << moved << " nodes moved, values " << values << ", holder kept " << kept << endl;
+    return moved > 0 && values && kept;
+}
+
+int main()
+{
+    cheap_init();
+
+    bool ok = check_space() && check_size() && check_group() && check_nursery()
+        && check_compact();
+    cout << (ok ? "OK" : "FAIL") << endl;
+
+    cheap_dispose();
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,71 @@
+#include <chrono>
+#include <iostream>
+#include <stdint.h>
+
+#include "heap.hpp"
+#include "test_util.hpp"
+
+/*
+ * Collects a heap of a live list and garbage without sweeping
+ * it, then checks that the allocations afterwards sweep the
+ * regions one at a time, recycle the garbage instead of growing
+ * the heap, and leave the list intact.
+ * Must be compiled with HEAP_DEBUG defined, see the Makefile.
+ */
+
+#define LIST_LEN    (1 << 18)
+
+using std::cout, std::endl;
+
+Node *__attribute__((noinline)) make_list(long len)
+{
+    Node *head = nullptr;
+    for (long i = 0; i < len; i++)
+    {
+        auto node = static_cast<Node *>(GC::Heap::alloc(sizeof(Node)));
+        node->value = i;
+        node->next = head;
+        head = node;
+        GC::Heap::alloc(sizeof(Node));
+        GC::Heap::alloc(sizeof(Node));
+    }
+    return head;
+}
+
+long __attribute__((noinline)) elapsed_us(GC::CollectOption flags)
+{
+    auto start = std::chrono::high_resolution_clock::now();
+    GC::Heap::the().collect(flags);
+    auto time = std::chrono::high_resolution_clock::now() - start;
+    return std::chrono::duration_cast<std::chrono::microseconds>(time).count();
+}
+
+int main()
+{
+    GC::Heap::init();
+    GC::Heap &heap = GC::Heap::the();
+
+    Node *head = make_list(LIST_LEN);
+
+    long eager = elapsed_us(GC::COLLECT_ALL);
+    // Garbage again, then a collection that leaves the sweep for later
+    for (long i = 0; i < 2 * LIST_LEN; i++)
+        GC::Heap::alloc(sizeof(Node));
+    size_t regions = heap.region_count();
+    long lazy = elapsed_us(static_cast<GC::CollectOption>(GC::MARK | GC::SWEEP));
+    size_t unswept = heap.unswept_region_count();
+    cout << "eager collect: " << eager << " us, lazy collect: " << lazy << " us" << endl;
+
+    GC::Heap::alloc(sizeof(Node));
+    size_t after_one = heap.unswept_region_count();
+    for (long i = 0; i < 2 * LIST_LEN; i++)
+        GC::Heap::alloc(sizeof(Node));
+    cout << "unswept regions: " << unswept << ", " << after_one << ", " << heap.unswept_region_count() << endl;
+
+    bool ok = unswept > 1 && after_one == unswept - 1 && heap.unswept_region_count() < unswept
+        && heap.region_count() <= regions && check_list(head, LIST_LEN);
+    cout << (ok ? "OK" : "FAIL") << endl;
+
+    GC::Heap::dispose();
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,96 @@
+#include <iostream>
+#include <stdint.h>
+
+#include "heap.hpp"
+#include "test_util.hpp"
+
+/*
+ * Builds a live list in the generational mode, across many
+ * minor collections, and checks that it is intact and has
+ * been copied to the old generation, that garbage does not
+ * grow the heap, and that a pointer stored into an old
+ * object behind the write barrier survives.
+ * Must be compiled with HEAP_DEBUG defined, see the Makefile.
+ */
+
+#define NURSERY_SIZE    (1UL << 20)
+#define LIST_LEN        (1 << 17)   // 3 MB of chunks
+#define GARBAGE         (1 << 21)
+
+using std::cout, std::endl;
+
+// Too large for the nursery, allocated in the old generation
+struct Holder
+{
+    Node *node;
+    char pad[CHEAP_TLAB_OBJ_MAX];
+};
+
+Node *__attribute__((noinline)) make_list(long len)
+{
+    Node *head = nullptr;
+    for (long i = 0; i < len; i++)
+    {
+        Node *node = static_cast<Node *>(GC::Heap::alloc(sizeof(Node)));
+        node->value = i;
+        node->next = head;
+        head = node;
+        GC::Heap::alloc(sizeof(Node));
+    }
+    return head;
+}
+
+long __attribute__((noinline)) young_count(Node *head)
+{
+    GC::Heap &heap = GC::Heap::the();
+    long count = 0;
+    for (; head != nullptr; head = head->next)
+        count += heap.is_young(head);
+    return count;
+}
+
+void __attribute__((noinline)) churn(long count)
+{
+    for (long i = 0; i < count; i++)
+        GC::Heap::alloc(sizeof(Node));
+}
+
+void __attribute__((noinline)) store_young(Holder *holder)
+{
+    Node *node = static_cast<Node *>(GC::Heap::alloc(sizeof(Node)));
+    node->value = 42;
+    node->next = nullptr;
+    holder->node = node;
+    GC::Heap::write_barrier(holder);
+}
+
+int main()
+{
+    GC::Heap::init();
+    GC::Heap &heap = GC::Heap::the();
+    GC::Heap::set_nursery_size(NURSERY_SIZE);
+
+    Node *head = make_list(LIST_LEN);
+    bool intact = check_list(head, LIST_LEN);
+    long young = young_count(head);
+    cout << "young nodes: " << young << endl;
+
+    size_t before = heap.region_count();
+    churn(GARBAGE);
+    size_t after = heap.region_count();
+    cout << "regions before garbage: " << before << ", after: " << after << endl;
+    intact = intact && check_list(head, LIST_LEN);
+
+    auto holder = static_cast<Holder *>(GC::Heap::alloc(sizeof(Holder)));
+    churn(NURSERY_SIZE / sizeof(Node));
+    store_young(holder);
+    churn(NURSERY_SIZE / sizeof(Node));
+    bool barrier = holder->node->value == 42 && !heap.is_young(holder->node);
+    cout << "remembered store: " << (barrier ? "kept" : "lost") << endl;
+
+    bool ok = intact && young < LIST_LEN / 16 && after <= before + 1 && barrier;
+    cout << (ok ? "OK" : "FAIL") << endl;
+
+    GC::Heap::dispose();
+    return ok ? 0 : 1;
+}
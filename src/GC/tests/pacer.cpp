@@ -0,0 +1,70 @@
+#include <iostream>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "heap.hpp"
+#include "test_util.hpp"
+
+/*
+ * Checks the limit that a collection sets for the next one,
+ * from the growth factor, the minimum interval and the share
+ * of the heap found alive, and that the policy is read from
+ * the environment.
+ * Must be compiled with HEAP_DEBUG defined, see the Makefile.
+ */
+
+#define LIST_LEN    (1 << 18)   // 6 MB of chunks
+#define NODE_BYTES  (HEADER_SIZE + sizeof(Node))
+
+using std::cout, std::endl;
+
+Node *__attribute__((noinline)) make_list(long len)
+{
+    Node *head = nullptr;
+    for (long i = 0; i < len; i++)
+    {
+        auto node = static_cast<Node *>(GC::Heap::alloc(sizeof(Node)));
+        node->value = i;
+        node->next = head;
+        head = node;
+    }
+    return head;
+}
+
+size_t __attribute__((noinline)) limit_after_collect()
+{
+    GC::Heap &heap = GC::Heap::the();
+    heap.collect(GC::COLLECT_ALL);
+    return heap.collect_limit();
+}
+
+int main()
+{
+    setenv("CHEAP_GROWTH_FACTOR", "3", 1);
+    setenv("CHEAP_MIN_INTERVAL", "1048576", 1);
+    GC::Heap::init();
+    GC::Heap &heap = GC::Heap::the();
+
+    Node *head = make_list(LIST_LEN);
+    size_t live = LIST_LEN * NODE_BYTES;
+
+    // The live list is most of the mapped heap, the limit is the
+    // growth factor from the environment times the mapped heap
+    size_t thrash = limit_after_collect();
+    size_t mapped = heap.region_count() * HEAP_REGION_SIZE;
+    cout << "live: " << live << ", mapped: " << mapped << ", limit: " << thrash << endl;
+    bool grows = thrash >= 3 * mapped - 3 * HEAP_REGION_SIZE;
+
+    GC::Heap::set_growth_factor(1.0);
+    size_t factor = limit_after_collect();
+    GC::Heap::set_gc_policy(2.0, 64UL << 20, 0);
+    size_t interval = limit_after_collect();
+    cout << "limit with factor 1: " << factor << ", with interval 64 MB: " << interval << endl;
+
+    bool ok = grows && factor < 2 * live && factor >= live + (1UL << 20)
+        && interval >= live + (64UL << 20) && check_list(head, LIST_LEN);
+    cout << (ok ? "OK" : "FAIL") << endl;
+
+    GC::Heap::dispose();
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,125 @@
+#include <iostream>
+#include <stdint.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "cheap.h"
+#include "heap.hpp"
+#include "test_util.hpp"
+
+/*
+ * Checks how freed memory is zeroed and how memory is mapped.
+ * Dead objects are zeroed by the sweep before their memory is
+ * recycled, the large runs of them are given back to the OS,
+ * the pre-faulting page policy maps the pages of a new object
+ * before it is touched, and the huge page policy maps regions
+ * aligned to HEAP_HUGE_PAGE.
+ * Must be compiled with HEAP_DEBUG defined, see the Makefile.
+ */
+
+#define SMALL       500
+#define RUN_SIZE    (256UL << 10)
+#define LARGE_SIZE  (256UL << 10)
+#define REGION_OBJ  (600UL << 10)
+
+using std::cout, std::endl;
+
+// The share of the pages of [start, start + bytes) that are resident,
+// unmapped memory counts as not resident
+double resident(void *start, size_t bytes)
+{
+    const size_t page = sysconf(_SC_PAGESIZE);
+    auto low = reinterpret_cast<uintptr_t>(start) & ~(page - 1);
+    size_t pages = (reinterpret_cast<uintptr_t>(start) + bytes - low + page - 1) / page;
+    unsigned char vec[pages];
+    if (mincore(reinterpret_cast<void *>(low), pages * page, vec) != 0)
+        return 0.0;
+    size_t in = 0;
+    for (size_t i = 0; i < pages; i++)
+        in += vec[i] & 1;
+    return static_cast<double>(in) / pages;
+}
+
+// Filled with pointers, which are stale once it is dead
+uintptr_t __attribute__((noinline)) make_dead(size_t size, size_t count)
+{
+    uintptr_t last = 0;
+    for (size_t i = 0; i < count; i++)
+    {
+        auto words = static_cast<uintptr_t *>(cheap_alloc(size));
+        for (size_t j = 0; j < size / sizeof(uintptr_t); j++)
+            words[j] = reinterpret_cast<uintptr_t>(words);
+        last = ~reinterpret_cast<uintptr_t>(words);
+    }
+    return last;
+}
+
+bool zeroed(void *obj, size_t size)
+{
+    auto words = static_cast<uintptr_t *>(obj);
+    for (size_t j = 0; j < size / sizeof(uintptr_t); j++)
+        if (words[j] != 0)
+            return false;
+    return true;
+}
+
+bool check_zeroing()
+{
+    // Small objects are recycled from the free lists
+    make_dead(sizeof(Node), SMALL);
+    churn_until_collection(false);
+    bool small = true;
+    for (int i = 0; i < SMALL; i++)
+        small &= zeroed(cheap_alloc(sizeof(Node)), sizeof(Node));
+
+    cheap_set_large_object_size(0);
+    auto run = reinterpret_cast<void *>(~make_dead(RUN_SIZE, 1));
+    churn_until_collection(false);
+    // Sweeps what is left of the lazy sweep
+    GC::Heap::the().collect(GC::FREE);
+    double kept = resident(static_cast<char *>(run) + 4096, RUN_SIZE - 8192);
+    bool large = zeroed(cheap_alloc(RUN_SIZE), RUN_SIZE);
+    cheap_set_large_object_size(HEAP_LARGE_OBJECT);
+    cout << "zeroing: small " << small << ", large " << large << ", resident after free " << kept << endl;
+    return small && large && kept < 0.5;
+}
+
+bool check_prefault()
+{
+    auto cold = static_cast<char *>(cheap_alloc(LARGE_SIZE));
+    double before = resident(cold + LARGE_SIZE / 2, LARGE_SIZE / 2);
+    cheap_set_page_policy(CHEAP_PAGES_PREFAULT);
+    auto warm = static_cast<char *>(cheap_alloc(LARGE_SIZE));
+    double after = resident(warm, LARGE_SIZE);
+    cheap_set_page_policy(0);
+    cout << "prefault: resident before " << before << ", after " << after << endl;
+    return before < 0.5 && after == 1.0;
+}
+
+bool check_huge()
+{
+    cheap_set_page_policy(CHEAP_PAGES_HUGE);
+    cheap_set_large_object_size(0);
+    bool aligned = false;
+    for (int i = 0; i < 8 && !aligned; i++)
+    {
+        GC::Region *region = GC::Heap::the().region_of(cheap_alloc(REGION_OBJ));
+        aligned = reinterpret_cast<uintptr_t>(region) % HEAP_HUGE_PAGE == 0
+            && region->m_mapped % HEAP_HUGE_PAGE == 0;
+    }
+    cheap_set_large_object_size(HEAP_LARGE_OBJECT);
+    cheap_set_page_policy(0);
+    cout << "huge: aligned region " << aligned << endl;
+    return aligned;
+}
+
+int main()
+{
+    cheap_init();
+
+    bool ok = check_zeroing() && check_prefault() && check_huge();
+    cout << (ok ? "OK" : "FAIL") << endl;
+
+    cheap_dispose();
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,98 @@
+#include <chrono>
+#include <iostream>
+#include <stdint.h>
+
+#include "heap.hpp"
+#include "test_util.hpp"
+
+/*
+ * Marks a live binary tree and a long list with garbage in
+ * between, with one and with several marking threads, and
+ * checks that the same chunks survive every collection and
+ * that the live structures are intact.
+ * Must be compiled with HEAP_DEBUG defined, see the Makefile.
+ */
+
+#define TREE_DEPTH  18
+#define LIST_LEN    (1 << 17)
+#define THREADS     4
+
+using std::cout, std::endl;
+
+struct Tree
+{
+    Tree *left;
+    Tree *right;
+    long value;
+};
+
+Tree *__attribute__((noinline)) make_tree(int depth)
+{
+    auto tree = static_cast<Tree *>(GC::Heap::alloc(sizeof(Tree)));
+    GC::Heap::alloc(sizeof(Tree));
+    tree->value = depth;
+    tree->left = depth > 0 ? make_tree(depth - 1) : nullptr;
+    tree->right = depth > 0 ? make_tree(depth - 1) : nullptr;
+    return tree;
+}
+
+long __attribute__((noinline)) tree_sum(Tree *tree)
+{
+    return tree == nullptr ? 0 : tree->value + tree_sum(tree->left) + tree_sum(tree->right);
+}
+
+Node *__attribute__((noinline)) make_list(long len)
+{
+    Node *head = nullptr;
+    for (long i = 0; i < len; i++)
+    {
+        auto node = static_cast<Node *>(GC::Heap::alloc(sizeof(Node)));
+        GC::Heap::alloc(sizeof(Node));
+        node->value = i;
+        node->next = head;
+        head = node;
+    }
+    return head;
+}
+
+long __attribute__((noinline)) list_sum(Node *head)
+{
+    long sum = 0;
+    for (; head != nullptr; head = head->next)
+        sum += head->value;
+    return sum;
+}
+
+size_t __attribute__((noinline)) timed_collect(size_t threads)
+{
+    GC::Heap &heap = GC::Heap::the();
+    GC::Heap::set_mark_threads(threads);
+    auto start = std::chrono::high_resolution_clock::now();
+    heap.collect(GC::COLLECT_ALL);
+    auto time = std::chrono::high_resolution_clock::now() - start;
+    cout << threads << " threads: " << std::chrono::duration_cast<std::chrono::microseconds>(time).count() << " us" << endl;
+    return heap.allocated_chunk_count();
+}
+
+int main()
+{
+    GC::Heap::init();
+
+    Tree *tree = make_tree(TREE_DEPTH);
+    Node *list = make_list(LIST_LEN);
+    long sums = tree_sum(tree) + list_sum(list);
+
+    size_t serial = timed_collect(1);
+    size_t parallel = timed_collect(THREADS);
+    size_t again = timed_collect(THREADS);
+    size_t live = (2UL << TREE_DEPTH) - 1 + LIST_LEN;
+    cout << "live chunks: " << serial << ", " << parallel << ", " << again << endl;
+
+    bool ok = serial == live && parallel == live && again == live
+        && sums == tree_sum(tree) + list_sum(list);
+    cout << (ok ? "OK" : "FAIL") << endl;
+
+    GC::Heap::set_mark_threads(1);
+    GC::Heap::dispose();
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,57 @@
+#include <iostream>
+#include <stdint.h>
+
+#include "heap.hpp"
+#include "test_util.hpp"
+
+/*
+ * Grows a live list far beyond a single region, checks that
+ * it is intact after the collections on the way, and that
+ * the regions are returned to the OS once the list is dead.
+ * Must be compiled with HEAP_DEBUG defined, see the Makefile.
+ */
+
+#define LIST_LEN    (1 << 20)   // 24 MB of chunks
+
+using std::cout, std::endl;
+
+Node *__attribute__((noinline)) make_list(long len)
+{
+    Node *head = nullptr;
+    for (long i = 0; i < len; i++)
+    {
+        Node *node = static_cast<Node *>(GC::Heap::alloc(sizeof(Node)));
+        node->value = i;
+        node->next = head;
+        head = node;
+        // Garbage in between, to make the collections do something
+        GC::Heap::alloc(sizeof(Node));
+    }
+    return head;
+}
+
+bool __attribute__((noinline)) grow()
+{
+    Node *head = make_list(LIST_LEN);
+    cout << "regions with list: " << GC::Heap::the().region_count() << endl;
+    return check_list(head, LIST_LEN);
+}
+
+int main()
+{
+    GC::Heap::init();
+    GC::Heap &heap = GC::Heap::the();
+
+    bool intact = grow();
+    size_t grown = heap.region_count();
+
+    heap.collect(GC::COLLECT_ALL);
+    size_t shrunk = heap.region_count();
+    cout << "regions after collect: " << shrunk << endl;
+
+    bool ok = intact && grown > 1 && shrunk < grown;
+    cout << (ok ? "OK" : "FAIL") << endl;
+
+    GC::Heap::dispose();
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,128 @@
+#include <iostream>
+#include <stdint.h>
+
+#include "cheap.h"
+#include "heap.hpp"
+#include "profiler.hpp"
+#include "test_util.hpp"
+
+/*
+ * Samples the allocations of a live list and of garbage from
+ * two sites, the way the compiled code passes its sites, and
+ * checks that the estimates of the bytes allocated and of the
+ * bytes surviving a collection per site add up.
+ * Must be compiled with HEAP_DEBUG defined, see the Makefile.
+ */
+
+#define LIST_LEN    (1 << 16)
+#define GARBAGE     (1 << 21)
+#define INTERVAL    (16 << 10)
+
+#define SITE_LIST       0
+#define SITE_GARBAGE    1
+
+using std::cout, std::endl;
+
+static const char *site_names[] = {"Node.list", "Node.garbage", nullptr};
+
+// The fast path the compiled code inlines, with its site
+static inline void *alloc_site(unsigned long size, unsigned long site)
+{
+    unsigned long rounded = (size + CHEAP_GRANULE - 1) & ~(CHEAP_GRANULE - 1);
+    char *header = cheap_tlab.cur;
+    if ((unsigned long)(cheap_tlab.end - header) >= rounded + CHEAP_HEADER_SIZE)
+    {
+        *(unsigned long *)header = rounded;
+        cheap_tlab.cur = header + CHEAP_HEADER_SIZE + rounded;
+        return header + CHEAP_HEADER_SIZE;
+    }
+    return cheap_alloc_refill_site(size, site);
+}
+
+Node *__attribute__((noinline)) make_list(long len)
+{
+    Node *head = nullptr;
+    for (long i = 0; i < len; i++)
+    {
+        auto node = static_cast<Node *>(alloc_site(sizeof(Node), SITE_LIST));
+        node->value = i;
+        node->next = head;
+        head = node;
+    }
+    return head;
+}
+
+void __attribute__((noinline)) churn(long count)
+{
+    for (long i = 0; i < count; i++)
+        alloc_site(sizeof(Node), SITE_GARBAGE);
+}
+
+// The totals of a site, over all of its stacks
+GC::SiteStats site_total(size_t site)
+{
+    GC::SiteStats total {site};
+    for (const GC::SiteStats &stats : GC::Profiler::get_sites())
+    {
+        if (stats.m_site != site)
+            continue;
+        total.m_bytes += stats.m_bytes;
+        total.m_objects += stats.m_objects;
+        total.m_survived_bytes += stats.m_survived_bytes;
+        total.m_survived_objects += stats.m_survived_objects;
+    }
+    return total;
+}
+
+// The samples kept the stacks of make_list() and churn()
+bool check_stacks()
+{
+    for (const GC::SiteStats &stats : GC::Profiler::get_sites())
+        if (stats.m_stack.empty())
+            return false;
+    return !GC::Profiler::get_sites().empty();
+}
+
+// The bytes since the last refill are counted towards the
+// site of the next one, so the estimates are also off by
+// an allocation buffer
+bool near(size_t estimate, size_t bytes)
+{
+    size_t slack = 4 * INTERVAL + CHEAP_TLAB_SIZE;
+    return estimate + slack >= bytes && estimate <= bytes + slack;
+}
+
+bool __attribute__((noinline)) run()
+{
+    Node *list = make_list(LIST_LEN);
+    churn(GARBAGE);
+
+    long sum = 0;
+    for (Node *node = list; node != nullptr; node = node->next)
+        sum += node->value;
+
+    GC::SiteStats live = site_total(SITE_LIST), garbage = site_total(SITE_GARBAGE);
+    unsigned long size = CHEAP_HEADER_SIZE + sizeof(Node);
+    cout << "list: " << live.m_bytes << " bytes, " << live.m_objects << " objects, "
+        << live.m_survived_bytes << " survived" << endl;
+    cout << "garbage: " << garbage.m_bytes << " bytes, " << garbage.m_objects << " objects, "
+        << garbage.m_survived_bytes << " survived" << endl;
+
+    // The list survived its first collection and the garbage did not
+    return near(live.m_bytes, LIST_LEN * size) && near(garbage.m_bytes, GARBAGE * size)
+        && near(live.m_survived_bytes, live.m_bytes) && garbage.m_survived_bytes <= garbage.m_bytes / 10
+        && check_stacks() && sum == static_cast<long>(LIST_LEN) * (LIST_LEN - 1) / 2;
+}
+
+int main()
+{
+    cheap_init();
+    cheap_set_alloc_sites(site_names);
+    cheap_set_alloc_sampling(INTERVAL);
+
+    bool ok = run();
+    cout << (ok ? "OK" : "FAIL") << endl;
+
+    cheap_dispose();
+    return ok ? 0 : 1;
+}
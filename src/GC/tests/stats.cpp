@@ -0,0 +1,145 @@
+#include <iostream>
+#include <stdint.h>
+
+#include "cheap.h"
+#include "heap.hpp"
+#include "test_util.hpp"
+
+/*
+ * Checks the percentiles of a histogram against known values,
+ * then allocates a live list and garbage through the C API,
+ * with and without the nursery, and checks that the statistics
+ * polled with cheap_get_stats() add up, and that the file of
+ * cheap_set_stats_file() holds them after cheap_dispose().
+ * Must be compiled with HEAP_DEBUG defined, see the Makefile.
+ */
+
+#define LIST_LEN    (1 << 15)
+#define GARBAGE     (1 << 21)
+#define STATS_FILE  "stats.json"
+
+using std::cout, std::endl;
+
+Node *__attribute__((noinline)) make_list(long len)
+{
+    Node *head = nullptr;
+    for (long i = 0; i < len; i++)
+    {
+        auto node = static_cast<Node *>(cheap_alloc(sizeof(Node)));
+        node->value = i;
+        node->next = head;
+        head = node;
+    }
+    return head;
+}
+
+void __attribute__((noinline)) churn(long count)
+{
+    for (long i = 0; i < count; i++)
+        cheap_alloc(sizeof(Node));
+}
+
+bool check_histogram()
+{
+    GC::Histogram histogram;
+    for (uint64_t value = 1; value <= 1000; value++)
+        histogram.record(value * 1000);
+
+    uint64_t p50 = histogram.percentile(0.5), p99 = histogram.percentile(0.99);
+    cout << "histogram p50: " << p50 << ", p99: " << p99 << ", max: " << histogram.max() << endl;
+    // Within the precision of a sub-bucket
+    return p50 >= 500000 && p50 <= 500000 + 500000 / HISTOGRAM_SUB_BUCKETS
+        && p99 >= 990000 && p99 <= 1000000 && histogram.max() == 1000000
+        && histogram.count() == 1000 && GC::Histogram().percentile(0.99) == 0;
+}
+
+void print_pause(const char *name, const cheap_pause_stats_t &pause)
+{
+    cout << name << ": " << pause.count << " x, p50 " << pause.p50_ns << " ns, p99 "
+        << pause.p99_ns << " ns, max " << pause.max_ns << " ns" << endl;
+}
+
+bool check_pause(const cheap_pause_stats_t &pause, unsigned long count)
+{
+    return pause.count == count && pause.p50_ns <= pause.p99_ns && pause.p99_ns <= pause.max_ns
+        && pause.max_ns <= pause.total_ns;
+}
+
+// The bytes allocated are off by what the allocation buffer holds
+bool __attribute__((noinline)) run(size_t nursery)
+{
+    cheap_set_nursery_size(nursery);
+    cheap_stats_t before, after;
+    cheap_get_stats(&before);
+
+    Node *list = make_list(LIST_LEN);
+    churn(GARBAGE);
+    cheap_get_stats(&after);
+
+    unsigned long collections = after.collections - before.collections;
+    unsigned long allocated = after.bytes_allocated - before.bytes_allocated;
+    unsigned long reclaimed = after.bytes_reclaimed - before.bytes_reclaimed;
+    cout << "nursery " << nursery << ": " << collections << " collections, "
+        << after.minor_collections - before.minor_collections << " minor, "
+        << allocated << " bytes allocated, " << reclaimed << " reclaimed, "
+        << after.live_bytes << " live" << endl;
+    print_pause("pause", after.pause);
+    print_pause("minor pause", after.minor_pause);
+    print_pause("find_roots", after.find_roots);
+    print_pause("mark", after.mark);
+    print_pause("sweep", after.sweep);
+    print_pause("free", after.free);
+
+    unsigned long size = CHEAP_HEADER_SIZE + sizeof(Node);
+    long sum = 0;
+    for (Node *node = list; node != nullptr; node = node->next)
+        sum += node->value;
+
+    return check_pause(after.pause, after.collections) && check_pause(after.mark, after.collections)
+        && check_pause(after.find_roots, after.collections) && check_pause(after.sweep, after.collections)
+        && check_pause(after.free, after.collections) && check_pause(after.minor_pause, after.minor_collections)
+        && allocated >= (LIST_LEN + GARBAGE - CHEAP_TLAB_SIZE / size) * size
+        && allocated <= (LIST_LEN + GARBAGE) * size + CHEAP_TLAB_SIZE
+        && reclaimed > 0 && after.bytes_reclaimed <= after.bytes_allocated && after.mapped_bytes > 0
+        && (nursery == 0 ? collections > 0 : after.minor_collections > before.minor_collections)
+        && sum == static_cast<long>(LIST_LEN) * (LIST_LEN - 1) / 2;
+}
+
+// The heap is disposed by then, so the statistics no longer change
+bool check_file(const cheap_stats_t &last)
+{
+    std::FILE *file = std::fopen(STATS_FILE, "r");
+    if (file == nullptr)
+        return false;
+    cheap_stats_t stats;
+    long rss = 0;
+    bool ok = std::fscanf(file, "{\"collections\": %lu, \"minor_collections\": %lu, \"bytes_allocated\": %lu, "
+        "\"bytes_reclaimed\": %lu, \"live_bytes\": %lu, \"mapped_bytes\": %lu, \"large_object_bytes\": %lu, "
+        "\"max_rss_kb\": %ld, \"pause_count\": %lu, \"pause_total_ns\": %lu",
+        &stats.collections, &stats.minor_collections, &stats.bytes_allocated, &stats.bytes_reclaimed,
+        &stats.live_bytes, &stats.mapped_bytes, &stats.large_object_bytes, &rss, &stats.pause.count,
+        &stats.pause.total_ns) == 10;
+    std::fclose(file);
+    std::remove(STATS_FILE);
+    cout << "stats file: " << stats.collections << " collections, " << stats.bytes_allocated
+        << " bytes allocated, max rss " << rss << " KB" << endl;
+    return ok && stats.collections == last.collections && stats.minor_collections == last.minor_collections
+        && stats.bytes_allocated >= last.bytes_allocated && stats.pause.count == last.pause.count
+        && stats.pause.total_ns == last.pause.total_ns && rss > 0;
+}
+
+int main()
+{
+    cheap_init();
+
+    bool ok = check_histogram() && run(0) && run(1 << 20);
+
+    cheap_set_nursery_size(0);
+    cheap_stats_t last;
+    cheap_get_stats(&last);
+    cheap_set_stats_file(STATS_FILE);
+    cheap_dispose();
+    ok = ok && check_file(last);
+    cout << (ok ? "OK" : "FAIL") << endl;
+    return ok ? 0 : 1;
+}
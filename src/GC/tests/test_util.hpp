@@ -0,0 +1,42 @@
+#pragma once
+
+#include "cheap.h"
+
+/*
+ * The fixtures shared by the tests of the runtime, each test is
+ * a program of its own that includes this header once.
+ */
+
+// The objects allocated between two looks at the stats
+#define CHURN_BATCH     1000
+
+// The node of the lists the tests keep alive, 16 bytes
+struct Node
+{
+    long value;
+    Node *next;
+};
+
+// Checks that a list built from len - 1 down to 0 is intact
+inline bool __attribute__((noinline)) check_list(Node *head, long len)
+{
+    for (long i = len - 1; i >= 0; i--, head = head->next)
+        if (head == nullptr || head->value != i)
+            return false;
+    return head == nullptr;
+}
+
+// Allocates garbage until the heap has collected once more, a
+// minor collection of the nursery or a full one
+inline void __attribute__((noinline)) churn_until_collection(bool minor)
+{
+    cheap_stats_t stats;
+    cheap_get_stats(&stats);
+    unsigned long collections = minor ? stats.minor_collections : stats.collections;
+    while ((minor ? stats.minor_collections : stats.collections) == collections)
+    {
+        for (int i = 0; i < CHURN_BATCH; i++)
+            cheap_alloc(sizeof(Node));
+        cheap_get_stats(&stats);
+    }
+}
@@ -0,0 +1,109 @@
+#include <atomic>
+#include <iostream>
+#include <stdint.h>
+#include <thread>
+#include <vector>
+
+#include "cheap.h"
+#include "heap.hpp"
+#include "test_util.hpp"
+
+/*
+ * Runs several threads that register with the heap, build a
+ * list each, and allocate garbage until the heap has been
+ * collected many times, with and without the nursery. The
+ * lists of all threads must survive the collections of the
+ * others. The main thread allocates too and waits at
+ * safepoints for the others to finish.
+ * Must be compiled with HEAP_DEBUG defined, see the Makefile.
+ */
+
+#define THREADS     4
+#define LIST_LEN    (1 << 14)
+#define GARBAGE     (1 << 19)
+
+using std::cout, std::endl;
+
+std::atomic<int> finished {0};
+std::atomic<int> failed {0};
+
+Node *__attribute__((noinline)) make_list(long len, long base)
+{
+    Node *head = nullptr;
+    for (long i = 0; i < len; i++)
+    {
+        auto node = static_cast<Node *>(cheap_alloc(sizeof(Node)));
+        node->value = base + i;
+        node->next = head;
+        head = node;
+    }
+    return head;
+}
+
+bool __attribute__((noinline)) check_list(Node *head, long len, long base)
+{
+    for (long i = len - 1; i >= 0; i--, head = head->next)
+        if (head == nullptr || head->value != base + i)
+            return false;
+    return head == nullptr;
+}
+
+void __attribute__((noinline)) churn(long count)
+{
+    for (long i = 0; i < count; i++)
+    {
+        auto node = static_cast<Node *>(cheap_alloc(sizeof(Node)));
+        node->value = i;
+        node->next = nullptr;
+    }
+}
+
+void __attribute__((noinline)) mutator(long id)
+{
+    cheap_register_thread();
+    Node *list = make_list(LIST_LEN, id * LIST_LEN);
+    churn(GARBAGE);
+    cheap_safepoint();
+    if (!check_list(list, LIST_LEN, id * LIST_LEN))
+        failed++;
+    cheap_unregister_thread();
+    finished++;
+}
+
+bool __attribute__((noinline)) run(size_t nursery)
+{
+    GC::Heap::set_nursery_size(nursery);
+    finished = 0;
+    failed = 0;
+
+    std::vector<std::thread> threads;
+    for (long id = 1; id <= THREADS; id++)
+        threads.emplace_back(mutator, id);
+
+    Node *list = make_list(LIST_LEN, 0);
+    churn(GARBAGE);
+    // Joining would block the collections of the others
+    while (finished < THREADS)
+    {
+        cheap_safepoint();
+        std::this_thread::yield();
+    }
+    for (std::thread &thread : threads)
+        thread.join();
+
+    bool ok = failed == 0 && check_list(list, LIST_LEN, 0);
+    cout << "nursery " << nursery << ": " << (ok ? "lists intact" : "lists broken") << endl;
+    return ok;
+}
+
+int main()
+{
+    cheap_init();
+
+    bool ok = run(0) && run(1 << 20);
+    cout << (ok ? "OK" : "FAIL") << endl;
+
+    GC::Heap::set_nursery_size(0);
+    cheap_dispose();
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,128 @@
+#include <iostream>
+#include <stdint.h>
+
+#include "cheap.h"
+#include "heap.hpp"
+#include "test_util.hpp"
+
+/*
+ * Checks that the collector only follows the pointer words of
+ * typed objects. A list that is only referenced from a word
+ * outside the pointer map of its holder, or from a holder of
+ * CHEAP_NO_POINTERS, is collected, with one and with several
+ * marking threads. In the nursery, a word outside the map that
+ * looks like a pointer into the nursery is not updated when the
+ * objects are evacuated, and the copies keep their type.
+ * Must be compiled with HEAP_DEBUG defined, see the Makefile.
+ */
+
+#define LIST_LEN    (1 << 15)
+
+using std::cout, std::endl;
+
+struct Holder
+{
+    uintptr_t word;
+    Node *list;
+};
+
+// The list node holds a pointer in its second word
+#define NODE_MAP    0x2UL
+
+Node *__attribute__((noinline)) make_list(long len)
+{
+    Node *head = nullptr;
+    for (long i = 0; i < len; i++)
+    {
+        auto node = static_cast<Node *>(cheap_alloc_typed(sizeof(Node), NODE_MAP));
+        node->value = i;
+        node->next = head;
+        head = node;
+    }
+    return head;
+}
+
+// The list is hidden in the word outside the map of the holder
+Holder *__attribute__((noinline)) make_holder(unsigned long descriptor, bool hidden)
+{
+    auto holder = static_cast<Holder *>(cheap_alloc_typed(sizeof(Holder), descriptor));
+    Node *list = make_list(LIST_LEN);
+    holder->word = hidden ? reinterpret_cast<uintptr_t>(list) : 0;
+    holder->list = hidden ? nullptr : list;
+    return holder;
+}
+
+// The bytes marked by a collection with only the holder on the stack
+unsigned long __attribute__((noinline)) live_after(unsigned long descriptor, bool hidden)
+{
+    Holder *volatile holder = make_holder(descriptor, hidden);
+    churn_until_collection(false);
+    cheap_stats_t stats;
+    cheap_get_stats(&stats);
+    (void)holder;
+    return stats.live_bytes;
+}
+
+bool check_marking()
+{
+    unsigned long list_bytes = LIST_LEN * (CHEAP_HEADER_SIZE + sizeof(Node));
+    unsigned long typed = live_after(0x2UL, false);
+    unsigned long hidden = live_after(0x2UL, true);
+    unsigned long untyped = live_after(CHEAP_ALL_POINTERS, true);
+    unsigned long leaf = live_after(CHEAP_NO_POINTERS, true);
+    cout << "live bytes, typed: " << typed << ", hidden: " << hidden << ", untyped: " << untyped
+        << ", no pointers: " << leaf << endl;
+    return typed >= list_bytes && untyped >= list_bytes && hidden < list_bytes / 2 && leaf < list_bytes / 2;
+}
+
+// The target is only referenced from the holder, so it is moved.
+// The allocation buffer of the thread may still be an old one
+Holder *__attribute__((noinline)) make_young_holder()
+{
+    Holder *holder;
+    do
+        holder = static_cast<Holder *>(cheap_alloc_typed(sizeof(Holder), 0x2UL));
+    while (!GC::Heap::the().is_young(holder));
+    auto target = static_cast<Node *>(cheap_alloc_typed(sizeof(Node), NODE_MAP));
+    target->value = 42;
+    target->next = nullptr;
+    // Looks like a pointer, but is not in the map
+    holder->word = reinterpret_cast<uintptr_t>(target);
+    holder->list = target;
+    return holder;
+}
+
+bool __attribute__((noinline)) check_nursery()
+{
+    cheap_set_nursery_size(1 << 20);
+    Holder *holder = make_young_holder();
+    // Kept inverted, or the word on the stack would pin the target
+    volatile uintptr_t fake = ~holder->word;
+    bool young = GC::Heap::the().is_young(holder);
+
+    churn_until_collection(true);
+    Node *copy = holder->list;
+    size_t header = reinterpret_cast<size_t *>(copy)[-1];
+    bool moved = reinterpret_cast<uintptr_t>(copy) != ~fake;
+    cout << "nursery: moved " << moved << ", word kept " << (holder->word == ~fake)
+        << ", typed " << !!(header & CHEAP_HEADER_TYPED) << endl;
+    bool ok = young && moved && holder->word == ~fake && copy->value == 42 && !GC::Heap::the().is_young(copy)
+        && header & CHEAP_HEADER_TYPED && (header >> CHEAP_HEADER_MAP_SHIFT & 0x7fff) == NODE_MAP;
+    cheap_set_nursery_size(0);
+    return ok;
+}
+
+int main()
+{
+    cheap_init();
+
+    bool ok = check_marking();
+    cheap_set_mark_threads(2);
+    ok = ok && check_marking();
+    cheap_set_mark_threads(1);
+    ok = ok && check_nursery();
+    cout << (ok ? "OK" : "FAIL") << endl;
+
+    cheap_dispose();
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,123 @@
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <stdint.h>
+
+#include "event.hpp"
+#include "trace.hpp"
+
+/*
+ * Converts a binary trace of the profiler to text, JSON or
+ * the Chrome trace-event format, written to stdout. The
+ * Chrome format loads in chrome://tracing and Perfetto, with
+ * every event as an instant event on the track of its thread.
+ * See docs/lib/trace.md, and the Makefile for how to build it.
+ *
+ * Usage: cheap_trace [--text | --json | --chrome] trace.bin
+ */
+
+using std::cout, std::cerr, std::endl;
+
+enum Format
+{
+    Text,
+    Json,
+    Chrome
+};
+
+static const char *type_name(uint16_t type)
+{
+    return GC::GCEvent(static_cast<GC::GCEventType>(1 << type)).type_to_string();
+}
+
+static void print_record(const GC::TraceRecord &record, uint64_t start_ns, Format format, bool first)
+{
+    // Events recorded before the trace was opened come out negative
+    double us = static_cast<double>(static_cast<int64_t>(record.m_timestamp - start_ns)) / 1000.0;
+    const char *name = type_name(record.m_type);
+
+    if (format == Text)
+    {
+        printf("%12.3f us  thread %u  %-16s", us, record.m_thread, name);
+        if (record.m_start != 0)
+            printf("  chunk 0x%lx  size %lu  mark %u", static_cast<unsigned long>(record.m_start),
+                static_cast<unsigned long>(record.m_size), record.m_marked);
+        else if (record.m_size != 0)
+            printf("  size %lu", static_cast<unsigned long>(record.m_size));
+        printf("\n");
+        return;
+    }
+
+    printf("%s\n", first ? "" : ",");
+    if (format == Json)
+        printf("  {\"time_us\": %.3f, \"thread\": %u, \"type\": \"%s\", \"chunk\": %lu, \"size\": %lu, \"marked\": %s}",
+            us, record.m_thread, name, static_cast<unsigned long>(record.m_start),
+            static_cast<unsigned long>(record.m_size), record.m_marked ? "true" : "false");
+    else
+        printf("  {\"name\": \"%s\", \"ph\": \"i\", \"s\": \"t\", \"ts\": %.3f, \"pid\": 1, \"tid\": %u, "
+            "\"args\": {\"chunk\": %lu, \"size\": %lu, \"marked\": %u}}",
+            name, us, record.m_thread, static_cast<unsigned long>(record.m_start),
+            static_cast<unsigned long>(record.m_size), record.m_marked);
+}
+
+int main(int argc, char **argv)
+{
+    Format format = Text;
+    const char *path = nullptr;
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--text") == 0)
+            format = Text;
+        else if (strcmp(argv[i], "--json") == 0)
+            format = Json;
+        else if (strcmp(argv[i], "--chrome") == 0)
+            format = Chrome;
+        else
+            path = argv[i];
+    }
+    if (path == nullptr)
+    {
+        cerr << "Usage: " << argv[0] << " [--text | --json | --chrome] trace.bin" << endl;
+        return 2;
+    }
+
+    std::FILE *trace = std::fopen(path, "rb");
+    if (trace == nullptr)
+    {
+        cerr << "Error: Cannot open " << path << endl;
+        return 1;
+    }
+
+    GC::TraceHeader header;
+    if (std::fread(&header, sizeof(header), 1, trace) != 1
+        || std::memcmp(header.m_magic, TRACE_MAGIC, sizeof(header.m_magic)) != 0
+        || header.m_version != TRACE_VERSION || header.m_record_size < sizeof(GC::TraceRecord))
+    {
+        cerr << "Error: " << path << " is not a trace of version " << TRACE_VERSION << endl;
+        std::fclose(trace);
+        return 1;
+    }
+
+    if (format == Json)
+        printf("[");
+    else if (format == Chrome)
+        printf("{\"displayTimeUnit\": \"ns\", \"traceEvents\": [");
+
+    // Records of a later version may be larger, the rest is skipped
+    char buffer[256];
+    size_t records = 0;
+    while (header.m_record_size <= sizeof(buffer) && std::fread(buffer, header.m_record_size, 1, trace) == 1)
+    {
+        GC::TraceRecord record;
+        std::memcpy(&record, buffer, sizeof(record));
+        print_record(record, header.m_start_ns, format, records++ == 0);
+    }
+
+    if (format == Json)
+        printf("\n]\n");
+    else if (format == Chrome)
+        printf("\n]}\n");
+
+    std::fclose(trace);
+    return 0;
+}
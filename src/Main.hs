@@ -4,6 +4,7 @@ module Main where
 
 import           AnnForall                   (annotateForall)
 import           Codegen.Codegen             (generateCode)
+import           Codegen.LlvmIr              (GcStrategy (ShadowStack, Statepoint))
 import           Compiler                    (compile)
 import           Control.Monad               (when, (<=<))
 import           Data.List.Extra             (isSuffixOf)
@@ -44,7 +45,7 @@ main = getArgs >>= parseArgs >>= uncurry3 main'
 parseArgs :: [String] -> IO (Options, String, String)
 parseArgs argv = case getOpt RequireOrder flags argv of
     (os, f : xs, [])
-        | opts.help || isNothing opts.typechecker -> do
+        | opts.help || isNothing opts.typechecker || isNothing opts.gcRoots -> do
             hPutStrLn stderr (usageInfo header flags)
             exitSuccess
         | otherwise -> do
@@ -56,15 +57,17 @@ parseArgs argv = case getOpt RequireOrder flags argv of
         hPutStrLn stderr (concat errs ++ usageInfo header flags)
         exitWith (ExitFailure 1)
   where
-    header = "Usage: churf [--help] [-l|--log-intermediate] [-d|--debug] [-m|--disable-gc] [-t|--type-checker bi/hm] [-p|--disable-prelude] <FILE> \n"
+    header = "Usage: churf [--help] [-l|--log-intermediate] [-d|--debug] [-m|--disable-gc] [-r|--gc-roots shadow-stack/stack-map] [-t|--type-checker bi/hm] [-p|--disable-prelude] [-c|--compile-only] <FILE> \n"
 
 flags :: [OptDescr (Options -> Options)]
 flags =
     [ Option ['d'] ["debug"] (NoArg $ enableDebug . logIntermediate) "Print debug messages. --debug implies --log-intermediate"
     , Option ['t'] ["type-checker"] (ReqArg chooseTypechecker "bi/hm") "Choose type checker. Possible options are bi and hm"
     , Option ['m'] ["disable-gc"] (NoArg disableGC) "Disables the garbage collector and uses malloc instead."
+    , Option ['r'] ["gc-roots"] (ReqArg chooseGcRoots "shadow-stack/stack-map") "Choose how the garbage collector finds the roots. Possible options are shadow-stack, the default, and stack-map"
     , Option ['p'] ["disable-prelude"] (NoArg disablePrelude) "Do not include the prelude"
     , Option ['l'] ["log-intermediate"] (NoArg logIntermediate) "Log intermediate languages"
+    , Option ['c'] ["compile-only"] (NoArg compileOnly) "Compile the program to output/ without running it"
     , Option [] ["help"] (NoArg enableHelp) "Print this help message"
     ]
 
@@ -74,9 +77,11 @@ initOpts =
         { help = False
         , debug = False
         , gc = True
+        , gcRoots = Just ShadowStack
         , typechecker = Nothing
         , preludeOpt = False
         , logIL = False
+        , onlyCompile = False
         }
 
 enableHelp :: Options -> Options
@@ -94,6 +99,9 @@ disablePrelude opts = opts{preludeOpt = True}
 logIntermediate :: Options -> Options
 logIntermediate opts = opts{logIL = True}
 
+compileOnly :: Options -> Options
+compileOnly opts = opts{onlyCompile = True}
+
 
 chooseTypechecker :: String -> Options -> Options
 chooseTypechecker s options = options{typechecker = tc}
@@ -103,13 +111,23 @@ chooseTypechecker s options = options{typechecker = tc}
         "bi" -> pure Bi
         _    -> Nothing
 
+chooseGcRoots :: String -> Options -> Options
+chooseGcRoots s options = options{gcRoots = strategy}
+  where
+    strategy = case s of
+        "shadow-stack" -> pure ShadowStack
+        "stack-map"    -> pure Statepoint
+        _              -> Nothing
+
 data Options = Options
     { help        :: Bool
     , debug       :: Bool
     , gc          :: Bool
+    , gcRoots     :: Maybe GcStrategy
     , typechecker :: Maybe TypeChecker
     , preludeOpt  :: Bool
     , logIL       :: Bool
+    , onlyCompile :: Bool
     }
 
 main' :: Options -> String -> String -> IO ()
@@ -152,7 +170,7 @@ main' opts name s =
             when opts.logIL (printToErr "\n -- Monomorphizer --" >> log monomorphized)
 
 
-            generatedCode <- fromErr $ generateCode monomorphized (gc opts)
+            generatedCode <- fromErr $ generateCode monomorphized (gc opts) (fromJust opts.gcRoots)
 
             check <- doesPathExist "output"
             when check (removeDirectoryRecursive "output")
@@ -165,6 +183,7 @@ main' opts name s =
 
             compile name generatedCode (gc opts)
             printToErr "Compilation done!"
+            when opts.onlyCompile exitSuccess
             printToErr "\n-- Program output --"
             print =<< spawnWait ("./output/" <> name)
 